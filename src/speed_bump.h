@@ -21,12 +21,24 @@
  * Configuration Limits (compile-time constants)
  * ============================================================ */
 
-#define SPEED_BUMP_MAX_TARGETS      64
+#define SPEED_BUMP_MAX_TARGETS      64  /* default for the max_targets parameter */
 #define SPEED_BUMP_MAX_PATH_LEN     256
 #define SPEED_BUMP_MAX_SYMBOL_LEN   128
+#define SPEED_BUMP_MAX_PROFILE_LEN  32
+#define SPEED_BUMP_MAX_RULE_LEN     32              /* rule= name */
+#define SPEED_BUMP_MAX_SITE_RULES   16              /* targets sharing one probed address */
+#define SPEED_BUMP_MAX_CGROUP_LEN   256             /* cgroup= path, from the v2 root */
+#define SPEED_BUMP_MAX_SWEEP_LEN    256             /* sweep= schedule text */
+#define SPEED_BUMP_MAX_BUILD_ID     20              /* buildid= bytes, as a SHA-1 */
+#define SPEED_BUMP_MAX_CPUS_LEN     128             /* cpus= list text */
+#define SPEED_BUMP_MAX_TASK_ACCTS   4096            /* thread and process delay accounts */
 #define SPEED_BUMP_MAX_LINE_LEN     512
 #define SPEED_BUMP_MAX_DELAY_NS     10000000000ULL  /* 10 seconds */
 #define SPEED_BUMP_DEFAULT_DELAY_NS 1000000ULL      /* 1 millisecond */
+#define SPEED_BUMP_HYBRID_SPIN_NS   50000ULL        /* spun tail of a hybrid delay */
+#define SPEED_BUMP_MAX_SCALE_PCT    10000           /* scale= up to 100x */
+#define SPEED_BUMP_PROB_ONE         1000000         /* prob= resolution: parts per million */
+#define SPEED_BUMP_MAX_SIGMA_MILLI  4000            /* lognormal sigma= up to 4.0 */
 
 /*
  * Spin delay for the specified number of nanoseconds.
@@ -35,16 +47,98 @@
  * maintaining precise timing. This is intentionally a spin-wait and
  * does not yield to the scheduler.
  *
+ * Times the spin with the clock chosen by speed_bump_delay_calibrate()
+ * (ktime until it has run).
+ *
  * @delay_ns: Number of nanoseconds to delay
  */
 void speed_bump_spin_delay_ns(u64 delay_ns);
 
+/* How a target's delay is spent */
+enum speed_bump_delay_mode {
+	SPEED_BUMP_MODE_SPIN,    /* busy-wait for the whole delay (default) */
+	SPEED_BUMP_MODE_SLEEP,   /* hrtimer sleep, no CPU consumed */
+	SPEED_BUMP_MODE_HYBRID,  /* sleep, then spin the last SPEED_BUMP_HYBRID_SPIN_NS */
+};
+
+/*
+ * Delay for the specified number of nanoseconds in the given mode.
+ *
+ * SPEED_BUMP_MODE_SLEEP and SPEED_BUMP_MODE_HYBRID schedule, so they may
+ * only be used from a context that can sleep (a uprobe handler can).
+ * A sleep is cut short if the task receives a fatal signal.
+ *
+ * @delay_ns: Number of nanoseconds to delay
+ * @mode: How to spend the delay
+ */
+void speed_bump_delay_ns(u64 delay_ns, enum speed_bump_delay_mode mode);
+
+/*
+ * Delay for a proportional ("virtual slowdown") target: @pct percent of
+ * the call's own @duration_ns, capped at SPEED_BUMP_MAX_DELAY_NS.
+ *
+ * Returns: delay in nanoseconds
+ */
+u64 speed_bump_scaled_delay_ns(u64 duration_ns, unsigned int pct);
+
+/*
+ * Parse a delay mode name ("spin", "sleep" or "hybrid").
+ *
+ * Returns: 0 on success, -EINVAL for an unknown name
+ */
+int speed_bump_parse_delay_mode(const char *name,
+				enum speed_bump_delay_mode *mode);
+
+/*
+ * Returns: the name of @mode, as accepted by speed_bump_parse_delay_mode()
+ */
+const char *speed_bump_delay_mode_name(enum speed_bump_delay_mode mode);
+
+/* Clock that times speed_bump_spin_delay_ns() */
+enum speed_bump_delay_clock {
+	SPEED_BUMP_CLOCK_KTIME,   /* ktime_get_ns() on every iteration */
+	SPEED_BUMP_CLOCK_CYCLES,  /* calibrated TSC / CNTVCT deadline */
+};
+
+/*
+ * Select and calibrate the delay clock, then measure per-call overhead.
+ *
+ * Uses the local cycle counter if @use_cycles is set and the counter is
+ * constant-rate and synchronised across CPUs; otherwise ktime. Spins
+ * for a few milliseconds; call once before any delay is injected.
+ *
+ * @use_cycles: Allow the cycle counter (false forces ktime)
+ */
+void speed_bump_delay_calibrate(bool use_cycles);
+
+/*
+ * Returns: the clock selected by speed_bump_delay_calibrate()
+ */
+enum speed_bump_delay_clock speed_bump_delay_clock(void);
+
+/*
+ * Mean amount by which a short delay overshoots its request, measured
+ * at calibration. Subtract it from injected delays to get the
+ * requested component.
+ *
+ * Returns: overhead in nanoseconds
+ */
+u64 speed_bump_delay_overhead_ns(void);
+
+/*
+ * Returns: calibrated cycle counter ticks per microsecond, or 0 when
+ *          the ktime clock is in use
+ */
+u64 speed_bump_delay_cycles_per_us(void);
+
 /*
  * Match a target pattern against a path and symbol.
  *
  * Pattern format: "PATH:SYMBOL"
  * - Exact match: "/path/to/binary:function_name"
  * - Prefix match: "/path/[*]:function_name" (any binary under /path/)
+ * - Globs: either side may use '*' and '?' (see speed_bump_glob_match),
+ *   e.g. "/usr/lib64/libcuda.so:cuMem*"
  *
  * @pattern: The pattern to match (PATH:SYMBOL format)
  * @path: The actual binary path
@@ -54,4 +148,297 @@ void speed_bump_spin_delay_ns(u64 delay_ns);
  */
 int speed_bump_match_target(const char *pattern, const char *path, const char *symbol);
 
+/*
+ * Match a string against a glob pattern.
+ *
+ * '*' matches any run of characters (including '/' and the empty run),
+ * '?' matches exactly one character; everything else matches itself.
+ *
+ * @pattern: The glob pattern
+ * @str: The string to test
+ *
+ * Returns: 1 if @str matches @pattern, 0 otherwise
+ */
+int speed_bump_glob_match(const char *pattern, const char *str);
+
+/*
+ * Check whether a string contains glob wildcards ('*' or '?').
+ *
+ * Returns: 1 if it does, 0 otherwise
+ */
+int speed_bump_has_wildcard(const char *str);
+
+/* ============================================================
+ * Stochastic Delays
+ * ============================================================ */
+
+/* Distribution of a target's delay around its configured mean */
+enum speed_bump_dist {
+	SPEED_BUMP_DIST_FIXED,      /* exactly the mean (default) */
+	SPEED_BUMP_DIST_EXP,        /* exponential */
+	SPEED_BUMP_DIST_UNIFORM,    /* uniform on [0, 2 * mean) */
+	SPEED_BUMP_DIST_LOGNORMAL,  /* lognormal with shape sigma */
+};
+
+/*
+ * Advance a xorshift64* generator.
+ *
+ * @state: Generator state; must be non-zero
+ *
+ * Returns: the next 64 pseudo-random bits
+ */
+u64 speed_bump_prng_next(u64 *state);
+
+/*
+ * Draw a delay from a distribution.
+ *
+ * @dist: Distribution
+ * @mean_ns: Mean delay (the value itself for SPEED_BUMP_DIST_FIXED)
+ * @max_ns: Upper bound on the result; 0 means SPEED_BUMP_MAX_DELAY_NS
+ * @sigma_milli: Lognormal shape, in thousandths
+ * @state: PRNG state (see speed_bump_prng_next)
+ *
+ * Returns: delay in nanoseconds, at most @max_ns
+ */
+u64 speed_bump_dist_sample(enum speed_bump_dist dist, u64 mean_ns,
+			   u64 max_ns, u32 sigma_milli, u64 *state);
+
+/*
+ * Parse a distribution name ("fixed", "exp", "uniform" or "lognormal").
+ *
+ * Returns: 0 on success, -EINVAL for an unknown name
+ */
+int speed_bump_parse_dist(const char *name, enum speed_bump_dist *dist);
+
+/*
+ * Returns: the name of @dist, as accepted by speed_bump_parse_dist()
+ */
+const char *speed_bump_dist_name(enum speed_bump_dist dist);
+
+/*
+ * Parse a non-negative decimal ("0.25", "3", ".5") into an integer
+ * scaled by 10^@frac_digits. Digits beyond that resolution are dropped.
+ *
+ * Returns: 0 on success, -EINVAL if malformed, -ERANGE on overflow
+ */
+int speed_bump_parse_fixed(const char *str, unsigned int frac_digits, u64 *out);
+
+/* ============================================================
+ * Delay Budgets
+ * ============================================================ */
+
+/*
+ * A cap on the delay injected per one-second window of the monotonic
+ * clock, shared by every CPU. CPUs draw tokens from @pool_ns in slices
+ * and spend them locally, so the shared counter is touched about once
+ * per slice rather than on every hit. Zero-initialised means unlimited.
+ */
+struct speed_bump_budget {
+	u64 ns_per_s;        /* cap, 0 = unlimited */
+	atomic64_t pool_ns;  /* tokens left to hand out in @window */
+	atomic64_t window;   /* current window, 1-based seconds since boot */
+};
+
+/* One CPU's tokens drawn from a struct speed_bump_budget */
+struct speed_bump_budget_cpu {
+	u64 window;
+	u64 tokens_ns;
+};
+
+/* A CPU draws at least this fraction of the cap at a time */
+#define SPEED_BUMP_BUDGET_SLICES 16
+
+/*
+ * Charge a delay against a budget.
+ *
+ * @budget: Budget shared by all CPUs
+ * @cpu: This CPU's tokens; the caller must keep it from being used
+ *       concurrently (preemption disabled)
+ * @now_ns: Current monotonic time
+ * @delay_ns: Delay about to be injected
+ *
+ * A delay that does not fit in what is left of the window is refused
+ * whole, never shortened. Tokens held by a CPU expire with the window.
+ *
+ * Returns: true if the delay may be injected
+ */
+bool speed_bump_budget_take(struct speed_bump_budget *budget,
+			    struct speed_bump_budget_cpu *cpu,
+			    u64 now_ns, u64 delay_ns);
+
+/* ============================================================
+ * Latency Histograms
+ * ============================================================ */
+
+/*
+ * Log2 buckets: bucket 0 counts [0, 2) ns, bucket i counts
+ * [2^i, 2^(i+1)) ns, and the last bucket also counts everything above.
+ */
+#define SPEED_BUMP_HIST_BUCKETS 40  /* last bucket starts at ~550 s */
+
+struct speed_bump_hist {
+	u64 count;
+	u64 sum_ns;
+	u64 buckets[SPEED_BUMP_HIST_BUCKETS];
+};
+
+/*
+ * Returns: the bucket a sample of @ns nanoseconds is counted in
+ */
+unsigned int speed_bump_hist_bucket(u64 ns);
+
+/*
+ * Returns: the smallest value counted in @bucket, in nanoseconds
+ */
+u64 speed_bump_hist_bucket_lo(unsigned int bucket);
+
+/*
+ * Add one sample. Not atomic: the caller owns @hist, e.g. its CPU's
+ * copy with preemption disabled.
+ */
+void speed_bump_hist_record(struct speed_bump_hist *hist, u64 ns);
+
+/*
+ * Add the samples of @src into @dst.
+ */
+void speed_bump_hist_merge(struct speed_bump_hist *dst,
+			   const struct speed_bump_hist *src);
+
+/*
+ * Estimate a percentile from the buckets.
+ *
+ * @pct: Percentile, 0 to 100
+ *
+ * Returns: upper bound (exclusive) in nanoseconds of the bucket that
+ *          holds the @pct-th percentile sample, or 0 with no samples
+ */
+u64 speed_bump_hist_percentile(const struct speed_bump_hist *hist,
+			       unsigned int pct);
+
+/* ============================================================
+ * Delay Sweeps
+ * ============================================================ */
+
+#define SPEED_BUMP_SWEEP_MAX_STEPS   256
+#define SPEED_BUMP_SWEEP_MIN_STEP_NS 1000000ULL        /* 1 ms */
+#define SPEED_BUMP_SWEEP_MAX_STEP_NS 3600000000000ULL  /* 1 hour */
+
+/* One step of a sweep: a delay and how long it is applied */
+struct speed_bump_sweep_step {
+	u64 delay_ns;
+	u64 duration_ns;
+};
+
+/*
+ * Parse a sweep= schedule, either a range or a list of steps:
+ *
+ *   START:STOP:STEP@DURATION       e.g. 0:50000:5000@2s
+ *   DELAY@DURATION[,DELAY@DURATION...]   e.g. 0@2s,20000@500ms
+ *
+ * A range runs from START towards STOP (up or down) in whole STEPs, each
+ * held for DURATION. Delays are in ns and at most SPEED_BUMP_MAX_DELAY_NS;
+ * durations take a unit of ns, us, ms or s (none means ns) and lie
+ * between SPEED_BUMP_SWEEP_MIN_STEP_NS and SPEED_BUMP_SWEEP_MAX_STEP_NS.
+ *
+ * @steps: Filled with the steps, or NULL to only validate and count
+ *
+ * Returns: the number of steps (1 to SPEED_BUMP_SWEEP_MAX_STEPS),
+ *          -EINVAL if malformed, -ERANGE if a value or the step count
+ *          is out of range
+ */
+int speed_bump_parse_sweep(const char *spec,
+			   struct speed_bump_sweep_step *steps);
+
+/* ============================================================
+ * ELF Symbol Resolution
+ * ============================================================ */
+
+/*
+ * Opaque handle on a parsed ELF file (headers and section table only;
+ * symbol and string tables are read on demand).
+ */
+struct speed_bump_elf;
+
+/*
+ * Read callback used for all ELF file access.
+ *
+ * Reads up to @len bytes at file offset @pos from the file behind @ctx.
+ *
+ * Returns: number of bytes read, or negative errno
+ */
+typedef ssize_t (*speed_bump_elf_read_t)(void *ctx, void *buf, size_t len,
+					 loff_t pos);
+
+/*
+ * Parse the ELF and section headers of a file.
+ *
+ * @elfp: Returns the new handle, to be freed with speed_bump_elf_close()
+ * @read: Read callback for the file
+ * @ctx: Opaque context passed to @read
+ *
+ * Returns: 0 on success, -ENOEXEC if not a 64-bit ELF, negative errno
+ */
+int speed_bump_elf_open(struct speed_bump_elf **elfp,
+			speed_bump_elf_read_t read, void *ctx);
+
+/*
+ * Release a handle from speed_bump_elf_open(). NULL is ignored.
+ */
+void speed_bump_elf_close(struct speed_bump_elf *elf);
+
+/*
+ * Resolve a symbol to the file offset of its code.
+ *
+ * Uses .gnu.hash / .hash for .dynsym, then streams .symtab. Only symbols
+ * inside an executable PT_LOAD segment resolve.
+ *
+ * @elf: Handle from speed_bump_elf_open()
+ * @symbol: Symbol name
+ * @offset: Returns the file offset on success
+ *
+ * Returns: 0 on success, -ENOENT if not found, negative errno
+ */
+int speed_bump_elf_lookup(struct speed_bump_elf *elf, const char *symbol,
+			  loff_t *offset);
+
+/*
+ * Callback for speed_bump_elf_for_each_code_symbol().
+ *
+ * @data: Opaque pointer passed through from the caller
+ * @name: Symbol name (only valid for the duration of the call)
+ * @offset: File offset of the symbol's code
+ * @is_func: Symbol is typed STT_FUNC or STT_GNU_IFUNC (rather than an
+ *           untyped label in an executable segment)
+ *
+ * Returns: 0 to continue, any other value to stop the walk
+ */
+typedef int (*speed_bump_elf_sym_fn)(void *data, const char *name,
+				     loff_t offset, bool is_func);
+
+/*
+ * Walk every defined code symbol in .dynsym, then .symtab.
+ *
+ * Symbol tables are streamed in chunks; a symbol present in both tables
+ * is reported twice, .dynsym first.
+ *
+ * Returns: 0 if all symbols were visited, the callback's non-zero return
+ *          value if it stopped the walk, or negative errno
+ */
+int speed_bump_elf_for_each_code_symbol(struct speed_bump_elf *elf,
+					speed_bump_elf_sym_fn fn, void *data);
+
+/*
+ * Read the GNU build ID from the NT_GNU_BUILD_ID note of a PT_NOTE
+ * segment. No section header or symbol table is consulted, so stripped
+ * binaries carry one too.
+ *
+ * @elf: Handle from speed_bump_elf_open()
+ * @id: Returns the first @size bytes of the build ID
+ * @size: Size of @id
+ *
+ * Returns: length of the build ID (which may exceed @size), -ENODATA if
+ *          the binary has none, or negative errno
+ */
+int speed_bump_elf_build_id(struct speed_bump_elf *elf, u8 *id, size_t size);
+
 #endif /* SPEED_BUMP_H */
@@ -0,0 +1,86 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Speed Bump - Delay Budgets
+ *
+ * Token buckets capping the delay injected per second. The bucket is
+ * refilled to its cap at the start of every one-second window; each CPU
+ * takes tokens from it a slice at a time and spends them without
+ * touching shared state, so a busy target costs one atomic per slice
+ * instead of one per hit.
+ */
+
+#ifdef MOCK_KERNEL
+#include "mock_kernel.h"
+#else
+#include <linux/types.h>
+#include <linux/atomic.h>
+#include <linux/math64.h>
+#include <linux/minmax.h>
+#include <linux/time64.h>
+#include <linux/export.h>
+#endif
+
+#include "speed_bump.h"
+
+/*
+ * Move @budget to @window and refill it, unless it is there already or
+ * another CPU got there first. A CPU that draws from the pool between
+ * the window moving and the refill draws from the old window's
+ * remainder; the refill then overwrites its draw. That can hand out one
+ * extra slice per window, which is within the accuracy promised.
+ */
+static void speed_bump_budget_refill(struct speed_bump_budget *budget,
+                                     u64 window, u64 ns_per_s)
+{
+    s64 cur = atomic64_read(&budget->window);
+
+    /* Never move backwards for a CPU whose clock read is a bit older */
+    if ((s64)(window - cur) <= 0)
+        return;
+
+    if (atomic64_cmpxchg(&budget->window, cur, window) == cur)
+        atomic64_set(&budget->pool_ns, ns_per_s);
+}
+
+bool speed_bump_budget_take(struct speed_bump_budget *budget,
+                            struct speed_bump_budget_cpu *cpu,
+                            u64 now_ns, u64 delay_ns)
+{
+    u64 ns_per_s = READ_ONCE(budget->ns_per_s);
+    u64 window, need, slice;
+    s64 left;
+
+    if (!ns_per_s || !delay_ns)
+        return true;
+
+    /* 1-based so that a zeroed budget or CPU is never current */
+    window = div_u64(now_ns, NSEC_PER_SEC) + 1;
+
+    if (cpu->window != window) {
+        cpu->window = window;
+        cpu->tokens_ns = 0;
+    }
+
+    if (cpu->tokens_ns < delay_ns) {
+        speed_bump_budget_refill(budget, window, ns_per_s);
+
+        need = delay_ns - cpu->tokens_ns;
+        slice = max_t(u64, need, ns_per_s / SPEED_BUMP_BUDGET_SLICES);
+
+        /* Whatever was left is ours, up to the slice */
+        left = atomic64_fetch_sub(slice, &budget->pool_ns);
+        if (left <= 0)
+            return false;
+
+        cpu->tokens_ns += min_t(u64, slice, left);
+        if (cpu->tokens_ns < delay_ns)
+            return false;
+    }
+
+    cpu->tokens_ns -= delay_ns;
+    return true;
+}
+
+#ifndef MOCK_KERNEL
+EXPORT_SYMBOL_GPL(speed_bump_budget_take);
+#endif
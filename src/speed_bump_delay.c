@@ -3,6 +3,18 @@
  * Speed Bump - Spin Delay Implementation
  *
  * Provides precise nanosecond-level spin delay using busy-wait loop.
+ *
+ * Two clocks are supported. The default after calibration is the local
+ * cycle counter (TSC on x86, CNTVCT on arm64): the deadline is computed
+ * once and each loop iteration costs a single cheap counter read, so
+ * short delays do not overshoot by a clocksource read per iteration.
+ * When the counter is not known to be constant-rate and synchronised
+ * across CPUs, the delay falls back to ktime_get_ns().
+ *
+ * Targets may instead sleep on an hrtimer for their delay ("sleep"), or
+ * sleep for the bulk and spin only the tail ("hybrid"), which keeps the
+ * precision of a spin for the end of the delay without burning a CPU
+ * for all of it.
  */
 
 #ifdef MOCK_KERNEL
@@ -11,32 +23,310 @@
 #include <linux/types.h>
 #include <linux/ktime.h>
 #include <linux/processor.h>
+#include <linux/timex.h>
+#include <linux/math64.h>
+#include <linux/export.h>
+#include <linux/hrtimer.h>
+#include <linux/sched.h>
+#include <linux/sched/signal.h>
+#include <linux/string.h>
+#include <linux/errno.h>
+#include <linux/minmax.h>
+#ifdef CONFIG_X86
+#include <asm/cpufeature.h>
+#include <asm/tsc.h>
+#endif
+#ifdef CONFIG_ARM64
+#include <clocksource/arm_arch_timer.h>
+#endif
 #endif
 
 #include "speed_bump.h"
 
+/* ns -> cycles is (ns * mult) >> DELAY_MULT_SHIFT */
+#define DELAY_MULT_SHIFT    24
+
+/* Calibration window against ktime */
+#define DELAY_CALIBRATE_NS  2000000ULL
+
+/* Overhead is the mean overshoot of this many short delays */
+#define DELAY_OVERHEAD_NS   1000ULL
+#define DELAY_OVERHEAD_REPS 64
+
+static struct {
+    enum speed_bump_delay_clock clock;
+    u32 mult;
+    u64 overhead_ns;
+} speed_bump_delay = {
+    .clock = SPEED_BUMP_CLOCK_KTIME,
+};
+
+/*
+ * Whether the cycle counter can time a delay: constant rate, running in
+ * idle states, and synchronised across CPUs (a spinning task may
+ * migrate).
+ */
+static bool speed_bump_cycles_stable(void)
+{
+#if defined(MOCK_KERNEL)
+    return mock_cycles_stable();
+#elif defined(CONFIG_X86)
+    return boot_cpu_has(X86_FEATURE_CONSTANT_TSC) &&
+           boot_cpu_has(X86_FEATURE_NONSTOP_TSC) &&
+           !check_tsc_unstable();
+#elif defined(CONFIG_ARM64)
+    /* The generic timer counter is architecturally constant-rate */
+    return true;
+#else
+    return false;
+#endif
+}
+
+static void speed_bump_spin_ktime(u64 delay_ns)
+{
+    u64 start_ns;
+    u64 elapsed_ns;
+
+    start_ns = ktime_get_ns();
+
+    do {
+        cpu_relax();
+        elapsed_ns = ktime_get_ns() - start_ns;
+    } while (elapsed_ns < delay_ns);
+}
+
+static void speed_bump_spin_cycles(u64 delay_ns)
+{
+    cycles_t deadline;
+
+    deadline = get_cycles() +
+               mul_u64_u32_shr(delay_ns, speed_bump_delay.mult,
+                               DELAY_MULT_SHIFT);
+
+    while ((s64)(get_cycles() - deadline) < 0)
+        cpu_relax();
+}
+
 /*
  * Spin delay for the specified number of nanoseconds.
  *
- * Uses ktime_get_ns() for high-resolution timing and cpu_relax()
- * to reduce power consumption during the spin wait.
+ * Uses the calibrated cycle counter when available, otherwise
+ * ktime_get_ns(), with cpu_relax() to reduce power consumption during
+ * the spin wait.
  */
 void speed_bump_spin_delay_ns(u64 delay_ns)
 {
-    u64 start_ns;
-    u64 elapsed_ns;
+    if (delay_ns == 0)
+        return;
+
+    if (speed_bump_delay.clock == SPEED_BUMP_CLOCK_CYCLES)
+        speed_bump_spin_cycles(delay_ns);
+    else
+        speed_bump_spin_ktime(delay_ns);
+}
+
+/*
+ * Sleep until @expires on the monotonic clock. Only a fatal signal ends
+ * the sleep early; other wakeups go back to sleep.
+ *
+ * Returns: true if the deadline was reached, false if interrupted
+ */
+static bool speed_bump_sleep_until(ktime_t expires)
+{
+    do {
+        set_current_state(TASK_KILLABLE);
+        if (!schedule_hrtimeout_range(&expires, 0, HRTIMER_MODE_ABS))
+            return true;
+    } while (!fatal_signal_pending(current));
+
+    return false;
+}
+
+/*
+ * Delay in the given mode. Hybrid delays no longer than the spun tail
+ * are spun entirely; hrtimer wakeup latency would dominate them anyway.
+ */
+void speed_bump_delay_ns(u64 delay_ns, enum speed_bump_delay_mode mode)
+{
+    ktime_t expires;
+    s64 remaining_ns;
 
     if (delay_ns == 0)
         return;
 
+    if (mode == SPEED_BUMP_MODE_SPIN ||
+        (mode == SPEED_BUMP_MODE_HYBRID &&
+         delay_ns <= SPEED_BUMP_HYBRID_SPIN_NS)) {
+        speed_bump_spin_delay_ns(delay_ns);
+        return;
+    }
+
+    expires = ktime_add_ns(ktime_get(), delay_ns);
+
+    if (mode == SPEED_BUMP_MODE_SLEEP) {
+        speed_bump_sleep_until(expires);
+        return;
+    }
+
+    if (!speed_bump_sleep_until(ktime_sub_ns(expires,
+                                             SPEED_BUMP_HYBRID_SPIN_NS)))
+        return;
+
+    /* Spin whatever the wakeup left of the tail */
+    remaining_ns = ktime_to_ns(ktime_sub(expires, ktime_get()));
+    if (remaining_ns > 0)
+        speed_bump_spin_delay_ns(remaining_ns);
+}
+
+u64 speed_bump_scaled_delay_ns(u64 duration_ns, unsigned int pct)
+{
+    u64 delay_ns;
+
+    /*
+     * Past 100x the maximum delay any pct >= 1 hits the cap anyway;
+     * clamping first keeps the product within 64 bits.
+     */
+    duration_ns = min_t(u64, duration_ns, SPEED_BUMP_MAX_DELAY_NS * 100);
+    delay_ns = mul_u64_u32_div(duration_ns, pct, 100);
+
+    return min_t(u64, delay_ns, SPEED_BUMP_MAX_DELAY_NS);
+}
+
+static const char * const speed_bump_delay_mode_names[] = {
+    [SPEED_BUMP_MODE_SPIN]   = "spin",
+    [SPEED_BUMP_MODE_SLEEP]  = "sleep",
+    [SPEED_BUMP_MODE_HYBRID] = "hybrid",
+};
+
+int speed_bump_parse_delay_mode(const char *name,
+                                enum speed_bump_delay_mode *mode)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(speed_bump_delay_mode_names); i++) {
+        if (strcmp(name, speed_bump_delay_mode_names[i]) == 0) {
+            *mode = i;
+            return 0;
+        }
+    }
+
+    return -EINVAL;
+}
+
+const char *speed_bump_delay_mode_name(enum speed_bump_delay_mode mode)
+{
+    if ((size_t)mode >= ARRAY_SIZE(speed_bump_delay_mode_names))
+        return "?";
+
+    return speed_bump_delay_mode_names[mode];
+}
+
+/*
+ * Counter frequency as already calibrated by the kernel, in kHz, or 0
+ * if it has to be measured.
+ */
+static u64 speed_bump_cycles_khz(void)
+{
+#if defined(MOCK_KERNEL)
+    return 0;
+#elif defined(CONFIG_X86)
+    return tsc_khz;
+#elif defined(CONFIG_ARM64)
+    return arch_timer_get_rate() / 1000;
+#else
+    return 0;
+#endif
+}
+
+/*
+ * Work out the ns -> cycles multiplier, from the kernel's own frequency
+ * if known, else by measuring the counter against ktime over
+ * DELAY_CALIBRATE_NS. Returns 0 if it does not fit.
+ */
+static u32 speed_bump_calibrate_mult(void)
+{
+    u64 start_ns, end_ns, mult, khz;
+    cycles_t start_cycles, end_cycles;
+
+    khz = speed_bump_cycles_khz();
+    if (khz) {
+        mult = div64_u64(khz << DELAY_MULT_SHIFT, USEC_PER_SEC);
+        return mult && mult <= U32_MAX ? (u32)mult : 0;
+    }
+
+    start_cycles = get_cycles();
     start_ns = ktime_get_ns();
 
     do {
         cpu_relax();
-        elapsed_ns = ktime_get_ns() - start_ns;
-    } while (elapsed_ns < delay_ns);
+        end_ns = ktime_get_ns();
+    } while (end_ns - start_ns < DELAY_CALIBRATE_NS);
+
+    end_cycles = get_cycles();
+
+    if (end_cycles <= start_cycles)
+        return 0;
+
+    mult = div64_u64((u64)(end_cycles - start_cycles) << DELAY_MULT_SHIFT,
+                     end_ns - start_ns);
+    if (mult == 0 || mult > U32_MAX)
+        return 0;
+
+    return (u32)mult;
+}
+
+/* Mean overshoot of a short delay on the selected clock */
+static u64 speed_bump_measure_overhead(void)
+{
+    u64 start_ns, elapsed_ns;
+    int i;
+
+    start_ns = ktime_get_ns();
+    for (i = 0; i < DELAY_OVERHEAD_REPS; i++)
+        speed_bump_spin_delay_ns(DELAY_OVERHEAD_NS);
+    elapsed_ns = ktime_get_ns() - start_ns;
+
+    elapsed_ns = div64_u64(elapsed_ns, DELAY_OVERHEAD_REPS);
+    return elapsed_ns > DELAY_OVERHEAD_NS ? elapsed_ns - DELAY_OVERHEAD_NS : 0;
+}
+
+void speed_bump_delay_calibrate(bool use_cycles)
+{
+    u32 mult = 0;
+
+    if (use_cycles && speed_bump_cycles_stable())
+        mult = speed_bump_calibrate_mult();
+
+    if (mult) {
+        speed_bump_delay.mult = mult;
+        speed_bump_delay.clock = SPEED_BUMP_CLOCK_CYCLES;
+    } else {
+        speed_bump_delay.clock = SPEED_BUMP_CLOCK_KTIME;
+    }
+
+    speed_bump_delay.overhead_ns = speed_bump_measure_overhead();
+}
+
+enum speed_bump_delay_clock speed_bump_delay_clock(void)
+{
+    return speed_bump_delay.clock;
+}
+
+u64 speed_bump_delay_overhead_ns(void)
+{
+    return speed_bump_delay.overhead_ns;
+}
+
+u64 speed_bump_delay_cycles_per_us(void)
+{
+    if (speed_bump_delay.clock != SPEED_BUMP_CLOCK_CYCLES)
+        return 0;
+
+    return mul_u64_u32_shr(NSEC_PER_USEC, speed_bump_delay.mult,
+                           DELAY_MULT_SHIFT);
 }
 
 #ifndef MOCK_KERNEL
 EXPORT_SYMBOL_GPL(speed_bump_spin_delay_ns);
+EXPORT_SYMBOL_GPL(speed_bump_delay_ns);
 #endif
@@ -0,0 +1,248 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Speed Bump - Stochastic Delay Sampling
+ *
+ * A small PRNG and integer-only samplers for randomised delays. Each
+ * sample is a handful of multiplies: logarithms and exponentials are
+ * computed bit by bit in fixed point, so the uprobe handler never needs
+ * the FPU.
+ */
+
+#ifdef MOCK_KERNEL
+#include "mock_kernel.h"
+#else
+#include <linux/types.h>
+#include <linux/bitops.h>
+#include <linux/math64.h>
+#include <linux/limits.h>
+#include <linux/string.h>
+#include <linux/errno.h>
+#include <linux/export.h>
+#endif
+
+#include "speed_bump.h"
+
+/* Fixed-point constants, Q16 */
+#define DIST_Q16_ONE    (1 << 16)
+#define DIST_LN2_Q16    45426   /* ln(2) */
+#define DIST_LOG2E_Q16  94548   /* log2(e) */
+
+/* 2^(1/2^i) for i = 1..16, Q30 */
+static const u32 dist_exp2_frac_q30[16] = {
+    0x5a82799a, /* 2^(1/2) */
+    0x4c1bf829, /* 2^(1/4) */
+    0x45cae0f2, /* 2^(1/8) */
+    0x42d561b4, /* 2^(1/16) */
+    0x4166c34c, /* 2^(1/32) */
+    0x40b268fa, /* 2^(1/64) */
+    0x4058f6a8, /* 2^(1/128) */
+    0x402c6be9, /* 2^(1/256) */
+    0x4016321b, /* 2^(1/512) */
+    0x400b1818, /* 2^(1/1024) */
+    0x40058bce, /* 2^(1/2048) */
+    0x4002c5d8, /* 2^(1/4096) */
+    0x400162e8, /* 2^(1/8192) */
+    0x4000b173, /* 2^(1/16384) */
+    0x400058b9, /* 2^(1/32768) */
+    0x40002c5d, /* 2^(1/65536) */
+};
+
+u64 speed_bump_prng_next(u64 *state)
+{
+    /* xorshift64* (Vigna): three shifts and a multiply, ample for jitter */
+    u64 x = *state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+
+    return x * 0x2545f4914f6cdd1dULL;
+}
+
+/*
+ * -log2(u / 2^32) in Q16, for u in [1, 2^32): the integer part from the
+ * top set bit, then 16 fractional bits by repeated squaring of the
+ * normalised mantissa.
+ */
+static u32 dist_neg_log2_q16(u32 u)
+{
+    int msb = fls(u) - 1;
+    u64 m = (u64)u << (31 - msb);  /* [2^31, 2^32) == [1, 2) in Q31 */
+    u32 frac = 0;
+    int i;
+
+    for (i = 15; i >= 0; i--) {
+        m = (m * m) >> 31;
+        if (m >= (1ULL << 32)) {
+            m >>= 1;
+            frac |= 1U << i;
+        }
+    }
+
+    return ((u32)(32 - msb) << 16) - frac;
+}
+
+/*
+ * @mean_ns * 2^(@t_q16 / 2^16), saturating at @max_ns.
+ */
+static u64 dist_scale_exp2(u64 mean_ns, s64 t_q16, u64 max_ns)
+{
+    s64 k = t_q16 >> 16;          /* floor, also for negative t */
+    u32 f = (u32)t_q16 & 0xffff;  /* t - floor(t) */
+    u64 r_q30 = 1ULL << 30;
+    u64 v;
+    int i;
+
+    for (i = 0; i < 16; i++) {
+        if (f & (1U << (15 - i)))
+            r_q30 = (r_q30 * dist_exp2_frac_q30[i]) >> 30;
+    }
+
+    v = mul_u64_u32_shr(mean_ns, (u32)r_q30, 30);
+
+    if (k >= 0) {
+        if (k >= 63 || v > (max_ns >> k))
+            return max_ns;
+        return v << k;
+    }
+
+    return k <= -63 ? 0 : v >> -k;
+}
+
+/* Standard normal in Q16 by Irwin-Hall: twelve 16-bit uniforms, minus 6 */
+static s64 dist_normal_q16(u64 *state)
+{
+    s64 sum = 0;
+    u64 r;
+    int i, j;
+
+    for (i = 0; i < 3; i++) {
+        r = speed_bump_prng_next(state);
+        for (j = 0; j < 4; j++, r >>= 16)
+            sum += r & 0xffff;
+    }
+
+    return sum - 6 * DIST_Q16_ONE;
+}
+
+u64 speed_bump_dist_sample(enum speed_bump_dist dist, u64 mean_ns,
+                           u64 max_ns, u32 sigma_milli, u64 *state)
+{
+    u64 delay_ns, r;
+    s64 sigma_q16, y_q16;
+    u32 u;
+
+    if (max_ns == 0 || max_ns > SPEED_BUMP_MAX_DELAY_NS)
+        max_ns = SPEED_BUMP_MAX_DELAY_NS;
+
+    switch (dist) {
+    case SPEED_BUMP_DIST_EXP:
+        /* Inverse CDF: -mean * ln(U), U in (0, 1) */
+        r = speed_bump_prng_next(state);
+        u = (u32)(r >> 32);
+        if (u == 0)
+            u = 1;
+        delay_ns = mul_u64_u32_shr(mean_ns,
+                                   (u32)(((u64)dist_neg_log2_q16(u) *
+                                          DIST_LN2_Q16) >> 16),
+                                   16);
+        break;
+
+    case SPEED_BUMP_DIST_UNIFORM:
+        /* [0, 2 * mean) */
+        r = speed_bump_prng_next(state);
+        delay_ns = mul_u64_u32_shr(mean_ns * 2, (u32)(r >> 32), 32);
+        break;
+
+    case SPEED_BUMP_DIST_LOGNORMAL:
+        /* mean * exp(sigma * Z - sigma^2 / 2) has mean @mean_ns */
+        sigma_q16 = div_s64((s64)sigma_milli * DIST_Q16_ONE, 1000);
+        y_q16 = ((sigma_q16 * dist_normal_q16(state)) >> 16) -
+                ((sigma_q16 * sigma_q16) >> 17);
+        delay_ns = dist_scale_exp2(mean_ns, (y_q16 * DIST_LOG2E_Q16) >> 16,
+                                   max_ns);
+        break;
+
+    case SPEED_BUMP_DIST_FIXED:
+    default:
+        delay_ns = mean_ns;
+        break;
+    }
+
+    return min_t(u64, delay_ns, max_ns);
+}
+
+static const char * const speed_bump_dist_names[] = {
+    [SPEED_BUMP_DIST_FIXED]     = "fixed",
+    [SPEED_BUMP_DIST_EXP]       = "exp",
+    [SPEED_BUMP_DIST_UNIFORM]   = "uniform",
+    [SPEED_BUMP_DIST_LOGNORMAL] = "lognormal",
+};
+
+int speed_bump_parse_dist(const char *name, enum speed_bump_dist *dist)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_SIZE(speed_bump_dist_names); i++) {
+        if (strcmp(name, speed_bump_dist_names[i]) == 0) {
+            *dist = i;
+            return 0;
+        }
+    }
+
+    return -EINVAL;
+}
+
+const char *speed_bump_dist_name(enum speed_bump_dist dist)
+{
+    if ((size_t)dist >= ARRAY_SIZE(speed_bump_dist_names))
+        return "?";
+
+    return speed_bump_dist_names[dist];
+}
+
+int speed_bump_parse_fixed(const char *str, unsigned int frac_digits, u64 *out)
+{
+    bool point = false, digits = false;
+    unsigned int frac = 0;
+    u64 val = 0;
+
+    for (; *str; str++) {
+        if (*str == '.' && !point) {
+            point = true;
+            continue;
+        }
+        if (*str < '0' || *str > '9')
+            return -EINVAL;
+        digits = true;
+
+        /* Digits beyond the resolution are dropped */
+        if (point) {
+            if (frac == frac_digits)
+                continue;
+            frac++;
+        }
+
+        if (val > (U64_MAX - 9) / 10)
+            return -ERANGE;
+        val = val * 10 + (*str - '0');
+    }
+
+    if (!digits)
+        return -EINVAL;
+
+    for (; frac < frac_digits; frac++) {
+        if (val > U64_MAX / 10)
+            return -ERANGE;
+        val *= 10;
+    }
+
+    *out = val;
+    return 0;
+}
+
+#ifndef MOCK_KERNEL
+EXPORT_SYMBOL_GPL(speed_bump_prng_next);
+EXPORT_SYMBOL_GPL(speed_bump_dist_sample);
+#endif
@@ -0,0 +1,722 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Speed Bump - ELF Symbol Resolution
+ *
+ * Resolves a symbol name to the file offset uprobe_register() expects.
+ *
+ * Exported symbols are looked up through the .gnu.hash (or SysV .hash)
+ * table of .dynsym, reading only the bloom word, bucket and chain
+ * entries involved. Anything else falls back to a streaming scan of the
+ * symbol table in fixed-size chunks, so no symbol or string table is
+ * ever loaded whole, however large the binary.
+ *
+ * The build ID a target's buildid= is checked against comes from the
+ * NT_GNU_BUILD_ID note, found through the program headers alone.
+ *
+ * All file access goes through a caller-supplied read callback, so the
+ * same code runs in the kernel (kernel_read) and in userspace tests.
+ */
+
+#ifdef MOCK_KERNEL
+#include "mock_kernel.h"
+#include <elf.h>
+#else
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/elf.h>
+#endif
+
+#include "speed_bump.h"
+
+#ifndef SHT_GNU_HASH
+#define SHT_GNU_HASH 0x6ffffff6
+#endif
+
+#ifndef STT_GNU_IFUNC
+#define STT_GNU_IFUNC 10
+#endif
+
+#ifndef NT_GNU_BUILD_ID
+#define NT_GNU_BUILD_ID 3
+#endif
+
+/* Symbols read per chunk when streaming a symbol table */
+#define ELF_SYM_CHUNK  256
+
+/* String table window; always large enough for one maximal name */
+#define ELF_STR_WINDOW 4096
+
+struct speed_bump_elf {
+	speed_bump_elf_read_t read;
+	void *ctx;
+	Elf64_Ehdr ehdr;
+	Elf64_Shdr *shdrs;
+	Elf64_Phdr *phdrs;
+	int symtab;     /* section indices, -1 if absent */
+	int dynsym;
+	int gnu_hash;
+	int sysv_hash;
+};
+
+/* Sliding window over a string table, used while streaming symbols */
+struct elf_str_window {
+	char *buf;
+	u64 start;
+	size_t len;
+};
+
+/*
+ * Read exactly @len bytes at @pos. A short read means the file is
+ * truncated relative to its headers, which we report as not-an-ELF.
+ */
+static int elf_read(struct speed_bump_elf *elf, void *buf, size_t len,
+		    u64 pos)
+{
+	ssize_t ret;
+
+	ret = elf->read(elf->ctx, buf, len, (loff_t)pos);
+	if (ret < 0)
+		return (int)ret;
+	if ((size_t)ret != len)
+		return -ENOEXEC;
+	return 0;
+}
+
+/* Check that a section is a usable symbol table with a string table */
+static bool elf_symsec_valid(const struct speed_bump_elf *elf, int idx)
+{
+	const Elf64_Shdr *sec = &elf->shdrs[idx];
+
+	if (sec->sh_entsize != sizeof(Elf64_Sym))
+		return false;
+	if (sec->sh_link >= elf->ehdr.e_shnum)
+		return false;
+	return elf->shdrs[sec->sh_link].sh_type == SHT_STRTAB;
+}
+
+/* Check that [off, off + len) lies within a section */
+static bool elf_sec_contains(const Elf64_Shdr *sec, u64 off, u64 len)
+{
+	return off <= sec->sh_size && len <= sec->sh_size - off;
+}
+
+/* A symbol we can put a probe on: defined, with an address */
+static bool elf_sym_defined(const Elf64_Sym *sym)
+{
+	return sym->st_shndx != SHN_UNDEF && sym->st_value != 0;
+}
+
+static u32 elf_gnu_hash(const char *name)
+{
+	u32 h = 5381;
+
+	while (*name)
+		h = (h << 5) + h + (unsigned char)*name++;
+	return h;
+}
+
+static u32 elf_sysv_hash(const char *name)
+{
+	u32 h = 0, g;
+
+	while (*name) {
+		h = (h << 4) + (unsigned char)*name++;
+		g = h & 0xf0000000;
+		if (g)
+			h ^= g >> 24;
+		h &= ~g;
+	}
+	return h;
+}
+
+/*
+ * Read symbol @idx of symbol table @symsec.
+ */
+static int elf_read_sym(struct speed_bump_elf *elf, const Elf64_Shdr *symsec,
+			u64 idx, Elf64_Sym *sym)
+{
+	u64 off = idx * sizeof(*sym);
+
+	if (!elf_sec_contains(symsec, off, sizeof(*sym)))
+		return -ENOEXEC;
+	return elf_read(elf, sym, sizeof(*sym), symsec->sh_offset + off);
+}
+
+/*
+ * Compare the string at @off in @strsec with @name (of length @len).
+ * Returns 1 on match, 0 on mismatch, negative errno on read failure.
+ */
+static int elf_name_equal(struct speed_bump_elf *elf, const Elf64_Shdr *strsec,
+			  u32 off, const char *name, size_t len)
+{
+	char buf[SPEED_BUMP_MAX_SYMBOL_LEN];
+	int ret;
+
+	if (len >= sizeof(buf) || !elf_sec_contains(strsec, off, len + 1))
+		return 0;
+
+	ret = elf_read(elf, buf, len + 1, strsec->sh_offset + off);
+	if (ret)
+		return ret;
+
+	return memcmp(buf, name, len + 1) == 0;
+}
+
+/*
+ * Check whether dynsym entry @idx is a defined symbol called @name.
+ * Returns 1 and fills @sym on match, 0 on mismatch, negative on error.
+ */
+static int elf_dynsym_match(struct speed_bump_elf *elf, u32 idx,
+			    const char *name, size_t len, Elf64_Sym *sym)
+{
+	const Elf64_Shdr *symsec = &elf->shdrs[elf->dynsym];
+	int ret;
+
+	ret = elf_read_sym(elf, symsec, idx, sym);
+	if (ret)
+		return ret;
+
+	if (!elf_sym_defined(sym))
+		return 0;
+
+	return elf_name_equal(elf, &elf->shdrs[symsec->sh_link],
+			      sym->st_name, name, len);
+}
+
+/*
+ * Look up @name in .dynsym through .gnu.hash.
+ *
+ * Layout (ELF64): nbuckets, symoffset, bloom_size, bloom_shift (u32
+ * each), then bloom_size u64 bloom words, nbuckets u32 buckets and one
+ * u32 chain entry per symbol from symoffset on. The low bit of a chain
+ * entry marks the end of its bucket's chain.
+ */
+static int elf_gnu_hash_lookup(struct speed_bump_elf *elf, const char *name,
+			       size_t len, Elf64_Sym *sym)
+{
+	const Elf64_Shdr *hsec = &elf->shdrs[elf->gnu_hash];
+	const Elf64_Shdr *symsec = &elf->shdrs[elf->dynsym];
+	u32 hdr[4], nbuckets, symoffset, bloom_size, bloom_shift;
+	u32 h, idx, chain, nsyms;
+	u64 buckets_off, chain_off, bloom, mask;
+	int ret;
+
+	ret = elf_read(elf, hdr, sizeof(hdr), hsec->sh_offset);
+	if (ret)
+		return ret;
+
+	nbuckets = hdr[0];
+	symoffset = hdr[1];
+	bloom_size = hdr[2];
+	bloom_shift = hdr[3];
+
+	buckets_off = sizeof(hdr) + (u64)bloom_size * sizeof(u64);
+	chain_off = buckets_off + (u64)nbuckets * sizeof(u32);
+	if (nbuckets == 0 || !elf_sec_contains(hsec, 0, chain_off))
+		return -ENOENT;
+
+	h = elf_gnu_hash(name);
+
+	/* Bloom filter rejects most absent names with a single read */
+	if (bloom_size && bloom_shift < 32) {
+		ret = elf_read(elf, &bloom, sizeof(bloom),
+			       hsec->sh_offset + sizeof(hdr) +
+			       (u64)((h / 64) % bloom_size) * sizeof(u64));
+		if (ret)
+			return ret;
+
+		mask = (1ULL << (h % 64)) | (1ULL << ((h >> bloom_shift) % 64));
+		if ((bloom & mask) != mask)
+			return -ENOENT;
+	}
+
+	ret = elf_read(elf, &idx, sizeof(idx), hsec->sh_offset + buckets_off +
+		       (u64)(h % nbuckets) * sizeof(u32));
+	if (ret)
+		return ret;
+
+	if (idx < symoffset)
+		return -ENOENT;
+
+	nsyms = symsec->sh_size / sizeof(Elf64_Sym);
+	for (; idx < nsyms; idx++) {
+		u64 off = chain_off + (u64)(idx - symoffset) * sizeof(u32);
+
+		if (!elf_sec_contains(hsec, off, sizeof(chain)))
+			break;
+
+		ret = elf_read(elf, &chain, sizeof(chain), hsec->sh_offset + off);
+		if (ret)
+			return ret;
+
+		if ((chain | 1) == (h | 1)) {
+			ret = elf_dynsym_match(elf, idx, name, len, sym);
+			if (ret)
+				return ret < 0 ? ret : 0;
+		}
+
+		if (chain & 1)
+			break;
+	}
+
+	return -ENOENT;
+}
+
+/*
+ * Look up @name in .dynsym through the SysV .hash table.
+ *
+ * Layout: nbucket, nchain (u32 each), then nbucket bucket entries and
+ * nchain chain entries. Index 0 (STN_UNDEF) terminates a chain.
+ */
+static int elf_sysv_hash_lookup(struct speed_bump_elf *elf, const char *name,
+				size_t len, Elf64_Sym *sym)
+{
+	const Elf64_Shdr *hsec = &elf->shdrs[elf->sysv_hash];
+	u32 hdr[2], nbucket, nchain, idx, steps;
+	u64 chain_off;
+	int ret;
+
+	ret = elf_read(elf, hdr, sizeof(hdr), hsec->sh_offset);
+	if (ret)
+		return ret;
+
+	nbucket = hdr[0];
+	nchain = hdr[1];
+	chain_off = sizeof(hdr) + (u64)nbucket * sizeof(u32);
+	if (nbucket == 0 ||
+	    !elf_sec_contains(hsec, 0, chain_off + (u64)nchain * sizeof(u32)))
+		return -ENOENT;
+
+	ret = elf_read(elf, &idx, sizeof(idx), hsec->sh_offset + sizeof(hdr) +
+		       (u64)(elf_sysv_hash(name) % nbucket) * sizeof(u32));
+	if (ret)
+		return ret;
+
+	/* Bound the walk so a corrupt chain cannot loop forever */
+	for (steps = 0; idx != 0 && idx < nchain && steps < nchain; steps++) {
+		ret = elf_dynsym_match(elf, idx, name, len, sym);
+		if (ret)
+			return ret < 0 ? ret : 0;
+
+		ret = elf_read(elf, &idx, sizeof(idx), hsec->sh_offset +
+			       chain_off + (u64)idx * sizeof(u32));
+		if (ret)
+			return ret;
+	}
+
+	return -ENOENT;
+}
+
+/*
+ * Return the NUL-terminated name at @off in @strsec through @name,
+ * refilling the window when the name is not wholly inside it. Names
+ * too long to be a target (or unterminated) come back as NULL.
+ */
+static int elf_window_str(struct speed_bump_elf *elf,
+			  const Elf64_Shdr *strsec, struct elf_str_window *w,
+			  u32 off, const char **name)
+{
+	size_t avail;
+	char *p;
+	int ret;
+
+	*name = NULL;
+	if (off >= strsec->sh_size)
+		return 0;
+
+	if (off >= w->start && off < w->start + w->len) {
+		p = w->buf + (off - w->start);
+		avail = w->start + w->len - off;
+		if (memchr(p, '\0', min_t(size_t, avail, SPEED_BUMP_MAX_SYMBOL_LEN))) {
+			*name = p;
+			return 0;
+		}
+		/* Name is too long, or runs off the end of the table */
+		if (avail >= SPEED_BUMP_MAX_SYMBOL_LEN ||
+		    w->start + w->len == strsec->sh_size)
+			return 0;
+	}
+
+	w->start = off;
+	w->len = min_t(u64, ELF_STR_WINDOW, strsec->sh_size - off);
+	ret = elf_read(elf, w->buf, w->len, strsec->sh_offset + off);
+	if (ret) {
+		w->len = 0;
+		return ret;
+	}
+
+	if (memchr(w->buf, '\0', min_t(size_t, w->len, SPEED_BUMP_MAX_SYMBOL_LEN)))
+		*name = w->buf;
+	return 0;
+}
+
+/*
+ * Stream every defined, named symbol of symbol table @secidx to @fn.
+ *
+ * Symbols are read ELF_SYM_CHUNK at a time and names through a small
+ * window over the string table, which linkers lay out roughly in symbol
+ * order, so the scan is sequential I/O with bounded memory.
+ *
+ * @fn returns 0 to continue, anything else to stop the scan; that value
+ * is returned. Returns 0 if the whole table was scanned.
+ */
+static int elf_scan_symbols(struct speed_bump_elf *elf, int secidx,
+			    int (*fn)(void *data, const char *name,
+				      const Elf64_Sym *sym),
+			    void *data)
+{
+	const Elf64_Shdr *symsec = &elf->shdrs[secidx];
+	const Elf64_Shdr *strsec = &elf->shdrs[symsec->sh_link];
+	struct elf_str_window win = { 0 };
+	Elf64_Sym *syms;
+	const char *name;
+	u64 nsyms, base, n, i;
+	int ret = 0;
+
+	syms = kmalloc_array(ELF_SYM_CHUNK, sizeof(*syms), GFP_KERNEL);
+	win.buf = kmalloc(ELF_STR_WINDOW, GFP_KERNEL);
+	if (!syms || !win.buf) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	nsyms = symsec->sh_size / sizeof(Elf64_Sym);
+	for (base = 0; base < nsyms; base += n) {
+		n = min_t(u64, nsyms - base, ELF_SYM_CHUNK);
+		ret = elf_read(elf, syms, n * sizeof(*syms),
+			       symsec->sh_offset + base * sizeof(*syms));
+		if (ret)
+			goto out;
+
+		for (i = 0; i < n; i++) {
+			if (!syms[i].st_name || !elf_sym_defined(&syms[i]))
+				continue;
+
+			ret = elf_window_str(elf, strsec, &win,
+					     syms[i].st_name, &name);
+			if (ret)
+				goto out;
+			if (!name)
+				continue;
+
+			ret = fn(data, name, &syms[i]);
+			if (ret)
+				goto out;
+		}
+	}
+
+out:
+	kfree(win.buf);
+	kfree(syms);
+	return ret;
+}
+
+struct elf_scan_lookup {
+	const char *name;
+	Elf64_Sym *sym;
+};
+
+static int elf_scan_lookup_fn(void *data, const char *name,
+			      const Elf64_Sym *sym)
+{
+	struct elf_scan_lookup *lookup = data;
+
+	if (strcmp(name, lookup->name) != 0)
+		return 0;
+
+	*lookup->sym = *sym;
+	return 1;
+}
+
+/* Find @name by streaming symbol table @secidx */
+static int elf_scan_lookup(struct speed_bump_elf *elf, int secidx,
+			   const char *name, Elf64_Sym *sym)
+{
+	struct elf_scan_lookup lookup = { .name = name, .sym = sym };
+	int ret;
+
+	ret = elf_scan_symbols(elf, secidx, elf_scan_lookup_fn, &lookup);
+	if (ret < 0)
+		return ret;
+	return ret ? 0 : -ENOENT;
+}
+
+/*
+ * Convert a virtual address to a file offset using the executable
+ * PT_LOAD segment that contains it. Addresses outside executable
+ * segments (data, TLS, absolute symbols) cannot carry a probe.
+ */
+static int elf_vaddr_to_offset(const struct speed_bump_elf *elf,
+			       Elf64_Addr vaddr, loff_t *offset)
+{
+	const Elf64_Phdr *phdr;
+	int i;
+
+	for (i = 0; i < elf->ehdr.e_phnum; i++) {
+		phdr = &elf->phdrs[i];
+		if (phdr->p_type != PT_LOAD || !(phdr->p_flags & PF_X))
+			continue;
+
+		if (vaddr >= phdr->p_vaddr &&
+		    vaddr < phdr->p_vaddr + phdr->p_filesz) {
+			*offset = phdr->p_offset + (vaddr - phdr->p_vaddr);
+			return 0;
+		}
+	}
+
+	return -ENOENT;
+}
+
+/* Symbol types that can never name code */
+static bool elf_sym_is_code_type(const Elf64_Sym *sym)
+{
+	switch (ELF64_ST_TYPE(sym->st_info)) {
+	case STT_OBJECT:
+	case STT_SECTION:
+	case STT_FILE:
+	case STT_TLS:
+		return false;
+	default:
+		return true;
+	}
+}
+
+struct elf_code_scan {
+	struct speed_bump_elf *elf;
+	speed_bump_elf_sym_fn fn;
+	void *data;
+};
+
+static int elf_code_scan_fn(void *data, const char *name,
+			    const Elf64_Sym *sym)
+{
+	struct elf_code_scan *scan = data;
+	unsigned char type = ELF64_ST_TYPE(sym->st_info);
+	loff_t offset;
+
+	if (!elf_sym_is_code_type(sym))
+		return 0;
+	if (elf_vaddr_to_offset(scan->elf, sym->st_value, &offset))
+		return 0;
+
+	return scan->fn(scan->data, name, offset,
+			type == STT_FUNC || type == STT_GNU_IFUNC);
+}
+
+int speed_bump_elf_for_each_code_symbol(struct speed_bump_elf *elf,
+					speed_bump_elf_sym_fn fn, void *data)
+{
+	struct elf_code_scan scan = { .elf = elf, .fn = fn, .data = data };
+	int ret = 0;
+
+	if (elf->dynsym >= 0)
+		ret = elf_scan_symbols(elf, elf->dynsym, elf_code_scan_fn, &scan);
+	if (!ret && elf->symtab >= 0)
+		ret = elf_scan_symbols(elf, elf->symtab, elf_code_scan_fn, &scan);
+
+	return ret;
+}
+
+/*
+ * Find the NT_GNU_BUILD_ID note in the PT_NOTE segment at @phdr.
+ * Returns the note's length with up to @size bytes of it in @id,
+ * 0 if the segment has none, or negative errno.
+ */
+static int elf_segment_build_id(struct speed_bump_elf *elf,
+				const Elf64_Phdr *phdr, u8 *id, size_t size)
+{
+	/* Notes are 4-byte aligned, or 8 in segments that say so */
+	u64 align = phdr->p_align == 8 ? 8 : 4;
+	u64 pos = phdr->p_offset, left = phdr->p_filesz;
+	u64 namesz, descsz;
+	Elf64_Nhdr nhdr;
+	char name[4];
+	int ret;
+
+	while (left >= sizeof(nhdr)) {
+		ret = elf_read(elf, &nhdr, sizeof(nhdr), pos);
+		if (ret)
+			return ret;
+		pos += sizeof(nhdr);
+		left -= sizeof(nhdr);
+
+		namesz = ALIGN((u64)nhdr.n_namesz, align);
+		descsz = ALIGN((u64)nhdr.n_descsz, align);
+		if (namesz > left || descsz > left - namesz)
+			return 0;
+
+		if (nhdr.n_type == NT_GNU_BUILD_ID &&
+		    nhdr.n_namesz == sizeof(name) && nhdr.n_descsz) {
+			ret = elf_read(elf, name, sizeof(name), pos);
+			if (ret)
+				return ret;
+			if (memcmp(name, "GNU", sizeof(name)) == 0) {
+				ret = elf_read(elf, id,
+					       min_t(size_t, nhdr.n_descsz, size),
+					       pos + namesz);
+				return ret ? ret : (int)nhdr.n_descsz;
+			}
+		}
+
+		pos += namesz + descsz;
+		left -= namesz + descsz;
+	}
+
+	return 0;
+}
+
+int speed_bump_elf_build_id(struct speed_bump_elf *elf, u8 *id, size_t size)
+{
+	int i, ret;
+
+	for (i = 0; i < elf->ehdr.e_phnum; i++) {
+		if (elf->phdrs[i].p_type != PT_NOTE)
+			continue;
+
+		ret = elf_segment_build_id(elf, &elf->phdrs[i], id, size);
+		if (ret)
+			return ret;
+	}
+
+	return -ENODATA;
+}
+
+int speed_bump_elf_open(struct speed_bump_elf **elfp,
+			speed_bump_elf_read_t read, void *ctx)
+{
+	struct speed_bump_elf *elf;
+	const Elf64_Shdr *sec;
+	int i, ret;
+
+	elf = kzalloc(sizeof(*elf), GFP_KERNEL);
+	if (!elf)
+		return -ENOMEM;
+
+	elf->read = read;
+	elf->ctx = ctx;
+	elf->symtab = elf->dynsym = elf->gnu_hash = elf->sysv_hash = -1;
+
+	ret = elf_read(elf, &elf->ehdr, sizeof(elf->ehdr), 0);
+	if (ret)
+		goto err;
+
+	/* Verify ELF magic; only 64-bit ELF is supported */
+	ret = -ENOEXEC;
+	if (memcmp(elf->ehdr.e_ident, ELFMAG, SELFMAG) != 0 ||
+	    elf->ehdr.e_ident[EI_CLASS] != ELFCLASS64)
+		goto err;
+
+	/* Program headers map symbol addresses to file offsets */
+	if (elf->ehdr.e_phnum == 0 ||
+	    elf->ehdr.e_phentsize != sizeof(Elf64_Phdr))
+		goto err;
+
+	ret = -ENOMEM;
+	elf->phdrs = kmalloc_array(elf->ehdr.e_phnum, sizeof(*elf->phdrs),
+				   GFP_KERNEL);
+	if (!elf->phdrs)
+		goto err;
+
+	ret = elf_read(elf, elf->phdrs,
+		       elf->ehdr.e_phnum * sizeof(*elf->phdrs),
+		       elf->ehdr.e_phoff);
+	if (ret)
+		goto err;
+
+	/* No section headers (e.g. fully stripped): nothing to look up */
+	if (elf->ehdr.e_shnum == 0) {
+		*elfp = elf;
+		return 0;
+	}
+
+	ret = -ENOEXEC;
+	if (elf->ehdr.e_shentsize != sizeof(Elf64_Shdr))
+		goto err;
+
+	ret = -ENOMEM;
+	elf->shdrs = kmalloc_array(elf->ehdr.e_shnum, sizeof(*elf->shdrs),
+				   GFP_KERNEL);
+	if (!elf->shdrs)
+		goto err;
+
+	ret = elf_read(elf, elf->shdrs,
+		       elf->ehdr.e_shnum * sizeof(*elf->shdrs),
+		       elf->ehdr.e_shoff);
+	if (ret)
+		goto err;
+
+	for (i = 0; i < elf->ehdr.e_shnum; i++) {
+		sec = &elf->shdrs[i];
+		if (sec->sh_type == SHT_SYMTAB && elf->symtab < 0 &&
+		    elf_symsec_valid(elf, i))
+			elf->symtab = i;
+		else if (sec->sh_type == SHT_DYNSYM && elf->dynsym < 0 &&
+			 elf_symsec_valid(elf, i))
+			elf->dynsym = i;
+	}
+
+	/* Hash tables are only useful for the .dynsym they index */
+	for (i = 0; i < elf->ehdr.e_shnum && elf->dynsym >= 0; i++) {
+		sec = &elf->shdrs[i];
+		if (sec->sh_link != (u32)elf->dynsym)
+			continue;
+		if (sec->sh_type == SHT_GNU_HASH && elf->gnu_hash < 0)
+			elf->gnu_hash = i;
+		/* Some 64-bit ABIs use 8-byte .hash entries; skip those */
+		else if (sec->sh_type == SHT_HASH && elf->sysv_hash < 0 &&
+			 (sec->sh_entsize == 0 || sec->sh_entsize == sizeof(u32)))
+			elf->sysv_hash = i;
+	}
+
+	*elfp = elf;
+	return 0;
+
+err:
+	kfree(elf->shdrs);
+	kfree(elf->phdrs);
+	kfree(elf);
+	return ret;
+}
+
+void speed_bump_elf_close(struct speed_bump_elf *elf)
+{
+	if (!elf)
+		return;
+	kfree(elf->shdrs);
+	kfree(elf->phdrs);
+	kfree(elf);
+}
+
+int speed_bump_elf_lookup(struct speed_bump_elf *elf, const char *symbol,
+			  loff_t *offset)
+{
+	Elf64_Sym sym;
+	size_t len = strlen(symbol);
+	int ret = -ENOENT;
+
+	if (len == 0 || len >= SPEED_BUMP_MAX_SYMBOL_LEN)
+		return -ENOENT;
+
+	/* Exported symbols: hashed .dynsym lookup, O(chain length) */
+	if (elf->gnu_hash >= 0)
+		ret = elf_gnu_hash_lookup(elf, symbol, len, &sym);
+	else if (elf->sysv_hash >= 0)
+		ret = elf_sysv_hash_lookup(elf, symbol, len, &sym);
+	else if (elf->dynsym >= 0)
+		ret = elf_scan_lookup(elf, elf->dynsym, symbol, &sym);
+
+	/* Local and static symbols: stream .symtab */
+	if (ret == -ENOENT && elf->symtab >= 0)
+		ret = elf_scan_lookup(elf, elf->symtab, symbol, &sym);
+
+	if (ret)
+		return ret;
+
+	if (!elf_sym_is_code_type(&sym))
+		return -ENOENT;
+
+	return elf_vaddr_to_offset(elf, sym.st_value, offset);
+}
@@ -0,0 +1,91 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Speed Bump - Log2 Latency Histograms
+ *
+ * Fixed-size power-of-two histograms: recording is one fls64() and an
+ * increment, so the uretprobe handler can keep one per CPU per target
+ * and readers merge them.
+ */
+
+#ifdef MOCK_KERNEL
+#include "mock_kernel.h"
+#else
+#include <linux/types.h>
+#include <linux/bitops.h>
+#include <linux/math64.h>
+#include <linux/compiler.h>
+#include <linux/export.h>
+#endif
+
+#include "speed_bump.h"
+
+unsigned int speed_bump_hist_bucket(u64 ns)
+{
+    unsigned int bucket;
+
+    /* fls64() is 0 for 0 and 1 for 1: both land in bucket 0 */
+    bucket = ns ? fls64(ns) - 1 : 0;
+
+    return bucket < SPEED_BUMP_HIST_BUCKETS ? bucket : SPEED_BUMP_HIST_BUCKETS - 1;
+}
+
+u64 speed_bump_hist_bucket_lo(unsigned int bucket)
+{
+    return bucket ? 1ULL << bucket : 0;
+}
+
+void speed_bump_hist_record(struct speed_bump_hist *hist, u64 ns)
+{
+    hist->count++;
+    hist->sum_ns += ns;
+    hist->buckets[speed_bump_hist_bucket(ns)]++;
+}
+
+/*
+ * @src may be a per-CPU copy that is still being recorded into; each
+ * field is read once, so a concurrent sample is either in or out.
+ */
+void speed_bump_hist_merge(struct speed_bump_hist *dst,
+                           const struct speed_bump_hist *src)
+{
+    unsigned int i;
+
+    dst->count += READ_ONCE(src->count);
+    dst->sum_ns += READ_ONCE(src->sum_ns);
+    for (i = 0; i < SPEED_BUMP_HIST_BUCKETS; i++)
+        dst->buckets[i] += READ_ONCE(src->buckets[i]);
+}
+
+u64 speed_bump_hist_percentile(const struct speed_bump_hist *hist,
+                               unsigned int pct)
+{
+    u64 total = 0, rank, seen = 0;
+    unsigned int i;
+
+    /* Rank from the buckets, not count: a merge may be mid-update */
+    for (i = 0; i < SPEED_BUMP_HIST_BUCKETS; i++)
+        total += hist->buckets[i];
+    if (total == 0)
+        return 0;
+
+    if (pct > 100)
+        pct = 100;
+    rank = div64_u64(total * pct + 99, 100);
+    if (rank == 0)
+        rank = 1;
+
+    for (i = 0; i < SPEED_BUMP_HIST_BUCKETS - 1; i++) {
+        seen += hist->buckets[i];
+        if (seen >= rank)
+            return speed_bump_hist_bucket_lo(i + 1);
+    }
+
+    return speed_bump_hist_bucket_lo(SPEED_BUMP_HIST_BUCKETS);
+}
+
+#ifndef MOCK_KERNEL
+EXPORT_SYMBOL_GPL(speed_bump_hist_bucket);
+EXPORT_SYMBOL_GPL(speed_bump_hist_record);
+EXPORT_SYMBOL_GPL(speed_bump_hist_merge);
+EXPORT_SYMBOL_GPL(speed_bump_hist_percentile);
+#endif
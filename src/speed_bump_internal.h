@@ -14,6 +14,11 @@
 #include <linux/atomic.h>
 #include <linux/uprobes.h>
 #include <linux/percpu.h>
+#include <linux/cache.h>
+#include <linux/rcupdate.h>
+#include <linux/workqueue.h>
+#include <linux/wait.h>
+#include <linux/hrtimer.h>
 
 #include "speed_bump.h"
 
@@ -21,21 +26,149 @@
  * Target Management Structure
  * ============================================================ */
 
+/*
+ * Per-CPU hit statistics for one target. Each CPU only ever writes its
+ * own copy, so the handler never bounces a shared cacheline; readers
+ * sum across CPUs.
+ */
+struct speed_bump_target_stats {
+	u64 hits;
+	u64 delay_ns;
+	u64 actual_ns;    /* measured length of the delays counted in delay_ns */
+	u64 skipped;      /* hits left undelayed by every= or prob= */
+	u64 throttled;    /* hits left undelayed by a delay budget */
+	u32 every_count;  /* hits since the last delayed one, for every= */
+	struct speed_bump_budget_cpu budget;  /* this CPU's share of target->budget */
+};
+
+/* Targets registered together by one wildcard add (speed_bump_main.c) */
+struct speed_bump_group;
+
+/* Named set of targets switched on and off as one (speed_bump_main.c) */
+struct speed_bump_profile;
+
+/* The targets at one probed address, under one consumer (speed_bump_uprobe.c) */
+struct speed_bump_site;
+
+/*
+ * The settings of a target that an update can change. A config is
+ * never written once published: an update copies it, edits the copy
+ * and swaps target->config with rcu_assign_pointer(), so a handler
+ * sees all of the old settings or all of the new ones, never a mix.
+ * The cgroup reference is dropped with the config, after a grace
+ * period, so a handler may test against it under rcu_read_lock().
+ */
+struct speed_bump_target_config {
+	u64 delay_ns;
+	pid_t pid_filter;  /* 0 = no filter (probe all), >0 = filter to this PID + descendants */
+	struct cgroup *cgroup;  /* NULL = no filter, else only tasks under this v2 cgroup (holds a ref) */
+	enum speed_bump_delay_mode mode;
+	u32 scale_pct;     /* 0 = off, else delay each call by this % of its duration */
+	u32 every;         /* delay one hit in this many per CPU, 0 or 1 = all */
+	u32 prob_ppm;      /* chance a hit is delayed, SPEED_BUMP_PROB_ONE = always */
+	enum speed_bump_dist dist;  /* delay_ns is the mean unless FIXED */
+	u32 sigma_milli;   /* lognormal shape, in thousandths */
+	u64 max_ns;        /* bound on a sampled delay, 0 = SPEED_BUMP_MAX_DELAY_NS */
+	struct cpumask *cpus;  /* NULL = all CPUs, else delay only hits on these */
+	struct rcu_head rcu;
+};
+
+/* A target's counters as a sweep step began (speed_bump_main.c) */
+struct speed_bump_sweep_mark {
+	u64 time_ns;    /* CLOCK_MONOTONIC */
+	u64 hits;
+	u64 delay_ns;   /* total_delay_ns */
+	u64 actual_ns;  /* total_actual_ns */
+};
+
+/*
+ * A sweep= schedule, stepped by its hrtimer from the add onwards. While
+ * it runs its delay replaces the config's; an update that sets a delay
+ * stops it. Each step begun, and the end of the last, leaves a mark.
+ */
+struct speed_bump_sweep {
+	u64 delay_ns;            /* current step's delay, read by the handler */
+	bool stopped;            /* ended by an update, read by the handler */
+	unsigned int nr_steps;
+	unsigned int nr_marks;   /* published with smp_store_release() */
+	struct hrtimer timer;
+	struct speed_bump_target *target;
+	struct speed_bump_sweep_step *steps;
+	struct speed_bump_sweep_mark marks[];  /* nr_steps + 1 */
+};
+
+/*
+ * Where a target's registration stands. An async add leaves the target
+ * PENDING while a worker resolves and registers it without
+ * speed_bump_mutex; until the worker is done it alone touches the
+ * offset, site and site_slot fields.
+ */
+enum speed_bump_target_state {
+	SPEED_BUMP_TARGET_ACTIVE,
+	SPEED_BUMP_TARGET_PENDING,
+	SPEED_BUMP_TARGET_FAILED,  /* error holds why; removed like any target */
+};
+
 struct speed_bump_target {
+	/*
+	 * Fields read by the uprobe handler on every hit. They are fixed
+	 * at add time or replaced whole through @config, so they stay
+	 * clean in every CPU's cache; the counters live in per-CPU memory
+	 * instead.
+	 */
+	struct speed_bump_target_config __rcu *config;
+	struct speed_bump_target_stats __percpu *stats;
+	struct speed_bump_hist __percpu *latency;  /* entry->return times, NULL = not measured */
+	struct speed_bump_hist __percpu *overshoot;  /* actual - requested delay, NULL = not kept */
+	struct speed_bump_sweep *sweep;  /* delay schedule, NULL = none */
+	bool ret_probe;    /* registered with a return handler (latency or scale) */
+	bool exited;       /* autoremove: the filtered process is gone, awaiting removal */
+	unsigned int profile_id;  /* 0 = always live, else only while that profile is active */
+
+	/* Written by the first hit of each slice, kept off the lines above */
+	struct speed_bump_budget budget ____cacheline_aligned;
+
 	struct list_head list;
+	struct hlist_node hnode;   /* in the PATH:SYMBOL hash */
+	struct hlist_node id_node; /* in the id hash */
 	char path[SPEED_BUMP_MAX_PATH_LEN];
 	char symbol[SPEED_BUMP_MAX_SYMBOL_LEN];
-	u64 delay_ns;
-	pid_t pid_filter;  /* 0 = no filter (probe all), >0 = filter to this PID + descendants */
+	char rule[SPEED_BUMP_MAX_RULE_LEN];  /* "" = the unnamed rule */
+	u8 build_id[SPEED_BUMP_MAX_BUILD_ID];  /* buildid= the binary must carry */
+	unsigned int build_id_len;      /* 0 = not checked */
 	loff_t offset;
-	atomic64_t hit_count;
-	atomic64_t total_delay_ns;
-	struct inode *inode;
-	struct uprobe *uprobe;
-	struct uprobe_consumer uc;
-	bool registered;
+	loff_t inner;                   /* SYMBOL+OFF: added to SYMBOL's offset */
+	struct speed_bump_site *site;  /* registered as one of its rules, or NULL */
+	struct list_head site_node;    /* in site->rules */
+	unsigned int site_slot;        /* index in site->slots */
+	struct speed_bump_group *group;  /* wildcard add it came from, or NULL */
+	struct speed_bump_profile *profile;  /* profile it is staged in, or NULL */
+	unsigned int id;   /* never reused while the module is loaded */
+	enum speed_bump_target_state state;  /* under speed_bump_mutex */
+	int error;         /* negative errno of a FAILED registration */
+	bool cancelled;    /* removed while PENDING, the worker frees it */
+	struct work_struct register_work;
+	struct pid *exit_pid;  /* autoremove: the process watched, or NULL */
+	struct wait_queue_entry exit_wait;  /* on exit_pid's pidfd waitqueue */
 };
 
+/*
+ * The delay hits of @target get now: the current step of a running
+ * sweep, which its timer moves on without replacing the config, else
+ * @config's.
+ */
+static inline u64
+speed_bump_target_delay_ns(const struct speed_bump_target *target,
+			   const struct speed_bump_target_config *config)
+{
+	const struct speed_bump_sweep *sweep = target->sweep;
+
+	if (sweep && !READ_ONCE(sweep->stopped))
+		return READ_ONCE(sweep->delay_ns);
+
+	return config->delay_ns;
+}
+
 /* ============================================================
  * Global State (defined in speed_bump_main.c)
  * ============================================================ */
@@ -44,9 +177,42 @@ extern struct list_head speed_bump_targets;
 extern struct mutex speed_bump_mutex;
 extern atomic_t speed_bump_enabled;
 
+/* Id of the active profile, 0 = none. Written under speed_bump_mutex. */
+extern unsigned int speed_bump_active_profile;
+
 /* Per-CPU counters for global statistics */
 DECLARE_PER_CPU(u64, speed_bump_hits_percpu);
 DECLARE_PER_CPU(u64, speed_bump_delay_percpu);
+DECLARE_PER_CPU(u64, speed_bump_actual_percpu);
+DECLARE_PER_CPU(u64, speed_bump_throttled_percpu);
+
+/* Cap on the delay injected across all targets (budget_ns_per_s) */
+extern struct speed_bump_budget speed_bump_budget;
+DECLARE_PER_CPU(struct speed_bump_budget_cpu, speed_bump_budget_percpu);
+
+/* Watchers of the control device waiting for hits, see below */
+extern wait_queue_head_t speed_bump_watch_wait;
+extern u32 speed_bump_watch_quantum;
+DECLARE_PER_CPU(u32, speed_bump_watch_count);
+
+/*
+ * Count a hit towards the hit threshold of control device watchers.
+ * Every speed_bump_watch_quantum hits on a CPU wake them to compare
+ * the total with their thresholds; with no threshold set this is one
+ * read of a global that rarely changes.
+ */
+static inline void speed_bump_watch_hit(void)
+{
+	u32 quantum = READ_ONCE(speed_bump_watch_quantum);
+
+	if (likely(!quantum) ||
+	    this_cpu_inc_return(speed_bump_watch_count) < quantum)
+		return;
+
+	this_cpu_write(speed_bump_watch_count, 0);
+	if (wq_has_sleeper(&speed_bump_watch_wait))
+		wake_up_interruptible(&speed_bump_watch_wait);
+}
 
 /* ============================================================
  * Uprobe Functions (defined in speed_bump_uprobe.c)
@@ -54,20 +220,141 @@ DECLARE_PER_CPU(u64, speed_bump_delay_percpu);
 
 /*
  * Register a uprobe for a target.
- * Resolves the symbol, sets up the uprobe consumer, and registers with kernel.
+ * Checks the binary's build ID if the target has a buildid=, resolves
+ * the symbol (unless target->offset is already set) and adds the
+ * target as the last rule of the probe site at that address,
+ * registering the site's uprobe consumer if it is the first.
+ *
+ * Caller must hold speed_bump_mutex, or be the register work of an
+ * async add.
+ *
+ * Returns: 0 on success, -ENOSPC if the site already has
+ *          SPEED_BUMP_MAX_SITE_RULES rules, -ESTALE if the binary's
+ *          build ID is not the target's, other negative error code
+ *          on failure
+ */
+int speed_bump_register_uprobe(struct speed_bump_target *target);
+
+/*
+ * Re-apply the consumer filter of a target's site after its pid or
+ * cgroup filter changed.
+ * Installs the breakpoint in newly matching processes and removes it
+ * from processes that no longer match.
  *
  * Caller must hold speed_bump_mutex.
  *
  * Returns: 0 on success, negative error code on failure
  */
-int speed_bump_register_uprobe(struct speed_bump_target *target);
+int speed_bump_apply_uprobe_filter(struct speed_bump_target *target);
 
 /*
  * Unregister a uprobe for a target.
- * Unregisters the uprobe and releases resources.
+ * Removes the target from its site, unregistering the site's consumer
+ * with the last rule, and waits for running handlers.
  *
  * Caller must hold speed_bump_mutex.
  */
 void speed_bump_unregister_uprobe(struct speed_bump_target *target);
 
+/*
+ * First half of a batched unregister: detach the target from its site
+ * but do not wait for running handlers. The target must stay allocated until
+ * speed_bump_unregister_uprobe_sync() has returned.
+ *
+ * Caller must hold speed_bump_mutex.
+ */
+void speed_bump_unregister_uprobe_nosync(struct speed_bump_target *target);
+
+/*
+ * Second half of a batched unregister: wait once for the handlers of
+ * every consumer detached with speed_bump_unregister_uprobe_nosync().
+ */
+void speed_bump_unregister_uprobe_sync(void);
+
+/* ============================================================
+ * Symbol Index Cache (defined in speed_bump_symcache.c)
+ * ============================================================ */
+
+/*
+ * Register the cache shrinker. Called once from module init.
+ *
+ * Returns: 0 on success, negative error code on failure
+ */
+int speed_bump_symcache_init(void);
+
+/*
+ * Unregister the shrinker and free every cached index.
+ */
+void speed_bump_symcache_exit(void);
+
+/*
+ * Resolve @symbol in the binary at @path (whose inode is @inode) to a
+ * file offset. Served from the inode's cached index when it is still
+ * valid; otherwise the file is parsed and its index cached.
+ *
+ * Returns: 0 on success, -ENOENT if the symbol is not code in this
+ *          binary, -ESTALE if @path no longer refers to @inode, or
+ *          another negative error code
+ */
+int speed_bump_symcache_lookup(struct inode *inode, const char *path,
+			       const char *symbol, loff_t *offset);
+
+/*
+ * Call @fn for every code symbol in the binary at @path (whose inode is
+ * @inode), building and caching its index on a miss. A symbol present
+ * in both .dynsym and .symtab is reported twice.
+ *
+ * @fn runs with the cache lock held: it may allocate but must not call
+ * back into the cache.
+ *
+ * Returns: 0 if all symbols were visited, the callback's non-zero
+ *          return value if it stopped the walk, or negative error code
+ */
+int speed_bump_symcache_for_each(struct inode *inode, const char *path,
+				 speed_bump_elf_sym_fn fn, void *data);
+
+/*
+ * Check that the binary at @path (whose inode is @inode) carries the
+ * GNU build ID @id of @len bytes.
+ *
+ * Returns: 0 if it does, -ESTALE if its build ID differs or @path no
+ *          longer refers to @inode, -ENODATA if it has no build ID, or
+ *          another negative error code
+ */
+int speed_bump_symcache_check_build_id(struct inode *inode, const char *path,
+				       const u8 *id, unsigned int len);
+
+/*
+ * Report the number of cached indexes and the memory they use.
+ */
+void speed_bump_symcache_stats(unsigned int *files, unsigned long *bytes);
+
+/* ============================================================
+ * Per-Task Delay Accounting (defined in speed_bump_task.c)
+ * ============================================================ */
+
+struct speed_bump_task_stats;
+
+/*
+ * Add @hits and an injected delay (@delay_ns as requested, @actual_ns as
+ * measured) to the accounts of current and of its process. Called from
+ * the probe handlers; does not sleep.
+ */
+void speed_bump_task_account(u64 hits, u64 delay_ns, u64 actual_ns);
+
+/*
+ * Fill in the thread and process accounts of @stats->tid, or of current
+ * if it is 0, zeroing them as they are read if @reset. A thread outside
+ * the caller's process takes ptrace read access or CAP_SYS_ADMIN.
+ *
+ * Returns: 0 on success, -ESRCH if there is no such thread, -EPERM if
+ * the caller may not read it
+ */
+int speed_bump_task_stats(struct speed_bump_task_stats *stats, bool reset);
+
+/*
+ * Free every account. Called from module exit, once no handler can run.
+ */
+void speed_bump_task_exit(void);
+
 #endif /* SPEED_BUMP_INTERNAL_H */
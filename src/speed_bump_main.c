@@ -8,13 +8,37 @@
  *   enabled         - RW: "0" or "1" - globally enable/disable all probes
  *   targets         - WO: Write commands to add/remove targets
  *   targets_list    - RO: Read current targets, one per line
+ *   groups          - RO: Read wildcard groups, one per line
+ *   latency         - RO: Read entry->return histograms of latency=1 targets
+ *   overshoot       - RO: Read delay overshoot histograms of overshoot=1 targets
  *   stats           - RO: Read hit counts and timing statistics
  *   default_delay_ns - RW: Default delay if not specified per-target
+ *   budget_ns_per_s - RW: Cap on delay injected per second, all targets
+ *   profile         - RW: Name of the active profile, or "none"
+ *   profiles        - RO: Read staged profiles, one per line
+ *
+ * debugfs (/sys/kernel/debug/speed_bump/):
+ *   targets         - RO: targets_list without the page size limit
+ *   latency         - RO: latency without the page size limit
+ *   overshoot       - RO: overshoot without the page size limit
+ *   sweeps          - RO: Step boundaries of sweep= targets
+ *   stats.bin       - RO: Binary per-target and per-CPU counters
+ *
+ * Control device (/dev/speed_bump, any user may open it):
+ *   SPEED_BUMP_IOC_BATCH - add/update/remove an array of targets, see
+ *                          speed_bump_uapi.h (CAP_SYS_ADMIN)
+ *   SPEED_BUMP_IOC_TASK_STATS - delay injected into a thread and its
+ *                               process (own process, or ptrace access)
+ *   SPEED_BUMP_IOC_WATCH - hit threshold for poll() and read() of events
+ *                          (CAP_SYS_ADMIN for a non-zero threshold)
  *
  * Target Command Format:
- *   Add:    +PATH:SYMBOL [DELAY_NS]
- *   Remove: -PATH:SYMBOL or -* (remove all)
- *   Update: =PATH:SYMBOL DELAY_NS
+ *   Add:    +PATH:SYMBOL [DELAY_NS] [KEY=VALUE...]
+ *   Remove: -PATH:SYMBOL [rule=NAME] [profile=NAME], -@NAME (a profile)
+ *           or -* (all)
+ *   Update: =PATH:SYMBOL DELAY_NS [KEY=VALUE...]
+ *   SYMBOL may be SYMBOL+0xOFF, and PATH:SYMBOL may be PATH@0xOFF (a
+ *   file offset, no symbol lookup).
  *
  * See docs/interface-spec.md for full specification.
  */
@@ -29,9 +53,33 @@
 #include <linux/sysfs.h>
 #include <linux/string.h>
 #include <linux/ctype.h>
+#include <linux/hashtable.h>
+#include <linux/jhash.h>
+#include <linux/fs.h>
+#include <linux/namei.h>
+#include <linux/overflow.h>
+#include <linux/version.h>
+#include <linux/math64.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/mm.h>
+#include <linux/miscdevice.h>
+#include <linux/uaccess.h>
+#include <linux/workqueue.h>
+#include <linux/wait.h>
+#include <linux/poll.h>
+#include <linux/pid.h>
+#include <linux/pid_namespace.h>
+#include <linux/sched.h>
+#include <linux/sched/signal.h>
+#include <linux/cgroup.h>
+#include <linux/cpumask.h>
+#include <linux/nodemask.h>
+#include <linux/topology.h>
 
 #include "speed_bump.h"
 #include "speed_bump_internal.h"
+#include "speed_bump_uapi.h"
 
 /* Module metadata */
 MODULE_LICENSE("GPL");
@@ -50,384 +98,2326 @@ static struct kobject *speed_bump_kobj;
 LIST_HEAD(speed_bump_targets);
 DEFINE_MUTEX(speed_bump_mutex);
 atomic_t speed_bump_enabled = ATOMIC_INIT(0);
+unsigned int speed_bump_active_profile;
 
 /* Per-CPU counters - no explicit init needed, zero-initialised */
 DEFINE_PER_CPU(u64, speed_bump_hits_percpu);
 DEFINE_PER_CPU(u64, speed_bump_delay_percpu);
+DEFINE_PER_CPU(u64, speed_bump_actual_percpu);
+DEFINE_PER_CPU(u64, speed_bump_throttled_percpu);
+
+/* Global delay budget, 0 = unlimited (exported to speed_bump_uprobe.c) */
+struct speed_bump_budget speed_bump_budget;
+DEFINE_PER_CPU(struct speed_bump_budget_cpu, speed_bump_budget_percpu);
+
+/*
+ * Wakes watchers of the control device (see Control Device Events):
+ * the handlers call speed_bump_watch_hit(), which wakes it every
+ * speed_bump_watch_quantum hits per CPU, 0 = no hit threshold.
+ */
+DECLARE_WAIT_QUEUE_HEAD(speed_bump_watch_wait);
+u32 speed_bump_watch_quantum;
+DEFINE_PER_CPU(u32, speed_bump_watch_count);
 
 /* Module-local state */
 static u64 speed_bump_default_delay = SPEED_BUMP_DEFAULT_DELAY_NS;
 static atomic_t speed_bump_target_count = ATOMIC_INIT(0);
+static unsigned int speed_bump_next_target_id = 1;  /* under speed_bump_mutex */
 
-/* ============================================================
- * Target Management
- * ============================================================ */
+/* Bumped on every change of the target set or of its state */
+static atomic_t speed_bump_watch_seq = ATOMIC_INIT(0);
+
+/* Registers the targets of async adds, see target_register_work() */
+static struct workqueue_struct *speed_bump_wq;
+
+static unsigned int max_targets = SPEED_BUMP_MAX_TARGETS;
+module_param(max_targets, uint, 0644);
+MODULE_PARM_DESC(max_targets, "Maximum number of simultaneous targets");
+
+static bool use_cycle_counter = true;
+module_param(use_cycle_counter, bool, 0444);
+MODULE_PARM_DESC(use_cycle_counter,
+		 "Time delays with the calibrated TSC/CNTVCT when stable (otherwise ktime)");
 
 /*
- * Free a target and its resources.
- * Caller must hold speed_bump_mutex.
+ * PATH:SYMBOL index over speed_bump_targets, so add/remove/update stay
+ * O(1) with thousands of targets. A target is named by PATH:SYMBOL, its
+ * rule and its profile. The list keeps insertion order for
+ * targets_list. Protected by speed_bump_mutex.
  */
-static void free_target(struct speed_bump_target *target)
+#define SPEED_BUMP_TARGET_HASH_BITS 10
+static DEFINE_HASHTABLE(speed_bump_target_hash, SPEED_BUMP_TARGET_HASH_BITS);
+
+static u32 target_key_hash(const char *path, const char *symbol,
+			   const char *rule, unsigned int profile_id)
 {
-	speed_bump_unregister_uprobe(target);
-	list_del(&target->list);
-	atomic_dec(&speed_bump_target_count);
-	kfree(target);
+	return jhash(rule, strlen(rule),
+		     jhash(symbol, strlen(symbol),
+			   jhash(path, strlen(path), profile_id)));
 }
 
+/* Target id index, for the control device. Protected by speed_bump_mutex. */
+static DEFINE_HASHTABLE(speed_bump_id_hash, SPEED_BUMP_TARGET_HASH_BITS);
+
+/*
+ * A wildcard add ("+/usr/lib64/libcuda.so:cuMem*") registers one target
+ * per matching function; the group ties them together so the same
+ * pattern removes or updates them all. A group lives as long as its
+ * last member. Protected by speed_bump_mutex.
+ */
+struct speed_bump_group {
+	struct list_head list;
+	unsigned int id;
+	unsigned int nr_targets;
+	struct speed_bump_profile *profile;
+	char rule[SPEED_BUMP_MAX_RULE_LEN];
+	char pattern[SPEED_BUMP_MAX_PATH_LEN + SPEED_BUMP_MAX_SYMBOL_LEN];
+};
+
+static LIST_HEAD(speed_bump_groups);
+static unsigned int speed_bump_next_group_id = 1;
+
+/*
+ * A profile is a complete set of targets staged under one name. Its
+ * uprobes are registered up front, but its targets only act while it
+ * is the active profile (speed_bump_active_profile), so switching from
+ * one experiment to the next is a single store instead of a remove and
+ * re-add of every target. Targets outside any profile are always live.
+ * The same PATH:SYMBOL may be staged in several profiles. A profile
+ * lives as long as its last member. Protected by speed_bump_mutex.
+ */
+struct speed_bump_profile {
+	struct list_head list;
+	unsigned int id;
+	unsigned int nr_targets;  /* plus one while a command holds it */
+	char name[SPEED_BUMP_MAX_PROFILE_LEN];
+};
+
+static LIST_HEAD(speed_bump_profiles);
+static unsigned int speed_bump_next_profile_id = 1;
+
 /* ============================================================
- * Command Parsing
+ * Target Management
  * ============================================================ */
 
 /*
- * Parse a target specification line.
- *
- * Format: PATH:SYMBOL [DELAY_NS] [pid=PID]
- *
- * Returns 0 on success, negative errno on failure.
- * On success, populates path, symbol, delay_ns, and pid_filter.
+ * Tell watchers of the control device that a target was added, removed
+ * or updated, changed state, or that enabled or the active profile
+ * changed.
  */
-static int parse_target_spec(const char *line, char *path, size_t path_len,
-			     char *symbol, size_t symbol_len, u64 *delay_ns,
-			     pid_t *pid_filter)
+static void speed_bump_watch_changed(void)
 {
-	const char *colon, *space, *pid_str;
-	size_t plen, slen;
-	int ret;
-
-	/* Validate input */
-	if (!line || !path || !symbol || !delay_ns || !pid_filter)
-		return -EINVAL;
-
-	/* Initialize pid_filter to 0 (no filter) */
-	*pid_filter = 0;
+	atomic_inc(&speed_bump_watch_seq);
+	if (wq_has_sleeper(&speed_bump_watch_wait))
+		wake_up_interruptible(&speed_bump_watch_wait);
+}
 
-	/* Find the colon separator */
-	colon = strchr(line, ':');
-	if (!colon)
-		return -EINVAL;
+/*
+ * Drop a reference to @profile, from a target or from get_profile(),
+ * and free it with the last one. An active profile that goes away
+ * leaves no profile active.
+ * Caller must hold speed_bump_mutex.
+ */
+static void put_profile(struct speed_bump_profile *profile)
+{
+	if (!profile || --profile->nr_targets)
+		return;
 
-	/* Extract path */
-	plen = colon - line;
-	if (plen == 0 || plen >= path_len)
-		return -ENAMETOOLONG;
+	if (READ_ONCE(speed_bump_active_profile) == profile->id)
+		WRITE_ONCE(speed_bump_active_profile, 0);
+	list_del(&profile->list);
+	kfree(profile);
+}
 
-	/* Path must be absolute */
-	if (line[0] != '/')
-		return -EINVAL;
+/*
+ * Whether the register work of an async add still owns @target's
+ * uprobe, in which case nothing else may register, apply or unregister
+ * it. Caller must hold speed_bump_mutex.
+ */
+static bool target_pending(const struct speed_bump_target *target)
+{
+	return target->state == SPEED_BUMP_TARGET_PENDING;
+}
 
-	memcpy(path, line, plen);
-	path[plen] = '\0';
+/*
+ * cgroup= names a cgroup v2 directory by its path from the root of the
+ * hierarchy, as /proc/PID/cgroup shows it. "/" holds every task, so it
+ * stands for no filter and resolves to NULL.
+ */
+#ifdef CONFIG_CGROUPS
+static int target_cgroup_get(const char *path, struct cgroup **cgrp)
+{
+	struct cgroup *cg;
 
-	/* Find space (optional delay and/or pid) */
-	space = strchr(colon + 1, ' ');
-	if (space) {
-		slen = space - (colon + 1);
-		if (slen == 0 || slen >= symbol_len)
-			return -ENAMETOOLONG;
+	*cgrp = NULL;
+	if (strcmp(path, "/") == 0)
+		return 0;
 
-		memcpy(symbol, colon + 1, slen);
-		symbol[slen] = '\0';
+	cg = cgroup_get_from_path(path);
+	if (IS_ERR(cg))
+		return PTR_ERR(cg);
 
-		/* Check for pid= in the remainder */
-		pid_str = strstr(space + 1, "pid=");
-		if (pid_str) {
-			/* Parse PID */
-			ret = kstrtoint(pid_str + 4, 10, pid_filter);
-			if (ret)
-				return ret;
-			if (*pid_filter < 0)
-				return -EINVAL;
-		}
+	*cgrp = cg;
+	return 0;
+}
 
-		/* Parse delay (everything between first space and pid= or end) */
-		if (pid_str && pid_str > space + 1) {
-			/* There's something before pid= - try to parse as delay */
-			char delay_buf[32];
-			size_t delay_len = pid_str - (space + 1);
-			/* Skip trailing whitespace */
-			while (delay_len > 0 && (space[delay_len] == ' ' || space[delay_len] == '\t'))
-				delay_len--;
-			if (delay_len > 0 && delay_len < sizeof(delay_buf)) {
-				memcpy(delay_buf, space + 1, delay_len);
-				delay_buf[delay_len] = '\0';
-				ret = kstrtou64(delay_buf, 10, delay_ns);
-				if (ret)
-					return ret;
-			} else {
-				*delay_ns = speed_bump_default_delay;
-			}
-		} else if (!pid_str) {
-			/* No pid=, just parse delay */
-			ret = kstrtou64(space + 1, 10, delay_ns);
-			if (ret)
-				return ret;
-		} else {
-			/* pid= is right after space, use default delay */
-			*delay_ns = speed_bump_default_delay;
-		}
+static void target_cgroup_hold(struct cgroup *cgrp)
+{
+	if (cgrp)
+		cgroup_get(cgrp);
+}
 
-		if (*delay_ns > SPEED_BUMP_MAX_DELAY_NS)
-			return -ERANGE;
-	} else {
-		slen = strlen(colon + 1);
-		/* Strip trailing newline */
-		while (slen > 0 && (colon[slen] == '\n' || colon[slen] == '\r'))
-			slen--;
+static void target_cgroup_put(struct cgroup *cgrp)
+{
+	if (cgrp)
+		cgroup_put(cgrp);
+}
 
-		if (slen == 0 || slen >= symbol_len)
-			return -ENAMETOOLONG;
+static size_t target_cgroup_format(struct cgroup *cgrp, char *buf,
+				   size_t size)
+{
+	int len;
 
-		memcpy(symbol, colon + 1, slen);
-		symbol[slen] = '\0';
+	if (size < 2)
+		return 0;
 
-		/* Use default delay */
-		*delay_ns = speed_bump_default_delay;
-	}
+	len = cgroup_path(cgrp, buf, size);
+	if (len < 0)
+		return scnprintf(buf, size, "?");
 
-	/* Validate symbol name (alphanumeric + underscore, starts with letter or _) */
-	if (symbol[0] != '_' && !isalpha(symbol[0]))
-		return -EINVAL;
+	return min_t(size_t, len, size - 1);
+}
+#else
+static int target_cgroup_get(const char *path, struct cgroup **cgrp)
+{
+	*cgrp = NULL;
+	return strcmp(path, "/") == 0 ? 0 : -EOPNOTSUPP;
+}
 
-	return 0;
+static void target_cgroup_hold(struct cgroup *cgrp)
+{
 }
 
-/*
- * Find a target by path and symbol.
- * Caller must hold speed_bump_mutex.
- */
-static struct speed_bump_target *find_target(const char *path, const char *symbol)
+static void target_cgroup_put(struct cgroup *cgrp)
 {
-	struct speed_bump_target *target;
+}
 
-	list_for_each_entry(target, &speed_bump_targets, list) {
-		if (strcmp(target->path, path) == 0 &&
-		    strcmp(target->symbol, symbol) == 0)
-			return target;
-	}
-	return NULL;
+static size_t target_cgroup_format(struct cgroup *cgrp, char *buf,
+				   size_t size)
+{
+	return 0;
 }
+#endif
 
 /*
- * Add a new target.
- * Returns 0 on success, negative errno on failure.
+ * cpus= and node= scope a target to the hits taken on some CPUs, e.g.
+ * the efficiency cores or the CPUs of a node with slow memory. The
+ * handler tests the CPU's bit in the config's mask, which an update
+ * replaces along with the config; "cpus=all" clears the scope.
+ *
+ * node=N is resolved to the CPUs of node N at the time of the add or
+ * update, and is listed as that cpus= list.
+ *
+ * Returns: 0 with *@maskp the new mask, or NULL for all CPUs, -EINVAL
+ *          for an empty list, a CPU that is not possible or a node
+ *          that is not online, -ENOMEM, or cpulist_parse()'s error
  */
-static int add_target(const char *spec)
+static int target_cpus_get(const char *list, int node, bool by_node,
+			   struct cpumask **maskp)
 {
-	struct speed_bump_target *target;
-	char path[SPEED_BUMP_MAX_PATH_LEN];
-	char symbol[SPEED_BUMP_MAX_SYMBOL_LEN];
-	u64 delay_ns;
-	pid_t pid_filter;
+	struct cpumask *mask;
 	int ret;
 
-	ret = parse_target_spec(spec, path, sizeof(path),
-				symbol, sizeof(symbol), &delay_ns, &pid_filter);
-	if (ret)
-		return ret;
+	*maskp = NULL;
+	if (!by_node && strcmp(list, "all") == 0)
+		return 0;
 
-	mutex_lock(&speed_bump_mutex);
+	if (by_node && (node < 0 || node >= nr_node_ids || !node_online(node)))
+		return -EINVAL;
 
-	/* Check for duplicate */
-	if (find_target(path, symbol)) {
-		ret = -EEXIST;
-		goto out_unlock;
-	}
+	mask = kzalloc(cpumask_size(), GFP_KERNEL);
+	if (!mask)
+		return -ENOMEM;
 
-	/* Check max targets */
-	if (atomic_read(&speed_bump_target_count) >= SPEED_BUMP_MAX_TARGETS) {
-		ret = -ENOSPC;
-		goto out_unlock;
+	if (by_node) {
+		cpumask_copy(mask, cpumask_of_node(node));
+	} else {
+		ret = cpulist_parse(list, mask);
+		if (ret) {
+			kfree(mask);
+			return ret;
+		}
 	}
 
-	/* Allocate and initialize target */
-	target = kzalloc(sizeof(*target), GFP_KERNEL);
-	if (!target) {
-		ret = -ENOMEM;
-		goto out_unlock;
+	if (cpumask_empty(mask) || !cpumask_subset(mask, cpu_possible_mask)) {
+		kfree(mask);
+		return -EINVAL;
 	}
 
-	strscpy(target->path, path, sizeof(target->path));
-	strscpy(target->symbol, symbol, sizeof(target->symbol));
-	target->delay_ns = delay_ns;
-	target->pid_filter = pid_filter;
-	atomic64_set(&target->hit_count, 0);
-	atomic64_set(&target->total_delay_ns, 0);
-	INIT_LIST_HEAD(&target->list);
+	*maskp = mask;
+	return 0;
+}
 
-	/* Register uprobe */
-	ret = speed_bump_register_uprobe(target);
-	if (ret) {
-		kfree(target);
-		goto out_unlock;
-	}
+/* Copy of the scope of a config being updated, NULL staying NULL */
+static int target_cpus_dup(const struct cpumask *mask,
+			   struct cpumask **maskp)
+{
+	*maskp = NULL;
+	if (!mask)
+		return 0;
 
-	/* Add to list */
-	list_add_tail(&target->list, &speed_bump_targets);
-	atomic_inc(&speed_bump_target_count);
+	*maskp = kmemdup(mask, cpumask_size(), GFP_KERNEL);
+	return *maskp ? 0 : -ENOMEM;
+}
 
-	if (pid_filter)
-		pr_info("speed_bump: added target %s:%s delay=%llu ns pid=%d\n",
-			path, symbol, delay_ns, pid_filter);
-	else
-		pr_info("speed_bump: added target %s:%s delay=%llu ns\n",
-			path, symbol, delay_ns);
+/* Free a config along with the cgroup reference and CPU mask it holds */
+static void target_config_free(struct speed_bump_target_config *config)
+{
+	if (!config)
+		return;
 
-out_unlock:
-	mutex_unlock(&speed_bump_mutex);
-	return ret;
+	target_cgroup_put(config->cgroup);
+	kfree(config->cpus);
+	kfree(config);
 }
 
-/*
- * Remove a target by path and symbol, or remove all targets.
- */
-static int remove_target(const char *spec)
+static void target_config_free_rcu(struct rcu_head *rcu)
 {
-	struct speed_bump_target *target, *tmp;
-	const char *colon;
-	char path[SPEED_BUMP_MAX_PATH_LEN];
-	char symbol[SPEED_BUMP_MAX_SYMBOL_LEN];
-	size_t plen, slen;
-	int removed = 0;
+	target_config_free(container_of(rcu, struct speed_bump_target_config,
+					rcu));
+}
 
-	/* Check for remove-all */
-	if (spec[0] == '*' && (spec[1] == '\0' || spec[1] == '\n')) {
-		mutex_lock(&speed_bump_mutex);
-		list_for_each_entry_safe(target, tmp, &speed_bump_targets, list) {
-			free_target(target);
-			removed++;
-		}
-		mutex_unlock(&speed_bump_mutex);
-		pr_info("speed_bump: removed all %d targets\n", removed);
-		return 0;
-	}
+static void target_sweep_free(struct speed_bump_sweep *sweep);
 
-	/* Parse path:symbol */
-	colon = strchr(spec, ':');
-	if (!colon)
-		return -EINVAL;
+/* Free the memory of a target whose uprobe is unregistered */
+static void release_target(struct speed_bump_target *target)
+{
+	target_sweep_free(target->sweep);
+	free_percpu(target->stats);
+	free_percpu(target->latency);
+	free_percpu(target->overshoot);
+	/* No handler is left to read it once the uprobe is unregistered */
+	target_config_free(rcu_access_pointer(target->config));
+	kfree(target);
+}
 
-	plen = colon - spec;
-	if (plen == 0 || plen >= sizeof(path))
-		return -ENAMETOOLONG;
+/*
+ * An autoremove target watches the process its pid= names through the
+ * waitqueue that wakes pidfd pollers when a process exits. The wakeup
+ * runs in the exiting task with locks held, so it only marks the target
+ * for the handler to skip and leaves the removal to
+ * speed_bump_reap_work. A crashed run therefore stops delaying at once,
+ * and a recycled PID never inherits the breakpoint.
+ */
 
-	memcpy(path, spec, plen);
-	path[plen] = '\0';
+static void target_reap_work(struct work_struct *work);
+static DECLARE_WORK(speed_bump_reap_work, target_reap_work);
 
-	slen = strlen(colon + 1);
-	/* Strip trailing newline */
-	while (slen > 0 && (colon[slen] == '\n' || colon[slen] == '\r'))
-		slen--;
+/*
+ * Whether the process @pid names has exited: no task left, or a group
+ * leader that is exiting with no other thread. Called from the pidfd
+ * wakeup as well, so it must not sleep.
+ */
+static bool target_process_gone(struct pid *pid)
+{
+	struct task_struct *task;
+	bool gone;
 
-	if (slen == 0 || slen >= sizeof(symbol))
-		return -ENAMETOOLONG;
+	rcu_read_lock();
+	task = pid_task(pid, PIDTYPE_TGID);
+	gone = !task || ((task->flags & PF_EXITING) && thread_group_empty(task));
+	rcu_read_unlock();
 
-	memcpy(symbol, colon + 1, slen);
-	symbol[slen] = '\0';
+	return gone;
+}
 
-	mutex_lock(&speed_bump_mutex);
+static int target_exit_wake(struct wait_queue_entry *wait, unsigned int mode,
+			    int sync, void *key)
+{
+	struct speed_bump_target *target =
+		container_of(wait, struct speed_bump_target, exit_wait);
 
-	target = find_target(path, symbol);
-	if (!target) {
-		mutex_unlock(&speed_bump_mutex);
-		return -ENOENT;
+	if (!READ_ONCE(target->exited) && target_process_gone(target->exit_pid)) {
+		WRITE_ONCE(target->exited, true);
+		schedule_work(&speed_bump_reap_work);
 	}
-
-	free_target(target);
-	mutex_unlock(&speed_bump_mutex);
-
-	pr_info("speed_bump: removed target %s:%s\n", path, symbol);
 	return 0;
 }
 
 /*
- * Update a target's delay.
+ * Stop watching, if @target was. On return the wakeup no longer runs
+ * for @target. Caller must hold speed_bump_mutex.
  */
-static int update_target(const char *spec)
+static void target_unwatch_exit(struct speed_bump_target *target)
 {
-	struct speed_bump_target *target;
-	char path[SPEED_BUMP_MAX_PATH_LEN];
-	char symbol[SPEED_BUMP_MAX_SYMBOL_LEN];
-	u64 delay_ns;
-	pid_t pid_filter;
-	int ret;
-
-	ret = parse_target_spec(spec, path, sizeof(path),
-				symbol, sizeof(symbol), &delay_ns, &pid_filter);
-	if (ret)
-		return ret;
+	if (!target->exit_pid)
+		return;
 
-	mutex_lock(&speed_bump_mutex);
+	remove_wait_queue(&target->exit_pid->wait_pidfd, &target->exit_wait);
+	put_pid(target->exit_pid);
+	target->exit_pid = NULL;
+}
 
-	target = find_target(path, symbol);
-	if (!target) {
-		mutex_unlock(&speed_bump_mutex);
-		return -ENOENT;
+/*
+ * Start watching process @tgid (a global PID, as pid= is) for @target.
+ * Caller must hold speed_bump_mutex.
+ * Returns 0 on success, -ESRCH if the process is already gone.
+ */
+static int target_watch_exit(struct speed_bump_target *target, pid_t tgid)
+{
+	struct pid *pid;
+
+	rcu_read_lock();
+	pid = get_pid(find_pid_ns(tgid, &init_pid_ns));
+	rcu_read_unlock();
+	if (!pid)
+		return -ESRCH;
+
+	target->exit_pid = pid;
+	init_waitqueue_func_entry(&target->exit_wait, target_exit_wake);
+	add_wait_queue(&pid->wait_pidfd, &target->exit_wait);
+
+	/* An exit before the entry was queued has no wakeup left for it */
+	if (target_process_gone(pid)) {
+		target_unwatch_exit(target);
+		return -ESRCH;
 	}
-
-	target->delay_ns = delay_ns;
-	/* Also update pid_filter if specified */
-	if (pid_filter)
-		target->pid_filter = pid_filter;
-	mutex_unlock(&speed_bump_mutex);
-
-	pr_info("speed_bump: updated target %s:%s delay=%llu ns\n",
-		path, symbol, delay_ns);
 	return 0;
 }
 
-/* ============================================================
- * Sysfs Interface
- * ============================================================ */
-
 /*
- * /sys/kernel/speed_bump/enabled
- *
- * Read/write global enable flag. When disabled (0), uprobe handlers
- * return immediately without executing delays.
+ * Free a target and its resources. A pending target is only unhooked
+ * here; its register work frees it once registration has finished.
+ * Caller must hold speed_bump_mutex.
  */
-static ssize_t enabled_show(struct kobject *kobj, struct kobj_attribute *attr,
-			    char *buf)
+static void free_target(struct speed_bump_target *target)
 {
-	return sysfs_emit(buf, "%d\n", atomic_read(&speed_bump_enabled));
-}
+	struct speed_bump_group *group = target->group;
+	struct speed_bump_profile *profile = target->profile;
 
-static ssize_t enabled_store(struct kobject *kobj, struct kobj_attribute *attr,
-			     const char *buf, size_t count)
-{
-	int val, ret;
+	hash_del(&target->hnode);
+	hash_del(&target->id_node);
+	list_del(&target->list);
+	atomic_dec(&speed_bump_target_count);
+	target_unwatch_exit(target);
+	speed_bump_watch_changed();
 
-	ret = kstrtoint(buf, 10, &val);
-	if (ret)
-		return ret;
+	if (target_pending(target)) {
+		target->group = NULL;
+		target->profile = NULL;
+		target->cancelled = true;
+	} else {
+		speed_bump_unregister_uprobe(target);
+		release_target(target);
+	}
 
-	if (val != 0 && val != 1)
-		return -EINVAL;
+	if (group && --group->nr_targets == 0) {
+		list_del(&group->list);
+		kfree(group);
+	}
 
-	atomic_set(&speed_bump_enabled, val);
-	pr_info("speed_bump: %s\n", val ? "enabled" : "disabled");
-	return count;
+	put_profile(profile);
 }
 
-static struct kobj_attribute enabled_attr =
-	__ATTR(enabled, 0644, enabled_show, enabled_store);
+/* Whether @target is in @group and @profile; NULL matches any */
+static bool target_selected(const struct speed_bump_target *target,
+			    const struct speed_bump_group *group,
+			    const struct speed_bump_profile *profile)
+{
+	return (!group || target->group == group) &&
+	       (!profile || target->profile == profile);
+}
 
 /*
- * /sys/kernel/speed_bump/targets
+ * Free every target of @group and @profile, where NULL matches any, so
+ * free_targets(NULL, NULL) frees every target. Groups and profiles go
+ * with their last member.
  *
- * Write-only: Add, remove, or update targets.
- * Format: +PATH:SYMBOL [DELAY], -PATH:SYMBOL, -*, =PATH:SYMBOL DELAY
+ * All consumers are detached first and then a single sync waits for
+ * their handlers, so a bulk teardown costs one SRCU grace period rather
+ * than one per target.
+ *
+ * Caller must hold speed_bump_mutex.
+ * Returns the number of targets freed.
  */
-static ssize_t targets_store(struct kobject *kobj, struct kobj_attribute *attr,
-			     const char *buf, size_t count)
+static int free_targets(struct speed_bump_group *group,
+			struct speed_bump_profile *profile)
 {
-	int ret;
+	struct speed_bump_target *target, *tmp;
+	int count = 0, left;
 
-	if (count == 0)
-		return -EINVAL;
+	list_for_each_entry(target, &speed_bump_targets, list) {
+		if (!target_selected(target, group, profile))
+			continue;
+		if (!target_pending(target))
+			speed_bump_unregister_uprobe_nosync(target);
+		count++;
+	}
 
-	if (count > SPEED_BUMP_MAX_LINE_LEN)
-		return -EINVAL;
+	if (!count)
+		return 0;
+
+	speed_bump_unregister_uprobe_sync();
+
+	/* Uprobes are gone; free_target() only releases memory now */
+	left = count;
+	list_for_each_entry_safe(target, tmp, &speed_bump_targets, list) {
+		if (!target_selected(target, group, profile))
+			continue;
+		free_target(target);
+		if (--left == 0)
+			break;
+	}
+
+	return count;
+}
+
+/*
+ * Sum a target's per-CPU statistics.
+ * Counters are read without synchronisation; a concurrent hit may or
+ * may not be included, which is fine for reporting.
+ */
+static void target_read_stats(struct speed_bump_target *target,
+			      u64 *hits, u64 *delay_ns, u64 *actual_ns,
+			      u64 *skipped, u64 *throttled)
+{
+	struct speed_bump_target_stats *stats;
+	int cpu;
+
+	*hits = 0;
+	*delay_ns = 0;
+	*actual_ns = 0;
+	*skipped = 0;
+	*throttled = 0;
+
+	for_each_possible_cpu(cpu) {
+		stats = per_cpu_ptr(target->stats, cpu);
+		*hits += READ_ONCE(stats->hits);
+		*delay_ns += READ_ONCE(stats->delay_ns);
+		*actual_ns += READ_ONCE(stats->actual_ns);
+		*skipped += READ_ONCE(stats->skipped);
+		*throttled += READ_ONCE(stats->throttled);
+	}
+}
+
+/*
+ * The current config of @target. Only the control plane replaces it,
+ * so under the mutex it is stable without an RCU read-side section.
+ */
+static struct speed_bump_target_config *
+target_config(const struct speed_bump_target *target)
+{
+	return rcu_dereference_protected(target->config,
+					 lockdep_is_held(&speed_bump_mutex));
+}
+
+/* Whether hits under @config may go undelayed or vary in delay */
+static bool target_is_sampled(const struct speed_bump_target_config *config)
+{
+	return config->every > 1 || config->prob_ppm < SPEED_BUMP_PROB_ONE ||
+	       config->dist != SPEED_BUMP_DIST_FIXED || config->cpus;
+}
+
+/* ============================================================
+ * Delay Sweeps
+ * ============================================================
+ *
+ * A sweep= target steps through its schedule on an hrtimer, so the
+ * step boundaries fall where the schedule puts them rather than where a
+ * control-plane write lands. Expiries are absolute, advanced by each
+ * step's duration from the add, so they do not drift either.
+ */
+
+/*
+ * Record the target's counters as mark @sweep->nr_marks. Runs in the
+ * timer callback; readers see a mark once nr_marks covers it.
+ */
+static void target_sweep_mark(struct speed_bump_sweep *sweep)
+{
+	struct speed_bump_sweep_mark *mark = &sweep->marks[sweep->nr_marks];
+	u64 skipped, throttled;
+
+	mark->time_ns = ktime_get_ns();
+	target_read_stats(sweep->target, &mark->hits, &mark->delay_ns,
+			  &mark->actual_ns, &skipped, &throttled);
+	smp_store_release(&sweep->nr_marks, sweep->nr_marks + 1);
+}
+
+/* Begin the next step, or mark the end of the last one */
+static enum hrtimer_restart target_sweep_timer(struct hrtimer *timer)
+{
+	struct speed_bump_sweep *sweep =
+		container_of(timer, struct speed_bump_sweep, timer);
+	unsigned int step = sweep->nr_marks;
+
+	/* The last delay stays in force once the schedule is over */
+	if (step < sweep->nr_steps)
+		WRITE_ONCE(sweep->delay_ns, sweep->steps[step].delay_ns);
+	target_sweep_mark(sweep);
+
+	if (step == sweep->nr_steps)
+		return HRTIMER_NORESTART;
+
+	hrtimer_add_expires_ns(timer, sweep->steps[step].duration_ns);
+	return HRTIMER_RESTART;
+}
+
+/*
+ * Parse @spec into a sweep for @target. The timer is set up but not
+ * started; target_sweep_start() does that once the target is in place.
+ * Returns 0 on success, negative errno on failure.
+ */
+static int target_sweep_alloc(struct speed_bump_target *target,
+			      const char *spec)
+{
+	struct speed_bump_sweep *sweep;
+	int nr_steps;
+
+	nr_steps = speed_bump_parse_sweep(spec, NULL);
+	if (nr_steps < 0)
+		return nr_steps;
+
+	sweep = kzalloc(struct_size(sweep, marks, nr_steps + 1), GFP_KERNEL);
+	if (!sweep)
+		return -ENOMEM;
+
+	sweep->steps = kcalloc(nr_steps, sizeof(*sweep->steps), GFP_KERNEL);
+	if (!sweep->steps) {
+		kfree(sweep);
+		return -ENOMEM;
+	}
+
+	speed_bump_parse_sweep(spec, sweep->steps);
+	sweep->nr_steps = nr_steps;
+	sweep->delay_ns = sweep->steps[0].delay_ns;
+	sweep->target = target;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,13,0)
+	hrtimer_setup(&sweep->timer, target_sweep_timer, CLOCK_MONOTONIC,
+		      HRTIMER_MODE_ABS);
+#else
+	hrtimer_init(&sweep->timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+	sweep->timer.function = target_sweep_timer;
+#endif
+
+	target->sweep = sweep;
+	return 0;
+}
+
+/* Begin the first step now */
+static void target_sweep_start(struct speed_bump_sweep *sweep)
+{
+	hrtimer_start(&sweep->timer, ktime_get(), HRTIMER_MODE_ABS);
+}
+
+/*
+ * End a sweep early, leaving its marks readable; the target's config
+ * delay applies from now on.
+ */
+static void target_sweep_stop(struct speed_bump_sweep *sweep)
+{
+	hrtimer_cancel(&sweep->timer);
+	WRITE_ONCE(sweep->stopped, true);
+}
+
+static void target_sweep_free(struct speed_bump_sweep *sweep)
+{
+	if (!sweep)
+		return;
+
+	hrtimer_cancel(&sweep->timer);
+	kfree(sweep->steps);
+	kfree(sweep);
+}
+
+/*
+ * Remove every target whose process has exited, with one sync for all
+ * of them as in free_targets().
+ */
+static void target_reap_work(struct work_struct *work)
+{
+	struct speed_bump_target *target, *tmp;
+	int count = 0;
+
+	mutex_lock(&speed_bump_mutex);
+
+	list_for_each_entry(target, &speed_bump_targets, list) {
+		if (!READ_ONCE(target->exited))
+			continue;
+		if (!target_pending(target))
+			speed_bump_unregister_uprobe_nosync(target);
+		count++;
+	}
+
+	if (count)
+		speed_bump_unregister_uprobe_sync();
+
+	list_for_each_entry_safe(target, tmp, &speed_bump_targets, list) {
+		if (!READ_ONCE(target->exited))
+			continue;
+		pr_info("speed_bump: process %d exited, removed target %s:%s\n",
+			target_config(target)->pid_filter, target->path,
+			target->symbol);
+		free_target(target);
+	}
+
+	mutex_unlock(&speed_bump_mutex);
+}
+
+/* ============================================================
+ * Command Parsing
+ * ============================================================ */
+
+/*
+ * Per-target settings parsed from a spec line. Options absent from the
+ * line keep their defaults; @given records which ones were present so
+ * an update only changes what it names. @rule_name and @profile_name
+ * select the target rather than set anything, so they have no bit.
+ * @profile is resolved from @profile_name under speed_bump_mutex, NULL
+ * outside any profile.
+ */
+struct target_opts {
+	u64 delay_ns;
+	pid_t pid_filter;
+	enum speed_bump_delay_mode mode;
+	bool latency;
+	bool overshoot;
+	unsigned int scale_pct;
+	u32 every;
+	u32 prob_ppm;
+	enum speed_bump_dist dist;
+	u64 max_ns;
+	u32 sigma_milli;
+	u64 budget_ns_per_s;
+	bool async;
+	bool autoremove;
+	unsigned int given;
+	char rule_name[SPEED_BUMP_MAX_RULE_LEN];
+	char profile_name[SPEED_BUMP_MAX_PROFILE_LEN];
+	char cgroup_path[SPEED_BUMP_MAX_CGROUP_LEN];  /* resolved per target */
+	char sweep_spec[SPEED_BUMP_MAX_SWEEP_LEN];    /* parsed per target */
+	u8 build_id[SPEED_BUMP_MAX_BUILD_ID];
+	unsigned int build_id_len;
+	char cpus_spec[SPEED_BUMP_MAX_CPUS_LEN];      /* resolved per target */
+	int node;                                     /* resolved per target */
+	struct speed_bump_profile *profile;
+};
+
+/* The same bits as a control device descriptor's "given" */
+#define TARGET_OPT_DELAY	SPEED_BUMP_OPT_DELAY
+#define TARGET_OPT_MODE		SPEED_BUMP_OPT_MODE
+#define TARGET_OPT_LATENCY	SPEED_BUMP_OPT_LATENCY
+#define TARGET_OPT_SCALE	SPEED_BUMP_OPT_SCALE
+#define TARGET_OPT_EVERY	SPEED_BUMP_OPT_EVERY
+#define TARGET_OPT_PROB		SPEED_BUMP_OPT_PROB
+#define TARGET_OPT_DIST		SPEED_BUMP_OPT_DIST
+#define TARGET_OPT_MAX		SPEED_BUMP_OPT_MAX
+#define TARGET_OPT_SIGMA	SPEED_BUMP_OPT_SIGMA
+#define TARGET_OPT_BUDGET	SPEED_BUMP_OPT_BUDGET
+#define TARGET_OPT_PID		SPEED_BUMP_OPT_PID
+#define TARGET_OPT_ASYNC	SPEED_BUMP_OPT_ASYNC
+#define TARGET_OPT_AUTOREMOVE	SPEED_BUMP_OPT_AUTOREMOVE
+#define TARGET_OPT_CGROUP	SPEED_BUMP_OPT_CGROUP
+#define TARGET_OPT_OVERSHOOT	SPEED_BUMP_OPT_OVERSHOOT
+#define TARGET_OPT_SWEEP	SPEED_BUMP_OPT_SWEEP
+#define TARGET_OPT_BUILDID	SPEED_BUMP_OPT_BUILDID
+#define TARGET_OPT_CPUS		SPEED_BUMP_OPT_CPUS
+#define TARGET_OPT_NODE		SPEED_BUMP_OPT_NODE
+
+/* Start from the defaults of an add */
+static void target_opts_init(struct target_opts *opts)
+{
+	memset(opts, 0, sizeof(*opts));
+	opts->delay_ns = speed_bump_default_delay;
+	opts->mode = SPEED_BUMP_MODE_SPIN;
+	opts->every = 1;
+	opts->prob_ppm = SPEED_BUMP_PROB_ONE;
+	opts->dist = SPEED_BUMP_DIST_FIXED;
+	opts->sigma_milli = 1000;
+}
+
+/*
+ * Range checks shared by the text and binary interfaces.
+ * Returns 0 if @opts are usable, -ERANGE or -EINVAL otherwise.
+ */
+static int target_opts_check(const struct target_opts *opts)
+{
+	if (opts->delay_ns > SPEED_BUMP_MAX_DELAY_NS ||
+	    opts->max_ns > SPEED_BUMP_MAX_DELAY_NS ||
+	    opts->scale_pct > SPEED_BUMP_MAX_SCALE_PCT ||
+	    opts->prob_ppm > SPEED_BUMP_PROB_ONE ||
+	    opts->sigma_milli > SPEED_BUMP_MAX_SIGMA_MILLI ||
+	    opts->budget_ns_per_s > (u64)NSEC_PER_SEC * num_possible_cpus())
+		return -ERANGE;
+
+	if (opts->pid_filter < 0 || opts->every == 0 ||
+	    (opts->autoremove && !opts->pid_filter) ||
+	    ((opts->given & TARGET_OPT_SWEEP) &&
+	     (opts->given & TARGET_OPT_DELAY)) ||
+	    ((opts->given & TARGET_OPT_CPUS) &&
+	     (opts->given & TARGET_OPT_NODE)) ||
+	    opts->mode > SPEED_BUMP_MODE_HYBRID ||
+	    opts->dist > SPEED_BUMP_DIST_LOGNORMAL)
+		return -EINVAL;
+
+	return 0;
+}
+
+/*
+ * A profile or rule name is 1 to SPEED_BUMP_MAX_PROFILE_LEN - 1 letters,
+ * digits, '_', '-' or '.'. "none" stands for no profile.
+ * Returns 0 if valid, -EINVAL or -ENAMETOOLONG otherwise.
+ */
+static int profile_name_check(const char *name)
+{
+	size_t i, len = strlen(name);
+
+	BUILD_BUG_ON(SPEED_BUMP_MAX_RULE_LEN != SPEED_BUMP_MAX_PROFILE_LEN);
+
+	if (len >= SPEED_BUMP_MAX_PROFILE_LEN)
+		return -ENAMETOOLONG;
+	if (len == 0 || strcmp(name, "none") == 0)
+		return -EINVAL;
+
+	for (i = 0; i < len; i++) {
+		if (!isalnum(name[i]) && !strchr("_-.", name[i]))
+			return -EINVAL;
+	}
+	return 0;
+}
+
+/*
+ * A path must be absolute; a symbol must start with a letter or '_',
+ * unless it is a glob for a wildcard add, a file offset (which starts
+ * with a digit) or SYMBOL+OFF. Offsets only name a location in one
+ * file, so they cannot go with a wildcard path.
+ * Returns 0 if valid, -EINVAL otherwise.
+ */
+static int target_name_check(const char *path, const char *symbol)
+{
+	if (path[0] != '/')
+		return -EINVAL;
+
+	if (isdigit(symbol[0]) || strchr(symbol, '+'))
+		return speed_bump_has_wildcard(path) ? -EINVAL : 0;
+
+	if (symbol[0] != '_' && !isalpha(symbol[0]) &&
+	    !speed_bump_has_wildcard(symbol))
+		return -EINVAL;
+
+	return 0;
+}
+
+/* Parse a "0x" hex offset that must fit a loff_t */
+static int target_parse_offset(const char *s, u64 *off)
+{
+	int ret;
+
+	if (s[0] != '0' || (s[1] != 'x' && s[1] != 'X'))
+		return -EINVAL;
+	ret = kstrtou64(s + 2, 16, off);
+	if (ret)
+		return ret;
+	return *off > S64_MAX ? -ERANGE : 0;
+}
+
+/*
+ * Rewrite a location given as a file offset or as SYMBOL+OFFSET in its
+ * one canonical spelling, so that it keys and lists the same however it
+ * was written: 0xHEX for an offset, SYMBOL+0xHEX for an offset into a
+ * function, or plain SYMBOL for SYMBOL+0. The canonical form is never
+ * longer than the input. Plain symbols and globs are left alone.
+ *
+ * An offset of 0 is the ELF header and never code.
+ * Returns 0 on success, -EINVAL or -ERANGE for a bad offset.
+ */
+static int target_location_canon(char *symbol)
+{
+	char *plus;
+	u64 off;
+	int ret;
+
+	if (isdigit(symbol[0])) {
+		ret = target_parse_offset(symbol, &off);
+		if (ret)
+			return ret;
+		if (!off)
+			return -EINVAL;
+		sprintf(symbol, "0x%llx", off);
+		return 0;
+	}
+
+	plus = strchr(symbol, '+');
+	if (!plus)
+		return 0;
+	if (plus == symbol || speed_bump_has_wildcard(symbol))
+		return -EINVAL;
+	ret = target_parse_offset(plus + 1, &off);
+	if (ret)
+		return ret;
+
+	if (off)
+		sprintf(plus, "+0x%llx", off);
+	else
+		*plus = '\0';
+	return 0;
+}
+
+/*
+ * Split a canonical location into the file offset of a raw 0xOFF (else
+ * 0) and the offset SYMBOL+0xOFF adds to SYMBOL's (else 0).
+ */
+static void target_location_offsets(const char *symbol, loff_t *offset,
+				    loff_t *inner)
+{
+	const char *plus = strchr(symbol, '+');
+	u64 off = 0;
+
+	*offset = *inner = 0;
+	if (isdigit(symbol[0]) && !target_parse_offset(symbol, &off))
+		*offset = off;
+	else if (plus && !target_parse_offset(plus + 1, &off))
+		*inner = off;
+}
+
+/*
+ * Parse the hex digits of a buildid= (as printed by readelf -n or
+ * file(1)) into @opts.
+ * Returns 0 on success, -EINVAL if @hex is not 1 to
+ * SPEED_BUMP_MAX_BUILD_ID bytes of hex.
+ */
+static int target_parse_build_id(const char *hex, struct target_opts *opts)
+{
+	size_t len = strlen(hex);
+
+	if (len == 0 || len % 2 || len / 2 > SPEED_BUMP_MAX_BUILD_ID)
+		return -EINVAL;
+	if (hex2bin(opts->build_id, hex, len / 2))
+		return -EINVAL;
+
+	opts->build_id_len = len / 2;
+	return 0;
+}
+
+/*
+ * Parse one option token: a bare DELAY_NS, or KEY=VALUE.
+ * Returns 0 on success, negative errno on failure.
+ */
+static int parse_target_option(char *tok, struct target_opts *opts)
+{
+	char *val;
+	u64 fixed;
+	int ret;
+
+	val = strchr(tok, '=');
+	if (!val) {
+		if (opts->given & TARGET_OPT_DELAY)
+			return -EINVAL;
+		ret = kstrtou64(tok, 10, &opts->delay_ns);
+		if (ret)
+			return ret;
+		opts->given |= TARGET_OPT_DELAY;
+		return 0;
+	}
+	*val++ = '\0';
+
+	if (strcmp(tok, "pid") == 0) {
+		ret = kstrtoint(val, 10, &opts->pid_filter);
+		if (ret)
+			return ret;
+		opts->given |= TARGET_OPT_PID;
+		return 0;
+	}
+
+	if (strcmp(tok, "mode") == 0) {
+		ret = speed_bump_parse_delay_mode(val, &opts->mode);
+		if (ret)
+			return ret;
+		opts->given |= TARGET_OPT_MODE;
+		return 0;
+	}
+
+	if (strcmp(tok, "latency") == 0) {
+		ret = kstrtobool(val, &opts->latency);
+		if (ret)
+			return ret;
+		opts->given |= TARGET_OPT_LATENCY;
+		return 0;
+	}
+
+	if (strcmp(tok, "overshoot") == 0) {
+		ret = kstrtobool(val, &opts->overshoot);
+		if (ret)
+			return ret;
+		opts->given |= TARGET_OPT_OVERSHOOT;
+		return 0;
+	}
+
+	if (strcmp(tok, "scale") == 0) {
+		ret = kstrtouint(val, 10, &opts->scale_pct);
+		if (ret)
+			return ret;
+		opts->given |= TARGET_OPT_SCALE;
+		return 0;
+	}
+
+	if (strcmp(tok, "every") == 0) {
+		ret = kstrtou32(val, 10, &opts->every);
+		if (ret)
+			return ret;
+		opts->given |= TARGET_OPT_EVERY;
+		return 0;
+	}
+
+	if (strcmp(tok, "prob") == 0) {
+		ret = speed_bump_parse_fixed(val, 6, &fixed);
+		if (ret)
+			return ret;
+		if (fixed > SPEED_BUMP_PROB_ONE)
+			return -ERANGE;
+		opts->prob_ppm = fixed;
+		opts->given |= TARGET_OPT_PROB;
+		return 0;
+	}
+
+	if (strcmp(tok, "dist") == 0) {
+		ret = speed_bump_parse_dist(val, &opts->dist);
+		if (ret)
+			return ret;
+		opts->given |= TARGET_OPT_DIST;
+		return 0;
+	}
+
+	if (strcmp(tok, "max") == 0) {
+		ret = kstrtou64(val, 10, &opts->max_ns);
+		if (ret)
+			return ret;
+		opts->given |= TARGET_OPT_MAX;
+		return 0;
+	}
+
+	if (strcmp(tok, "sigma") == 0) {
+		ret = speed_bump_parse_fixed(val, 3, &fixed);
+		if (ret)
+			return ret;
+		if (fixed > SPEED_BUMP_MAX_SIGMA_MILLI)
+			return -ERANGE;
+		opts->sigma_milli = fixed;
+		opts->given |= TARGET_OPT_SIGMA;
+		return 0;
+	}
+
+	if (strcmp(tok, "profile") == 0) {
+		ret = profile_name_check(val);
+		if (ret)
+			return ret;
+		strscpy(opts->profile_name, val, sizeof(opts->profile_name));
+		return 0;
+	}
+
+	if (strcmp(tok, "rule") == 0) {
+		ret = profile_name_check(val);
+		if (ret)
+			return ret;
+		strscpy(opts->rule_name, val, sizeof(opts->rule_name));
+		return 0;
+	}
+
+	if (strcmp(tok, "budget_ns_per_s") == 0) {
+		ret = kstrtou64(val, 10, &opts->budget_ns_per_s);
+		if (ret)
+			return ret;
+		opts->given |= TARGET_OPT_BUDGET;
+		return 0;
+	}
+
+	if (strcmp(tok, "async") == 0) {
+		ret = kstrtobool(val, &opts->async);
+		if (ret)
+			return ret;
+		opts->given |= TARGET_OPT_ASYNC;
+		return 0;
+	}
+
+	if (strcmp(tok, "autoremove") == 0) {
+		ret = kstrtobool(val, &opts->autoremove);
+		if (ret)
+			return ret;
+		opts->given |= TARGET_OPT_AUTOREMOVE;
+		return 0;
+	}
+
+	if (strcmp(tok, "cgroup") == 0) {
+		if (val[0] != '/')
+			return -EINVAL;
+		if (strscpy(opts->cgroup_path, val,
+			    sizeof(opts->cgroup_path)) < 0)
+			return -ENAMETOOLONG;
+		opts->given |= TARGET_OPT_CGROUP;
+		return 0;
+	}
+
+	if (strcmp(tok, "sweep") == 0) {
+		ret = speed_bump_parse_sweep(val, NULL);
+		if (ret < 0)
+			return ret;
+		if (strscpy(opts->sweep_spec, val,
+			    sizeof(opts->sweep_spec)) < 0)
+			return -ERANGE;
+		opts->given |= TARGET_OPT_SWEEP;
+		return 0;
+	}
+
+	if (strcmp(tok, "buildid") == 0) {
+		ret = target_parse_build_id(val, opts);
+		if (ret)
+			return ret;
+		opts->given |= TARGET_OPT_BUILDID;
+		return 0;
+	}
+
+	if (strcmp(tok, "cpus") == 0) {
+		if (!val[0])
+			return -EINVAL;
+		if (strscpy(opts->cpus_spec, val,
+			    sizeof(opts->cpus_spec)) < 0)
+			return -ENAMETOOLONG;
+		opts->given |= TARGET_OPT_CPUS;
+		return 0;
+	}
+
+	if (strcmp(tok, "node") == 0) {
+		ret = kstrtoint(val, 10, &opts->node);
+		if (ret)
+			return ret;
+		opts->given |= TARGET_OPT_NODE;
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+/*
+ * Parse a target specification line.
+ *
+ * Format: PATH:SYMBOL[+0xOFF]|PATH@0xOFF [DELAY_NS] [pid=PID]
+ *         [mode=spin|sleep|hybrid]
+ *         [latency=0|1] [scale=PCT] [every=N] [prob=P]
+ *         [dist=fixed|exp|uniform|lognormal] [max=NS] [sigma=S]
+ *         [budget_ns_per_s=NS] [rule=NAME] [profile=NAME] [async=0|1]
+ *         [autoremove=0|1] [cgroup=PATH] [overshoot=0|1]
+ *         [sweep=START:STOP:STEP@DURATION|DELAY@DURATION,...]
+ *         [buildid=HEX] [cpus=LIST|all] [node=N]
+ *
+ * PATH@0xOFF probes file offset OFF of PATH with no symbol lookup, and
+ * is kept as PATH:0xOFF; SYMBOL+0xOFF probes OFF bytes into SYMBOL.
+ * Either is rewritten with target_location_canon().
+ *
+ * Options may appear in any order, separated by whitespace. A scaled
+ * target has no fixed delay unless DELAY_NS is given explicitly. With
+ * a dist= other than fixed, DELAY_NS is the mean of the distribution.
+ * A sweep= sets the delay itself, so it does not take a DELAY_NS.
+ * cpus= and node= are two ways of giving one scope and exclude each
+ * other.
+ *
+ * Returns 0 on success, negative errno on failure.
+ * On success, populates path, symbol and opts.
+ */
+static int parse_target_spec(const char *line, char *path, size_t path_len,
+			     char *symbol, size_t symbol_len,
+			     struct target_opts *opts)
+{
+	const char *colon;
+	char *buf, *cur, *tok;
+	size_t plen, slen, tlen;
+	int ret = 0;
+
+	/* Validate input */
+	if (!line || !path || !symbol || !opts)
+		return -EINVAL;
+
+	target_opts_init(opts);
+
+	/*
+	 * The target is split at its first ':', or for PATH@0xOFF at its
+	 * last '@', so a path may still contain '@'
+	 */
+	tlen = strcspn(line, " \t\r\n");
+	colon = strnchr(line, tlen, ':');
+	while (!colon && tlen > 0) {
+		if (line[--tlen] == '@')
+			colon = line + tlen;
+	}
+	if (!colon)
+		return -EINVAL;
+
+	/* Extract path */
+	plen = colon - line;
+	if (plen == 0 || plen >= path_len)
+		return -ENAMETOOLONG;
+
+	memcpy(path, line, plen);
+	path[plen] = '\0';
+
+	/* Symbol runs to the first whitespace (or the end of the line) */
+	slen = strcspn(colon + 1, " \t\r\n");
+	if (slen == 0 || slen >= symbol_len)
+		return -ENAMETOOLONG;
+
+	memcpy(symbol, colon + 1, slen);
+	symbol[slen] = '\0';
+
+	if (*colon == '@' && !isdigit(symbol[0]))
+		return -EINVAL;
+	ret = target_location_canon(symbol);
+	if (ret)
+		return ret;
+	ret = target_name_check(path, symbol);
+	if (ret)
+		return ret;
+
+	/* Options */
+	buf = kstrdup(colon + 1 + slen, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+
+	cur = buf;
+	while ((tok = strsep(&cur, " \t\r\n")) != NULL) {
+		if (*tok == '\0')
+			continue;
+		ret = parse_target_option(tok, opts);
+		if (ret)
+			break;
+	}
+	kfree(buf);
+
+	if (ret)
+		return ret;
+
+	/* The delay an add of a scaled target starts from; updates ignore it */
+	if ((opts->given & TARGET_OPT_SCALE) && !(opts->given & TARGET_OPT_DELAY))
+		opts->delay_ns = 0;
+
+	return target_opts_check(opts);
+}
+
+/*
+ * Find the rule @rule ("" for the unnamed one) of path and symbol in
+ * @profile (NULL: outside any).
+ * Caller must hold speed_bump_mutex.
+ */
+static struct speed_bump_target *find_target(const char *path, const char *symbol,
+					     const char *rule,
+					     const struct speed_bump_profile *profile)
+{
+	struct speed_bump_target *target;
+
+	hash_for_each_possible(speed_bump_target_hash, target, hnode,
+			       target_key_hash(path, symbol, rule,
+					       profile ? profile->id : 0)) {
+		if (target->profile == profile &&
+		    strcmp(target->path, path) == 0 &&
+		    strcmp(target->symbol, symbol) == 0 &&
+		    strcmp(target->rule, rule) == 0)
+			return target;
+	}
+	return NULL;
+}
+
+/* Caller must hold speed_bump_mutex */
+static struct speed_bump_profile *find_profile(const char *name)
+{
+	struct speed_bump_profile *profile;
+
+	list_for_each_entry(profile, &speed_bump_profiles, list) {
+		if (strcmp(profile->name, name) == 0)
+			return profile;
+	}
+	return NULL;
+}
+
+/*
+ * Resolve @opts->profile_name into @opts->profile, creating the profile
+ * if @create, and hold it until put_profile(@opts->profile). The hold
+ * keeps the profile alive while its last target is removed, and frees
+ * a new profile again if no target was added to it.
+ *
+ * Caller must hold speed_bump_mutex.
+ * Returns 0 on success, -ENOENT if the profile does not exist and
+ * @create is false, -ENOMEM.
+ */
+static int get_profile(struct target_opts *opts, bool create)
+{
+	struct speed_bump_profile *profile;
+
+	opts->profile = NULL;
+	if (!opts->profile_name[0])
+		return 0;
+
+	profile = find_profile(opts->profile_name);
+	if (!profile) {
+		if (!create)
+			return -ENOENT;
+
+		profile = kzalloc(sizeof(*profile), GFP_KERNEL);
+		if (!profile)
+			return -ENOMEM;
+		strscpy(profile->name, opts->profile_name, sizeof(profile->name));
+		profile->id = speed_bump_next_profile_id++;
+		list_add_tail(&profile->list, &speed_bump_profiles);
+	}
+
+	profile->nr_targets++;
+	opts->profile = profile;
+	return 0;
+}
+
+/*
+ * Find a target by id.
+ * Caller must hold speed_bump_mutex.
+ */
+static struct speed_bump_target *find_target_by_id(unsigned int id)
+{
+	struct speed_bump_target *target;
+
+	hash_for_each_possible(speed_bump_id_hash, target, id_node, id) {
+		if (target->id == id)
+			return target;
+	}
+	return NULL;
+}
+
+/*
+ * Register the target of an async add. Path lookup, symbol resolution
+ * and uprobe_register() run without speed_bump_mutex, so a slow
+ * filesystem holds up only this target; the mutex is taken just to
+ * publish the outcome.
+ */
+static void target_register_work(struct work_struct *work)
+{
+	struct speed_bump_target *target =
+		container_of(work, struct speed_bump_target, register_work);
+	const struct speed_bump_target_config *config;
+	struct cgroup *cgroup;
+	pid_t pid_filter;
+	int ret;
+
+	/* Only compared below, never dereferenced */
+	rcu_read_lock();
+	config = rcu_dereference(target->config);
+	pid_filter = config->pid_filter;
+	cgroup = config->cgroup;
+	rcu_read_unlock();
+
+	ret = speed_bump_register_uprobe(target);
+
+	mutex_lock(&speed_bump_mutex);
+
+	if (target->cancelled) {
+		speed_bump_unregister_uprobe(target);
+		release_target(target);
+		goto out;
+	}
+
+	speed_bump_watch_changed();
+	if (ret) {
+		target->state = SPEED_BUMP_TARGET_FAILED;
+		target->error = ret;
+		pr_warn("speed_bump: failed to register target %s:%s: %d\n",
+			target->path, target->symbol, ret);
+		goto out;
+	}
+
+	target->state = SPEED_BUMP_TARGET_ACTIVE;
+
+	/* An update while pending did not move the breakpoints */
+	config = target_config(target);
+	if (config->pid_filter != pid_filter || config->cgroup != cgroup) {
+		ret = speed_bump_apply_uprobe_filter(target);
+		if (ret)
+			pr_warn("speed_bump: failed to re-apply filter for %s:%s: %d\n",
+				target->path, target->symbol, ret);
+	}
+
+	pr_info("speed_bump: registered target %s:%s\n",
+		target->path, target->symbol);
+out:
+	mutex_unlock(&speed_bump_mutex);
+}
+
+/*
+ * Allocate, register and index one target. With @opts->async the
+ * target is indexed as pending and registered by target_register_work().
+ *
+ * @offset: File offset of @symbol if the caller already resolved it,
+ *          or 0 to take it from a raw 0xOFF location or resolve it at
+ *          registration
+ * @group: Wildcard group the target belongs to, or NULL
+ *
+ * Caller must hold speed_bump_mutex and have checked for duplicates.
+ * Returns 0 on success, negative errno on failure.
+ */
+static int insert_target(const char *path, const char *symbol, loff_t offset,
+			 const struct target_opts *opts,
+			 struct speed_bump_group *group)
+{
+	struct speed_bump_target_config *config;
+	struct speed_bump_target *target;
+	int ret;
+
+	/* Check max targets */
+	if (atomic_read(&speed_bump_target_count) >= READ_ONCE(max_targets))
+		return -ENOSPC;
+
+	/* Allocate and initialize target */
+	target = kzalloc(sizeof(*target), GFP_KERNEL);
+	if (!target)
+		return -ENOMEM;
+
+	config = kzalloc(sizeof(*config), GFP_KERNEL);
+	if (!config) {
+		kfree(target);
+		return -ENOMEM;
+	}
+	RCU_INIT_POINTER(target->config, config);
+
+	config->delay_ns = opts->delay_ns;
+	config->pid_filter = opts->pid_filter;
+	config->mode = opts->mode;
+	config->scale_pct = opts->scale_pct;
+	config->every = opts->every;
+	config->prob_ppm = opts->prob_ppm;
+	config->dist = opts->dist;
+	config->max_ns = opts->max_ns;
+	config->sigma_milli = opts->sigma_milli;
+
+	if (opts->given & TARGET_OPT_CGROUP) {
+		ret = target_cgroup_get(opts->cgroup_path, &config->cgroup);
+		if (ret) {
+			release_target(target);
+			return ret;
+		}
+	}
+
+	if (opts->given & (TARGET_OPT_CPUS | TARGET_OPT_NODE)) {
+		ret = target_cpus_get(opts->cpus_spec, opts->node,
+				      opts->given & TARGET_OPT_NODE,
+				      &config->cpus);
+		if (ret) {
+			release_target(target);
+			return ret;
+		}
+	}
+
+	strscpy(target->path, path, sizeof(target->path));
+	strscpy(target->symbol, symbol, sizeof(target->symbol));
+	strscpy(target->rule, opts->rule_name, sizeof(target->rule));
+	memcpy(target->build_id, opts->build_id, opts->build_id_len);
+	target->build_id_len = opts->build_id_len;
+	if (offset)
+		target->offset = offset;
+	else
+		target_location_offsets(symbol, &target->offset, &target->inner);
+	target->ret_probe = opts->latency || opts->scale_pct;
+	target->budget.ns_per_s = opts->budget_ns_per_s;
+	target->profile = opts->profile;
+	target->profile_id = opts->profile ? opts->profile->id : 0;
+	INIT_LIST_HEAD(&target->list);
+
+	/* Per-CPU counters are zero-initialised by alloc_percpu() */
+	target->stats = alloc_percpu(struct speed_bump_target_stats);
+	if (!target->stats) {
+		release_target(target);
+		return -ENOMEM;
+	}
+
+	if (opts->latency) {
+		target->latency = alloc_percpu(struct speed_bump_hist);
+		if (!target->latency) {
+			release_target(target);
+			return -ENOMEM;
+		}
+	}
+
+	if (opts->overshoot) {
+		target->overshoot = alloc_percpu(struct speed_bump_hist);
+		if (!target->overshoot) {
+			release_target(target);
+			return -ENOMEM;
+		}
+	}
+
+	if (opts->given & TARGET_OPT_SWEEP) {
+		ret = target_sweep_alloc(target, opts->sweep_spec);
+		if (ret) {
+			release_target(target);
+			return ret;
+		}
+		config->delay_ns = target->sweep->delay_ns;
+	}
+
+	if (opts->autoremove) {
+		ret = target_watch_exit(target, opts->pid_filter);
+		if (ret) {
+			release_target(target);
+			return ret;
+		}
+	}
+
+	/* Before registration, as the hit tracepoint reports it */
+	target->id = speed_bump_next_target_id++;
+
+	/* Register uprobe, or leave that to the register work */
+	if (opts->async) {
+		target->state = SPEED_BUMP_TARGET_PENDING;
+		INIT_WORK(&target->register_work, target_register_work);
+	} else {
+		ret = speed_bump_register_uprobe(target);
+		if (ret) {
+			target_unwatch_exit(target);
+			release_target(target);
+			return ret;
+		}
+	}
+
+	/* Add to list and index */
+	list_add_tail(&target->list, &speed_bump_targets);
+	hash_add(speed_bump_target_hash, &target->hnode,
+		 target_key_hash(path, symbol, target->rule, target->profile_id));
+	hash_add(speed_bump_id_hash, &target->id_node, target->id);
+	atomic_inc(&speed_bump_target_count);
+
+	if (group) {
+		target->group = group;
+		group->nr_targets++;
+	}
+	if (target->profile)
+		target->profile->nr_targets++;
+
+	if (target->sweep)
+		target_sweep_start(target->sweep);
+
+	if (opts->async)
+		queue_work(speed_bump_wq, &target->register_work);
+
+	speed_bump_watch_changed();
+	return 0;
+}
+
+/* ============================================================
+ * Wildcard Targets
+ * ============================================================
+ *
+ * A '*' or '?' in SYMBOL selects every matching STT_FUNC symbol; in the
+ * last component of PATH it selects every matching file in that
+ * directory. Each binary's symbols come from one walk of its cached
+ * index (see speed_bump_symcache.c).
+ */
+
+/* Generous bound on a single path (directory + "/" + entry name) */
+#define WILDCARD_NAME_MAX 256
+
+struct wildcard_name {
+	struct list_head list;
+	char name[];
+};
+
+struct wildcard_dir {
+	struct dir_context ctx;
+	const char *pattern;
+	struct list_head names;
+	int err;
+};
+
+static void wildcard_free_names(struct list_head *names)
+{
+	struct wildcard_name *n, *tmp;
+
+	list_for_each_entry_safe(n, tmp, names, list) {
+		list_del(&n->list);
+		kfree(n);
+	}
+}
+
+static int wildcard_dir_entry(struct wildcard_dir *dir, const char *name,
+			      int namlen, unsigned int d_type)
+{
+	char buf[WILDCARD_NAME_MAX];
+	struct wildcard_name *n;
+
+	if (d_type != DT_REG && d_type != DT_LNK && d_type != DT_UNKNOWN)
+		return 0;
+	if (namlen >= WILDCARD_NAME_MAX)
+		return 0;
+
+	/* Like the shell, only an explicit leading '.' matches hidden files */
+	if (name[0] == '.' && dir->pattern[0] != '.')
+		return 0;
+
+	memcpy(buf, name, namlen);
+	buf[namlen] = '\0';
+	if (!speed_bump_glob_match(dir->pattern, buf))
+		return 0;
+
+	n = kmalloc(struct_size(n, name, namlen + 1), GFP_KERNEL);
+	if (!n)
+		return -ENOMEM;
+
+	memcpy(n->name, buf, namlen + 1);
+	list_add_tail(&n->list, &dir->names);
+	return 0;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,1,0)
+static bool wildcard_dir_actor(struct dir_context *ctx, const char *name,
+			       int namlen, loff_t offset, u64 ino,
+			       unsigned int d_type)
+{
+	struct wildcard_dir *dir = container_of(ctx, struct wildcard_dir, ctx);
+
+	dir->err = wildcard_dir_entry(dir, name, namlen, d_type);
+	return dir->err == 0;
+}
+#else
+static int wildcard_dir_actor(struct dir_context *ctx, const char *name,
+			      int namlen, loff_t offset, u64 ino,
+			      unsigned int d_type)
+{
+	struct wildcard_dir *dir = container_of(ctx, struct wildcard_dir, ctx);
+
+	dir->err = wildcard_dir_entry(dir, name, namlen, d_type);
+	return dir->err;
+}
+#endif
+
+/*
+ * List the entries of directory @dirname matching @pattern.
+ * Returns 0 on success (the list may be empty), negative errno on failure.
+ */
+static int wildcard_list_dir(const char *dirname, const char *pattern,
+			     struct list_head *names)
+{
+	struct wildcard_dir dir = {
+		.ctx.actor = wildcard_dir_actor,
+		.pattern = pattern,
+		.names = LIST_HEAD_INIT(dir.names),
+	};
+	struct file *file;
+	int ret;
+
+	file = filp_open(dirname, O_RDONLY | O_DIRECTORY, 0);
+	if (IS_ERR(file))
+		return PTR_ERR(file);
+
+	ret = iterate_dir(file, &dir.ctx);
+	filp_close(file, NULL);
+
+	if (!ret)
+		ret = dir.err;
+	if (ret)
+		wildcard_free_names(&dir.names);
+	else
+		list_splice(&dir.names, names);
+	return ret;
+}
+
+struct wildcard_symbols {
+	const char *pattern;
+	struct list_head matches;
+	unsigned int nr;
+	unsigned int limit;
+};
+
+struct wildcard_match {
+	struct list_head list;
+	loff_t offset;
+	char symbol[];
+};
+
+static int wildcard_symbol_fn(void *data, const char *name, loff_t offset,
+			      bool is_func)
+{
+	struct wildcard_symbols *syms = data;
+	struct wildcard_match *m;
+	size_t len;
+
+	if (!is_func || !speed_bump_glob_match(syms->pattern, name))
+		return 0;
+
+	len = strlen(name);
+	if (len >= SPEED_BUMP_MAX_SYMBOL_LEN)
+		return 0;
+
+	if (syms->nr >= syms->limit)
+		return -ENOSPC;
+
+	m = kmalloc(struct_size(m, symbol, len + 1), GFP_KERNEL);
+	if (!m)
+		return -ENOMEM;
+
+	m->offset = offset;
+	memcpy(m->symbol, name, len + 1);
+	list_add_tail(&m->list, &syms->matches);
+	syms->nr++;
+	return 0;
+}
+
+/*
+ * Register every function in @path matching the group's symbol pattern.
+ * Symbols that already have a target (including the second copy of a
+ * symbol present in both .dynsym and .symtab) are skipped.
+ *
+ * Caller must hold speed_bump_mutex.
+ * Returns 0 on success, negative errno on failure.
+ */
+static int wildcard_add_file(const char *path, const char *symbol_pattern,
+			     const struct target_opts *opts,
+			     struct speed_bump_group *group)
+{
+	struct wildcard_symbols syms = {
+		.pattern = symbol_pattern,
+		.matches = LIST_HEAD_INIT(syms.matches),
+		/* Each function can appear once per symbol table */
+		.limit = 2 * READ_ONCE(max_targets),
+	};
+	struct wildcard_match *m, *tmp;
+	struct path kpath;
+	struct inode *inode;
+	int ret;
+
+	ret = kern_path(path, LOOKUP_FOLLOW, &kpath);
+	if (ret)
+		return ret;
+
+	inode = igrab(d_inode(kpath.dentry));
+	path_put(&kpath);
+	if (!inode)
+		return -ENOENT;
+
+	if (S_ISREG(inode->i_mode))
+		ret = speed_bump_symcache_for_each(inode, path,
+						   wildcard_symbol_fn, &syms);
+	else
+		ret = -ENOEXEC;
+	iput(inode);
+
+	list_for_each_entry_safe(m, tmp, &syms.matches, list) {
+		if (!ret && !find_target(path, m->symbol, opts->rule_name,
+					 opts->profile))
+			ret = insert_target(path, m->symbol, m->offset,
+					    opts, group);
+		list_del(&m->list);
+		kfree(m);
+	}
+
+	return ret;
+}
+
+/* Caller must hold speed_bump_mutex */
+static struct speed_bump_group *find_group(const char *pattern, const char *rule,
+					   const struct speed_bump_profile *profile)
+{
+	struct speed_bump_group *group;
+
+	list_for_each_entry(group, &speed_bump_groups, list) {
+		if (group->profile == profile &&
+		    strcmp(group->rule, rule) == 0 &&
+		    strcmp(group->pattern, pattern) == 0)
+			return group;
+	}
+	return NULL;
+}
+
+/*
+ * Add every function matching a wildcard PATH:SYMBOL as one group.
+ * Either all matches are registered or none are. @path is modified
+ * temporarily while its directory is listed.
+ *
+ * @group_id: Set to the id of the new group
+ *
+ * Caller must hold speed_bump_mutex.
+ * Returns 0 on success, -ENOENT if nothing matched, negative errno on
+ * failure.
+ */
+static int add_group(char *path, const char *symbol,
+		     const struct target_opts *opts, unsigned int *group_id)
+{
+	struct speed_bump_group *group;
+	struct wildcard_name *n;
+	LIST_HEAD(names);
+	char *slash, *file_path;
+	int ret;
+
+	group = kzalloc(sizeof(*group), GFP_KERNEL);
+	if (!group)
+		return -ENOMEM;
+	INIT_LIST_HEAD(&group->list);
+	group->profile = opts->profile;
+	strscpy(group->rule, opts->rule_name, sizeof(group->rule));
+
+	snprintf(group->pattern, sizeof(group->pattern), "%s:%s", path, symbol);
+	if (find_group(group->pattern, group->rule, group->profile)) {
+		kfree(group);
+		return -EEXIST;
+	}
+
+	slash = strrchr(path, '/');
+	if (!speed_bump_has_wildcard(slash)) {
+		/* Only SYMBOL is a pattern: one binary */
+		ret = wildcard_add_file(path, symbol, opts, group);
+		goto out;
+	}
+
+	/* Wildcards are only supported in the last path component */
+	if (strpbrk(path, "*?") < slash) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	file_path = kmalloc(SPEED_BUMP_MAX_PATH_LEN, GFP_KERNEL);
+	if (!file_path) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	*slash = '\0';
+	ret = wildcard_list_dir(slash == path ? "/" : path, slash + 1, &names);
+	list_for_each_entry(n, &names, list) {
+		if (ret)
+			break;
+		if (snprintf(file_path, SPEED_BUMP_MAX_PATH_LEN, "%s/%s",
+			     path, n->name) >= SPEED_BUMP_MAX_PATH_LEN)
+			continue;
+
+		ret = wildcard_add_file(file_path, symbol, opts, group);
+		/* Not every file in a directory is a probe-able binary */
+		if (ret == -ENOEXEC || ret == -ENOENT || ret == -EACCES ||
+		    ret == -ESTALE)
+			ret = 0;
+	}
+	*slash = '/';
+
+	wildcard_free_names(&names);
+	kfree(file_path);
+
+out:
+	if (!ret && group->nr_targets == 0)
+		ret = -ENOENT;
+
+	if (ret) {
+		if (group->nr_targets)
+			free_targets(group, NULL);  /* frees the group */
+		else
+			kfree(group);
+		return ret;
+	}
+
+	group->id = speed_bump_next_group_id++;
+	list_add_tail(&group->list, &speed_bump_groups);
+	*group_id = group->id;
+
+	pr_info("speed_bump: added group %u %s: %u targets delay=%llu ns mode=%s\n",
+		group->id, group->pattern, group->nr_targets, opts->delay_ns,
+		speed_bump_delay_mode_name(opts->mode));
+	return 0;
+}
+
+/*
+ * Add a new target, or a group of targets for a wildcard PATH:SYMBOL.
+ * @path is modified temporarily by a wildcard add. A group is added
+ * all or nothing and cannot be async.
+ *
+ * @id: Set to the id of the new target, or 0 for a group
+ * @group_id: Set to the id of the new group, or 0 for a single target
+ *
+ * Caller must hold speed_bump_mutex.
+ * Returns 0 on success, negative errno on failure.
+ */
+static int add_target_locked(char *path, const char *symbol,
+			     const struct target_opts *opts,
+			     unsigned int *id, unsigned int *group_id)
+{
+	int ret;
+
+	*id = 0;
+	*group_id = 0;
+
+	if (speed_bump_has_wildcard(path) || speed_bump_has_wildcard(symbol)) {
+		if (opts->async)
+			return -EINVAL;
+		return add_group(path, symbol, opts, group_id);
+	}
+
+	/* Check for duplicate */
+	if (find_target(path, symbol, opts->rule_name, opts->profile))
+		return -EEXIST;
+
+	ret = insert_target(path, symbol, 0, opts, NULL);
+	if (ret)
+		return ret;
+
+	*id = find_target(path, symbol, opts->rule_name, opts->profile)->id;
+
+	if (opts->async)
+		pr_info("speed_bump: queued target %s:%s delay=%llu ns mode=%s\n",
+			path, symbol, opts->delay_ns,
+			speed_bump_delay_mode_name(opts->mode));
+	else if (opts->pid_filter)
+		pr_info("speed_bump: added target %s:%s delay=%llu ns mode=%s pid=%d\n",
+			path, symbol, opts->delay_ns,
+			speed_bump_delay_mode_name(opts->mode), opts->pid_filter);
+	else
+		pr_info("speed_bump: added target %s:%s delay=%llu ns mode=%s\n",
+			path, symbol, opts->delay_ns,
+			speed_bump_delay_mode_name(opts->mode));
+	return 0;
+}
+
+static int add_target(const char *spec)
+{
+	char path[SPEED_BUMP_MAX_PATH_LEN];
+	char symbol[SPEED_BUMP_MAX_SYMBOL_LEN];
+	struct target_opts opts;
+	unsigned int id, group_id;
+	int ret;
+
+	ret = parse_target_spec(spec, path, sizeof(path),
+				symbol, sizeof(symbol), &opts);
+	if (ret)
+		return ret;
+
+	mutex_lock(&speed_bump_mutex);
+	ret = get_profile(&opts, true);
+	if (!ret) {
+		ret = add_target_locked(path, symbol, &opts, &id, &group_id);
+		put_profile(opts.profile);
+	}
+	mutex_unlock(&speed_bump_mutex);
+
+	return ret;
+}
+
+/*
+ * Unhook a target from the list and indexes and detach its consumer
+ * without waiting, for a batch to free after a single
+ * speed_bump_unregister_uprobe_sync().
+ * Caller must hold speed_bump_mutex.
+ */
+static void detach_target(struct speed_bump_target *target,
+			  struct list_head *doomed)
+{
+	if (!target_pending(target))
+		speed_bump_unregister_uprobe_nosync(target);
+	hash_del(&target->hnode);
+	hash_del(&target->id_node);
+	list_move_tail(&target->list, doomed);
+}
+
+/*
+ * Free the targets collected by detach_target().
+ * Caller must hold speed_bump_mutex.
+ */
+static void free_detached_targets(struct list_head *doomed)
+{
+	struct speed_bump_target *target, *tmp;
+
+	if (list_empty(doomed))
+		return;
+
+	speed_bump_unregister_uprobe_sync();
+	list_for_each_entry_safe(target, tmp, doomed, list)
+		free_target(target);
+}
+
+/*
+ * Remove the target PATH:SYMBOL of @rule and @profile, or every target
+ * of a wildcard group.
+ *
+ * @doomed: If non-NULL, a single target is only detached onto @doomed
+ *          for free_detached_targets()
+ *
+ * Caller must hold speed_bump_mutex.
+ * Returns 0 on success, -ENOENT if there is no such target or group.
+ */
+static int remove_target_locked(const char *path, const char *symbol,
+				const char *rule,
+				struct speed_bump_profile *profile,
+				struct list_head *doomed)
+{
+	struct speed_bump_target *target;
+	int removed;
+
+	/* A wildcard spec removes the group it added */
+	if (speed_bump_has_wildcard(path) || speed_bump_has_wildcard(symbol)) {
+		struct speed_bump_group *group;
+		char pattern[sizeof(group->pattern)];
+
+		snprintf(pattern, sizeof(pattern), "%s:%s", path, symbol);
+		group = find_group(pattern, rule, profile);
+		if (!group)
+			return -ENOENT;
+
+		removed = free_targets(group, NULL);
+		pr_info("speed_bump: removed group %s (%d targets)\n",
+			pattern, removed);
+		return 0;
+	}
+
+	target = find_target(path, symbol, rule, profile);
+	if (!target)
+		return -ENOENT;
+
+	if (doomed)
+		detach_target(target, doomed);
+	else
+		free_target(target);
+
+	pr_info("speed_bump: removed target %s:%s\n", path, symbol);
+	return 0;
+}
+
+/*
+ * Remove every target staged in the profile @name.
+ * Caller must hold speed_bump_mutex.
+ * Returns 0 on success, -ENOENT if there is no such profile.
+ */
+static int remove_profile_locked(const char *name)
+{
+	struct speed_bump_profile *profile;
+	int removed;
+
+	profile = find_profile(name);
+	if (!profile)
+		return -ENOENT;
+
+	removed = free_targets(NULL, profile);  /* frees the profile */
+	pr_info("speed_bump: removed profile %s (%d targets)\n", name, removed);
+	return 0;
+}
+
+/*
+ * Make the profile @name the active one, or none for "" or "none".
+ * Hits already past the check finish under the old profile.
+ * Caller must hold speed_bump_mutex.
+ * Returns 0 on success, -ENOENT if there is no such profile.
+ */
+static int activate_profile_locked(const char *name)
+{
+	struct speed_bump_profile *profile = NULL;
+
+	if (name[0] && strcmp(name, "none") != 0) {
+		profile = find_profile(name);
+		if (!profile)
+			return -ENOENT;
+	}
+
+	WRITE_ONCE(speed_bump_active_profile, profile ? profile->id : 0);
+	pr_info("speed_bump: active profile %s\n", profile ? name : "none");
+	speed_bump_watch_changed();
+	return 0;
+}
+
+/*
+ * Remove a target by path and symbol, a whole profile, or all targets.
+ */
+static int remove_target(const char *spec)
+{
+	char path[SPEED_BUMP_MAX_PATH_LEN];
+	char symbol[SPEED_BUMP_MAX_SYMBOL_LEN];
+	char name[SPEED_BUMP_MAX_PROFILE_LEN], *trimmed;
+	struct target_opts opts;
+	int removed, ret;
+
+	/* Check for remove-all */
+	if (spec[0] == '*' && (spec[1] == '\0' || spec[1] == '\n')) {
+		mutex_lock(&speed_bump_mutex);
+		removed = free_targets(NULL, NULL);
+		mutex_unlock(&speed_bump_mutex);
+		pr_info("speed_bump: removed all %d targets\n", removed);
+		return 0;
+	}
+
+	if (spec[0] == '@') {
+		if (strscpy(name, spec + 1, sizeof(name)) < 0)
+			return -ENAMETOOLONG;
+		trimmed = strim(name);
+		ret = profile_name_check(trimmed);
+		if (ret)
+			return ret;
+
+		mutex_lock(&speed_bump_mutex);
+		ret = remove_profile_locked(trimmed);
+		mutex_unlock(&speed_bump_mutex);
+		return ret;
+	}
+
+	/* PATH:SYMBOL, and at most a rule= and a profile= */
+	ret = parse_target_spec(spec, path, sizeof(path),
+				symbol, sizeof(symbol), &opts);
+	if (ret)
+		return ret;
+	if (opts.given)
+		return -EINVAL;
+
+	mutex_lock(&speed_bump_mutex);
+	ret = get_profile(&opts, false);
+	if (!ret) {
+		ret = remove_target_locked(path, symbol, opts.rule_name,
+					   opts.profile, NULL);
+		put_profile(opts.profile);
+	}
+	mutex_unlock(&speed_bump_mutex);
+
+	return ret;
+}
+
+/*
+ * Apply the delay, pid filter, mode, scale and other options that were
+ * given to one target; what is not given keeps its current value, the
+ * delay included. latency= and overshoot= may be repeated but not
+ * changed, only a target registered with a return probe can take a
+ * scale, and a given DELAY_NS ends a sweep.
+ *
+ * The new settings go into a copy of the current config that replaces
+ * it in one pointer store, so a concurrent hit sees either the old
+ * settings or the new ones. The old config is freed after a grace
+ * period.
+ *
+ * Caller must hold speed_bump_mutex.
+ */
+static int update_one_target(struct speed_bump_target *target,
+			     const struct target_opts *opts)
+{
+	struct speed_bump_target_config *old, *config;
+	bool refilter;
+	int ret = 0;
+
+	/* Only an add can ask for these */
+	if (opts->given & (TARGET_OPT_ASYNC | TARGET_OPT_AUTOREMOVE |
+			   TARGET_OPT_SWEEP | TARGET_OPT_BUILDID))
+		return -EINVAL;
+
+	/* The return probe is part of the registration; it cannot change */
+	if ((opts->given & TARGET_OPT_LATENCY) &&
+	    opts->latency != !!target->latency)
+		return -EINVAL;
+	/* Nor does a histogram the handler may be writing */
+	if ((opts->given & TARGET_OPT_OVERSHOOT) &&
+	    opts->overshoot != !!target->overshoot)
+		return -EINVAL;
+	if (opts->scale_pct && !target->ret_probe)
+		return -EINVAL;
+
+	old = target_config(target);
+	config = kmemdup(old, sizeof(*old), GFP_KERNEL);
+	if (!config)
+		return -ENOMEM;
+
+	if (opts->given & TARGET_OPT_DELAY)
+		config->delay_ns = opts->delay_ns;
+	if (opts->given & TARGET_OPT_MODE)
+		config->mode = opts->mode;
+	if (opts->given & TARGET_OPT_SCALE)
+		config->scale_pct = opts->scale_pct;
+	if (opts->given & TARGET_OPT_EVERY)
+		config->every = opts->every;
+	if (opts->given & TARGET_OPT_PROB)
+		config->prob_ppm = opts->prob_ppm;
+	if (opts->given & TARGET_OPT_DIST)
+		config->dist = opts->dist;
+	if (opts->given & TARGET_OPT_MAX)
+		config->max_ns = opts->max_ns;
+	if (opts->given & TARGET_OPT_SIGMA)
+		config->sigma_milli = opts->sigma_milli;
+	if (opts->pid_filter)
+		config->pid_filter = opts->pid_filter;
+
+	/* The copy holds its own reference, to the old cgroup or a new one */
+	if (opts->given & TARGET_OPT_CGROUP) {
+		ret = target_cgroup_get(opts->cgroup_path, &config->cgroup);
+		if (ret) {
+			kfree(config);
+			return ret;
+		}
+	} else {
+		target_cgroup_hold(config->cgroup);
+	}
+
+	/* Likewise its own CPU mask, copied or resolved afresh */
+	if (opts->given & (TARGET_OPT_CPUS | TARGET_OPT_NODE))
+		ret = target_cpus_get(opts->cpus_spec, opts->node,
+				      opts->given & TARGET_OPT_NODE,
+				      &config->cpus);
+	else
+		ret = target_cpus_dup(old->cpus, &config->cpus);
+	if (ret) {
+		target_config_free(config);
+		return ret;
+	}
+	refilter = config->pid_filter != old->pid_filter ||
+		   config->cgroup != old->cgroup;
+
+	/* An autoremove target follows the filter to its new process */
+	if (config->pid_filter != old->pid_filter && target->exit_pid) {
+		target_unwatch_exit(target);
+		ret = target_watch_exit(target, config->pid_filter);
+		if (ret) {
+			target_config_free(config);
+			if (target_watch_exit(target, old->pid_filter)) {
+				/* The old process went too: reap as if woken */
+				WRITE_ONCE(target->exited, true);
+				schedule_work(&speed_bump_reap_work);
+			}
+			return ret;
+		}
+	}
+
+	rcu_assign_pointer(target->config, config);
+	call_rcu(&old->rcu, target_config_free_rcu);
+	speed_bump_watch_changed();
+
+	/* An explicit delay takes over from a sweep */
+	if ((opts->given & TARGET_OPT_DELAY) && target->sweep)
+		target_sweep_stop(target->sweep);
+
+	if (opts->given & TARGET_OPT_BUDGET)
+		WRITE_ONCE(target->budget.ns_per_s, opts->budget_ns_per_s);
+
+	/*
+	 * Move the breakpoints if the pid or cgroup filter changed. A
+	 * pending target is checked again by its register work.
+	 */
+	if (refilter && !target_pending(target)) {
+		ret = speed_bump_apply_uprobe_filter(target);
+		if (ret)
+			pr_warn("speed_bump: failed to re-apply filter for %s:%s: %d\n",
+				target->path, target->symbol, ret);
+	}
+
+	return ret;
+}
+
+/*
+ * Update the target PATH:SYMBOL, or every target of a wildcard group.
+ * Caller must hold speed_bump_mutex.
+ * Returns 0 on success, negative errno on failure.
+ */
+static int update_target_locked(const char *path, const char *symbol,
+				const struct target_opts *opts)
+{
+	struct speed_bump_target *target;
+	struct speed_bump_group *group;
+	char pattern[sizeof(group->pattern)];
+	int ret = 0, err;
+
+	if (speed_bump_has_wildcard(path) || speed_bump_has_wildcard(symbol)) {
+		snprintf(pattern, sizeof(pattern), "%s:%s", path, symbol);
+		group = find_group(pattern, opts->rule_name, opts->profile);
+		if (!group)
+			return -ENOENT;
+
+		/* Keep going on error so the group stays consistent */
+		list_for_each_entry(target, &speed_bump_targets, list) {
+			if (target->group != group)
+				continue;
+			err = update_one_target(target, opts);
+			if (err && !ret)
+				ret = err;
+		}
+	} else {
+		target = find_target(path, symbol, opts->rule_name,
+				     opts->profile);
+		if (!target)
+			return -ENOENT;
+
+		ret = update_one_target(target, opts);
+	}
+
+	if (opts->given & TARGET_OPT_DELAY)
+		pr_info("speed_bump: updated target %s:%s delay=%llu ns\n",
+			path, symbol, opts->delay_ns);
+	else
+		pr_info("speed_bump: updated target %s:%s\n", path, symbol);
+	return ret;
+}
+
+static int update_target(const char *spec)
+{
+	char path[SPEED_BUMP_MAX_PATH_LEN];
+	char symbol[SPEED_BUMP_MAX_SYMBOL_LEN];
+	struct target_opts opts;
+	int ret;
+
+	ret = parse_target_spec(spec, path, sizeof(path),
+				symbol, sizeof(symbol), &opts);
+	if (ret)
+		return ret;
+
+	mutex_lock(&speed_bump_mutex);
+	ret = get_profile(&opts, false);
+	if (!ret) {
+		ret = update_target_locked(path, symbol, &opts);
+		put_profile(opts.profile);
+	}
+	mutex_unlock(&speed_bump_mutex);
+
+	return ret;
+}
+
+/* ============================================================
+ * Sysfs Interface
+ * ============================================================ */
+
+/*
+ * /sys/kernel/speed_bump/enabled
+ *
+ * Read/write global enable flag. When disabled (0), uprobe handlers
+ * return immediately without executing delays.
+ */
+static ssize_t enabled_show(struct kobject *kobj, struct kobj_attribute *attr,
+			    char *buf)
+{
+	return sysfs_emit(buf, "%d\n", atomic_read(&speed_bump_enabled));
+}
+
+static ssize_t enabled_store(struct kobject *kobj, struct kobj_attribute *attr,
+			     const char *buf, size_t count)
+{
+	int val, ret;
+
+	ret = kstrtoint(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	if (val != 0 && val != 1)
+		return -EINVAL;
+
+	atomic_set(&speed_bump_enabled, val);
+	pr_info("speed_bump: %s\n", val ? "enabled" : "disabled");
+	speed_bump_watch_changed();
+	return count;
+}
+
+static struct kobj_attribute enabled_attr =
+	__ATTR(enabled, 0644, enabled_show, enabled_store);
+
+/*
+ * /sys/kernel/speed_bump/targets
+ *
+ * Write-only: Add, remove, or update targets.
+ * Format: +PATH:SYMBOL [DELAY] [OPTS], -PATH:SYMBOL, -*,
+ *         =PATH:SYMBOL DELAY [OPTS]
+ * PATH (last component) and SYMBOL may be globs; see Wildcard Targets.
+ */
+static ssize_t targets_store(struct kobject *kobj, struct kobj_attribute *attr,
+			     const char *buf, size_t count)
+{
+	int ret;
+
+	if (count == 0)
+		return -EINVAL;
+
+	if (count > SPEED_BUMP_MAX_LINE_LEN)
+		return -EINVAL;
 
 	switch (buf[0]) {
 	case '+':
@@ -446,139 +2436,1410 @@ static ssize_t targets_store(struct kobject *kobj, struct kobj_attribute *attr,
 	return ret ? ret : count;
 }
 
-static struct kobj_attribute targets_attr =
-	__ATTR(targets, 0200, NULL, targets_store);
+static struct kobj_attribute targets_attr =
+	__ATTR(targets, 0200, NULL, targets_store);
+
+/* Bytes needed for any one target_format() line or histogram block */
+#define TARGET_FORMAT_MAX	4096
+
+/* " sweep=K/N" for step K of N, or " sweep=done" or " sweep=stopped" */
+static size_t target_format_sweep_state(const struct speed_bump_sweep *sweep,
+					char *buf, size_t size)
+{
+	unsigned int nr_marks = smp_load_acquire(&sweep->nr_marks);
+
+	if (READ_ONCE(sweep->stopped))
+		return scnprintf(buf, size, " sweep=stopped");
+	if (nr_marks > sweep->nr_steps)
+		return scnprintf(buf, size, " sweep=done");
+
+	return scnprintf(buf, size, " sweep=%u/%u", max(nr_marks, 1U),
+			 sweep->nr_steps);
+}
+
+/*
+ * Format one targets_list line for @target into @buf, including the
+ * newline. A line always fits in TARGET_FORMAT_MAX bytes.
+ * Caller must hold speed_bump_mutex.
+ *
+ * Format: PATH:SYMBOL delay_ns=N hits=M total_delay_ns=T
+ *         total_actual_ns=A id=I state=active|pending|failed(ERRNO)
+ *         [mode=M] [pid=P] [autoremove=1] [cgroup=PATH] [group=G]
+ *         [rule=NAME] [buildid=HEX] [profile=NAME] [latency=1] [overshoot=1]
+ *         [sweep=K/N|done|stopped] [scale=PCT] [every=N] [prob=P]
+ *         [dist=D [max=NS] [sigma=S]] [skipped=K] [budget_ns_per_s=B]
+ *         [throttled=K]
+ *
+ * delay_ns is the delay hits get now, a sweep's current step while one
+ * runs. total_delay_ns is the delay asked for, total_actual_ns the time
+ * those delays were measured to take. ERRNO is the positive errno of a failed
+ * async registration. Sampling
+ * options are shown only when they differ from the default;
+ * skipped= is shown for any sampled target, throttled= for any target
+ * with a budget or whose hits a budget has refused.
+ *
+ * Returns: bytes written, which is size - 1 if the line was cut short
+ */
+static size_t target_format(struct speed_bump_target *target, char *buf,
+			    size_t size)
+{
+	const struct speed_bump_target_config *config = target_config(target);
+	u64 hits, total_delay, total_actual, skipped, throttled;
+	size_t len;
+
+	target_read_stats(target, &hits, &total_delay, &total_actual, &skipped,
+			  &throttled);
+
+	len = scnprintf(buf, size,
+			"%s:%s delay_ns=%llu hits=%llu total_delay_ns=%llu total_actual_ns=%llu id=%u",
+			target->path, target->symbol,
+			speed_bump_target_delay_ns(target, config), hits, total_delay,
+			total_actual, target->id);
+	switch (target->state) {
+	case SPEED_BUMP_TARGET_ACTIVE:
+		len += scnprintf(buf + len, size - len, " state=active");
+		break;
+	case SPEED_BUMP_TARGET_PENDING:
+		len += scnprintf(buf + len, size - len, " state=pending");
+		break;
+	case SPEED_BUMP_TARGET_FAILED:
+		len += scnprintf(buf + len, size - len, " state=failed(%d)",
+				 -target->error);
+		break;
+	}
+	if (config->mode != SPEED_BUMP_MODE_SPIN)
+		len += scnprintf(buf + len, size - len, " mode=%s",
+				 speed_bump_delay_mode_name(config->mode));
+	if (config->pid_filter)
+		len += scnprintf(buf + len, size - len, " pid=%d",
+				 config->pid_filter);
+	if (target->exit_pid)
+		len += scnprintf(buf + len, size - len, " autoremove=1");
+	if (config->cgroup) {
+		len += scnprintf(buf + len, size - len, " cgroup=");
+		len += target_cgroup_format(config->cgroup, buf + len,
+					    size - len);
+	}
+	if (target->group)
+		len += scnprintf(buf + len, size - len, " group=%u",
+				 target->group->id);
+	if (target->rule[0])
+		len += scnprintf(buf + len, size - len, " rule=%s",
+				 target->rule);
+	if (target->build_id_len)
+		len += scnprintf(buf + len, size - len, " buildid=%*phN",
+				 target->build_id_len, target->build_id);
+	if (config->cpus)
+		len += scnprintf(buf + len, size - len, " cpus=%*pbl",
+				 cpumask_pr_args(config->cpus));
+	if (target->profile)
+		len += scnprintf(buf + len, size - len, " profile=%s",
+				 target->profile->name);
+	if (target->latency)
+		len += scnprintf(buf + len, size - len, " latency=1");
+	if (target->overshoot)
+		len += scnprintf(buf + len, size - len, " overshoot=1");
+	if (target->sweep)
+		len += target_format_sweep_state(target->sweep, buf + len,
+						 size - len);
+	if (config->scale_pct)
+		len += scnprintf(buf + len, size - len, " scale=%u",
+				 config->scale_pct);
+	if (config->every > 1)
+		len += scnprintf(buf + len, size - len, " every=%u",
+				 config->every);
+	if (config->prob_ppm < SPEED_BUMP_PROB_ONE)
+		len += scnprintf(buf + len, size - len, " prob=%u.%06u",
+				 config->prob_ppm / SPEED_BUMP_PROB_ONE,
+				 config->prob_ppm % SPEED_BUMP_PROB_ONE);
+	if (config->dist != SPEED_BUMP_DIST_FIXED) {
+		len += scnprintf(buf + len, size - len, " dist=%s",
+				 speed_bump_dist_name(config->dist));
+		if (config->max_ns)
+			len += scnprintf(buf + len, size - len, " max=%llu",
+					 config->max_ns);
+		if (config->dist == SPEED_BUMP_DIST_LOGNORMAL)
+			len += scnprintf(buf + len, size - len, " sigma=%u.%03u",
+					 config->sigma_milli / 1000,
+					 config->sigma_milli % 1000);
+	}
+	if (target_is_sampled(config))
+		len += scnprintf(buf + len, size - len, " skipped=%llu",
+				 skipped);
+	if (target->budget.ns_per_s)
+		len += scnprintf(buf + len, size - len, " budget_ns_per_s=%llu",
+				 target->budget.ns_per_s);
+	if (target->budget.ns_per_s || throttled)
+		len += scnprintf(buf + len, size - len, " throttled=%llu",
+				 throttled);
+	len += scnprintf(buf + len, size - len, "\n");
+
+	return len;
+}
+
+/*
+ * Format the histogram @percpu of @target into @buf: nothing if it is
+ * not kept, else one summary line and one line per non-empty log2
+ * bucket:
+ *
+ *   PATH:SYMBOL samples=N mean_ns=M p50_ns=A p90_ns=B p99_ns=C
+ *     LO-HI COUNT
+ *
+ * Percentiles are the upper bound of the bucket holding them. A block
+ * always fits in TARGET_FORMAT_MAX bytes.
+ * Caller must hold speed_bump_mutex.
+ *
+ * Returns: bytes written, which is size - 1 if the block was cut short
+ */
+static size_t target_format_hist(struct speed_bump_target *target,
+				 struct speed_bump_hist __percpu *percpu,
+				 char *buf, size_t size)
+{
+	struct speed_bump_hist hist;
+	unsigned int i;
+	size_t len;
+	int cpu;
+
+	if (!percpu)
+		return 0;
+
+	memset(&hist, 0, sizeof(hist));
+	for_each_possible_cpu(cpu)
+		speed_bump_hist_merge(&hist, per_cpu_ptr(percpu, cpu));
+
+	len = scnprintf(buf, size,
+			"%s:%s samples=%llu mean_ns=%llu p50_ns=%llu p90_ns=%llu p99_ns=%llu\n",
+			target->path, target->symbol, hist.count,
+			hist.count ? div64_u64(hist.sum_ns, hist.count) : 0,
+			speed_bump_hist_percentile(&hist, 50),
+			speed_bump_hist_percentile(&hist, 90),
+			speed_bump_hist_percentile(&hist, 99));
+
+	for (i = 0; i < SPEED_BUMP_HIST_BUCKETS; i++) {
+		if (!hist.buckets[i])
+			continue;
+		len += scnprintf(buf + len, size - len, "  %llu-%llu %llu\n",
+				 speed_bump_hist_bucket_lo(i),
+				 speed_bump_hist_bucket_lo(i + 1) - 1,
+				 hist.buckets[i]);
+	}
+
+	return len;
+}
+
+/* The latency block of a latency=1 target: entry->return times */
+static size_t target_format_latency(struct speed_bump_target *target,
+				    char *buf, size_t size)
+{
+	return target_format_hist(target, target->latency, buf, size);
+}
+
+/* The overshoot block of an overshoot=1 target: actual - requested delay */
+static size_t target_format_overshoot(struct speed_bump_target *target,
+				      char *buf, size_t size)
+{
+	return target_format_hist(target, target->overshoot, buf, size);
+}
+
+typedef size_t (*target_format_fn)(struct speed_bump_target *target,
+				   char *buf, size_t size);
+
+/*
+ * Fill a sysfs page with @fmt's output for every target. Only whole
+ * entries are emitted: once the page is full the rest is left out, and
+ * the debugfs file of the same listing has them all.
+ */
+static ssize_t targets_emit_page(char *buf, target_format_fn fmt,
+				 const char *file, const char *debugfs_file)
+{
+	struct speed_bump_target *target;
+	size_t len = 0, n;
+
+	mutex_lock(&speed_bump_mutex);
+
+	list_for_each_entry(target, &speed_bump_targets, list) {
+		n = fmt(target, buf + len, PAGE_SIZE - len);
+		if (len + n >= PAGE_SIZE - 1) {
+			pr_warn_once("speed_bump: %s is full, read speed_bump/%s in debugfs for every target\n",
+				     file, debugfs_file);
+			break;
+		}
+		len += n;
+	}
+
+	mutex_unlock(&speed_bump_mutex);
+	return len;
+}
+
+/*
+ * /sys/kernel/speed_bump/targets_list
+ *
+ * Read-only: List configured targets with their delays and hit counts,
+ * one target_format() line each, as many as fit in a page.
+ */
+static ssize_t targets_list_show(struct kobject *kobj,
+				 struct kobj_attribute *attr, char *buf)
+{
+	return targets_emit_page(buf, target_format, "targets_list", "targets");
+}
+
+static struct kobj_attribute targets_list_attr =
+	__ATTR(targets_list, 0444, targets_list_show, NULL);
+
+/*
+ * /sys/kernel/speed_bump/groups
+ *
+ * Read-only: List wildcard groups.
+ * Format: ID PATTERN targets=N
+ */
+static ssize_t groups_show(struct kobject *kobj, struct kobj_attribute *attr,
+			   char *buf)
+{
+	struct speed_bump_group *group;
+	ssize_t len = 0;
+
+	mutex_lock(&speed_bump_mutex);
+
+	list_for_each_entry(group, &speed_bump_groups, list) {
+		len += sysfs_emit_at(buf, len, "%u %s targets=%u",
+				     group->id, group->pattern,
+				     group->nr_targets);
+		if (group->profile)
+			len += sysfs_emit_at(buf, len, " profile=%s",
+					     group->profile->name);
+		len += sysfs_emit_at(buf, len, "\n");
+	}
+
+	mutex_unlock(&speed_bump_mutex);
+	return len;
+}
+
+static struct kobj_attribute groups_attr =
+	__ATTR(groups, 0444, groups_show, NULL);
+
+/*
+ * /sys/kernel/speed_bump/profiles
+ *
+ * Read: One line per profile: "ID NAME targets=N active=0|1"
+ */
+static ssize_t profiles_show(struct kobject *kobj, struct kobj_attribute *attr,
+			     char *buf)
+{
+	struct speed_bump_profile *profile;
+	unsigned int active = READ_ONCE(speed_bump_active_profile);
+	ssize_t len = 0;
+
+	mutex_lock(&speed_bump_mutex);
+
+	list_for_each_entry(profile, &speed_bump_profiles, list)
+		len += sysfs_emit_at(buf, len, "%u %s targets=%u active=%d\n",
+				     profile->id, profile->name,
+				     profile->nr_targets,
+				     profile->id == active);
+
+	mutex_unlock(&speed_bump_mutex);
+	return len;
+}
+
+static struct kobj_attribute profiles_attr =
+	__ATTR(profiles, 0444, profiles_show, NULL);
+
+/*
+ * /sys/kernel/speed_bump/profile
+ *
+ * Read: Name of the active profile, or "none"
+ * Write: A profile name to activate it, or "none" to deactivate
+ */
+static ssize_t profile_show(struct kobject *kobj, struct kobj_attribute *attr,
+			    char *buf)
+{
+	struct speed_bump_profile *profile;
+	unsigned int active;
+	ssize_t len = 0;
+
+	mutex_lock(&speed_bump_mutex);
+
+	active = READ_ONCE(speed_bump_active_profile);
+	list_for_each_entry(profile, &speed_bump_profiles, list) {
+		if (profile->id == active) {
+			len = sysfs_emit(buf, "%s\n", profile->name);
+			break;
+		}
+	}
+
+	mutex_unlock(&speed_bump_mutex);
+	return len ? len : sysfs_emit(buf, "none\n");
+}
+
+static ssize_t profile_store(struct kobject *kobj, struct kobj_attribute *attr,
+			     const char *buf, size_t count)
+{
+	char name[SPEED_BUMP_MAX_PROFILE_LEN];
+	int ret;
+
+	if (strscpy(name, buf, sizeof(name)) < 0)
+		return -ENAMETOOLONG;
+
+	mutex_lock(&speed_bump_mutex);
+	ret = activate_profile_locked(strim(name));
+	mutex_unlock(&speed_bump_mutex);
+
+	return ret ? ret : count;
+}
+
+static struct kobj_attribute profile_attr =
+	__ATTR(profile, 0644, profile_show, profile_store);
+
+/*
+ * /sys/kernel/speed_bump/latency
+ *
+ * Read-only: Entry->return latency of every latency=1 target, excluding
+ * the injected delay, one target_format_latency() block each, as many
+ * as fit in a page.
+ */
+static ssize_t latency_show(struct kobject *kobj, struct kobj_attribute *attr,
+			    char *buf)
+{
+	return targets_emit_page(buf, target_format_latency, "latency",
+				 "latency");
+}
+
+static struct kobj_attribute latency_attr =
+	__ATTR(latency, 0444, latency_show, NULL);
+
+/*
+ * /sys/kernel/speed_bump/overshoot
+ *
+ * Read-only: How far the delays of every overshoot=1 target ran past
+ * what was asked, one target_format_overshoot() block each, as many as
+ * fit in a page.
+ */
+static ssize_t overshoot_show(struct kobject *kobj,
+			      struct kobj_attribute *attr, char *buf)
+{
+	return targets_emit_page(buf, target_format_overshoot, "overshoot",
+				 "overshoot");
+}
+
+static struct kobj_attribute overshoot_attr =
+	__ATTR(overshoot, 0444, overshoot_show, NULL);
+
+/*
+ * Aggregate per-CPU counters.
+ * Returns the sum of all per-CPU values.
+ */
+static u64 aggregate_percpu_hits(void)
+{
+	u64 total = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		total += per_cpu(speed_bump_hits_percpu, cpu);
+
+	return total;
+}
+
+static u64 aggregate_percpu_delay(void)
+{
+	u64 total = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		total += per_cpu(speed_bump_delay_percpu, cpu);
+
+	return total;
+}
+
+static u64 aggregate_percpu_actual(void)
+{
+	u64 total = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		total += per_cpu(speed_bump_actual_percpu, cpu);
+
+	return total;
+}
+
+static u64 aggregate_percpu_throttled(void)
+{
+	u64 total = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		total += per_cpu(speed_bump_throttled_percpu, cpu);
+
+	return total;
+}
+
+/*
+ * /sys/kernel/speed_bump/stats
+ *
+ * Read-only: Global statistics.
+ */
+static ssize_t stats_show(struct kobject *kobj, struct kobj_attribute *attr,
+			  char *buf)
+{
+	unsigned int symcache_files;
+	unsigned long symcache_bytes;
+
+	speed_bump_symcache_stats(&symcache_files, &symcache_bytes);
+
+	return sysfs_emit(buf,
+			  "enabled: %d\n"
+			  "targets: %d\n"
+			  "total_hits: %llu\n"
+			  "total_delay_ns: %llu\n"
+			  "total_actual_ns: %llu\n"
+			  "total_throttled: %llu\n"
+			  "budget_ns_per_s: %llu\n"
+			  "symcache_files: %u\n"
+			  "symcache_bytes: %lu\n"
+			  "delay_clock: %s\n"
+			  "delay_cycles_per_us: %llu\n"
+			  "delay_overhead_ns: %llu\n",
+			  atomic_read(&speed_bump_enabled),
+			  atomic_read(&speed_bump_target_count),
+			  aggregate_percpu_hits(),
+			  aggregate_percpu_delay(),
+			  aggregate_percpu_actual(),
+			  aggregate_percpu_throttled(),
+			  READ_ONCE(speed_bump_budget.ns_per_s),
+			  symcache_files, symcache_bytes,
+			  speed_bump_delay_clock() == SPEED_BUMP_CLOCK_CYCLES ?
+			  "cycles" : "ktime",
+			  speed_bump_delay_cycles_per_us(),
+			  speed_bump_delay_overhead_ns());
+}
+
+static struct kobj_attribute stats_attr =
+	__ATTR(stats, 0444, stats_show, NULL);
+
+/*
+ * /sys/kernel/speed_bump/default_delay_ns
+ *
+ * Read/write: Default delay applied to targets without explicit delay.
+ */
+static ssize_t default_delay_ns_show(struct kobject *kobj,
+				     struct kobj_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "%llu\n", speed_bump_default_delay);
+}
+
+static ssize_t default_delay_ns_store(struct kobject *kobj,
+				      struct kobj_attribute *attr,
+				      const char *buf, size_t count)
+{
+	u64 val;
+	int ret;
+
+	ret = kstrtou64(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	if (val > SPEED_BUMP_MAX_DELAY_NS)
+		return -ERANGE;
+
+	speed_bump_default_delay = val;
+	return count;
+}
+
+static struct kobj_attribute default_delay_ns_attr =
+	__ATTR(default_delay_ns, 0644, default_delay_ns_show,
+	       default_delay_ns_store);
+
+/*
+ * /sys/kernel/speed_bump/budget_ns_per_s
+ *
+ * Read/write: Cap on the delay injected per second across all targets,
+ * 0 for no cap. Hits over the cap are counted but not delayed.
+ */
+static ssize_t budget_ns_per_s_show(struct kobject *kobj,
+				    struct kobj_attribute *attr, char *buf)
+{
+	return sysfs_emit(buf, "%llu\n", READ_ONCE(speed_bump_budget.ns_per_s));
+}
+
+static ssize_t budget_ns_per_s_store(struct kobject *kobj,
+				     struct kobj_attribute *attr,
+				     const char *buf, size_t count)
+{
+	u64 val;
+	int ret;
+
+	ret = kstrtou64(buf, 10, &val);
+	if (ret)
+		return ret;
+
+	if (val > (u64)NSEC_PER_SEC * num_possible_cpus())
+		return -ERANGE;
+
+	WRITE_ONCE(speed_bump_budget.ns_per_s, val);
+	return count;
+}
+
+static struct kobj_attribute budget_ns_per_s_attr =
+	__ATTR(budget_ns_per_s, 0644, budget_ns_per_s_show,
+	       budget_ns_per_s_store);
+
+/* Attribute group */
+static struct attribute *speed_bump_attrs[] = {
+	&enabled_attr.attr,
+	&targets_attr.attr,
+	&targets_list_attr.attr,
+	&groups_attr.attr,
+	&latency_attr.attr,
+	&overshoot_attr.attr,
+	&stats_attr.attr,
+	&default_delay_ns_attr.attr,
+	&budget_ns_per_s_attr.attr,
+	&profile_attr.attr,
+	&profiles_attr.attr,
+	NULL,
+};
+
+static struct attribute_group speed_bump_attr_group = {
+	.attrs = speed_bump_attrs,
+};
+
+/* ============================================================
+ * debugfs Interface
+ * ============================================================ */
+
+static struct dentry *speed_bump_debugfs;
+
+/*
+ * The seq_file listings walk the target list under speed_bump_mutex,
+ * formatting each target into a per-open TARGET_FORMAT_MAX buffer, so
+ * they have no size limit.
+ */
+static void *targets_seq_start(struct seq_file *m, loff_t *pos)
+{
+	mutex_lock(&speed_bump_mutex);
+	return seq_list_start(&speed_bump_targets, *pos);
+}
+
+static void *targets_seq_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	return seq_list_next(v, &speed_bump_targets, pos);
+}
+
+static void targets_seq_stop(struct seq_file *m, void *v)
+{
+	mutex_unlock(&speed_bump_mutex);
+}
+
+static int targets_seq_show(struct seq_file *m, void *v)
+{
+	struct speed_bump_target *target =
+		list_entry(v, struct speed_bump_target, list);
+	char *buf = m->private;
+
+	seq_write(m, buf, target_format(target, buf, TARGET_FORMAT_MAX));
+	return 0;
+}
+
+static int latency_seq_show(struct seq_file *m, void *v)
+{
+	struct speed_bump_target *target =
+		list_entry(v, struct speed_bump_target, list);
+	char *buf = m->private;
+
+	seq_write(m, buf, target_format_latency(target, buf, TARGET_FORMAT_MAX));
+	return 0;
+}
+
+static int overshoot_seq_show(struct seq_file *m, void *v)
+{
+	struct speed_bump_target *target =
+		list_entry(v, struct speed_bump_target, list);
+	char *buf = m->private;
+
+	seq_write(m, buf,
+		  target_format_overshoot(target, buf, TARGET_FORMAT_MAX));
+	return 0;
+}
+
+/*
+ * The marks of a sweep= target: a header line, then one line per step
+ * begun and a last one when the schedule ended, each with the time
+ * (CLOCK_MONOTONIC) and the target's counters at that moment:
+ *
+ *   PATH:SYMBOL id=I steps=N sweep=K/N|done|stopped
+ *     STEP TIME_NS DELAY_NS HITS TOTAL_DELAY_NS TOTAL_ACTUAL_NS
+ *     end TIME_NS - HITS TOTAL_DELAY_NS TOTAL_ACTUAL_NS
+ *
+ * A step's hits and delay are the difference to the next line. Too long
+ * for a sysfs page with many steps, so only debugfs lists them.
+ */
+static int sweeps_seq_show(struct seq_file *m, void *v)
+{
+	struct speed_bump_target *target =
+		list_entry(v, struct speed_bump_target, list);
+	const struct speed_bump_sweep *sweep = target->sweep;
+	const struct speed_bump_sweep_mark *mark;
+	char state[32];
+	unsigned int i, nr_marks;
+
+	if (!sweep)
+		return 0;
+
+	nr_marks = smp_load_acquire(&sweep->nr_marks);
+	target_format_sweep_state(sweep, state, sizeof(state));
+	seq_printf(m, "%s:%s id=%u steps=%u%s\n", target->path, target->symbol,
+		   target->id, sweep->nr_steps, state);
+
+	for (i = 0; i < nr_marks; i++) {
+		mark = &sweep->marks[i];
+		if (i < sweep->nr_steps)
+			seq_printf(m, "  %u %llu %llu", i + 1, mark->time_ns,
+				   sweep->steps[i].delay_ns);
+		else
+			seq_printf(m, "  end %llu -", mark->time_ns);
+		seq_printf(m, " %llu %llu %llu\n", mark->hits, mark->delay_ns,
+			   mark->actual_ns);
+	}
+	return 0;
+}
+
+static const struct seq_operations targets_seq_ops = {
+	.start = targets_seq_start,
+	.next  = targets_seq_next,
+	.stop  = targets_seq_stop,
+	.show  = targets_seq_show,
+};
+
+static const struct seq_operations latency_seq_ops = {
+	.start = targets_seq_start,
+	.next  = targets_seq_next,
+	.stop  = targets_seq_stop,
+	.show  = latency_seq_show,
+};
+
+static const struct seq_operations overshoot_seq_ops = {
+	.start = targets_seq_start,
+	.next  = targets_seq_next,
+	.stop  = targets_seq_stop,
+	.show  = overshoot_seq_show,
+};
+
+static const struct seq_operations sweeps_seq_ops = {
+	.start = targets_seq_start,
+	.next  = targets_seq_next,
+	.stop  = targets_seq_stop,
+	.show  = sweeps_seq_show,
+};
+
+static int targets_debugfs_open(struct inode *inode, struct file *file)
+{
+	return seq_open_private(file, &targets_seq_ops, TARGET_FORMAT_MAX);
+}
+
+static int latency_debugfs_open(struct inode *inode, struct file *file)
+{
+	return seq_open_private(file, &latency_seq_ops, TARGET_FORMAT_MAX);
+}
+
+static int overshoot_debugfs_open(struct inode *inode, struct file *file)
+{
+	return seq_open_private(file, &overshoot_seq_ops, TARGET_FORMAT_MAX);
+}
+
+static int sweeps_debugfs_open(struct inode *inode, struct file *file)
+{
+	return seq_open(file, &sweeps_seq_ops);
+}
+
+static const struct file_operations targets_debugfs_fops = {
+	.owner   = THIS_MODULE,
+	.open    = targets_debugfs_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = seq_release_private,
+};
+
+static const struct file_operations latency_debugfs_fops = {
+	.owner   = THIS_MODULE,
+	.open    = latency_debugfs_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = seq_release_private,
+};
+
+static const struct file_operations overshoot_debugfs_fops = {
+	.owner   = THIS_MODULE,
+	.open    = overshoot_debugfs_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = seq_release_private,
+};
+
+static const struct file_operations sweeps_debugfs_fops = {
+	.owner   = THIS_MODULE,
+	.open    = sweeps_debugfs_open,
+	.read    = seq_read,
+	.llseek  = seq_lseek,
+	.release = seq_release,
+};
 
 /*
- * /sys/kernel/speed_bump/targets_list
+ * stats.bin: a struct speed_bump_stats_header followed by nr_targets
+ * records of record_size bytes (see speed_bump_uapi.h). Each open file
+ * holds a snapshot, retaken by every read at offset 0, so a poller can
+ * keep the file open and pread() it whole each time.
+ */
+struct stats_bin {
+	struct mutex lock;  /* serialises preads of one open file */
+	void *data;
+	size_t size;
+	size_t alloc;
+};
+
+/*
+ * Take a new snapshot of every target's counters into @snap.
  *
- * Read-only: List all configured targets with their delays and hit counts.
- * Format: PATH:SYMBOL delay_ns=N hits=M [pid=P]
+ * Returns: 0 on success, -ENOMEM
  */
-static ssize_t targets_list_show(struct kobject *kobj,
-				 struct kobj_attribute *attr, char *buf)
+static int stats_bin_fill(struct stats_bin *snap)
 {
+	struct speed_bump_stats_header *hdr;
+	struct speed_bump_stats_record *rec;
+	struct speed_bump_target_stats *stats;
 	struct speed_bump_target *target;
-	ssize_t len = 0;
+	size_t record_size, size;
+	unsigned int nr = 0, max_nr;
+	int cpu;
+
+	record_size = struct_size(rec, cpus, nr_cpu_ids);
 
 	mutex_lock(&speed_bump_mutex);
 
+	max_nr = atomic_read(&speed_bump_target_count);
+	size = array_size(record_size, max_nr);
+	if (size > SIZE_MAX - sizeof(*hdr)) {
+		mutex_unlock(&speed_bump_mutex);
+		return -ENOMEM;
+	}
+	size += sizeof(*hdr);
+
+	if (size > snap->alloc) {
+		kvfree(snap->data);
+		snap->alloc = 0;
+		snap->data = kvzalloc(size, GFP_KERNEL);
+		if (!snap->data) {
+			snap->size = 0;
+			mutex_unlock(&speed_bump_mutex);
+			return -ENOMEM;
+		}
+		snap->alloc = size;
+	} else {
+		memset(snap->data, 0, size);
+	}
+
+	hdr = snap->data;
+	hdr->magic = SPEED_BUMP_STATS_MAGIC;
+	hdr->version = SPEED_BUMP_STATS_VERSION;
+	hdr->header_size = sizeof(*hdr);
+	hdr->record_size = record_size;
+	hdr->nr_cpus = nr_cpu_ids;
+
 	list_for_each_entry(target, &speed_bump_targets, list) {
-		if (target->pid_filter)
-			len += sysfs_emit_at(buf, len,
-					     "%s:%s delay_ns=%llu hits=%lld pid=%d\n",
-					     target->path, target->symbol,
-					     target->delay_ns,
-					     atomic64_read(&target->hit_count),
-					     target->pid_filter);
-		else
-			len += sysfs_emit_at(buf, len,
-					     "%s:%s delay_ns=%llu hits=%lld\n",
-					     target->path, target->symbol,
-					     target->delay_ns,
-					     atomic64_read(&target->hit_count));
+		if (nr == max_nr)
+			break;
+		rec = snap->data + sizeof(*hdr) + nr * record_size;
+		rec->id = target->id;
+
+		for_each_possible_cpu(cpu) {
+			stats = per_cpu_ptr(target->stats, cpu);
+			rec->cpus[cpu].hits = READ_ONCE(stats->hits);
+			rec->cpus[cpu].delay_ns = READ_ONCE(stats->delay_ns);
+			rec->hits += rec->cpus[cpu].hits;
+			rec->total_delay_ns += rec->cpus[cpu].delay_ns;
+			rec->total_actual_ns += READ_ONCE(stats->actual_ns);
+			rec->skipped += READ_ONCE(stats->skipped);
+			rec->throttled += READ_ONCE(stats->throttled);
+		}
+		nr++;
 	}
 
 	mutex_unlock(&speed_bump_mutex);
-	return len;
+
+	hdr->nr_targets = nr;
+	hdr->total_hits = aggregate_percpu_hits();
+	hdr->total_delay_ns = aggregate_percpu_delay();
+	hdr->total_throttled = aggregate_percpu_throttled();
+	hdr->total_actual_ns = aggregate_percpu_actual();
+	snap->size = size;
+	return 0;
 }
 
-static struct kobj_attribute targets_list_attr =
-	__ATTR(targets_list, 0444, targets_list_show, NULL);
+static int stats_bin_open(struct inode *inode, struct file *file)
+{
+	struct stats_bin *snap;
+
+	snap = kzalloc(sizeof(*snap), GFP_KERNEL);
+	if (!snap)
+		return -ENOMEM;
+
+	mutex_init(&snap->lock);
+	file->private_data = snap;
+	return 0;
+}
+
+static ssize_t stats_bin_read(struct file *file, char __user *ubuf,
+			      size_t count, loff_t *ppos)
+{
+	struct stats_bin *snap = file->private_data;
+	ssize_t ret;
+
+	mutex_lock(&snap->lock);
+
+	if (*ppos == 0) {
+		ret = stats_bin_fill(snap);
+		if (ret) {
+			mutex_unlock(&snap->lock);
+			return ret;
+		}
+	}
+
+	ret = simple_read_from_buffer(ubuf, count, ppos, snap->data,
+				      snap->size);
+	mutex_unlock(&snap->lock);
+	return ret;
+}
+
+static int stats_bin_release(struct inode *inode, struct file *file)
+{
+	struct stats_bin *snap = file->private_data;
+
+	kvfree(snap->data);
+	kfree(snap);
+	return 0;
+}
+
+static const struct file_operations stats_bin_fops = {
+	.owner   = THIS_MODULE,
+	.open    = stats_bin_open,
+	.read    = stats_bin_read,
+	.llseek  = default_llseek,
+	.release = stats_bin_release,
+};
 
 /*
- * Aggregate per-CPU counters.
- * Returns the sum of all per-CPU values.
+ * Create /sys/kernel/debug/speed_bump/. debugfs is optional: the
+ * module works without it, so failures are not reported.
  */
-static u64 aggregate_percpu_hits(void)
+static void speed_bump_debugfs_init(void)
 {
-	u64 total = 0;
-	int cpu;
+	speed_bump_debugfs = debugfs_create_dir("speed_bump", NULL);
+	debugfs_create_file("targets", 0444, speed_bump_debugfs, NULL,
+			    &targets_debugfs_fops);
+	debugfs_create_file("latency", 0444, speed_bump_debugfs, NULL,
+			    &latency_debugfs_fops);
+	debugfs_create_file("overshoot", 0444, speed_bump_debugfs, NULL,
+			    &overshoot_debugfs_fops);
+	debugfs_create_file("sweeps", 0444, speed_bump_debugfs, NULL,
+			    &sweeps_debugfs_fops);
+	debugfs_create_file("stats.bin", 0444, speed_bump_debugfs, NULL,
+			    &stats_bin_fops);
+}
 
-	for_each_possible_cpu(cpu)
-		total += per_cpu(speed_bump_hits_percpu, cpu);
+/* ============================================================
+ * Control Device
+ * ============================================================ */
 
-	return total;
-}
+/*
+ * /dev/speed_bump takes batches of binary target descriptors, so a tool
+ * can add, update or remove thousands of targets with one syscall and
+ * one lock round-trip, and learn each entry's status and target id
+ * without parsing text back.
+ */
 
-static u64 aggregate_percpu_delay(void)
+/*
+ * Fill @opts from the option fields of @desc.
+ * Returns 0 on success, negative errno if a field is invalid.
+ */
+static int target_opts_from_desc(const struct speed_bump_target_desc *desc,
+				 struct target_opts *opts)
 {
-	u64 total = 0;
-	int cpu;
+	int ret;
 
-	for_each_possible_cpu(cpu)
-		total += per_cpu(speed_bump_delay_percpu, cpu);
+	BUILD_BUG_ON(SPEED_BUMP_DESC_MODE_SPIN != SPEED_BUMP_MODE_SPIN);
+	BUILD_BUG_ON(SPEED_BUMP_DESC_MODE_SLEEP != SPEED_BUMP_MODE_SLEEP);
+	BUILD_BUG_ON(SPEED_BUMP_DESC_MODE_HYBRID != SPEED_BUMP_MODE_HYBRID);
+	BUILD_BUG_ON(SPEED_BUMP_DESC_DIST_FIXED != SPEED_BUMP_DIST_FIXED);
+	BUILD_BUG_ON(SPEED_BUMP_DESC_DIST_EXP != SPEED_BUMP_DIST_EXP);
+	BUILD_BUG_ON(SPEED_BUMP_DESC_DIST_UNIFORM != SPEED_BUMP_DIST_UNIFORM);
+	BUILD_BUG_ON(SPEED_BUMP_DESC_DIST_LOGNORMAL != SPEED_BUMP_DIST_LOGNORMAL);
 
-	return total;
+	if ((desc->given & ~SPEED_BUMP_OPT_ALL) || desc->reserved ||
+	    desc->reserved2 || desc->latency > 1)
+		return -EINVAL;
+
+	target_opts_init(opts);
+	opts->given = desc->given;
+
+	if (desc->given & TARGET_OPT_DELAY)
+		opts->delay_ns = desc->delay_ns;
+	if (desc->given & TARGET_OPT_PID)
+		opts->pid_filter = desc->pid;
+	if (desc->given & TARGET_OPT_MODE) {
+		if (desc->mode > SPEED_BUMP_DESC_MODE_HYBRID)
+			return -EINVAL;
+		opts->mode = desc->mode;
+	}
+	if (desc->given & TARGET_OPT_LATENCY)
+		opts->latency = desc->latency;
+	if (desc->given & TARGET_OPT_SCALE)
+		opts->scale_pct = desc->scale_pct;
+	if (desc->given & TARGET_OPT_EVERY)
+		opts->every = desc->every;
+	if (desc->given & TARGET_OPT_PROB)
+		opts->prob_ppm = desc->prob_ppm;
+	if (desc->given & TARGET_OPT_DIST) {
+		if (desc->dist > SPEED_BUMP_DESC_DIST_LOGNORMAL)
+			return -EINVAL;
+		opts->dist = desc->dist;
+	}
+	if (desc->given & TARGET_OPT_MAX)
+		opts->max_ns = desc->max_ns;
+	if (desc->given & TARGET_OPT_SIGMA)
+		opts->sigma_milli = desc->sigma_milli;
+	if (desc->given & TARGET_OPT_BUDGET)
+		opts->budget_ns_per_s = desc->budget_ns_per_s;
+	if (desc->given & TARGET_OPT_ASYNC)
+		opts->async = true;
+	if (desc->given & TARGET_OPT_AUTOREMOVE)
+		opts->autoremove = true;
+	if (desc->given & TARGET_OPT_OVERSHOOT)
+		opts->overshoot = true;
+	if (desc->given & TARGET_OPT_SWEEP) {
+		if (strnlen(desc->sweep, sizeof(desc->sweep)) == sizeof(desc->sweep))
+			return -ERANGE;
+		ret = speed_bump_parse_sweep(desc->sweep, NULL);
+		if (ret < 0)
+			return ret;
+		strscpy(opts->sweep_spec, desc->sweep,
+			sizeof(opts->sweep_spec));
+	}
+	if (desc->given & TARGET_OPT_CGROUP) {
+		if (desc->cgroup[0] != '/')
+			return -EINVAL;
+		strscpy(opts->cgroup_path, desc->cgroup,
+			sizeof(opts->cgroup_path));
+	}
+	if (desc->profile[0]) {
+		if (profile_name_check(desc->profile))
+			return -EINVAL;
+		strscpy(opts->profile_name, desc->profile,
+			sizeof(opts->profile_name));
+	}
+	if (desc->rule[0]) {
+		if (profile_name_check(desc->rule))
+			return -EINVAL;
+		strscpy(opts->rule_name, desc->rule, sizeof(opts->rule_name));
+	}
+	if (desc->given & TARGET_OPT_BUILDID) {
+		if (strnlen(desc->buildid, sizeof(desc->buildid)) == sizeof(desc->buildid))
+			return -EINVAL;
+		ret = target_parse_build_id(desc->buildid, opts);
+		if (ret)
+			return ret;
+	}
+	if (desc->given & TARGET_OPT_CPUS) {
+		if (strnlen(desc->cpus, sizeof(desc->cpus)) == sizeof(desc->cpus) ||
+		    !desc->cpus[0])
+			return -EINVAL;
+		strscpy(opts->cpus_spec, desc->cpus, sizeof(opts->cpus_spec));
+	}
+	if (desc->given & TARGET_OPT_NODE)
+		opts->node = desc->node;
+
+	/* As in parse_target_spec() */
+	if ((opts->given & TARGET_OPT_SCALE) && !(opts->given & TARGET_OPT_DELAY))
+		opts->delay_ns = 0;
+
+	return target_opts_check(opts);
 }
 
 /*
- * /sys/kernel/speed_bump/stats
+ * Apply one descriptor. Single targets removed by it are only detached
+ * onto @doomed; the caller frees them all after one sync.
  *
- * Read-only: Global statistics.
+ * Caller must hold speed_bump_mutex.
+ * Returns 0 on success, negative errno on failure.
  */
-static ssize_t stats_show(struct kobject *kobj, struct kobj_attribute *attr,
-			  char *buf)
+static int ctl_apply_desc(struct speed_bump_target_desc *desc,
+			  struct list_head *doomed)
 {
-	return sysfs_emit(buf,
-			  "enabled: %d\n"
-			  "targets: %d\n"
-			  "total_hits: %llu\n"
-			  "total_delay_ns: %llu\n",
-			  atomic_read(&speed_bump_enabled),
-			  atomic_read(&speed_bump_target_count),
-			  aggregate_percpu_hits(),
-			  aggregate_percpu_delay());
-}
+	struct speed_bump_target *target = NULL;
+	struct target_opts opts;
+	int ret;
 
-static struct kobj_attribute stats_attr =
-	__ATTR(stats, 0444, stats_show, NULL);
+	if (strnlen(desc->path, sizeof(desc->path)) == sizeof(desc->path) ||
+	    strnlen(desc->symbol, sizeof(desc->symbol)) == sizeof(desc->symbol) ||
+	    strnlen(desc->profile, sizeof(desc->profile)) == sizeof(desc->profile) ||
+	    strnlen(desc->rule, sizeof(desc->rule)) == sizeof(desc->rule) ||
+	    strnlen(desc->cgroup, sizeof(desc->cgroup)) == sizeof(desc->cgroup))
+		return -ENAMETOOLONG;
+
+	/* As in parse_target_spec(), so every spelling finds the target */
+	if (desc->path[0]) {
+		ret = target_location_canon(desc->symbol);
+		if (ret)
+			return ret;
+	}
+
+	switch (desc->op) {
+	case SPEED_BUMP_OP_ADD:
+		desc->id = 0;
+		ret = target_opts_from_desc(desc, &opts);
+		if (ret)
+			return ret;
+		ret = target_name_check(desc->path, desc->symbol);
+		if (ret)
+			return ret;
+		ret = get_profile(&opts, true);
+		if (ret)
+			return ret;
+		ret = add_target_locked(desc->path, desc->symbol, &opts,
+					&desc->id, &desc->group);
+		put_profile(opts.profile);
+		return ret;
+
+	case SPEED_BUMP_OP_UPDATE:
+		ret = target_opts_from_desc(desc, &opts);
+		if (ret)
+			return ret;
+		if (desc->path[0]) {
+			ret = get_profile(&opts, false);
+			if (ret)
+				return ret;
+			ret = update_target_locked(desc->path, desc->symbol,
+						   &opts);
+			put_profile(opts.profile);
+			return ret;
+		}
+		target = find_target_by_id(desc->id);
+		if (!target)
+			return -ENOENT;
+		return update_one_target(target, &opts);
+
+	case SPEED_BUMP_OP_REMOVE:
+		if (desc->path[0]) {
+			ret = target_opts_from_desc(desc, &opts);
+			if (!ret)
+				ret = get_profile(&opts, false);
+			if (ret)
+				return ret;
+			ret = remove_target_locked(desc->path, desc->symbol,
+						   opts.rule_name, opts.profile,
+						   doomed);
+			put_profile(opts.profile);
+			return ret;
+		}
+		target = find_target_by_id(desc->id);
+		if (!target)
+			return -ENOENT;
+		detach_target(target, doomed);
+		return 0;
+
+	case SPEED_BUMP_OP_CLEAR:
+		ret = free_targets(NULL, NULL);
+		pr_info("speed_bump: removed all %d targets\n", ret);
+		return 0;
+
+	case SPEED_BUMP_OP_ACTIVATE:
+		return activate_profile_locked(desc->profile);
+
+	case SPEED_BUMP_OP_REMOVE_PROFILE:
+		if (profile_name_check(desc->profile))
+			return -EINVAL;
+		return remove_profile_locked(desc->profile);
+	}
+
+	return -EINVAL;
+}
 
 /*
- * /sys/kernel/speed_bump/default_delay_ns
- *
- * Read/write: Default delay applied to targets without explicit delay.
+ * SPEED_BUMP_IOC_BATCH: apply an array of descriptors under one lock.
+ * Every entry is attempted; failures are reported per entry and in
+ * nr_failed, and do not fail the ioctl.
  */
-static ssize_t default_delay_ns_show(struct kobject *kobj,
-				     struct kobj_attribute *attr, char *buf)
+static long ctl_batch(struct speed_bump_batch __user *ubatch)
 {
-	return sysfs_emit(buf, "%llu\n", speed_bump_default_delay);
+	struct speed_bump_target_desc *descs;
+	struct speed_bump_batch batch;
+	LIST_HEAD(doomed);
+	size_t size;
+	long ret = 0;
+	u32 i;
+
+	/* The device is open to all for TASK_STATS; targets are root's */
+	if (!capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	if (copy_from_user(&batch, ubatch, sizeof(batch)))
+		return -EFAULT;
+
+	if (batch.desc_size != sizeof(*descs) || batch.reserved)
+		return -EINVAL;
+	if (batch.count == 0 || batch.count > SPEED_BUMP_BATCH_MAX)
+		return -E2BIG;
+
+	size = array_size(batch.count, sizeof(*descs));
+	descs = vmemdup_user(u64_to_user_ptr(batch.descs), size);
+	if (IS_ERR(descs))
+		return PTR_ERR(descs);
+
+	batch.nr_failed = 0;
+
+	mutex_lock(&speed_bump_mutex);
+	for (i = 0; i < batch.count; i++) {
+		descs[i].status = ctl_apply_desc(&descs[i], &doomed);
+		if (descs[i].status)
+			batch.nr_failed++;
+	}
+	free_detached_targets(&doomed);
+	mutex_unlock(&speed_bump_mutex);
+
+	if (copy_to_user(u64_to_user_ptr(batch.descs), descs, size) ||
+	    put_user(batch.nr_failed, &ubatch->nr_failed))
+		ret = -EFAULT;
+
+	kvfree(descs);
+	return ret;
 }
 
-static ssize_t default_delay_ns_store(struct kobject *kobj,
-				      struct kobj_attribute *attr,
-				      const char *buf, size_t count)
+/*
+ * SPEED_BUMP_IOC_TASK_STATS: read, and optionally reset, the delay
+ * injected into a thread and its process. Takes no lock.
+ */
+static long ctl_task_stats(struct speed_bump_task_stats __user *ustats)
 {
-	u64 val;
+	struct speed_bump_task_stats stats;
 	int ret;
 
-	ret = kstrtou64(buf, 10, &val);
+	if (copy_from_user(&stats, ustats, sizeof(stats)))
+		return -EFAULT;
+
+	if (stats.flags & ~SPEED_BUMP_TASK_STATS_RESET || stats.tid < 0)
+		return -EINVAL;
+
+	ret = speed_bump_task_stats(&stats,
+				    stats.flags & SPEED_BUMP_TASK_STATS_RESET);
 	if (ret)
 		return ret;
 
-	if (val > SPEED_BUMP_MAX_DELAY_NS)
-		return -ERANGE;
+	if (copy_to_user(ustats, &stats, sizeof(stats)))
+		return -EFAULT;
+	return 0;
+}
 
-	speed_bump_default_delay = val;
-	return count;
+/* ============================================================
+ * Control Device Events
+ * ============================================================
+ *
+ * A monitor that re-reads stats and targets_list on a timer takes
+ * speed_bump_mutex and formats every target each time. Instead, each
+ * open file of the control device is a watcher: poll() says when
+ * something changed since its last read() and read() returns the
+ * global totals at that point, without the target lock.
+ *
+ * State changes bump speed_bump_watch_seq. A hit threshold is checked
+ * against the summed per-CPU hit counters, but only when a handler
+ * wakes the watchers, every speed_bump_watch_quantum hits on one CPU.
+ * With a quantum of a half of the lowest threshold per online CPU, a
+ * watcher wakes at most 1.5 thresholds after its last read.
+ */
+
+struct speed_bump_watcher {
+	struct list_head node;
+	u64 threshold;   /* SPEED_BUMP_IOC_WATCH hits, 0 = none */
+	u64 hits;        /* total_hits at the last read */
+	int seq;         /* speed_bump_watch_seq at the last read */
+	bool primed;     /* read at least once */
+};
+
+/* Watchers and their bookkeeping; no target state is taken under it */
+static DEFINE_MUTEX(speed_bump_watch_mutex);
+static LIST_HEAD(speed_bump_watchers);
+
+/*
+ * Size the per-CPU countdown of the handlers for the lowest threshold.
+ * Caller must hold speed_bump_watch_mutex.
+ */
+static void watch_update_quantum(void)
+{
+	struct speed_bump_watcher *w;
+	u64 lowest = 0, quantum = 0;
+
+	list_for_each_entry(w, &speed_bump_watchers, node) {
+		if (w->threshold && (!lowest || w->threshold < lowest))
+			lowest = w->threshold;
+	}
+
+	if (lowest)
+		quantum = clamp_t(u64, lowest / (2 * num_online_cpus()),
+				  1, U32_MAX);
+	WRITE_ONCE(speed_bump_watch_quantum, quantum);
 }
 
-static struct kobj_attribute default_delay_ns_attr =
-	__ATTR(default_delay_ns, 0644, default_delay_ns_show,
-	       default_delay_ns_store);
+/*
+ * Whether @w has an event to read. Checked without speed_bump_watch_mutex
+ * from poll() and the wait in read(); a stale answer there only costs
+ * one more check.
+ */
+static bool watch_ready(const struct speed_bump_watcher *w)
+{
+	u64 threshold = READ_ONCE(w->threshold);
 
-/* Attribute group */
-static struct attribute *speed_bump_attrs[] = {
-	&enabled_attr.attr,
-	&targets_attr.attr,
-	&targets_list_attr.attr,
-	&stats_attr.attr,
-	&default_delay_ns_attr.attr,
-	NULL,
+	if (!READ_ONCE(w->primed) ||
+	    atomic_read(&speed_bump_watch_seq) != READ_ONCE(w->seq))
+		return true;
+
+	return threshold &&
+	       aggregate_percpu_hits() - READ_ONCE(w->hits) >= threshold;
+}
+
+static int speed_bump_ctl_open(struct inode *inode, struct file *file)
+{
+	struct speed_bump_watcher *w;
+
+	w = kzalloc(sizeof(*w), GFP_KERNEL_ACCOUNT);
+	if (!w)
+		return -ENOMEM;
+
+	mutex_lock(&speed_bump_watch_mutex);
+	list_add(&w->node, &speed_bump_watchers);
+	mutex_unlock(&speed_bump_watch_mutex);
+
+	file->private_data = w;
+	return 0;
+}
+
+static int speed_bump_ctl_release(struct inode *inode, struct file *file)
+{
+	struct speed_bump_watcher *w = file->private_data;
+
+	mutex_lock(&speed_bump_watch_mutex);
+	list_del(&w->node);
+	if (w->threshold)
+		watch_update_quantum();
+	mutex_unlock(&speed_bump_watch_mutex);
+
+	kfree(w);
+	return 0;
+}
+
+static __poll_t speed_bump_ctl_poll(struct file *file, poll_table *wait)
+{
+	struct speed_bump_watcher *w = file->private_data;
+
+	poll_wait(file, &speed_bump_watch_wait, wait);
+	return watch_ready(w) ? EPOLLIN | EPOLLRDNORM : 0;
+}
+
+/*
+ * Wait for an event unless O_NONBLOCK, then return the totals and make
+ * them the base of the next event.
+ */
+static ssize_t speed_bump_ctl_read(struct file *file, char __user *buf,
+				   size_t count, loff_t *ppos)
+{
+	struct speed_bump_watcher *w = file->private_data;
+	struct speed_bump_event ev;
+	int seq, ret;
+
+	if (count < sizeof(ev))
+		return -EINVAL;
+
+	while (!watch_ready(w)) {
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		ret = wait_event_interruptible(speed_bump_watch_wait,
+					       watch_ready(w));
+		if (ret)
+			return ret;
+	}
+
+	memset(&ev, 0, sizeof(ev));
+
+	mutex_lock(&speed_bump_watch_mutex);
+	seq = atomic_read(&speed_bump_watch_seq);
+	ev.changes = w->primed ? (u32)(seq - w->seq) : 0;
+	ev.nr_targets = atomic_read(&speed_bump_target_count);
+	ev.enabled = atomic_read(&speed_bump_enabled);
+	ev.total_hits = aggregate_percpu_hits();
+	ev.total_delay_ns = aggregate_percpu_delay();
+	ev.total_actual_ns = aggregate_percpu_actual();
+	ev.total_throttled = aggregate_percpu_throttled();
+	WRITE_ONCE(w->seq, seq);
+	WRITE_ONCE(w->hits, ev.total_hits);
+	WRITE_ONCE(w->primed, true);
+	mutex_unlock(&speed_bump_watch_mutex);
+
+	if (copy_to_user(buf, &ev, sizeof(ev)))
+		return -EFAULT;
+	return sizeof(ev);
+}
+
+/* SPEED_BUMP_IOC_WATCH: set the hit threshold of @w */
+static long ctl_watch(struct speed_bump_watcher *w,
+		      struct speed_bump_watch __user *uwatch)
+{
+	struct speed_bump_watch watch;
+
+	if (copy_from_user(&watch, uwatch, sizeof(watch)))
+		return -EFAULT;
+	if (watch.reserved)
+		return -EINVAL;
+	/* A threshold sets how often every handler wakes the watchers */
+	if (watch.hits && !capable(CAP_SYS_ADMIN))
+		return -EPERM;
+
+	mutex_lock(&speed_bump_watch_mutex);
+	WRITE_ONCE(w->threshold, watch.hits);
+	watch_update_quantum();
+	mutex_unlock(&speed_bump_watch_mutex);
+
+	/* Waiters re-check against the new threshold */
+	wake_up_interruptible(&speed_bump_watch_wait);
+	return 0;
+}
+
+static long speed_bump_ctl_ioctl(struct file *file, unsigned int cmd,
+				 unsigned long arg)
+{
+	switch (cmd) {
+	case SPEED_BUMP_IOC_BATCH:
+		return ctl_batch((struct speed_bump_batch __user *)arg);
+	case SPEED_BUMP_IOC_TASK_STATS:
+		return ctl_task_stats((struct speed_bump_task_stats __user *)arg);
+	case SPEED_BUMP_IOC_WATCH:
+		return ctl_watch(file->private_data,
+				 (struct speed_bump_watch __user *)arg);
+	}
+
+	return -ENOTTY;
+}
+
+static const struct file_operations speed_bump_ctl_fops = {
+	.owner = THIS_MODULE,
+	.open = speed_bump_ctl_open,
+	.release = speed_bump_ctl_release,
+	.read = speed_bump_ctl_read,
+	.poll = speed_bump_ctl_poll,
+	.unlocked_ioctl = speed_bump_ctl_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
+	.llseek = noop_llseek,
 };
 
-static struct attribute_group speed_bump_attr_group = {
-	.attrs = speed_bump_attrs,
+static struct miscdevice speed_bump_ctl_dev = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "speed_bump",
+	.fops = &speed_bump_ctl_fops,
+	.mode = 0666,       /* each ioctl checks its caller itself */
 };
 
 /* ============================================================
@@ -589,41 +3850,87 @@ static int __init speed_bump_init(void)
 {
 	int ret;
 
+	/* Pick and calibrate the delay clock before any probe can fire */
+	speed_bump_delay_calibrate(use_cycle_counter);
+
+	ret = speed_bump_symcache_init();
+	if (ret)
+		return ret;
+
+	/* Unbound, so async adds of many targets resolve in parallel */
+	speed_bump_wq = alloc_workqueue("speed_bump", WQ_UNBOUND, 0);
+	if (!speed_bump_wq) {
+		speed_bump_symcache_exit();
+		return -ENOMEM;
+	}
+
 	/* Create sysfs directory under /sys/kernel/speed_bump */
 	speed_bump_kobj = kobject_create_and_add("speed_bump", kernel_kobj);
-	if (!speed_bump_kobj)
+	if (!speed_bump_kobj) {
+		destroy_workqueue(speed_bump_wq);
+		speed_bump_symcache_exit();
 		return -ENOMEM;
+	}
 
 	/* Create sysfs files */
 	ret = sysfs_create_group(speed_bump_kobj, &speed_bump_attr_group);
 	if (ret) {
 		kobject_put(speed_bump_kobj);
+		destroy_workqueue(speed_bump_wq);
+		speed_bump_symcache_exit();
+		return ret;
+	}
+
+	ret = misc_register(&speed_bump_ctl_dev);
+	if (ret) {
+		sysfs_remove_group(speed_bump_kobj, &speed_bump_attr_group);
+		kobject_put(speed_bump_kobj);
+		destroy_workqueue(speed_bump_wq);
+		speed_bump_symcache_exit();
 		return ret;
 	}
 
-	pr_info("speed_bump: module loaded (max_targets=%d, max_delay=%llu ns)\n",
-		SPEED_BUMP_MAX_TARGETS, SPEED_BUMP_MAX_DELAY_NS);
+	speed_bump_debugfs_init();
+
+	pr_info("speed_bump: module loaded (max_targets=%u, max_delay=%llu ns, delay_clock=%s, overhead=%llu ns)\n",
+		max_targets, SPEED_BUMP_MAX_DELAY_NS,
+		speed_bump_delay_clock() == SPEED_BUMP_CLOCK_CYCLES ?
+		"cycles" : "ktime",
+		speed_bump_delay_overhead_ns());
 	return 0;
 }
 
 static void __exit speed_bump_exit(void)
 {
-	struct speed_bump_target *target, *tmp;
-
 	/* Disable all probes */
 	atomic_set(&speed_bump_enabled, 0);
 
+	/* No new commands once these return */
+	misc_deregister(&speed_bump_ctl_dev);
+	sysfs_remove_group(speed_bump_kobj, &speed_bump_attr_group);
+
+	/* Waits for readers, which may be walking the targets */
+	debugfs_remove_recursive(speed_bump_debugfs);
+
+	/* Let async adds finish, so no target is pending below */
+	destroy_workqueue(speed_bump_wq);
+
 	/* Remove all targets */
 	mutex_lock(&speed_bump_mutex);
-	list_for_each_entry_safe(target, tmp, &speed_bump_targets, list) {
-		free_target(target);
-	}
+	free_targets(NULL, NULL);
 	mutex_unlock(&speed_bump_mutex);
 
-	/* Remove sysfs entries */
-	sysfs_remove_group(speed_bump_kobj, &speed_bump_attr_group);
+	/* No target is left to queue it again */
+	cancel_work_sync(&speed_bump_reap_work);
+
+	/* Configs replaced by updates drop their cgroup in an RCU callback */
+	rcu_barrier();
+
 	kobject_put(speed_bump_kobj);
 
+	speed_bump_task_exit();
+	speed_bump_symcache_exit();
+
 	pr_info("speed_bump: module unloaded\n");
 }
 
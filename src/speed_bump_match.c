@@ -3,7 +3,7 @@
  * Speed Bump - Pattern Matching Implementation
  *
  * Matches "PATH:SYMBOL" patterns against target path and symbol.
- * Supports exact match and prefix match (PATH ending in *).
+ * Supports exact match, prefix match (PATH ending in *) and globs.
  */
 
 #ifdef MOCK_KERNEL
@@ -16,22 +16,66 @@
 
 #include "speed_bump.h"
 
+/*
+ * Glob-match [pat, pat_end) against the whole of str.
+ *
+ * Iterative with single-star backtracking: on mismatch, retry from the
+ * most recent '*' with one more character consumed. Linear in practice
+ * and never recursive, so safe on kernel stacks.
+ */
+static int glob_match_n(const char *pat, const char *pat_end, const char *str)
+{
+    const char *star = NULL, *star_str = NULL;
+
+    while (*str) {
+        if (pat < pat_end && (*pat == '?' || *pat == *str)) {
+            pat++;
+            str++;
+        } else if (pat < pat_end && *pat == '*') {
+            star = pat++;
+            star_str = str;
+        } else if (star) {
+            pat = star + 1;
+            str = ++star_str;
+        } else {
+            return 0;
+        }
+    }
+
+    while (pat < pat_end && *pat == '*')
+        pat++;
+
+    return pat == pat_end;
+}
+
+int speed_bump_glob_match(const char *pattern, const char *str)
+{
+    if (!pattern || !str)
+        return 0;
+
+    return glob_match_n(pattern, pattern + strlen(pattern), str);
+}
+
+int speed_bump_has_wildcard(const char *str)
+{
+    return str && strpbrk(str, "*?") != NULL;
+}
+
 /*
  * Match a target pattern against path and symbol.
  *
  * Pattern format: "PATH:SYMBOL"
  * - Exact: "/usr/bin/app:func" matches only that exact path and symbol
  * - Prefix: path ending in asterisk matches any path with that prefix
+ * - Glob: '*' and '?' anywhere in PATH or SYMBOL
+ *
+ * A trailing '*' is just the glob case, since '*' also matches '/'.
  *
  * Returns 1 on match, 0 on no match.
  */
 int speed_bump_match_target(const char *pattern, const char *path, const char *symbol)
 {
     const char *colon;
-    size_t path_pattern_len;
-    const char *symbol_pattern;
-    size_t symbol_pattern_len;
-    int is_prefix_match;
 
     if (!pattern || !path || !symbol)
         return 0;
@@ -41,38 +85,15 @@ int speed_bump_match_target(const char *pattern, const char *path, const char *s
     if (!colon)
         return 0;
 
-    path_pattern_len = (size_t)(colon - pattern);
-    symbol_pattern = colon + 1;
-    symbol_pattern_len = strlen(symbol_pattern);
-
-    /* Check for prefix match (path pattern ending in *) */
-    is_prefix_match = (path_pattern_len > 0 && pattern[path_pattern_len - 1] == '*');
-
-    /* Match the symbol first (must be exact) */
-    if (strlen(symbol) != symbol_pattern_len)
+    /* Match the symbol first: cheaper, and usually the selective part */
+    if (!speed_bump_glob_match(colon + 1, symbol))
         return 0;
-    if (strncmp(symbol, symbol_pattern, symbol_pattern_len) != 0)
-        return 0;
-
-    /* Match the path */
-    if (is_prefix_match) {
-        /* Prefix match: compare up to the * (excluding it) */
-        size_t prefix_len = path_pattern_len - 1;
-        if (strlen(path) < prefix_len)
-            return 0;
-        if (strncmp(path, pattern, prefix_len) != 0)
-            return 0;
-    } else {
-        /* Exact match */
-        if (strlen(path) != path_pattern_len)
-            return 0;
-        if (strncmp(path, pattern, path_pattern_len) != 0)
-            return 0;
-    }
 
-    return 1;
+    return glob_match_n(pattern, colon, path);
 }
 
 #ifndef MOCK_KERNEL
 EXPORT_SYMBOL_GPL(speed_bump_match_target);
+EXPORT_SYMBOL_GPL(speed_bump_glob_match);
+EXPORT_SYMBOL_GPL(speed_bump_has_wildcard);
 #endif
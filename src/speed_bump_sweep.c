@@ -0,0 +1,163 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Speed Bump - Delay Sweep Schedules
+ *
+ * Parses a target's sweep= option into the list of (delay, duration)
+ * steps the module then walks on an hrtimer, so that one run covers a
+ * whole range of delays without a control-plane write per step.
+ */
+
+#ifdef MOCK_KERNEL
+#include "mock_kernel.h"
+#else
+#include <linux/types.h>
+#include <linux/limits.h>
+#include <linux/string.h>
+#include <linux/errno.h>
+#include <linux/time64.h>
+#endif
+
+#include "speed_bump.h"
+
+/* Parse the decimal digits at *@s into @out, advancing *@s past them */
+static int sweep_parse_u64(const char **s, u64 *out)
+{
+    const char *p = *s;
+    u64 val = 0;
+
+    if (*p < '0' || *p > '9')
+        return -EINVAL;
+
+    for (; *p >= '0' && *p <= '9'; p++) {
+        if (val > (U64_MAX - 9) / 10)
+            return -ERANGE;
+        val = val * 10 + (*p - '0');
+    }
+
+    *s = p;
+    *out = val;
+    return 0;
+}
+
+/* A step duration: digits with a unit of ns, us, ms or s (none = ns) */
+static int sweep_parse_duration(const char **s, u64 *ns)
+{
+    static const struct {
+        const char *unit;
+        u64 mult;
+    } units[] = {
+        { "ns", 1 },
+        { "us", NSEC_PER_USEC },
+        { "ms", NSEC_PER_MSEC },
+        { "s",  NSEC_PER_SEC },
+    };
+    size_t i, len;
+    u64 val;
+    int ret;
+
+    ret = sweep_parse_u64(s, &val);
+    if (ret)
+        return ret;
+
+    for (i = 0; i < ARRAY_SIZE(units); i++) {
+        len = strlen(units[i].unit);
+        if (strncmp(*s, units[i].unit, len) == 0) {
+            if (val > SPEED_BUMP_SWEEP_MAX_STEP_NS / units[i].mult)
+                return -ERANGE;
+            *s += len;
+            val *= units[i].mult;
+            break;
+        }
+    }
+
+    if (val < SPEED_BUMP_SWEEP_MIN_STEP_NS ||
+        val > SPEED_BUMP_SWEEP_MAX_STEP_NS)
+        return -ERANGE;
+
+    *ns = val;
+    return 0;
+}
+
+/* START:STOP:STEP@DURATION, after START has been read */
+static int sweep_parse_range(const char *s, u64 start,
+                             struct speed_bump_sweep_step *steps)
+{
+    u64 stop, step, span, duration, count, i;
+    int ret;
+
+    if (*s++ != ':')
+        return -EINVAL;
+    ret = sweep_parse_u64(&s, &stop);
+    if (ret)
+        return ret;
+    if (*s++ != ':')
+        return -EINVAL;
+    ret = sweep_parse_u64(&s, &step);
+    if (ret)
+        return ret;
+    if (*s++ != '@')
+        return -EINVAL;
+    ret = sweep_parse_duration(&s, &duration);
+    if (ret)
+        return ret;
+    if (*s != '\0' || step == 0)
+        return -EINVAL;
+
+    if (start > SPEED_BUMP_MAX_DELAY_NS || stop > SPEED_BUMP_MAX_DELAY_NS)
+        return -ERANGE;
+
+    /* Whole steps from START towards STOP, which is only hit if aligned */
+    span = start <= stop ? stop - start : start - stop;
+    count = span / step + 1;
+    if (count > SPEED_BUMP_SWEEP_MAX_STEPS)
+        return -ERANGE;
+
+    for (i = 0; steps && i < count; i++) {
+        steps[i].delay_ns = start <= stop ? start + i * step : start - i * step;
+        steps[i].duration_ns = duration;
+    }
+
+    return count;
+}
+
+int speed_bump_parse_sweep(const char *spec,
+                           struct speed_bump_sweep_step *steps)
+{
+    const char *s = spec;
+    unsigned int count = 0;
+    u64 delay, duration;
+    int ret;
+
+    ret = sweep_parse_u64(&s, &delay);
+    if (ret)
+        return ret;
+    if (*s == ':')
+        return sweep_parse_range(s, delay, steps);
+
+    /* DELAY@DURATION[,DELAY@DURATION...] */
+    for (;;) {
+        if (*s++ != '@')
+            return -EINVAL;
+        ret = sweep_parse_duration(&s, &duration);
+        if (ret)
+            return ret;
+        if (delay > SPEED_BUMP_MAX_DELAY_NS)
+            return -ERANGE;
+        if (count == SPEED_BUMP_SWEEP_MAX_STEPS)
+            return -ERANGE;
+
+        if (steps) {
+            steps[count].delay_ns = delay;
+            steps[count].duration_ns = duration;
+        }
+        count++;
+
+        if (*s == '\0')
+            return count;
+        if (*s++ != ',')
+            return -EINVAL;
+        ret = sweep_parse_u64(&s, &delay);
+        if (ret)
+            return ret;
+    }
+}
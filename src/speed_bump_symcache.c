@@ -0,0 +1,619 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Speed Bump - Symbol Index Cache
+ *
+ * The first target added against a binary parses its symbol tables once
+ * into a compact index of code symbols (name hash, name, file offset),
+ * sorted by hash. Later adds against the same inode - other symbols in
+ * the same libcuda.so, re-adds after a clear - resolve with a binary
+ * search and no file I/O at all.
+ *
+ * Entries are keyed by inode identity (device, inode number, generation)
+ * and validated against mtime, size and i_version, so a rebuilt binary
+ * is re-parsed rather than served stale offsets. The cache holds no
+ * inode references; a shrinker drops least recently used indexes under
+ * memory pressure.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/sort.h>
+#include <linux/jhash.h>
+#include <linux/iversion.h>
+#include <linux/shrinker.h>
+#include <linux/version.h>
+
+#include "speed_bump.h"
+#include "speed_bump_internal.h"
+
+static unsigned long symcache_max_bytes = 64UL << 20;
+module_param(symcache_max_bytes, ulong, 0644);
+MODULE_PARM_DESC(symcache_max_bytes,
+		 "Largest symbol index cached per binary in bytes (0 disables the cache)");
+
+/* One code symbol; @name is an offset into the file's name blob */
+struct symcache_sym {
+	u32 hash;
+	u32 name : 31;
+	u32 is_func : 1;
+	u64 offset;
+};
+
+struct symcache_file {
+	struct list_head lru;   /* on symcache_lru, most recently used first */
+
+	/* Identity */
+	dev_t dev;
+	unsigned long ino;
+	u32 generation;
+
+	/* Validation: the index is rebuilt if any of these change */
+	struct timespec64 mtime;
+	loff_t size;
+	u64 iversion;
+
+	struct symcache_sym *syms;
+	u32 nr_syms;
+	u32 syms_cap;
+	char *names;
+	size_t names_len;
+	size_t names_cap;
+	size_t bytes;           /* memory charged to the cache */
+};
+
+static LIST_HEAD(symcache_lru);
+static DEFINE_MUTEX(symcache_lock);
+static unsigned long symcache_bytes;    /* protected by symcache_lock */
+static unsigned int symcache_nr_files;  /* protected by symcache_lock */
+
+/* ============================================================
+ * Index Construction
+ * ============================================================ */
+
+static ssize_t symcache_kernel_read(void *ctx, void *buf, size_t len,
+				    loff_t pos)
+{
+	return kernel_read(ctx, buf, len, &pos);
+}
+
+static void symcache_snapshot(struct symcache_file *f, struct inode *inode)
+{
+	f->dev = inode->i_sb->s_dev;
+	f->ino = inode->i_ino;
+	f->generation = inode->i_generation;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,7,0)
+	f->mtime = inode_get_mtime(inode);
+#else
+	f->mtime = inode->i_mtime;
+#endif
+	f->size = i_size_read(inode);
+	f->iversion = inode_peek_iversion(inode);
+}
+
+static bool symcache_same_inode(const struct symcache_file *f,
+				struct inode *inode)
+{
+	return f->dev == inode->i_sb->s_dev && f->ino == inode->i_ino &&
+	       f->generation == inode->i_generation;
+}
+
+static bool symcache_still_valid(const struct symcache_file *f,
+				 struct inode *inode)
+{
+	struct symcache_file now;
+
+	symcache_snapshot(&now, inode);
+	return timespec64_equal(&f->mtime, &now.mtime) &&
+	       f->size == now.size && f->iversion == now.iversion;
+}
+
+static void symcache_file_free(struct symcache_file *f)
+{
+	if (!f)
+		return;
+	kvfree(f->syms);
+	kvfree(f->names);
+	kfree(f);
+}
+
+/*
+ * Grow @buf (currently @cap bytes, @used in use) to hold at least @need
+ * bytes, doubling each time.
+ */
+static int symcache_grow(void **buf, size_t *cap, size_t used, size_t need)
+{
+	size_t new_cap = max_t(size_t, *cap, PAGE_SIZE);
+	void *new_buf;
+
+	if (need <= *cap)
+		return 0;
+
+	while (new_cap < need)
+		new_cap *= 2;
+
+	new_buf = kvmalloc(new_cap, GFP_KERNEL);
+	if (!new_buf)
+		return -ENOMEM;
+
+	if (*buf)
+		memcpy(new_buf, *buf, used);
+	kvfree(*buf);
+	*buf = new_buf;
+	*cap = new_cap;
+	return 0;
+}
+
+static int symcache_add_sym(void *data, const char *name, loff_t offset,
+			    bool is_func)
+{
+	struct symcache_file *f = data;
+	size_t len = strlen(name) + 1;
+	size_t syms_bytes = f->syms_cap * sizeof(*f->syms);
+	struct symcache_sym *sym;
+	int ret;
+
+	if ((f->nr_syms + 1) * sizeof(*f->syms) + f->names_len + len >
+	    READ_ONCE(symcache_max_bytes) ||
+	    f->names_len + len > INT_MAX)
+		return -EFBIG;
+
+	ret = symcache_grow((void **)&f->syms, &syms_bytes,
+			    f->nr_syms * sizeof(*f->syms),
+			    (f->nr_syms + 1) * sizeof(*f->syms));
+	if (ret)
+		return ret;
+	f->syms_cap = syms_bytes / sizeof(*f->syms);
+
+	ret = symcache_grow((void **)&f->names, &f->names_cap, f->names_len,
+			    f->names_len + len);
+	if (ret)
+		return ret;
+
+	sym = &f->syms[f->nr_syms++];
+	sym->hash = jhash(name, len - 1, 0);
+	sym->name = f->names_len;
+	sym->is_func = is_func;
+	sym->offset = offset;
+
+	memcpy(f->names + f->names_len, name, len);
+	f->names_len += len;
+	return 0;
+}
+
+/*
+ * Names are appended in scan order, so ordering ties by name offset
+ * keeps .dynsym ahead of .symtab, matching speed_bump_elf_lookup().
+ */
+static int symcache_sym_cmp(const void *a, const void *b)
+{
+	const struct symcache_sym *x = a, *y = b;
+
+	if (x->hash != y->hash)
+		return x->hash < y->hash ? -1 : 1;
+	if (x->name != y->name)
+		return x->name < y->name ? -1 : 1;
+	return 0;
+}
+
+/*
+ * Parse @elf into a new index for @inode.
+ *
+ * The validation snapshot is taken before parsing so that a binary
+ * modified mid-parse is caught on the next lookup.
+ *
+ * Returns: 0 on success, -EFBIG if the index would exceed
+ *          symcache_max_bytes, or negative errno
+ */
+static int symcache_build(struct speed_bump_elf *elf, struct inode *inode,
+			  struct symcache_file **fp)
+{
+	struct symcache_file *f;
+	int ret;
+
+	f = kzalloc(sizeof(*f), GFP_KERNEL);
+	if (!f)
+		return -ENOMEM;
+
+	symcache_snapshot(f, inode);
+
+	ret = speed_bump_elf_for_each_code_symbol(elf, symcache_add_sym, f);
+	if (ret) {
+		symcache_file_free(f);
+		return ret;
+	}
+
+	sort(f->syms, f->nr_syms, sizeof(*f->syms), symcache_sym_cmp, NULL);
+
+	f->bytes = sizeof(*f) + f->syms_cap * sizeof(*f->syms) + f->names_cap;
+	*fp = f;
+	return 0;
+}
+
+/* ============================================================
+ * Lookup
+ * ============================================================ */
+
+static int symcache_search(const struct symcache_file *f, const char *symbol,
+			   loff_t *offset)
+{
+	u32 hash = jhash(symbol, strlen(symbol), 0);
+	u32 lo = 0, hi = f->nr_syms, mid;
+
+	/* Lower bound of @hash; the first match in a run wins */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (f->syms[mid].hash < hash)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	for (; lo < f->nr_syms && f->syms[lo].hash == hash; lo++) {
+		if (strcmp(f->names + f->syms[lo].name, symbol) == 0) {
+			*offset = f->syms[lo].offset;
+			return 0;
+		}
+	}
+
+	return -ENOENT;
+}
+
+/* Caller must hold symcache_lock */
+static struct symcache_file *symcache_find(struct inode *inode)
+{
+	struct symcache_file *f;
+
+	list_for_each_entry(f, &symcache_lru, lru) {
+		if (symcache_same_inode(f, inode))
+			return f;
+	}
+
+	return NULL;
+}
+
+/* Caller must hold symcache_lock */
+static void symcache_evict(struct symcache_file *f)
+{
+	list_del(&f->lru);
+	symcache_bytes -= f->bytes;
+	symcache_nr_files--;
+	symcache_file_free(f);
+}
+
+/*
+ * Return @inode's cached index if it is still valid, dropping a stale
+ * one, and mark it most recently used.
+ *
+ * Caller must hold symcache_lock.
+ */
+static struct symcache_file *symcache_get(struct inode *inode)
+{
+	struct symcache_file *f;
+
+	f = symcache_find(inode);
+	if (!f)
+		return NULL;
+
+	if (!symcache_still_valid(f, inode)) {
+		symcache_evict(f);
+		return NULL;
+	}
+
+	list_move(&f->lru, &symcache_lru);
+	return f;
+}
+
+/*
+ * Look up @symbol in the cached index for @inode.
+ *
+ * Returns: 0 or -ENOENT on a cache hit, -EAGAIN on a miss
+ */
+static int symcache_lookup_cached(struct inode *inode, const char *symbol,
+				  loff_t *offset)
+{
+	struct symcache_file *f;
+	int ret = -EAGAIN;
+
+	mutex_lock(&symcache_lock);
+	f = symcache_get(inode);
+	if (f) {
+		ret = symcache_search(f, symbol, offset);
+	}
+	mutex_unlock(&symcache_lock);
+
+	return ret;
+}
+
+/* Publish a freshly built index, replacing any stale one for the inode */
+static void symcache_insert(struct symcache_file *f, struct inode *inode)
+{
+	struct symcache_file *old;
+
+	mutex_lock(&symcache_lock);
+	old = symcache_find(inode);
+	if (old)
+		symcache_evict(old);
+	list_add(&f->lru, &symcache_lru);
+	symcache_bytes += f->bytes;
+	symcache_nr_files++;
+	mutex_unlock(&symcache_lock);
+}
+
+/*
+ * Open @path, check it is still @inode, and parse its ELF headers.
+ * On success the caller owns both *@filep and *@elfp.
+ */
+static int symcache_open(struct inode *inode, const char *path,
+			 struct file **filep, struct speed_bump_elf **elfp)
+{
+	struct file *file;
+	int ret;
+
+	file = filp_open(path, O_RDONLY, 0);
+	if (IS_ERR(file))
+		return PTR_ERR(file);
+
+	/* The path was replaced since the caller resolved it */
+	if (file_inode(file) != inode) {
+		filp_close(file, NULL);
+		return -ESTALE;
+	}
+
+	ret = speed_bump_elf_open(elfp, symcache_kernel_read, file);
+	if (ret) {
+		filp_close(file, NULL);
+		return ret;
+	}
+
+	*filep = file;
+	return 0;
+}
+
+/*
+ * Build the index for @inode. The caller uses it, then publishes it
+ * with symcache_insert(); until then, nothing else can free it.
+ *
+ * Returns: 0 with *@fp set, 0 with *@fp NULL and *@filep / *@elfp set
+ *          if the binary is too large to cache (the caller must use
+ *          the parsed file directly and close both), or negative errno
+ */
+static int symcache_fill(struct inode *inode, const char *path,
+			 struct symcache_file **fp, struct file **filep,
+			 struct speed_bump_elf **elfp)
+{
+	int ret;
+
+	*fp = NULL;
+
+	ret = symcache_open(inode, path, filep, elfp);
+	if (ret)
+		return ret;
+
+	ret = READ_ONCE(symcache_max_bytes) ?
+	      symcache_build(*elfp, inode, fp) : -EFBIG;
+
+	/* Too large to cache: hand the parsed file back */
+	if (ret == -EFBIG)
+		return 0;
+
+	speed_bump_elf_close(*elfp);
+	filp_close(*filep, NULL);
+	return ret;
+}
+
+static void symcache_close(struct file *file, struct speed_bump_elf *elf)
+{
+	speed_bump_elf_close(elf);
+	filp_close(file, NULL);
+}
+
+int speed_bump_symcache_lookup(struct inode *inode, const char *path,
+			       const char *symbol, loff_t *offset)
+{
+	struct symcache_file *f;
+	struct speed_bump_elf *elf;
+	struct file *file;
+	int ret;
+
+	ret = symcache_lookup_cached(inode, symbol, offset);
+	if (ret != -EAGAIN)
+		return ret;
+
+	ret = symcache_fill(inode, path, &f, &file, &elf);
+	if (ret)
+		return ret;
+
+	if (!f) {
+		ret = speed_bump_elf_lookup(elf, symbol, offset);
+		symcache_close(file, elf);
+		return ret;
+	}
+
+	ret = symcache_search(f, symbol, offset);
+	symcache_insert(f, inode);
+	return ret;
+}
+
+static int symcache_file_for_each(const struct symcache_file *f,
+				  speed_bump_elf_sym_fn fn, void *data)
+{
+	const struct symcache_sym *sym;
+	int ret = 0;
+	u32 i;
+
+	for (i = 0; i < f->nr_syms && !ret; i++) {
+		sym = &f->syms[i];
+		ret = fn(data, f->names + sym->name, sym->offset, sym->is_func);
+	}
+
+	return ret;
+}
+
+/*
+ * Call @fn for each symbol in @inode's cached index.
+ *
+ * Returns: the callback's non-zero return value if it stopped the walk,
+ *          0 if all symbols were visited, -EAGAIN if no valid index is
+ *          cached
+ */
+static int symcache_for_each_cached(struct inode *inode,
+				    speed_bump_elf_sym_fn fn, void *data)
+{
+	struct symcache_file *f;
+	int ret = -EAGAIN;
+
+	mutex_lock(&symcache_lock);
+	f = symcache_get(inode);
+	if (f) {
+		ret = symcache_file_for_each(f, fn, data);
+	}
+	mutex_unlock(&symcache_lock);
+
+	return ret;
+}
+
+int speed_bump_symcache_for_each(struct inode *inode, const char *path,
+				 speed_bump_elf_sym_fn fn, void *data)
+{
+	struct symcache_file *f;
+	struct speed_bump_elf *elf;
+	struct file *file;
+	int ret;
+
+	ret = symcache_for_each_cached(inode, fn, data);
+	if (ret != -EAGAIN)
+		return ret;
+
+	ret = symcache_fill(inode, path, &f, &file, &elf);
+	if (ret)
+		return ret;
+
+	if (!f) {
+		ret = speed_bump_elf_for_each_code_symbol(elf, fn, data);
+		symcache_close(file, elf);
+		return ret;
+	}
+
+	ret = symcache_file_for_each(f, fn, data);
+	symcache_insert(f, inode);
+	return ret;
+}
+
+int speed_bump_symcache_check_build_id(struct inode *inode, const char *path,
+				       const u8 *id, unsigned int len)
+{
+	u8 found[SPEED_BUMP_MAX_BUILD_ID];
+	struct speed_bump_elf *elf;
+	struct file *file;
+	int ret;
+
+	/* One note read per registration; the symbol index is not needed */
+	ret = symcache_open(inode, path, &file, &elf);
+	if (ret)
+		return ret;
+
+	ret = speed_bump_elf_build_id(elf, found, sizeof(found));
+	symcache_close(file, elf);
+	if (ret < 0)
+		return ret;
+
+	if (ret != len || memcmp(found, id, len) != 0)
+		return -ESTALE;
+	return 0;
+}
+
+void speed_bump_symcache_stats(unsigned int *files, unsigned long *bytes)
+{
+	mutex_lock(&symcache_lock);
+	*files = symcache_nr_files;
+	*bytes = symcache_bytes;
+	mutex_unlock(&symcache_lock);
+}
+
+/* ============================================================
+ * Shrinker
+ * ============================================================
+ *
+ * Objects are counted in pages so that one huge index and many small
+ * ones are weighed by what freeing them actually returns.
+ */
+
+static unsigned long symcache_count(struct shrinker *shrink,
+				    struct shrink_control *sc)
+{
+	unsigned long bytes = READ_ONCE(symcache_bytes);
+
+	if (!bytes)
+		return SHRINK_EMPTY;
+	return max(bytes >> PAGE_SHIFT, 1UL);
+}
+
+static unsigned long symcache_scan(struct shrinker *shrink,
+				   struct shrink_control *sc)
+{
+	struct symcache_file *f;
+	unsigned long freed = 0;
+
+	/* Never wait on a lookup that may itself be allocating */
+	if (!mutex_trylock(&symcache_lock))
+		return SHRINK_STOP;
+
+	while (freed < sc->nr_to_scan && !list_empty(&symcache_lru)) {
+		f = list_last_entry(&symcache_lru, struct symcache_file, lru);
+		freed += max(f->bytes >> PAGE_SHIFT, 1UL);
+		symcache_evict(f);
+	}
+
+	mutex_unlock(&symcache_lock);
+	return freed;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,7,0)
+static struct shrinker *symcache_shrinker;
+#else
+static struct shrinker symcache_shrinker = {
+	.count_objects = symcache_count,
+	.scan_objects = symcache_scan,
+	.seeks = DEFAULT_SEEKS,
+};
+#endif
+
+int speed_bump_symcache_init(void)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,7,0)
+	symcache_shrinker = shrinker_alloc(0, "speed_bump-symcache");
+	if (!symcache_shrinker)
+		return -ENOMEM;
+
+	symcache_shrinker->count_objects = symcache_count;
+	symcache_shrinker->scan_objects = symcache_scan;
+	shrinker_register(symcache_shrinker);
+	return 0;
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(6,0,0)
+	return register_shrinker(&symcache_shrinker, "speed_bump-symcache");
+#else
+	return register_shrinker(&symcache_shrinker);
+#endif
+}
+
+void speed_bump_symcache_exit(void)
+{
+	struct symcache_file *f, *tmp;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,7,0)
+	shrinker_free(symcache_shrinker);
+#else
+	unregister_shrinker(&symcache_shrinker);
+#endif
+
+	mutex_lock(&symcache_lock);
+	list_for_each_entry_safe(f, tmp, &symcache_lru, lru)
+		symcache_evict(f);
+	mutex_unlock(&symcache_lock);
+}
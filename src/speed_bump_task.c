@@ -0,0 +1,281 @@
+// SPDX-License-Identifier: GPL-2.0
+/*
+ * Speed Bump - Per-Task Delay Accounting
+ *
+ * The global and per-target counters say how much delay was injected,
+ * not into whom. A benchmark timing itself wants its own share, to
+ * report elapsed time minus injected delay without estimating it after
+ * the fact. Hits of filtered targets (pid= or cgroup=) are therefore
+ * also added to an account of the thread that took them and one of its
+ * process, which SPEED_BUMP_IOC_TASK_STATS reads back. A process may
+ * read and reset its own accounts; those of another take ptrace read
+ * access to it, or CAP_SYS_ADMIN.
+ *
+ * Accounts are keyed by pid and start time in the initial namespace,
+ * as the PID-tree verdict cache is, so a recycled pid never inherits
+ * one. They are found under RCU and made on a task's first accounted
+ * hit. A process account outlives the threads it sums. Accounts of
+ * tasks that have exited stay until the table is full. They are then
+ * reclaimed by a work item, at most once a second, so that a workload
+ * with more live threads than the table holds does not walk it on
+ * every hit. A hit with no room is only counted as dropped.
+ */
+
+#include <linux/kernel.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/sched.h>
+#include <linux/sched/signal.h>
+#include <linux/sched/task.h>
+#include <linux/capability.h>
+#include <linux/ptrace.h>
+#include <linux/pid.h>
+#include <linux/pid_namespace.h>
+#include <linux/rcupdate.h>
+#include <linux/rculist.h>
+#include <linux/hashtable.h>
+#include <linux/jhash.h>
+#include <linux/spinlock.h>
+#include <linux/atomic.h>
+#include <linux/jiffies.h>
+#include <linux/workqueue.h>
+
+#include "speed_bump.h"
+#include "speed_bump_internal.h"
+#include "speed_bump_uapi.h"
+
+struct speed_bump_task_acct {
+	struct hlist_node node;
+	u64 start_time;    /* of the thread, or of a process's group leader */
+	pid_t pid;         /* thread id, or tgid of a process account */
+	bool process;
+	atomic64_t hits;
+	atomic64_t delay_ns;
+	atomic64_t actual_ns;
+	struct rcu_head rcu;
+};
+
+static DEFINE_HASHTABLE(speed_bump_task_hash, 8);
+static DEFINE_SPINLOCK(speed_bump_task_lock);  /* adds and removals */
+static unsigned int speed_bump_task_nr;        /* under speed_bump_task_lock */
+static atomic64_t speed_bump_task_dropped = ATOMIC64_INIT(0);
+static unsigned long speed_bump_task_reap_next;  /* jiffies */
+
+static void task_acct_reap_work(struct work_struct *work);
+static DECLARE_WORK(speed_bump_task_reap_work, task_acct_reap_work);
+
+static u32 task_acct_hash(pid_t pid, bool process)
+{
+	return jhash_2words(pid, process, 0);
+}
+
+/* Caller must be in an RCU read-side section or hold speed_bump_task_lock */
+static struct speed_bump_task_acct *task_acct_find(pid_t pid, u64 start_time,
+						   bool process)
+{
+	struct speed_bump_task_acct *acct;
+
+	hash_for_each_possible_rcu(speed_bump_task_hash, acct, node,
+				   task_acct_hash(pid, process)) {
+		if (acct->pid == pid && acct->process == process &&
+		    acct->start_time == start_time)
+			return acct;
+	}
+	return NULL;
+}
+
+/*
+ * Whether the task or process of @acct still runs.
+ * Caller must be in an RCU read-side section.
+ */
+static bool task_acct_live(const struct speed_bump_task_acct *acct)
+{
+	struct task_struct *task;
+
+	task = pid_task(find_pid_ns(acct->pid, &init_pid_ns),
+			acct->process ? PIDTYPE_TGID : PIDTYPE_PID);
+	if (!task)
+		return false;
+	if (acct->process)
+		task = task->group_leader;
+	return task->start_time == acct->start_time;
+}
+
+/* Drop the accounts of tasks that have exited */
+static void task_acct_reap_work(struct work_struct *work)
+{
+	struct speed_bump_task_acct *acct;
+	struct hlist_node *tmp;
+	int bkt;
+
+	rcu_read_lock();
+	spin_lock(&speed_bump_task_lock);
+	hash_for_each_safe(speed_bump_task_hash, bkt, tmp, acct, node) {
+		if (task_acct_live(acct))
+			continue;
+		hash_del_rcu(&acct->node);
+		WRITE_ONCE(speed_bump_task_nr, speed_bump_task_nr - 1);
+		kfree_rcu(acct, rcu);
+	}
+	spin_unlock(&speed_bump_task_lock);
+	rcu_read_unlock();
+}
+
+/*
+ * The table is full: queue a reap unless one ran in the last second.
+ * Racing callers may both queue it; the work runs once either way.
+ */
+static void task_acct_reap_soon(void)
+{
+	unsigned long next = READ_ONCE(speed_bump_task_reap_next);
+
+	if (time_before(jiffies, next))
+		return;
+	WRITE_ONCE(speed_bump_task_reap_next, jiffies + HZ);
+	schedule_work(&speed_bump_task_reap_work);
+}
+
+/*
+ * Find the account of @pid, making it if it is new. This runs in the
+ * probe handler, so it must not sleep, and with the table full it only
+ * queues a reap rather than allocating.
+ * Caller must be in an RCU read-side section.
+ *
+ * Returns: the account, or NULL if there was no memory or no room
+ */
+static struct speed_bump_task_acct *task_acct_get(pid_t pid, u64 start_time,
+						  bool process)
+{
+	struct speed_bump_task_acct *acct, *fresh;
+
+	acct = task_acct_find(pid, start_time, process);
+	if (likely(acct))
+		return acct;
+
+	if (READ_ONCE(speed_bump_task_nr) >= SPEED_BUMP_MAX_TASK_ACCTS) {
+		task_acct_reap_soon();
+		return NULL;
+	}
+
+	fresh = kzalloc(sizeof(*fresh), GFP_NOWAIT | __GFP_NOWARN);
+	if (!fresh)
+		return NULL;
+	fresh->pid = pid;
+	fresh->start_time = start_time;
+	fresh->process = process;
+
+	spin_lock(&speed_bump_task_lock);
+	/* Another thread of the process may have made it meanwhile */
+	acct = task_acct_find(pid, start_time, process);
+	if (!acct && speed_bump_task_nr < SPEED_BUMP_MAX_TASK_ACCTS) {
+		hash_add_rcu(speed_bump_task_hash, &fresh->node,
+			     task_acct_hash(pid, process));
+		WRITE_ONCE(speed_bump_task_nr, speed_bump_task_nr + 1);
+		acct = fresh;
+		fresh = NULL;
+	}
+	spin_unlock(&speed_bump_task_lock);
+
+	kfree(fresh);
+	return acct;
+}
+
+static void task_acct_add(struct speed_bump_task_acct *acct, u64 hits,
+			  u64 delay_ns, u64 actual_ns)
+{
+	if (!acct) {
+		atomic64_inc(&speed_bump_task_dropped);
+		return;
+	}
+
+	if (hits)
+		atomic64_add(hits, &acct->hits);
+	if (delay_ns) {
+		atomic64_add(delay_ns, &acct->delay_ns);
+		atomic64_add(actual_ns, &acct->actual_ns);
+	}
+}
+
+void speed_bump_task_account(u64 hits, u64 delay_ns, u64 actual_ns)
+{
+	struct task_struct *task = current;
+
+	rcu_read_lock();
+	task_acct_add(task_acct_get(task->pid, task->start_time, false),
+		      hits, delay_ns, actual_ns);
+	task_acct_add(task_acct_get(task->tgid,
+				    task->group_leader->start_time, true),
+		      hits, delay_ns, actual_ns);
+	rcu_read_unlock();
+}
+
+/* Copy out @acct's counters, zeroing them on the way if @reset */
+static void task_acct_read(struct speed_bump_task_acct *acct,
+			   struct speed_bump_task_delay *out, bool reset)
+{
+	if (!acct)
+		return;
+
+	if (reset) {
+		out->hits = atomic64_xchg(&acct->hits, 0);
+		out->delay_ns = atomic64_xchg(&acct->delay_ns, 0);
+		out->actual_ns = atomic64_xchg(&acct->actual_ns, 0);
+	} else {
+		out->hits = atomic64_read(&acct->hits);
+		out->delay_ns = atomic64_read(&acct->delay_ns);
+		out->actual_ns = atomic64_read(&acct->actual_ns);
+	}
+}
+
+int speed_bump_task_stats(struct speed_bump_task_stats *stats, bool reset)
+{
+	struct task_struct *task;
+
+	memset(&stats->thread, 0, sizeof(stats->thread));
+	memset(&stats->process, 0, sizeof(stats->process));
+
+	rcu_read_lock();
+	task = stats->tid ? pid_task(find_vpid(stats->tid), PIDTYPE_PID) :
+			    current;
+	if (!task) {
+		rcu_read_unlock();
+		return -ESRCH;
+	}
+	get_task_struct(task);
+	rcu_read_unlock();
+
+	/* ptrace_may_access() takes the task lock, so check outside RCU */
+	if (!same_thread_group(task, current) && !capable(CAP_SYS_ADMIN) &&
+	    !ptrace_may_access(task, PTRACE_MODE_READ_REALCREDS)) {
+		put_task_struct(task);
+		return -EPERM;
+	}
+
+	rcu_read_lock();
+	task_acct_read(task_acct_find(task->pid, task->start_time, false),
+		       &stats->thread, reset);
+	task_acct_read(task_acct_find(task->tgid,
+				      task->group_leader->start_time, true),
+		       &stats->process, reset);
+	rcu_read_unlock();
+	put_task_struct(task);
+
+	stats->dropped = atomic64_read(&speed_bump_task_dropped);
+	return 0;
+}
+
+void speed_bump_task_exit(void)
+{
+	struct speed_bump_task_acct *acct;
+	struct hlist_node *tmp;
+	int bkt;
+
+	cancel_work_sync(&speed_bump_task_reap_work);
+
+	/* No handler is left to look accounts up, or to queue a reap */
+	hash_for_each_safe(speed_bump_task_hash, bkt, tmp, acct, node) {
+		hash_del(&acct->node);
+		kfree(acct);
+	}
+	speed_bump_task_nr = 0;
+}
@@ -0,0 +1,86 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Speed Bump - Tracepoints
+ *
+ * One event per hit of a target, so that injected delays can be lined
+ * up with an application's own traces. The tracing core supplies the
+ * timestamp, CPU and thread of each record, and perf, trace-cmd and BPF
+ * read the events from their per-CPU buffers without a syscall per
+ * event. A disabled tracepoint costs the handler a patched-out branch.
+ *
+ * Events are written when the delay ends: the hit arrived actual_ns
+ * before the record's timestamp.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM speed_bump
+
+#if !defined(_SPEED_BUMP_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _SPEED_BUMP_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/sched.h>
+
+/* What became of a hit */
+#define SPEED_BUMP_HIT_DELAYED   0
+#define SPEED_BUMP_HIT_SKIPPED   1  /* left undelayed by every=, prob=, cpus= */
+#define SPEED_BUMP_HIT_THROTTLED 2  /* refused by a delay budget */
+
+DECLARE_EVENT_CLASS(speed_bump_delay,
+
+	TP_PROTO(unsigned int id, unsigned int verdict, u64 delay_ns,
+		 u64 actual_ns),
+
+	TP_ARGS(id, verdict, delay_ns, actual_ns),
+
+	TP_STRUCT__entry(
+		__field(unsigned int, id)
+		__field(unsigned int, verdict)
+		__field(pid_t, tgid)
+		__field(u64, delay_ns)
+		__field(u64, actual_ns)
+	),
+
+	TP_fast_assign(
+		__entry->id = id;
+		__entry->verdict = verdict;
+		__entry->tgid = current->tgid;
+		__entry->delay_ns = delay_ns;
+		__entry->actual_ns = actual_ns;
+	),
+
+	TP_printk("id=%u tgid=%d %s delay_ns=%llu actual_ns=%llu",
+		  __entry->id, __entry->tgid,
+		  __print_symbolic(__entry->verdict,
+				   { SPEED_BUMP_HIT_DELAYED, "delayed" },
+				   { SPEED_BUMP_HIT_SKIPPED, "skipped" },
+				   { SPEED_BUMP_HIT_THROTTLED, "throttled" }),
+		  __entry->delay_ns, __entry->actual_ns)
+);
+
+/* A hit of the entry probe; delay_ns is 0 unless it was delayed */
+DEFINE_EVENT(speed_bump_delay, speed_bump_hit,
+
+	TP_PROTO(unsigned int id, unsigned int verdict, u64 delay_ns,
+		 u64 actual_ns),
+
+	TP_ARGS(id, verdict, delay_ns, actual_ns)
+);
+
+/* The return-probe delay of a scale= target */
+DEFINE_EVENT(speed_bump_delay, speed_bump_scale,
+
+	TP_PROTO(unsigned int id, unsigned int verdict, u64 delay_ns,
+		 u64 actual_ns),
+
+	TP_ARGS(id, verdict, delay_ns, actual_ns)
+);
+
+#endif /* _SPEED_BUMP_TRACE_H */
+
+/* This part must be outside the include guard */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE speed_bump_trace
+#include <trace/define_trace.h>
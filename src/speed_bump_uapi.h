@@ -0,0 +1,234 @@
+/* SPDX-License-Identifier: GPL-2.0 WITH Linux-syscall-note */
+/*
+ * Speed Bump - Userspace ABI
+ *
+ * Binary layouts shared with userspace: the statistics file and the
+ * control device's ioctls. Only fixed-width types are used, so this
+ * header can be included as is from kernel and userspace code.
+ */
+
+#ifndef SPEED_BUMP_UAPI_H
+#define SPEED_BUMP_UAPI_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+/* ============================================================
+ * Binary Statistics (debugfs speed_bump/stats.bin)
+ * ============================================================ */
+
+#define SPEED_BUMP_STATS_MAGIC   0x54534253  /* "SBST" little-endian */
+#define SPEED_BUMP_STATS_VERSION 2
+
+/*
+ * File header. Readers should step over header_size and record_size
+ * bytes rather than sizeof(), so that fields appended by later
+ * versions are skipped. Version 2 added total_actual_ns to the header
+ * and to each record, which moved a record's cpus[] 8 bytes on.
+ */
+struct speed_bump_stats_header {
+	__u32 magic;           /* SPEED_BUMP_STATS_MAGIC */
+	__u32 version;         /* SPEED_BUMP_STATS_VERSION */
+	__u32 header_size;     /* bytes from the start to the first record */
+	__u32 record_size;     /* bytes per record, cpus[] included */
+	__u32 nr_cpus;         /* entries in each record's cpus[] */
+	__u32 nr_targets;      /* records that follow */
+	__u64 total_hits;      /* as total_hits in stats */
+	__u64 total_delay_ns;  /* as total_delay_ns in stats */
+	__u64 total_throttled; /* as total_throttled in stats */
+	__u64 total_actual_ns; /* as total_actual_ns in stats (version 2) */
+};
+
+/* One CPU's share of a target's counters */
+struct speed_bump_stats_cpu {
+	__u64 hits;
+	__u64 delay_ns;
+};
+
+/* One target, in targets_list order */
+struct speed_bump_stats_record {
+	__u64 id;              /* id= in targets_list */
+	__u64 hits;
+	__u64 total_delay_ns;
+	__u64 skipped;
+	__u64 throttled;
+	__u64 total_actual_ns; /* measured time of total_delay_ns (version 2) */
+	struct speed_bump_stats_cpu cpus[];  /* indexed by CPU number */
+};
+
+/* ============================================================
+ * Control Device (/dev/speed_bump)
+ * ============================================================ */
+
+#define SPEED_BUMP_IOC_MAGIC 0xB5
+
+/* Largest count accepted by SPEED_BUMP_IOC_BATCH */
+#define SPEED_BUMP_BATCH_MAX 4096
+
+/* speed_bump_target_desc.op */
+#define SPEED_BUMP_OP_ADD    1  /* +PATH:SYMBOL */
+#define SPEED_BUMP_OP_UPDATE 2  /* =PATH:SYMBOL */
+#define SPEED_BUMP_OP_REMOVE 3  /* -PATH:SYMBOL */
+#define SPEED_BUMP_OP_CLEAR  4  /* -* */
+#define SPEED_BUMP_OP_ACTIVATE 5        /* activate profile, "" = none */
+#define SPEED_BUMP_OP_REMOVE_PROFILE 6  /* -@profile */
+
+/*
+ * speed_bump_target_desc.given: which option fields are set. Fields
+ * whose bit is clear take the defaults of the text command, so an
+ * update only changes what it names.
+ */
+#define SPEED_BUMP_OPT_DELAY   (1U << 0)   /* delay_ns */
+#define SPEED_BUMP_OPT_MODE    (1U << 1)   /* mode */
+#define SPEED_BUMP_OPT_LATENCY (1U << 2)   /* latency */
+#define SPEED_BUMP_OPT_SCALE   (1U << 3)   /* scale_pct */
+#define SPEED_BUMP_OPT_EVERY   (1U << 4)   /* every */
+#define SPEED_BUMP_OPT_PROB    (1U << 5)   /* prob_ppm */
+#define SPEED_BUMP_OPT_DIST    (1U << 6)   /* dist */
+#define SPEED_BUMP_OPT_MAX     (1U << 7)   /* max_ns */
+#define SPEED_BUMP_OPT_SIGMA   (1U << 8)   /* sigma_milli */
+#define SPEED_BUMP_OPT_BUDGET  (1U << 9)   /* budget_ns_per_s */
+#define SPEED_BUMP_OPT_PID     (1U << 10)  /* pid */
+#define SPEED_BUMP_OPT_ASYNC   (1U << 11)  /* add only: register in the background */
+#define SPEED_BUMP_OPT_AUTOREMOVE (1U << 12)  /* add only: remove when pid exits */
+#define SPEED_BUMP_OPT_CGROUP  (1U << 13)  /* cgroup */
+#define SPEED_BUMP_OPT_OVERSHOOT (1U << 14)  /* keep an overshoot histogram, as overshoot=1 */
+#define SPEED_BUMP_OPT_SWEEP   (1U << 15)  /* add only: sweep */
+#define SPEED_BUMP_OPT_BUILDID (1U << 16)  /* add only: buildid */
+#define SPEED_BUMP_OPT_CPUS    (1U << 17)  /* cpus */
+#define SPEED_BUMP_OPT_NODE    (1U << 18)  /* node, not with cpus */
+#define SPEED_BUMP_OPT_ALL     ((1U << 19) - 1)
+
+/* speed_bump_target_desc.mode, as mode= */
+#define SPEED_BUMP_DESC_MODE_SPIN   0
+#define SPEED_BUMP_DESC_MODE_SLEEP  1
+#define SPEED_BUMP_DESC_MODE_HYBRID 2
+
+/* speed_bump_target_desc.dist, as dist= */
+#define SPEED_BUMP_DESC_DIST_FIXED     0
+#define SPEED_BUMP_DESC_DIST_EXP       1
+#define SPEED_BUMP_DESC_DIST_UNIFORM   2
+#define SPEED_BUMP_DESC_DIST_LOGNORMAL 3
+
+/*
+ * One target command. Option fields carry the values of the text
+ * command's KEY=VALUE options, in the same units; prob and sigma are
+ * fixed point (parts per million and thousandths).
+ *
+ * Update and remove name their target either by path and symbol, or by
+ * id with path[0] == '\0'. A wildcard path or symbol adds, updates or
+ * removes a group, as in the text command. A non-empty profile stages
+ * an add in that profile and selects the profile's copy of PATH:SYMBOL
+ * for update and remove, as profile= does. A non-empty rule does the
+ * same for the rules of one PATH:SYMBOL, as rule= does.
+ *
+ * symbol may also be a file offset, "0xOFF", for PATH@0xOFF, or
+ * "SYMBOL+0xOFF" for an offset into SYMBOL.
+ */
+struct speed_bump_target_desc {
+	__u32 op;              /* SPEED_BUMP_OP_* */
+	__s32 status;          /* out: 0 or negative errno */
+	__u32 id;              /* in: target to update/remove by id;
+				* out: id of an added target, 0 for a group */
+	__u32 group;           /* out: id of an added group, else 0 */
+	__u32 given;           /* SPEED_BUMP_OPT_* */
+	__s32 pid;
+	__u64 delay_ns;
+	__u32 mode;            /* SPEED_BUMP_DESC_MODE_* */
+	__u32 latency;         /* 0 or 1 */
+	__u32 scale_pct;
+	__u32 every;
+	__u32 prob_ppm;        /* 0..1000000 */
+	__u32 dist;            /* SPEED_BUMP_DESC_DIST_* */
+	__u32 sigma_milli;
+	__u32 reserved;        /* must be 0 */
+	__u64 max_ns;
+	__u64 budget_ns_per_s;
+	char path[256];        /* NUL-terminated */
+	char symbol[128];      /* NUL-terminated */
+	char profile[32];      /* NUL-terminated, "" = no profile */
+	char cgroup[256];      /* NUL-terminated cgroup v2 path, as cgroup= */
+	char sweep[256];       /* NUL-terminated schedule, as sweep= */
+	char rule[32];         /* NUL-terminated, "" = the unnamed rule */
+	char buildid[48];      /* NUL-terminated hex, as buildid= */
+	char cpus[128];        /* NUL-terminated CPU list, as cpus= */
+	__s32 node;            /* as node= */
+	__u32 reserved2;       /* must be 0 */
+};
+
+/*
+ * Argument of SPEED_BUMP_IOC_BATCH. Entries are applied in order under
+ * one lock; a failing entry does not stop the ones after it. Each
+ * entry's status, and the id and group of adds, are written back.
+ */
+struct speed_bump_batch {
+	__u64 descs;           /* pointer to count descriptors */
+	__u32 count;           /* 1..SPEED_BUMP_BATCH_MAX */
+	__u32 desc_size;       /* sizeof(struct speed_bump_target_desc) */
+	__u32 nr_failed;       /* out: entries with a non-zero status */
+	__u32 reserved;        /* must be 0 */
+};
+
+#define SPEED_BUMP_IOC_BATCH _IOWR(SPEED_BUMP_IOC_MAGIC, 1, struct speed_bump_batch)
+
+/* Delay injected into one thread or process by filtered targets */
+struct speed_bump_task_delay {
+	__u64 hits;            /* hits taken, delayed or not */
+	__u64 delay_ns;        /* delay requested */
+	__u64 actual_ns;       /* delay measured, as total_actual_ns */
+};
+
+/* speed_bump_task_stats.flags */
+#define SPEED_BUMP_TASK_STATS_RESET 1U  /* zero the accounts as they are read */
+
+/*
+ * Argument of SPEED_BUMP_IOC_TASK_STATS. Only hits of targets with a
+ * pid= or cgroup= filter are accounted per task. A task that has not
+ * taken one reads as zeros. Any process may read and reset its own
+ * accounts; another process's take ptrace read access or CAP_SYS_ADMIN
+ * (EPERM otherwise).
+ */
+struct speed_bump_task_stats {
+	__s32 tid;             /* in: thread, in the caller's pid namespace;
+				* 0 = the calling thread */
+	__u32 flags;           /* in: SPEED_BUMP_TASK_STATS_* */
+	__u64 dropped;         /* out: hits of all tasks left unaccounted
+				* for want of room */
+	struct speed_bump_task_delay thread;   /* out: the thread */
+	struct speed_bump_task_delay process;  /* out: its whole process */
+};
+
+#define SPEED_BUMP_IOC_TASK_STATS _IOWR(SPEED_BUMP_IOC_MAGIC, 2, struct speed_bump_task_stats)
+
+/*
+ * What read() of the control device returns, once something happened
+ * since the file's last read: a target was added, removed or updated
+ * or changed state, enabled or the active profile changed, or
+ * total_hits grew by the file's hit threshold. poll() reports EPOLLIN
+ * then. The first read of a file returns at once with the totals to
+ * start from.
+ */
+struct speed_bump_event {
+	__u32 changes;         /* state changes since the last read */
+	__u32 nr_targets;      /* as targets in stats */
+	__u32 enabled;         /* 0 or 1 */
+	__u32 reserved;
+	__u64 total_hits;      /* as in stats */
+	__u64 total_delay_ns;
+	__u64 total_actual_ns;
+	__u64 total_throttled;
+};
+
+/*
+ * Argument of SPEED_BUMP_IOC_WATCH, which sets the hit threshold of the
+ * file it is called on.
+ */
+struct speed_bump_watch {
+	__u64 hits;            /* wake once total_hits grew by this much since
+				* the last read, 0 = on state changes only */
+	__u64 reserved;        /* must be 0 */
+};
+
+#define SPEED_BUMP_IOC_WATCH _IOW(SPEED_BUMP_IOC_MAGIC, 3, struct speed_bump_watch)
+
+#endif /* SPEED_BUMP_UAPI_H */
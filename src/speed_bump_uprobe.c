@@ -2,7 +2,11 @@
 /*
  * Speed Bump - Uprobe Management
  *
- * Handles uprobe registration, symbol resolution, and uprobe handlers.
+ * Handles uprobe registration, symbol resolution, and uprobe handlers,
+ * including the return handler of latency-measuring and scaled targets
+ * and the per-hit sampling of every=, prob= and dist= targets and the
+ * delay budgets that cap them. The handlers are where the tracepoints
+ * of speed_bump_trace.h are defined and fired.
  */
 
 #include <linux/kernel.h>
@@ -10,361 +14,1045 @@
 #include <linux/uprobes.h>
 #include <linux/namei.h>
 #include <linux/fs.h>
-#include <linux/elf.h>
 #include <linux/file.h>
 #include <linux/version.h>
 #include <linux/sched.h>
+#include <linux/sched/signal.h>
+#include <linux/sched/mm.h>
 #include <linux/rcupdate.h>
 #include <linux/percpu.h>
+#include <linux/jhash.h>
+#include <linux/hashtable.h>
+#include <linux/mutex.h>
+#include <linux/rculist.h>
+#include <linux/random.h>
+#include <linux/cgroup.h>
+#include <linux/cpumask.h>
 
 #include "speed_bump.h"
 #include "speed_bump_internal.h"
 
+#define CREATE_TRACE_POINTS
+#include "speed_bump_trace.h"
+
 /* ============================================================
- * Uprobe Handler
+ * PID and Cgroup Filtering
  * ============================================================ */
 
 /*
- * Uprobe handler called when a probed function is entered.
- * Executes the spin delay configured for this target.
+ * Check whether a task belongs to the process tree rooted at @root_tgid.
+ * Walks up real_parent until a match is found or init is reached.
  */
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,13,0)
-static int speed_bump_uprobe_handler(struct uprobe_consumer *uc,
-				     struct pt_regs *regs,
-				     __u64 *data)
-#else
-static int speed_bump_uprobe_handler(struct uprobe_consumer *uc,
-				     struct pt_regs *regs)
-#endif
+static bool speed_bump_task_in_tree(struct task_struct *task, pid_t root_tgid)
 {
-	struct speed_bump_target *target;
+	bool match = false;
 
-	if (!atomic_read(&speed_bump_enabled))
-		return 0;
-
-	target = container_of(uc, struct speed_bump_target, uc);
-
-	/* Check PID filter if set */
-	if (target->pid_filter != 0) {
-		struct task_struct *task = current;
-		bool match = false;
-
-		/* Walk up the process tree to find a match */
-		rcu_read_lock();
-		while (task->pid != 1) {  /* Stop at init */
-			if (task->tgid == target->pid_filter) {
-				match = true;
-				break;
-			}
-			task = rcu_dereference(task->real_parent);
+	rcu_read_lock();
+	while (task->pid != 1) {  /* Stop at init */
+		if (task->tgid == root_tgid) {
+			match = true;
+			break;
 		}
-		rcu_read_unlock();
+		task = rcu_dereference(task->real_parent);
+	}
+	rcu_read_unlock();
 
-		if (!match)
-			return 0;  /* Not in target process tree, skip delay */
+	return match;
+}
+
+/*
+ * Per-CPU cache of PID-tree verdicts.
+ *
+ * Walking real_parent to init on every hit costs more than the short
+ * delays we inject once the tree is a few levels deep, so remember the
+ * answer per (process, filter root). The key doubles as invalidation:
+ *
+ *   - fork/exit: a new process has a new tgid or group leader start
+ *     time, so it misses and a recycled PID never inherits a verdict
+ *   - exec: does not change a process's ancestry, the verdict stands
+ *   - pid_filter change: the new root is part of the key
+ *
+ * Ancestry can only change by re-parenting away from the tree (to init
+ * or a subreaper), so a cached "no" never goes stale. A cached "yes"
+ * is kept for a process whose ancestor exited, which keeps daemonised
+ * children of the filtered process delayed.
+ *
+ * Each CPU only touches its own slots with preemption disabled, so
+ * entries are never torn and need no locking.
+ */
+#define SPEED_BUMP_PID_CACHE_BITS 6
+#define SPEED_BUMP_PID_CACHE_SIZE (1 << SPEED_BUMP_PID_CACHE_BITS)
+
+struct speed_bump_pid_verdict {
+	u64 start_time;    /* group leader start time */
+	pid_t tgid;        /* 0 = empty slot */
+	pid_t root_tgid;   /* pid_filter the verdict was computed for */
+	bool match;
+};
+
+struct speed_bump_pid_cache {
+	struct speed_bump_pid_verdict slots[SPEED_BUMP_PID_CACHE_SIZE];
+};
+
+static DEFINE_PER_CPU(struct speed_bump_pid_cache, speed_bump_pid_cache);
+
+/*
+ * Check whether current belongs to the tree rooted at @root_tgid,
+ * consulting the per-CPU verdict cache first.
+ */
+static bool speed_bump_current_in_tree(pid_t root_tgid)
+{
+	struct speed_bump_pid_cache *cache;
+	struct speed_bump_pid_verdict *v;
+	pid_t tgid = current->tgid;
+	u64 start_time = current->group_leader->start_time;
+	u32 slot;
+	bool match;
+
+	slot = jhash_2words(tgid, root_tgid, 0) & (SPEED_BUMP_PID_CACHE_SIZE - 1);
+
+	cache = get_cpu_ptr(&speed_bump_pid_cache);
+	v = &cache->slots[slot];
+	if (v->tgid == tgid && v->root_tgid == root_tgid &&
+	    v->start_time == start_time) {
+		match = v->match;
+	} else {
+		match = speed_bump_task_in_tree(current, root_tgid);
+		v->start_time = start_time;
+		v->tgid = tgid;
+		v->root_tgid = root_tgid;
+		v->match = match;
 	}
+	put_cpu_ptr(&speed_bump_pid_cache);
 
-	/* Execute the delay */
-	speed_bump_spin_delay_ns(target->delay_ns);
+	return match;
+}
 
-	/* Update statistics */
-	atomic64_inc(&target->hit_count);
-	atomic64_add(target->delay_ns, &target->total_delay_ns);
-	/* Per-CPU counters - no contention */
-	this_cpu_inc(speed_bump_hits_percpu);
-	this_cpu_add(speed_bump_delay_percpu, target->delay_ns);
+/*
+ * Check whether @task is in the cgroup v2 subtree under @cgrp, where
+ * NULL means no cgroup filter. Unlike the tree walk this is already
+ * cheap: an ancestor test on the task's default hierarchy cgroup is a
+ * single comparison at the ancestor's depth, and it stays correct for
+ * daemons re-parented to init.
+ * Caller must hold rcu_read_lock().
+ */
+static bool speed_bump_task_in_cgroup(struct task_struct *task,
+				      struct cgroup *cgrp)
+{
+	return !cgrp || task_under_cgroup_hierarchy(task, cgrp);
+}
 
-	return 0;
+/*
+ * Check whether current passes both the PID tree and the cgroup filter
+ * of @config.
+ * Caller must hold rcu_read_lock().
+ */
+static bool speed_bump_current_matches(const struct speed_bump_target_config *config)
+{
+	return (!config->pid_filter ||
+		speed_bump_current_in_tree(config->pid_filter)) &&
+	       speed_bump_task_in_cgroup(current, config->cgroup);
+}
+
+/*
+ * Check whether a process (any of its live threads) is using @mm.
+ * The group leader's mm is cleared once it exits, even if other
+ * threads are still running, so fall back to scanning the threads.
+ * Caller must hold rcu_read_lock().
+ */
+static bool speed_bump_process_uses_mm(struct task_struct *p,
+				       struct mm_struct *mm)
+{
+	struct task_struct *t;
+
+	if (READ_ONCE(p->mm))
+		return READ_ONCE(p->mm) == mm;
+
+	for_each_thread(p, t) {
+		if (READ_ONCE(t->mm) == mm)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Check whether @mm is used by a process other than @skip (a group
+ * leader, or NULL) that passes both the PID tree and the cgroup filter
+ * of @config, searching every process.
+ * Caller must hold rcu_read_lock().
+ */
+static bool speed_bump_mm_owner_matches(struct mm_struct *mm,
+					const struct speed_bump_target_config *config,
+					struct task_struct *skip)
+{
+	pid_t root_tgid = config->pid_filter;
+	struct task_struct *p;
+
+	for_each_process(p) {
+		if ((p->flags & PF_KTHREAD) || p == skip)
+			continue;
+		if (!speed_bump_process_uses_mm(p, mm))
+			continue;
+		if ((!root_tgid || speed_bump_task_in_tree(p, root_tgid)) &&
+		    speed_bump_task_in_cgroup(p, config->cgroup))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Check whether @mm is used by a process that passes both the PID tree
+ * and the cgroup filter of @config.
+ *
+ * On mmap (including exec) the mapping task is current, so the common
+ * case is a single ancestry walk. That only asks about current, not
+ * about other processes sharing its mm; see
+ * speed_bump_handler_unmatched(). At register/apply time the mm belongs
+ * to some other process and we have to search for its owner.
+ * Caller must hold rcu_read_lock().
+ */
+static bool speed_bump_mm_matches(struct mm_struct *mm,
+				  const struct speed_bump_target_config *config)
+{
+	if (current->mm == mm)
+		return speed_bump_current_matches(config);
+
+	return speed_bump_mm_owner_matches(mm, config, NULL);
 }
 
 /* ============================================================
- * ELF Symbol Resolution
- * ============================================================
+ * Probe Sites
+ * ============================================================ */
+
+/*
+ * Every target at one probed address (inode and offset) is a rule of
+ * the same site, and the site holds the only consumer registered
+ * there. A hit goes to the first rule, in the order they were
+ * registered, that is live and whose PID and cgroup filters take the
+ * task, so jobs sharing a host can each delay a function for their own
+ * processes with their own settings, and a hit is delayed at most once
+ * however many rules match.
  *
- * These functions resolve a symbol name to an offset within an ELF file.
- * Note: This is a simplified implementation that handles common cases.
- * Production use may need additional validation and error handling.
+ * The rules are an RCU list for the handlers and are changed under
+ * speed_bump_site_mutex, which the register work of an async add takes
+ * without speed_bump_mutex. A rule keeps its slot in @slots for as long
+ * as it is registered; the return handler finds its rule through the
+ * slot recorded in the call's session cookie.
+ */
+struct speed_bump_site {
+	struct uprobe_consumer uc;
+	struct list_head rules;  /* targets, by site_node */
+	struct speed_bump_target __rcu *slots[SPEED_BUMP_MAX_SITE_RULES];
+	unsigned int nr_rules;
+	struct inode *inode;
+	loff_t offset;
+	struct uprobe *uprobe;
+	struct hlist_node hnode;  /* in speed_bump_site_hash */
+	struct list_head doomed;  /* unregistered, freed by the next sync */
+};
+
+#define SPEED_BUMP_SITE_HASH_BITS 10
+static DEFINE_HASHTABLE(speed_bump_site_hash, SPEED_BUMP_SITE_HASH_BITS);
+static DEFINE_MUTEX(speed_bump_site_mutex);
+static LIST_HEAD(speed_bump_doomed_sites);
+
+static unsigned long speed_bump_site_key(const struct inode *inode,
+					 loff_t offset)
+{
+	return (unsigned long)inode ^ (unsigned long)offset;
+}
+
+/* Caller must hold speed_bump_site_mutex */
+static struct speed_bump_site *speed_bump_find_site(const struct inode *inode,
+						    loff_t offset)
+{
+	struct speed_bump_site *site;
+
+	hash_for_each_possible(speed_bump_site_hash, site, hnode,
+			       speed_bump_site_key(inode, offset)) {
+		if (site->inode == inode && site->offset == offset)
+			return site;
+	}
+	return NULL;
+}
+
+/*
+ * Append @target to the rules of @site.
+ * Caller must hold speed_bump_site_mutex.
+ * Returns 0 on success, -ENOSPC if every slot is taken.
  */
+static int speed_bump_site_add_rule(struct speed_bump_site *site,
+				    struct speed_bump_target *target)
+{
+	unsigned int slot;
+
+	for (slot = 0; slot < SPEED_BUMP_MAX_SITE_RULES; slot++) {
+		if (!rcu_access_pointer(site->slots[slot]))
+			break;
+	}
+	if (slot == SPEED_BUMP_MAX_SITE_RULES)
+		return -ENOSPC;
+
+	target->site = site;
+	target->site_slot = slot;
+	rcu_assign_pointer(site->slots[slot], target);
+	list_add_tail_rcu(&target->site_node, &site->rules);
+	site->nr_rules++;
+	return 0;
+}
 
 /*
- * Convert a virtual address to a file offset using ELF program headers.
- * Returns the file offset on success, 0 on failure.
+ * Unhook @target from its site. Handlers already past the list may
+ * still be using it.
+ * Caller must hold speed_bump_site_mutex.
  */
-static loff_t vaddr_to_file_offset(struct file *file,
-				   const struct elf64_hdr *ehdr,
-				   Elf64_Addr vaddr)
+static void speed_bump_site_del_rule(struct speed_bump_target *target)
 {
-	struct elf64_phdr *phdrs = NULL;
-	loff_t file_offset = 0;
-	loff_t pos;
-	ssize_t ret;
-	int i;
+	struct speed_bump_site *site = target->site;
 
-	if (ehdr->e_phnum == 0)
-		return 0;
+	list_del_rcu(&target->site_node);
+	RCU_INIT_POINTER(site->slots[target->site_slot], NULL);
+	site->nr_rules--;
+	target->site = NULL;
+}
 
-	/* Allocate and read program headers */
-	phdrs = kmalloc_array(ehdr->e_phnum, sizeof(*phdrs), GFP_KERNEL);
-	if (!phdrs)
-		return 0;
+/* One pass of the site's consumer filter over the mms mapping it */
+static int speed_bump_site_apply(struct speed_bump_site *site, bool add)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,12,0)
+	return uprobe_apply(site->uprobe, &site->uc, add);
+#else
+	return uprobe_apply(site->inode, site->offset, &site->uc, add);
+#endif
+}
 
-	pos = ehdr->e_phoff;
-	ret = kernel_read(file, phdrs, ehdr->e_phnum * sizeof(*phdrs), &pos);
-	if (ret != ehdr->e_phnum * sizeof(*phdrs))
-		goto out;
+/*
+ * Uprobe consumer filter.
+ *
+ * Consulted by the uprobes core before it installs a breakpoint in an mm
+ * (on register, on uprobe_apply() and on every new mapping of the file).
+ * Returning false keeps the int3 out of processes outside the PID or
+ * cgroup filter of every rule entirely, so they run the probed function
+ * at native speed.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,12,0)
+static bool speed_bump_uprobe_filter(struct uprobe_consumer *uc,
+				     struct mm_struct *mm)
+#else
+static bool speed_bump_uprobe_filter(struct uprobe_consumer *uc,
+				     enum uprobe_filter_ctx ctx,
+				     struct mm_struct *mm)
+#endif
+{
+	const struct speed_bump_target_config *config;
+	struct speed_bump_target *target;
+	struct speed_bump_site *site;
+	bool match = false;
 
-	/* Find PT_LOAD segment containing this virtual address */
-	for (i = 0; i < ehdr->e_phnum; i++) {
-		if (phdrs[i].p_type != PT_LOAD)
-			continue;
+	site = container_of(uc, struct speed_bump_site, uc);
 
-		if (vaddr >= phdrs[i].p_vaddr &&
-		    vaddr < phdrs[i].p_vaddr + phdrs[i].p_filesz) {
-			file_offset = phdrs[i].p_offset +
-				      (vaddr - phdrs[i].p_vaddr);
+	/* The config also pins the cgroup, so test within the section */
+	rcu_read_lock();
+	list_for_each_entry_rcu(target, &site->rules, site_node) {
+		config = rcu_dereference(target->config);
+		if ((!config->pid_filter && !config->cgroup) ||
+		    speed_bump_mm_matches(mm, config)) {
+			match = true;
 			break;
 		}
 	}
+	rcu_read_unlock();
 
-out:
-	kfree(phdrs);
-	return file_offset;
+	return match;
 }
 
+/* ============================================================
+ * Hit Sampling
+ * ============================================================ */
+
+/*
+ * Per-CPU PRNG state for prob= and dist=. Seeded from the kernel's
+ * CSPRNG on first use; xorshift never leaves a non-zero state, so zero
+ * means unseeded.
+ */
+static DEFINE_PER_CPU(u64, speed_bump_prng);
+
 /*
- * Read ELF symbol table and find the file offset for a symbol.
- * Returns the symbol's file offset on success, 0 on failure.
+ * Decide whether this hit of @target is delayed and by how much under
+ * @config. @delay_ns holds the configured delay on entry and the
+ * sampled one on return. Targets with none of every=, prob=, dist= or
+ * cpus= take the early return and touch no extra state. A cpus= scope
+ * costs one bit test of the running CPU in the config's mask.
+ *
+ * The every= countdown is per CPU like the other counters, so with
+ * several CPUs hitting a target it delays one hit in roughly N rather
+ * than exactly every Nth.
  *
- * Note: Symbol st_value is a virtual address; we convert it to a file
- * offset using the program headers since uprobe_register() expects
- * a file offset.
+ * Returns: true if the hit should be delayed
  */
-static loff_t resolve_symbol_offset(struct file *file,
-				    const char *symbol_name)
+static bool speed_bump_sample_hit(struct speed_bump_target *target,
+				  const struct speed_bump_target_config *config,
+				  u64 *delay_ns)
 {
-	struct elf64_hdr ehdr;
-	struct elf64_shdr *shdrs = NULL;
-	char *shstrtab = NULL;
-	char *strtab = NULL;
-	struct elf64_sym *symtab = NULL;
-	Elf64_Addr sym_vaddr = 0;
-	loff_t offset = 0;
-	loff_t pos = 0;
-	ssize_t ret;
-	int i, j;
-	unsigned int symcount;
-	size_t shstrtab_size, strtab_size, symtab_size;
-
-	/* Read ELF header */
-	ret = kernel_read(file, &ehdr, sizeof(ehdr), &pos);
-	if (ret != sizeof(ehdr))
-		return 0;
+	struct speed_bump_target_stats *stats;
+	enum speed_bump_dist dist = config->dist;
+	u32 every = config->every;
+	u32 prob_ppm = config->prob_ppm;
+	bool delay = true;
+	u64 *state;
 
-	/* Verify ELF magic */
-	if (memcmp(ehdr.e_ident, ELFMAG, SELFMAG) != 0)
-		return 0;
+	if (every <= 1 && prob_ppm >= SPEED_BUMP_PROB_ONE &&
+	    dist == SPEED_BUMP_DIST_FIXED && !config->cpus)
+		return true;
 
-	/* Only support 64-bit ELF */
-	if (ehdr.e_ident[EI_CLASS] != ELFCLASS64)
-		return 0;
+	stats = get_cpu_ptr(target->stats);
 
-	/* Allocate and read section headers */
-	shdrs = kmalloc_array(ehdr.e_shnum, sizeof(*shdrs), GFP_KERNEL);
-	if (!shdrs)
-		goto out;
-
-	pos = ehdr.e_shoff;
-	ret = kernel_read(file, shdrs, ehdr.e_shnum * sizeof(*shdrs), &pos);
-	if (ret != ehdr.e_shnum * sizeof(*shdrs))
-		goto out;
-
-	/* Read section header string table */
-	if (ehdr.e_shstrndx >= ehdr.e_shnum)
-		goto out;
-
-	shstrtab_size = shdrs[ehdr.e_shstrndx].sh_size;
-	shstrtab = kmalloc(shstrtab_size, GFP_KERNEL);
-	if (!shstrtab)
-		goto out;
-
-	pos = shdrs[ehdr.e_shstrndx].sh_offset;
-	ret = kernel_read(file, shstrtab, shstrtab_size, &pos);
-	if (ret != shstrtab_size)
-		goto out;
-
-	/* Find .symtab or .dynsym and their string tables */
-	for (i = 0; i < ehdr.e_shnum; i++) {
-		if (shdrs[i].sh_type != SHT_SYMTAB &&
-		    shdrs[i].sh_type != SHT_DYNSYM)
-			continue;
+	/* Out of scope hits pass undelayed and leave every= where it was */
+	if (config->cpus &&
+	    !cpumask_test_cpu(smp_processor_id(), config->cpus))
+		delay = false;
 
-		/* Get the associated string table */
-		if (shdrs[i].sh_link >= ehdr.e_shnum)
-			continue;
+	if (delay && every > 1) {
+		if (++stats->every_count < every)
+			delay = false;
+		else
+			stats->every_count = 0;
+	}
 
-		strtab_size = shdrs[shdrs[i].sh_link].sh_size;
-		strtab = kmalloc(strtab_size, GFP_KERNEL);
-		if (!strtab)
-			continue;
+	if (delay && (prob_ppm < SPEED_BUMP_PROB_ONE ||
+		      dist != SPEED_BUMP_DIST_FIXED)) {
+		state = this_cpu_ptr(&speed_bump_prng);
+		if (unlikely(!*state))
+			*state = get_random_u64() | 1;
 
-		pos = shdrs[shdrs[i].sh_link].sh_offset;
-		ret = kernel_read(file, strtab, strtab_size, &pos);
-		if (ret != strtab_size) {
-			kfree(strtab);
-			strtab = NULL;
-			continue;
-		}
+		/* Top 32 bits scaled to [0, SPEED_BUMP_PROB_ONE) */
+		if (prob_ppm < SPEED_BUMP_PROB_ONE &&
+		    (((speed_bump_prng_next(state) >> 32) *
+		      SPEED_BUMP_PROB_ONE) >> 32) >= prob_ppm)
+			delay = false;
 
-		/* Read symbol table */
-		symtab_size = shdrs[i].sh_size;
-		symtab = kmalloc(symtab_size, GFP_KERNEL);
-		if (!symtab) {
-			kfree(strtab);
-			strtab = NULL;
-			continue;
-		}
+		if (delay && dist != SPEED_BUMP_DIST_FIXED)
+			*delay_ns = speed_bump_dist_sample(dist, *delay_ns,
+							   config->max_ns,
+							   config->sigma_milli,
+							   state);
+	}
+
+	if (!delay)
+		stats->skipped++;
+
+	put_cpu_ptr(target->stats);
+
+	return delay;
+}
+
+/*
+ * Charge @delay_ns to @target's budget and then to the global one.
+ * Targets without a budget, under a module without one, only pay for
+ * the two reads.
+ *
+ * A delay the target's budget admits but the global budget refuses has
+ * still spent the target's tokens; with both caps set, the smaller one
+ * ends up binding either way.
+ *
+ * Returns: true if the delay may be injected
+ */
+static bool speed_bump_budget_allow(struct speed_bump_target *target,
+				    u64 delay_ns)
+{
+	struct speed_bump_target_stats *stats;
+	bool allow;
+	u64 now_ns;
+
+	if (!delay_ns || (!READ_ONCE(target->budget.ns_per_s) &&
+			  !READ_ONCE(speed_bump_budget.ns_per_s)))
+		return true;
+
+	now_ns = ktime_get_ns();
+
+	stats = get_cpu_ptr(target->stats);
+	allow = speed_bump_budget_take(&target->budget, &stats->budget,
+				       now_ns, delay_ns) &&
+		speed_bump_budget_take(&speed_bump_budget,
+				       this_cpu_ptr(&speed_bump_budget_percpu),
+				       now_ns, delay_ns);
+	if (!allow) {
+		stats->throttled++;
+		__this_cpu_inc(speed_bump_throttled_percpu);
+	}
+	put_cpu_ptr(target->stats);
+
+	return allow;
+}
 
-		pos = shdrs[i].sh_offset;
-		ret = kernel_read(file, symtab, symtab_size, &pos);
-		if (ret != symtab_size) {
-			kfree(symtab);
-			kfree(strtab);
-			symtab = NULL;
-			strtab = NULL;
+/*
+ * Account an injected delay: @delay_ns as requested and @actual_ns as
+ * measured around it, to @target and the global counters. Targets
+ * keeping an overshoot histogram also record by how much the delay ran
+ * long.
+ */
+static void speed_bump_account_delay(struct speed_bump_target *target,
+				     u64 delay_ns, u64 actual_ns)
+{
+	struct speed_bump_hist *hist;
+
+	this_cpu_add(target->stats->delay_ns, delay_ns);
+	this_cpu_add(target->stats->actual_ns, actual_ns);
+	this_cpu_add(speed_bump_delay_percpu, delay_ns);
+	this_cpu_add(speed_bump_actual_percpu, actual_ns);
+
+	if (target->overshoot) {
+		hist = get_cpu_ptr(target->overshoot);
+		speed_bump_hist_record(hist, actual_ns > delay_ns ?
+				       actual_ns - delay_ns : 0);
+		put_cpu_ptr(target->overshoot);
+	}
+}
+
+/* ============================================================
+ * Uprobe Handler
+ * ============================================================ */
+
+/*
+ * Entry handler verdict for a hit that is not delayed: on 6.13+ this
+ * also skips arming the return probe of a latency-measuring target.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,13,0)
+#define SPEED_BUMP_HANDLER_SKIP UPROBE_HANDLER_IGNORE
+#else
+#define SPEED_BUMP_HANDLER_SKIP 0
+#endif
+
+/*
+ * Whether hits of @target take effect: always outside a profile, else
+ * only while its profile is the active one, and never once the process
+ * of an autoremove target has exited. Activating a profile is a single
+ * store of its id, so the handler compares ids and never dereferences
+ * the profile.
+ */
+static bool speed_bump_target_live(const struct speed_bump_target *target)
+{
+	if (READ_ONCE(target->exited))
+		return false;
+
+	return !target->profile_id ||
+	       target->profile_id == READ_ONCE(speed_bump_active_profile);
+}
+
+/*
+ * The rule of @site that takes this hit of current, with the config it
+ * was chosen under, or NULL. @keep is set if a rule was passed over for
+ * not being live, as it may take later hits in this mm.
+ * Caller must hold rcu_read_lock().
+ */
+static struct speed_bump_target *
+speed_bump_site_select(struct speed_bump_site *site,
+		       const struct speed_bump_target_config **config,
+		       bool *keep)
+{
+	struct speed_bump_target *target;
+
+	*keep = false;
+	list_for_each_entry_rcu(target, &site->rules, site_node) {
+		if (!speed_bump_target_live(target)) {
+			*keep = true;
 			continue;
 		}
+		*config = rcu_dereference(target->config);
+		if (speed_bump_current_matches(*config))
+			return target;
+	}
+	return NULL;
+}
 
-		/* Search for the symbol */
-		symcount = symtab_size / sizeof(struct elf64_sym);
-		for (j = 0; j < symcount; j++) {
-			if (symtab[j].st_name >= strtab_size)
-				continue;
-
-			if (strcmp(&strtab[symtab[j].st_name], symbol_name) == 0) {
-				/* Found symbol - get virtual address */
-				sym_vaddr = symtab[j].st_value;
-				kfree(symtab);
-				kfree(strtab);
-				goto convert_offset;
-			}
+/*
+ * Session cookie of a call for the return handler: the time the body
+ * started, shifted up by SPEED_BUMP_COOKIE_SHIFT, then the slot of the
+ * rule that took the entry and whether it was delayed. The time wraps
+ * every 2^56 ns (over two years), which the subtraction in the return
+ * handler absorbs.
+ */
+#define SPEED_BUMP_COOKIE_SHIFT 8
+#define SPEED_BUMP_COOKIE_SLOT(cookie) \
+	(((cookie) >> 1) & ((1U << (SPEED_BUMP_COOKIE_SHIFT - 1)) - 1))
+
+/*
+ * Handler verdict for a hit no rule of @site takes.
+ * UPROBE_HANDLER_REMOVE unapplies the breakpoint from all of
+ * current->mm. The filter that 6.12+ runs first takes the current fast
+ * path of speed_bump_mm_matches(), and earlier kernels run none, so
+ * neither looks at other processes sharing the mm (CLONE_VM without
+ * CLONE_THREAD, such as a vfork child). One of those that a rule takes
+ * would lose its breakpoint too, so search for it here and keep the
+ * breakpoint if there is one. An mm with no users beyond current's
+ * threads, the usual case, is removed without a search.
+ */
+static int speed_bump_handler_unmatched(struct speed_bump_site *site)
+{
+	const struct speed_bump_target_config *config;
+	struct speed_bump_target *target;
+	struct mm_struct *mm = current->mm;
+	bool shared = false;
+
+	/* Transient references only make this search more often */
+	if (atomic_read(&mm->mm_users) <= get_nr_threads(current))
+		return UPROBE_HANDLER_REMOVE;
+
+	rcu_read_lock();
+	list_for_each_entry_rcu(target, &site->rules, site_node) {
+		config = rcu_dereference(target->config);
+		if (speed_bump_mm_owner_matches(mm, config,
+						current->group_leader)) {
+			shared = true;
+			break;
 		}
+	}
+	rcu_read_unlock();
+
+	return shared ? SPEED_BUMP_HANDLER_SKIP : UPROBE_HANDLER_REMOVE;
+}
+
+/*
+ * Uprobe handler called when a probed function is entered.
+ * Executes the delay of the site's rule that takes the hit. Handlers
+ * run in the probed task's context with preemption enabled, so the
+ * sleeping modes are allowed here.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,13,0)
+static int speed_bump_uprobe_handler(struct uprobe_consumer *uc,
+				     struct pt_regs *regs,
+				     __u64 *data)
+#else
+static int speed_bump_uprobe_handler(struct uprobe_consumer *uc,
+				     struct pt_regs *regs)
+#endif
+{
+	const struct speed_bump_target_config *config;
+	struct speed_bump_target *target;
+	struct speed_bump_site *site;
+	enum speed_bump_delay_mode mode;
+	unsigned int verdict;
+	u64 delay_ns, start_ns, actual_ns = 0;
+	bool delay, keep, filtered;
+
+	if (!atomic_read(&speed_bump_enabled))
+		return SPEED_BUMP_HANDLER_SKIP;
+
+	site = container_of(uc, struct speed_bump_site, uc);
 
-		kfree(symtab);
-		kfree(strtab);
-		symtab = NULL;
-		strtab = NULL;
+	/*
+	 * Find the rule for this task. Rules staged in a profile that is
+	 * not active, or reaped, are passed over uncounted. The consumer
+	 * filter keeps the breakpoint out of unrelated mms, but a task can
+	 * still trap here with no rule taking it, e.g. after being
+	 * re-parented away from the tree, migrated out of the cgroup, or
+	 * when a filter changed. Ask the core to remove the breakpoint
+	 * from this mm, unless speed_bump_handler_unmatched() finds
+	 * another process sharing it that a rule still takes.
+	 */
+	rcu_read_lock();
+	target = speed_bump_site_select(site, &config, &keep);
+	if (!target) {
+		rcu_read_unlock();
+		return keep ? SPEED_BUMP_HANDLER_SKIP :
+			      speed_bump_handler_unmatched(site);
+	}
+
+	/*
+	 * Decide the delay from one config, unless sampling skips this hit
+	 * or it is over budget. The delay itself may sleep, so it runs
+	 * after the read-side section with the values taken out of it.
+	 */
+	delay_ns = speed_bump_target_delay_ns(target, config);
+	mode = config->mode;
+	filtered = config->pid_filter || config->cgroup;
+	if (!speed_bump_sample_hit(target, config, &delay_ns))
+		verdict = SPEED_BUMP_HIT_SKIPPED;
+	else if (!speed_bump_budget_allow(target, delay_ns))
+		verdict = SPEED_BUMP_HIT_THROTTLED;
+	else
+		verdict = SPEED_BUMP_HIT_DELAYED;
+	rcu_read_unlock();
+
+	/*
+	 * Time the delay: what a spin or sleep really took, wakeup
+	 * latency and preemption included, is what the caller lost. A
+	 * delay of 0 (a latency-only target, a sweep step) costs nothing
+	 * and is not timed.
+	 */
+	delay = verdict == SPEED_BUMP_HIT_DELAYED;
+	if (delay && delay_ns) {
+		start_ns = ktime_get_ns();
+		speed_bump_delay_ns(delay_ns, mode);
+		actual_ns = ktime_get_ns() - start_ns;
+	} else {
+		delay_ns = 0;
 	}
 
-convert_offset:
-	/* Convert virtual address to file offset using program headers */
-	if (sym_vaddr != 0)
-		offset = vaddr_to_file_offset(file, &ehdr, sym_vaddr);
+	trace_speed_bump_hit(target->id, verdict, delay_ns, actual_ns);
+
+	/* Update statistics - per-CPU counters, no contention */
+	this_cpu_inc(target->stats->hits);
+	this_cpu_inc(speed_bump_hits_percpu);
+	speed_bump_watch_hit();
+	if (delay && delay_ns)
+		speed_bump_account_delay(target, delay_ns, actual_ns);
+	/* Filtered targets also charge the task, see speed_bump_task.c */
+	if (filtered)
+		speed_bump_task_account(1, delay_ns, actual_ns);
 
-out:
-	kfree(shstrtab);
-	kfree(shdrs);
-	return offset;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,13,0)
+	/*
+	 * Every site has the return handler, for whichever rules need it;
+	 * the others decline it here. A skipped hit has nothing to scale
+	 * or measure.
+	 */
+	if (!target->ret_probe || (!delay && !target->latency))
+		return SPEED_BUMP_HANDLER_SKIP;
+
+	/*
+	 * Start the call's clock after the delay so it is not counted.
+	 * The low bit tells the return handler whether this hit was
+	 * delayed and so is to be scaled.
+	 */
+	*data = ktime_get_ns() << SPEED_BUMP_COOKIE_SHIFT |
+		target->site_slot << 1 | delay;
+#endif
+
+	return 0;
 }
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,13,0)
+/*
+ * Return handler for targets measuring latency or scaling their delay.
+ * The entry handler left the time the function body started in this
+ * call's session cookie, along with the slot of the rule that took it.
+ * A rule removed since then is skipped; one that took over its slot in
+ * the meantime may see the odd call it did not enter.
+ *
+ * A scaled target is delayed here, by its percentage of the duration
+ * just measured, so the caller sees the function run that much slower.
+ * Calls whose entry was skipped by sampling are measured but not scaled.
+ */
+static int speed_bump_uretprobe_handler(struct uprobe_consumer *uc,
+					unsigned long func,
+					struct pt_regs *regs,
+					__u64 *data)
+{
+	const struct speed_bump_target_config *config;
+	struct speed_bump_target *target;
+	struct speed_bump_site *site;
+	enum speed_bump_delay_mode mode;
+	struct speed_bump_hist *hist;
+	u64 duration_ns, delay_ns, start_ns, actual_ns;
+	u32 scale_pct;
+	bool filtered;
+
+	if (!data || !*data)
+		return 0;
+
+	duration_ns = ((ktime_get_ns() << SPEED_BUMP_COOKIE_SHIFT) -
+		       (*data & ~((1ULL << SPEED_BUMP_COOKIE_SHIFT) - 1))) >>
+		      SPEED_BUMP_COOKIE_SHIFT;
+	site = container_of(uc, struct speed_bump_site, uc);
+
+	/* Freed only after a sync, see speed_bump_unregister_uprobe_nosync() */
+	rcu_read_lock();
+	target = rcu_dereference(site->slots[SPEED_BUMP_COOKIE_SLOT(*data)]);
+	rcu_read_unlock();
+	if (!target || !target->ret_probe)
+		return 0;
+
+	if (target->latency) {
+		/* Only this CPU writes its copy; preemption off keeps it that way */
+		hist = get_cpu_ptr(target->latency);
+		speed_bump_hist_record(hist, duration_ns);
+		put_cpu_ptr(target->latency);
+	}
+
+	rcu_read_lock();
+	config = rcu_dereference(target->config);
+	scale_pct = config->scale_pct;
+	mode = config->mode;
+	filtered = config->pid_filter || config->cgroup;
+	rcu_read_unlock();
+
+	if (!scale_pct || !(*data & 1) || !atomic_read(&speed_bump_enabled) ||
+	    !speed_bump_target_live(target))
+		return 0;
+
+	delay_ns = speed_bump_scaled_delay_ns(duration_ns, scale_pct);
+	if (!delay_ns)
+		return 0;
+	if (!speed_bump_budget_allow(target, delay_ns)) {
+		trace_speed_bump_scale(target->id, SPEED_BUMP_HIT_THROTTLED,
+				       0, 0);
+		return 0;
+	}
+
+	start_ns = ktime_get_ns();
+	speed_bump_delay_ns(delay_ns, mode);
+	actual_ns = ktime_get_ns() - start_ns;
+
+	trace_speed_bump_scale(target->id, SPEED_BUMP_HIT_DELAYED, delay_ns,
+			       actual_ns);
+	speed_bump_account_delay(target, delay_ns, actual_ns);
+	if (filtered)
+		speed_bump_task_account(0, delay_ns, actual_ns);
+
+	return 0;
+}
+#endif
+
 /* ============================================================
  * Uprobe Registration
  * ============================================================ */
 
+/*
+ * Register the consumer of a new site at @inode and @target->offset,
+ * with @target as its only rule. On success the site holds @inode's
+ * reference.
+ * Caller must hold speed_bump_site_mutex.
+ */
+static int speed_bump_site_register(struct inode *inode,
+				    struct speed_bump_target *target)
+{
+	struct speed_bump_site *site;
+
+	BUILD_BUG_ON(SPEED_BUMP_MAX_SITE_RULES >
+		     1U << (SPEED_BUMP_COOKIE_SHIFT - 1));
+
+	site = kzalloc(sizeof(*site), GFP_KERNEL);
+	if (!site)
+		return -ENOMEM;
+
+	INIT_LIST_HEAD(&site->rules);
+	site->inode = inode;
+	site->offset = target->offset;
+	speed_bump_site_add_rule(site, target);
+
+	/* Set up uprobe consumer */
+	site->uc.handler = speed_bump_uprobe_handler;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,13,0)
+	/* Rules added later may want the return probe */
+	site->uc.ret_handler = speed_bump_uretprobe_handler;
+#else
+	site->uc.ret_handler = NULL;
+#endif
+	site->uc.filter = speed_bump_uprobe_filter;
+
+	/* Register the uprobe (ref_ctr_offset = 0 means no semaphore) */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,12,0)
+	/* Kernel 6.12+: returns struct uprobe *, 4 args with ref_ctr_offset */
+	site->uprobe = uprobe_register(inode, site->offset, 0, &site->uc);
+	if (IS_ERR(site->uprobe)) {
+		int err = PTR_ERR(site->uprobe);
+
+		target->site = NULL;
+		kfree(site);
+		return err;
+	}
+#else
+	/* Kernel <6.12: returns int, 3 args (no ref_ctr_offset) */
+	{
+		int err = uprobe_register(inode, site->offset, &site->uc);
+
+		if (err) {
+			target->site = NULL;
+			kfree(site);
+			return err;
+		}
+		site->uprobe = NULL;  /* Not returned by this API */
+	}
+#endif
+
+	hash_add(speed_bump_site_hash, &site->hnode,
+		 speed_bump_site_key(inode, site->offset));
+	return 0;
+}
+
 /*
  * Register a uprobe for a target.
- * Caller must hold speed_bump_mutex.
+ * Caller must hold speed_bump_mutex, or own the target as the register
+ * work of an async add.
  */
 int speed_bump_register_uprobe(struct speed_bump_target *target)
 {
+	char symbol[SPEED_BUMP_MAX_SYMBOL_LEN];
+	struct speed_bump_site *site;
+	struct inode *inode;
 	struct path path;
-	struct file *file;
 	int ret;
 
-	if (target->registered)
+	if (target->site)
 		return 0;
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6,13,0)
+	/* Passing the entry time to the return probe needs session cookies */
+	if (target->ret_probe)
+		return -EOPNOTSUPP;
+#endif
+
 	/* Resolve the path */
 	ret = kern_path(target->path, LOOKUP_FOLLOW, &path);
 	if (ret)
 		return ret;
 
 	/* Get inode */
-	target->inode = igrab(d_inode(path.dentry));
+	inode = igrab(d_inode(path.dentry));
 	path_put(&path);
 
-	if (!target->inode)
+	if (!inode)
 		return -ENOENT;
 
-	/* Resolve symbol to offset */
-	file = filp_open(target->path, O_RDONLY, 0);
-	if (IS_ERR(file)) {
-		iput(target->inode);
-		target->inode = NULL;
-		return PTR_ERR(file);
+	/* Offsets resolved offline are only good for the binary they came from */
+	if (target->build_id_len) {
+		ret = speed_bump_symcache_check_build_id(inode, target->path,
+							 target->build_id,
+							 target->build_id_len);
+		if (ret) {
+			iput(inode);
+			return ret;
+		}
 	}
 
-	target->offset = resolve_symbol_offset(file, target->symbol);
-	filp_close(file, NULL);
+	/*
+	 * Resolve symbol to offset, reusing the binary's cached index,
+	 * unless the caller already did or the target is a raw file offset
+	 * (offset 0 is the ELF header and never code). SYMBOL+OFF resolves
+	 * SYMBOL alone and adds OFF.
+	 */
+	if (!target->offset) {
+		strscpy(symbol, target->symbol,
+			strcspn(target->symbol, "+") + 1);
+		ret = speed_bump_symcache_lookup(inode, target->path, symbol,
+						 &target->offset);
+		if (ret) {
+			iput(inode);
+			return ret;
+		}
+		target->offset += target->inner;
+	}
 
-	if (target->offset == 0) {
-		iput(target->inode);
-		target->inode = NULL;
-		return -ENOENT;
+	mutex_lock(&speed_bump_site_mutex);
+	site = speed_bump_find_site(inode, target->offset);
+	if (!site) {
+		ret = speed_bump_site_register(inode, target);
+		if (!ret)
+			inode = NULL;  /* now the site's */
+	} else {
+		ret = speed_bump_site_add_rule(site, target);
+		/* Install the breakpoint in mms only the new rule takes */
+		if (!ret && speed_bump_site_apply(site, true))
+			pr_warn("speed_bump: failed to apply filter for %s:%s\n",
+				target->path, target->symbol);
 	}
+	mutex_unlock(&speed_bump_site_mutex);
 
-	/* Set up uprobe consumer */
-	target->uc.handler = speed_bump_uprobe_handler;
-	target->uc.ret_handler = NULL;
+	iput(inode);
+	return ret;
+}
 
-	/* Register the uprobe (ref_ctr_offset = 0 means no semaphore) */
+/*
+ * Re-evaluate the consumer filter against every mm mapping the target.
+ * Caller must hold speed_bump_mutex and have already published the new
+ * filter.
+ */
+int speed_bump_apply_uprobe_filter(struct speed_bump_target *target)
+{
+	int ret;
+
+	if (!target->site)
+		return 0;
+
+	/*
+	 * The add pass installs the breakpoint in mms the filter now accepts,
+	 * the remove pass strips it from mms it no longer accepts.
+	 */
+	ret = speed_bump_site_apply(target->site, true);
+	if (!ret)
+		ret = speed_bump_site_apply(target->site, false);
+	return ret;
+}
+
+/*
+ * Detach a target from its site without waiting for in-flight handlers.
+ *
+ * Handlers go on using the rule they picked after leaving the RCU
+ * section, while they delay, so the target must not be freed before
+ * speed_bump_unregister_uprobe_sync() has returned. The last rule
+ * unregisters the site's consumer and leaves the site itself for that
+ * sync to free. A site that keeps other rules has its breakpoint
+ * stripped from mms only @target wanted; on kernels before 6.12 that
+ * pass takes the uprobe's register_rwsem for write, which handlers
+ * hold for read, so it also waits them out.
+ *
+ * Caller must hold speed_bump_mutex.
+ */
+void speed_bump_unregister_uprobe_nosync(struct speed_bump_target *target)
+{
+	struct speed_bump_site *site = target->site;
+
+	if (!site)
+		return;
+
+	mutex_lock(&speed_bump_site_mutex);
+	speed_bump_site_del_rule(target);
+
+	if (site->nr_rules) {
+		speed_bump_site_apply(site, false);
+	} else {
+		hash_del(&site->hnode);
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(6,12,0)
-	/* Kernel 6.12+: returns struct uprobe *, 4 args with ref_ctr_offset */
-	target->uprobe = uprobe_register(target->inode, target->offset, 0,
-					 &target->uc);
-	if (IS_ERR(target->uprobe)) {
-		int err = PTR_ERR(target->uprobe);
-		target->uprobe = NULL;
-		iput(target->inode);
-		target->inode = NULL;
-		return err;
-	}
+		uprobe_unregister_nosync(site->uprobe, &site->uc);
 #else
-	/* Kernel <6.12: returns int, 3 args (no ref_ctr_offset) */
-	{
-		int err = uprobe_register(target->inode, target->offset,
-					  &target->uc);
-		if (err) {
-			iput(target->inode);
-			target->inode = NULL;
-			return err;
-		}
-		target->uprobe = NULL;  /* Not returned by this API */
+		/* Kernel <6.12: single-call unregister with inode/offset */
+		uprobe_unregister(site->inode, site->offset, &site->uc);
+#endif
+		site->uprobe = NULL;
+		iput(site->inode);
+		site->inode = NULL;
+		list_add_tail(&site->doomed, &speed_bump_doomed_sites);
 	}
+	mutex_unlock(&speed_bump_site_mutex);
+}
+
+/*
+ * Wait for handlers of every rule and consumer detached so far, and
+ * free the sites left without rules. One call covers any number of
+ * speed_bump_unregister_uprobe_nosync() calls. From 6.12 handlers run
+ * under RCU Tasks Trace, so this waits for the handlers of rules whose
+ * site is still registered as well.
+ */
+void speed_bump_unregister_uprobe_sync(void)
+{
+	struct speed_bump_site *site, *tmp;
+	LIST_HEAD(doomed);
+
+	mutex_lock(&speed_bump_site_mutex);
+	list_splice_init(&speed_bump_doomed_sites, &doomed);
+	mutex_unlock(&speed_bump_site_mutex);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,12,0)
+	uprobe_unregister_sync();
 #endif
 
-	target->registered = true;
-	return 0;
+	list_for_each_entry_safe(site, tmp, &doomed, doomed) {
+		list_del(&site->doomed);
+		kfree(site);
+	}
 }
 
 /*
- * Unregister a uprobe for a target.
+ * Unregister a uprobe for a target and wait for its handlers.
  * Caller must hold speed_bump_mutex.
  */
 void speed_bump_unregister_uprobe(struct speed_bump_target *target)
 {
-	if (!target->registered)
+	if (!target->site)
 		return;
 
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(6,12,0)
-	/* Kernel 6.12+: two-phase unregister */
-	uprobe_unregister_nosync(target->uprobe, &target->uc);
-	uprobe_unregister_sync();
-#else
-	/* Kernel <6.12: single-call unregister with inode/offset */
-	uprobe_unregister(target->inode, target->offset, &target->uc);
-#endif
-	target->uprobe = NULL;
-	iput(target->inode);
-	target->inode = NULL;
-	target->registered = false;
+	speed_bump_unregister_uprobe_nosync(target);
+	speed_bump_unregister_uprobe_sync();
 }
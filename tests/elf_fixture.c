@@ -0,0 +1,45 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Speed Bump - ELF Resolution Test Fixture
+ *
+ * Built into several shared libraries (GNU hash, SysV hash, stripped)
+ * that test_elf resolves symbols in. Enough exported functions are
+ * defined to give the hash tables multi-entry buckets and chains.
+ */
+
+#define FIXTURE_FN(n)                                   \
+    __attribute__((noinline))                           \
+    int fixture_fn_##n(int x)                           \
+    {                                                   \
+        __asm__ __volatile__("" : "+r"(x));             \
+        return x + n;                                   \
+    }
+
+#define FIXTURE_FN8(n)                                  \
+    FIXTURE_FN(n##0) FIXTURE_FN(n##1) FIXTURE_FN(n##2) FIXTURE_FN(n##3) \
+    FIXTURE_FN(n##4) FIXTURE_FN(n##5) FIXTURE_FN(n##6) FIXTURE_FN(n##7)
+
+FIXTURE_FN8(1)
+FIXTURE_FN8(2)
+FIXTURE_FN8(3)
+FIXTURE_FN8(4)
+FIXTURE_FN8(5)
+FIXTURE_FN8(6)
+FIXTURE_FN8(7)
+FIXTURE_FN8(8)
+
+/* Exported data: never resolves, a probe needs code */
+int fixture_data = 42;
+
+/* Only present in .symtab; found by the streaming scan */
+__attribute__((noinline))
+static int fixture_local(int x)
+{
+    __asm__ __volatile__("" : "+r"(x));
+    return x * 3;
+}
+
+void *fixture_local_addr(void)
+{
+    return (void *)fixture_local;
+}
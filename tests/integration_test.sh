@@ -27,7 +27,8 @@
 # 4. Run /bin/sleep with a short duration and measure wall-clock time
 # 5. The measured time should include the injected delay
 # 6. Verify the delay by comparing expected vs actual duration
-# 7. Clean up: remove config, disable, unload module
+# 7. Update only the target's mode and check its delay is unchanged
+# 8. Clean up: remove config, disable, unload module
 #
 # REQUIREMENTS:
 # - Root/sudo privileges
@@ -311,9 +312,42 @@ test_delay_injection() {
     fi
 }
 
-# Test 3: Verify cleanup works
+# Test 3: Verify an update only changes the options it names
+test_update_keeps_delay() {
+    log_info "=== Test 3: Mode-only update ==="
+
+    clear_all_targets
+    if ! configure_target "$TEST_BINARY" "$TEST_SYMBOL" "$INJECT_DELAY_NS"; then
+        log_fail "Failed to configure delay target"
+        return 1
+    fi
+
+    log_info "Updating ${TEST_BINARY}:${TEST_SYMBOL} to mode=sleep"
+    if ! echo "=${TEST_BINARY}:${TEST_SYMBOL} mode=sleep" > "${SYSFS_BASE}/targets" 2>&1; then
+        log_fail "Test 3: Mode-only update FAILED - update rejected"
+        return 1
+    fi
+
+    local line
+    line=$(grep "^${TEST_BINARY}:${TEST_SYMBOL} " "${SYSFS_BASE}/targets_list")
+    log_info "Target now: ${line}"
+    clear_all_targets
+
+    case "$line" in
+    *" delay_ns=${INJECT_DELAY_NS} "*" mode=sleep"*)
+        log_pass "Test 3: Mode-only update PASSED"
+        return 0
+        ;;
+    esac
+
+    log_fail "Test 3: Mode-only update FAILED"
+    log_error "Expected delay_ns=${INJECT_DELAY_NS} and mode=sleep"
+    return 1
+}
+
+# Test 4: Verify cleanup works
 test_cleanup() {
-    log_info "=== Test 3: Cleanup verification ==="
+    log_info "=== Test 4: Cleanup verification ==="
 
     # Clear all targets
     clear_all_targets
@@ -331,11 +365,11 @@ test_cleanup() {
 
     # Unload module
     if ! unload_module; then
-        log_fail "Test 3: Cleanup FAILED - module unload failed"
+        log_fail "Test 4: Cleanup FAILED - module unload failed"
         return 1
     fi
 
-    log_pass "Test 3: Cleanup PASSED"
+    log_pass "Test 4: Cleanup PASSED"
     return 0
 }
 
@@ -410,7 +444,18 @@ main() {
 
     echo ""
 
-    # Test 3: Cleanup
+    # Test 3: Mode-only update
+    ((tests_run++))
+    if test_update_keeps_delay; then
+        ((tests_passed++))
+    else
+        ((tests_failed++))
+        exit_code=1
+    fi
+
+    echo ""
+
+    # Test 4: Cleanup
     ((tests_run++))
     if test_cleanup; then
         ((tests_passed++))
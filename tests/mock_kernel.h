@@ -19,6 +19,9 @@
 #include <time.h>
 #include <sched.h>
 #include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/types.h>
 
 /* ============================================================
  * 1. Type Definitions
@@ -34,6 +37,9 @@ typedef int16_t   s16;
 typedef int32_t   s32;
 typedef int64_t   s64;
 
+#define U32_MAX   ((u32)~0U)
+#define U64_MAX   ((u64)~0ULL)
+
 /* Size types */
 typedef size_t    size_t;
 typedef ssize_t   ssize_t;
@@ -63,6 +69,14 @@ typedef struct {
 #define atomic64_set(v, i)   ((v)->counter = (i))
 #define atomic64_inc(v)      ((v)->counter++)
 #define atomic64_add(i, v)   ((v)->counter += (i))
+#define atomic64_fetch_sub(i, v) __atomic_fetch_sub(&(v)->counter, (i), __ATOMIC_SEQ_CST)
+
+static inline s64 atomic64_cmpxchg(atomic64_t *v, s64 old, s64 new)
+{
+    __atomic_compare_exchange_n(&v->counter, &old, new, false,
+                                __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+    return old;
+}
 
 /* Likely/unlikely branch hints */
 #define likely(x)            __builtin_expect(!!(x), 1)
@@ -126,9 +140,25 @@ static inline s64 ktime_to_ms(ktime_t kt)
     return kt / 1000000;
 }
 
+static inline ktime_t ktime_add_ns(ktime_t kt, u64 nsec)
+{
+    return kt + (s64)nsec;
+}
+
+static inline ktime_t ktime_sub_ns(ktime_t kt, u64 nsec)
+{
+    return kt - (s64)nsec;
+}
+
+static inline ktime_t ktime_sub(ktime_t a, ktime_t b)
+{
+    return a - b;
+}
+
 #define NSEC_PER_SEC    1000000000L
 #define NSEC_PER_MSEC   1000000L
 #define NSEC_PER_USEC   1000L
+#define USEC_PER_SEC    1000000L
 
 /* Delay functions */
 static inline void ndelay(unsigned long nsecs)
@@ -169,6 +199,36 @@ static inline void rep_nop(void)
     cpu_relax();
 }
 
+/*
+ * Local cycle counter: the TSC on x86, CNTVCT_EL0 on arm64, falling
+ * back to the monotonic clock elsewhere. Userspace reads are allowed on
+ * both architectures under Linux.
+ */
+typedef u64 cycles_t;
+
+static inline cycles_t get_cycles(void)
+{
+#if defined(__x86_64__)
+    u32 lo, hi;
+
+    __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((u64)hi << 32) | lo;
+#elif defined(__aarch64__)
+    u64 val;
+
+    __asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(val));
+    return val;
+#else
+    return ktime_get_ns();
+#endif
+}
+
+/* Linux keeps both counters constant-rate and synchronised across CPUs */
+static inline bool mock_cycles_stable(void)
+{
+    return true;
+}
+
 /* ============================================================
  * 4. Scheduler Hints
  * ============================================================ */
@@ -185,6 +245,42 @@ static inline int cond_resched_rcu(void)
     return 0;
 }
 
+/*
+ * hrtimer sleeps: a single test thread, so task state is a no-op and no
+ * signal is ever pending; sleep on the monotonic clock expiry directly.
+ */
+#define TASK_KILLABLE            0
+#define current                  NULL
+#define set_current_state(state) ((void)(state))
+
+enum hrtimer_mode {
+    HRTIMER_MODE_ABS,
+    HRTIMER_MODE_REL,
+};
+
+static inline bool fatal_signal_pending(void *task)
+{
+    (void)task;
+    return false;
+}
+
+static inline int schedule_hrtimeout_range(ktime_t *expires, u64 delta,
+                                           enum hrtimer_mode mode)
+{
+    struct timespec ts;
+    ktime_t kt = *expires;
+
+    (void)delta;
+    if (mode == HRTIMER_MODE_REL)
+        kt += ktime_get();
+
+    ts.tv_sec = kt / NSEC_PER_SEC;
+    ts.tv_nsec = kt % NSEC_PER_SEC;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+    return 0;
+}
+
 /* ============================================================
  * 5. Print Macros
  * ============================================================ */
@@ -347,6 +443,46 @@ static inline void mock_uprobe_reset(void)
     memset(__mock_uprobe_records, 0, sizeof(__mock_uprobe_records));
 }
 
+/* ============================================================
+ * 8. Memory Allocation
+ * ============================================================ */
+
+typedef unsigned int gfp_t;
+
+#define GFP_KERNEL  0u
+#define GFP_ATOMIC  1u
+
+static inline void *kmalloc(size_t size, gfp_t flags)
+{
+    (void)flags;
+    return malloc(size);
+}
+
+static inline void *kzalloc(size_t size, gfp_t flags)
+{
+    (void)flags;
+    return calloc(1, size);
+}
+
+static inline void *kmalloc_array(size_t n, size_t size, gfp_t flags)
+{
+    (void)flags;
+    if (size && n > (size_t)-1 / size)
+        return NULL;
+    return malloc(n * size);
+}
+
+static inline void *kcalloc(size_t n, size_t size, gfp_t flags)
+{
+    (void)flags;
+    return calloc(n, size);
+}
+
+static inline void kfree(const void *ptr)
+{
+    free((void *)ptr);
+}
+
 /* ============================================================
  * Additional Kernel Utilities
  * ============================================================ */
@@ -382,6 +518,9 @@ static inline bool IS_ERR_OR_NULL(const void *ptr)
 #define max_t(type, a, b) ((type)(a) > (type)(b) ? (type)(a) : (type)(b))
 #define clamp(val, lo, hi) min((typeof(val))max(val, lo), hi)
 
+/* Round up to a power-of-two boundary */
+#define ALIGN(x, a) (((x) + ((a) - 1)) & ~((typeof(x))(a) - 1))
+
 /* ARRAY_SIZE */
 #define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
 
@@ -428,4 +567,44 @@ static inline bool IS_ERR_OR_NULL(const void *ptr)
 
 #endif /* MOCK_KERNEL */
 
+/* ============================================================
+ * 9. Math Helpers
+ * ============================================================ */
+
+static inline u64 div64_u64(u64 dividend, u64 divisor)
+{
+    return dividend / divisor;
+}
+
+static inline u64 mul_u64_u32_shr(u64 a, u32 mul, unsigned int shift)
+{
+    return (u64)(((unsigned __int128)a * mul) >> shift);
+}
+
+static inline u64 mul_u64_u32_div(u64 a, u32 mul, u32 divisor)
+{
+    return (u64)(((unsigned __int128)a * mul) / divisor);
+}
+
+static inline u64 div_u64(u64 dividend, u32 divisor)
+{
+    return dividend / divisor;
+}
+
+static inline s64 div_s64(s64 dividend, s32 divisor)
+{
+    return dividend / divisor;
+}
+
+/* Find last (most significant) set bit, 1-based; 0 if none */
+static inline int fls64(u64 x)
+{
+    return x ? 64 - __builtin_clzll(x) : 0;
+}
+
+static inline int fls(unsigned int x)
+{
+    return x ? 32 - __builtin_clz(x) : 0;
+}
+
 #endif /* MOCK_KERNEL_H */
@@ -0,0 +1,175 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Speed Bump - Delay Budget Tests
+ *
+ * Tests the per-second token buckets behind budget_ns_per_s, with
+ * several simulated CPUs sharing one budget.
+ * Compile with -DMOCK_KERNEL
+ */
+
+#include "mock_kernel.h"
+#include "speed_bump.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define TEST_CPUS 4
+#define TEST_T0   (5 * NSEC_PER_SEC + 123)   /* some time into a window */
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+static void check(int ok, const char *description)
+{
+    tests_run++;
+    if (ok) {
+        tests_passed++;
+        printf("[PASS] %s\n", description);
+    } else {
+        printf("[FAIL] %s\n", description);
+    }
+}
+
+static void budget_init(struct speed_bump_budget *budget,
+                        struct speed_bump_budget_cpu *cpus, u64 ns_per_s)
+{
+    memset(budget, 0, sizeof(*budget));
+    memset(cpus, 0, sizeof(*cpus) * TEST_CPUS);
+    budget->ns_per_s = ns_per_s;
+}
+
+/* Take @delay_ns on @cpu until refused; returns the total granted */
+static u64 drain(struct speed_bump_budget *budget,
+                 struct speed_bump_budget_cpu *cpu, u64 now_ns, u64 delay_ns)
+{
+    u64 granted = 0;
+
+    while (speed_bump_budget_take(budget, cpu, now_ns, delay_ns))
+        granted += delay_ns;
+
+    return granted;
+}
+
+static void test_unlimited(void)
+{
+    struct speed_bump_budget budget;
+    struct speed_bump_budget_cpu cpus[TEST_CPUS];
+    int i, ok = 1;
+
+    budget_init(&budget, cpus, 0);
+    for (i = 0; i < 100000; i++) {
+        if (!speed_bump_budget_take(&budget, &cpus[0], TEST_T0,
+                                    SPEED_BUMP_MAX_DELAY_NS))
+            ok = 0;
+    }
+    check(ok, "zero cap never refuses");
+
+    budget_init(&budget, cpus, 1000);
+    ok = 1;
+    for (i = 0; i < 1000; i++) {
+        if (!speed_bump_budget_take(&budget, &cpus[0], TEST_T0, 0))
+            ok = 0;
+    }
+    check(ok, "zero delay is never refused or charged");
+}
+
+static void test_single_cpu(void)
+{
+    struct speed_bump_budget budget;
+    struct speed_bump_budget_cpu cpus[TEST_CPUS];
+    u64 granted;
+
+    budget_init(&budget, cpus, 1000000);
+
+    granted = drain(&budget, &cpus[0], TEST_T0, 100000);
+    check(granted == 1000000, "one CPU gets the whole cap in a window");
+
+    check(!speed_bump_budget_take(&budget, &cpus[0],
+                                  TEST_T0 + NSEC_PER_SEC / 2, 100000),
+          "still refused later in the same window");
+
+    granted = drain(&budget, &cpus[0], TEST_T0 + NSEC_PER_SEC, 100000);
+    check(granted == 1000000, "next window is refilled");
+
+    check(!speed_bump_budget_take(&budget, &cpus[0],
+                                  TEST_T0 + 3 * NSEC_PER_SEC, 1000001),
+          "delay larger than the cap is refused");
+    check(speed_bump_budget_take(&budget, &cpus[0],
+                                 TEST_T0 + 3 * NSEC_PER_SEC, 1000000),
+          "delay equal to the cap fits an unused window");
+}
+
+static void test_shared(void)
+{
+    struct speed_bump_budget budget;
+    struct speed_bump_budget_cpu cpus[TEST_CPUS];
+    u64 granted = 0, window_total;
+    int i, round, ok = 1;
+
+    budget_init(&budget, cpus, 1600000);
+
+    /* Interleave the CPUs until every one of them is refused */
+    for (round = 0; round < 1000; round++) {
+        for (i = 0; i < TEST_CPUS; i++) {
+            if (speed_bump_budget_take(&budget, &cpus[i], TEST_T0, 10000))
+                granted += 10000;
+        }
+    }
+    check(granted == 1600000, "interleaved CPUs share exactly the cap");
+
+    /* CPUs 1..3 hold a slice each; CPU 0 can still use the rest */
+    budget_init(&budget, cpus, 1600000);
+    for (i = 1; i < TEST_CPUS; i++)
+        speed_bump_budget_take(&budget, &cpus[i], TEST_T0, 1000);
+    window_total = 3 * 1000 + drain(&budget, &cpus[0], TEST_T0, 1000);
+    check(window_total >= 1600000 - 3 * (1600000 / SPEED_BUMP_BUDGET_SLICES) &&
+          window_total <= 1600000,
+          "idle CPUs hold at most a slice each");
+
+    /* Tokens held in one window are not carried into the next */
+    granted = 0;
+    for (i = 0; i < TEST_CPUS; i++)
+        granted += drain(&budget, &cpus[i], TEST_T0 + NSEC_PER_SEC, 1000);
+    check(granted == 1600000, "held tokens expire with the window");
+
+    /* A CPU with a slightly older clock read does not rewind the window */
+    budget_init(&budget, cpus, 1000000);
+    drain(&budget, &cpus[0], TEST_T0 + NSEC_PER_SEC, 1000);
+    ok = !speed_bump_budget_take(&budget, &cpus[1], TEST_T0, 1000) &&
+         atomic64_read(&budget.window) ==
+         (s64)(TEST_T0 / NSEC_PER_SEC + 2);
+    check(ok, "window never moves backwards");
+}
+
+static void test_cap_change(void)
+{
+    struct speed_bump_budget budget;
+    struct speed_bump_budget_cpu cpus[TEST_CPUS];
+    u64 granted;
+
+    budget_init(&budget, cpus, 1000000);
+    drain(&budget, &cpus[0], TEST_T0, 100000);
+
+    WRITE_ONCE(budget.ns_per_s, 200000);
+    granted = drain(&budget, &cpus[0], TEST_T0 + NSEC_PER_SEC, 100000);
+    check(granted == 200000, "lowered cap applies from the next window");
+
+    WRITE_ONCE(budget.ns_per_s, 0);
+    check(speed_bump_budget_take(&budget, &cpus[0], TEST_T0 + NSEC_PER_SEC,
+                                 100000),
+          "clearing the cap lifts it at once");
+}
+
+int main(void)
+{
+    printf("=== Speed Bump Delay Budget Tests ===\n\n");
+
+    test_unlimited();
+    test_single_cpu();
+    test_shared();
+    test_cap_change();
+
+    printf("\n=== Results: %d/%d tests passed ===\n", tests_passed, tests_run);
+
+    return (tests_passed == tests_run) ? 0 : 1;
+}
@@ -2,7 +2,9 @@
 /*
  * Speed Bump - Delay Function Tests
  *
- * Tests spin delay accuracy within +/- 10% tolerance.
+ * Tests spin delay accuracy within +/- 10% tolerance, on both the
+ * ktime clock and the calibrated cycle counter, and that the sleep and
+ * hybrid modes keep that accuracy without spinning.
  * Compile with -DMOCK_KERNEL
  */
 
@@ -14,6 +16,7 @@
 
 #define TEST_TOLERANCE_PERCENT 10
 #define TEST_MIN_OVERHEAD_NS   500  /* Minimum overhead for timing measurement */
+#define TEST_SLEEP_SLACK_NS    1000000ULL  /* Wakeup latency allowance */
 
 static int tests_run = 0;
 static int tests_passed = 0;
@@ -85,20 +88,175 @@ static void test_zero_delay(void)
     }
 }
 
-int main(void)
+static void test_calibrate(bool use_cycles, enum speed_bump_delay_clock expected,
+                           const char *name)
 {
-    printf("=== Speed Bump Delay Tests ===\n\n");
+    u64 overhead_ns;
 
-    /* Test zero delay (edge case) */
-    test_zero_delay();
+    tests_run++;
+    speed_bump_delay_calibrate(use_cycles);
+    overhead_ns = speed_bump_delay_overhead_ns();
+
+    /* Overhead is a fixed per-call cost; a few us means a broken clock */
+    if (speed_bump_delay_clock() == expected && overhead_ns < 5000 &&
+        (expected == SPEED_BUMP_CLOCK_KTIME) ==
+        (speed_bump_delay_cycles_per_us() == 0)) {
+        tests_passed++;
+        printf("[PASS] %s: overhead=%llu ns, cycles/us=%llu\n", name,
+               (unsigned long long)overhead_ns,
+               (unsigned long long)speed_bump_delay_cycles_per_us());
+    } else {
+        printf("[FAIL] %s: clock=%d (expected %d), overhead=%llu ns, cycles/us=%llu\n",
+               name, speed_bump_delay_clock(), expected,
+               (unsigned long long)overhead_ns,
+               (unsigned long long)speed_bump_delay_cycles_per_us());
+    }
+}
+
+static u64 thread_cpu_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (u64)ts.tv_sec * 1000000000ULL + (u64)ts.tv_nsec;
+}
+
+/*
+ * A sleep or hybrid delay is never early and spends at most
+ * @max_cpu_pct of its duration on the CPU. Wakeup latency is up to the
+ * host scheduler, so lateness is only bounded loosely (twice the delay
+ * plus a millisecond) to catch gross errors.
+ */
+static void test_mode_delay(enum speed_bump_delay_mode mode, u64 target_ns,
+                            unsigned int max_cpu_pct, const char *name)
+{
+    u64 start_ns, actual_ns, cpu_start_ns, cpu_ns, tolerance_ns;
+
+    tests_run++;
+
+    tolerance_ns = target_ns + TEST_SLEEP_SLACK_NS;
+
+    cpu_start_ns = thread_cpu_ns();
+    start_ns = ktime_get_ns();
+    speed_bump_delay_ns(target_ns, mode);
+    actual_ns = ktime_get_ns() - start_ns;
+    cpu_ns = thread_cpu_ns() - cpu_start_ns;
+
+    if (actual_ns >= target_ns && actual_ns <= target_ns + tolerance_ns &&
+        cpu_ns * 100 <= target_ns * max_cpu_pct) {
+        tests_passed++;
+        printf("[PASS] %s: target=%llu ns, actual=%llu ns, cpu=%llu ns\n",
+               name, (unsigned long long)target_ns,
+               (unsigned long long)actual_ns, (unsigned long long)cpu_ns);
+    } else {
+        printf("[FAIL] %s: target=%llu ns, actual=%llu ns, cpu=%llu ns (expected not early, <= %u%% cpu)\n",
+               name, (unsigned long long)target_ns,
+               (unsigned long long)actual_ns, (unsigned long long)cpu_ns,
+               max_cpu_pct);
+    }
+}
+
+static void test_mode_names(void)
+{
+    static const enum speed_bump_delay_mode modes[] = {
+        SPEED_BUMP_MODE_SPIN, SPEED_BUMP_MODE_SLEEP, SPEED_BUMP_MODE_HYBRID,
+    };
+    enum speed_bump_delay_mode mode;
+    int ok = 1;
+    size_t i;
+
+    tests_run++;
+
+    for (i = 0; i < ARRAY_SIZE(modes); i++) {
+        if (speed_bump_parse_delay_mode(speed_bump_delay_mode_name(modes[i]),
+                                        &mode) != 0 || mode != modes[i])
+            ok = 0;
+    }
+    if (speed_bump_parse_delay_mode("nap", &mode) != -EINVAL ||
+        speed_bump_parse_delay_mode("", &mode) != -EINVAL)
+        ok = 0;
 
-    /* Test various delay durations */
+    if (ok) {
+        tests_passed++;
+        printf("[PASS] mode_names: spin/sleep/hybrid round-trip\n");
+    } else {
+        printf("[FAIL] mode_names\n");
+    }
+}
+
+static void test_scaled_delay(u64 duration_ns, unsigned int pct, u64 expected,
+                              const char *name)
+{
+    u64 result = speed_bump_scaled_delay_ns(duration_ns, pct);
+
+    tests_run++;
+    if (result == expected) {
+        tests_passed++;
+        printf("[PASS] %s: %u%% of %llu ns = %llu ns\n", name, pct,
+               (unsigned long long)duration_ns, (unsigned long long)result);
+    } else {
+        printf("[FAIL] %s: %u%% of %llu ns = %llu ns (expected %llu)\n", name,
+               pct, (unsigned long long)duration_ns,
+               (unsigned long long)result, (unsigned long long)expected);
+    }
+}
+
+static void test_scaled_delays(void)
+{
+    test_scaled_delay(1000000, 30, 300000, "scale_30pct");
+    test_scaled_delay(1000000, 0, 0, "scale_0pct");
+    test_scaled_delay(999, 50, 499, "scale_rounds_down");
+    test_scaled_delay(3000000000ULL, SPEED_BUMP_MAX_SCALE_PCT,
+                      SPEED_BUMP_MAX_DELAY_NS, "scale_capped_at_max_delay");
+    test_scaled_delay(U64_MAX, SPEED_BUMP_MAX_SCALE_PCT,
+                      SPEED_BUMP_MAX_DELAY_NS, "scale_no_overflow");
+}
+
+static void test_delay_modes(void)
+{
+    /* Sleeps never spin; hybrid spins at most its tail plus wakeup slop */
+    test_mode_delay(SPEED_BUMP_MODE_SLEEP,  5000000,  10, "sleep_5ms");
+    test_mode_delay(SPEED_BUMP_MODE_SLEEP,  20000000, 10, "sleep_20ms");
+    test_mode_delay(SPEED_BUMP_MODE_HYBRID, 5000000,  25, "hybrid_5ms");
+    test_mode_delay(SPEED_BUMP_MODE_HYBRID, 20000000, 10, "hybrid_20ms");
+    /* Shorter than the tail: spun, so accurate and all CPU */
+    test_mode_delay(SPEED_BUMP_MODE_HYBRID, 40000,    110, "hybrid_40us");
+}
+
+static void test_delay_durations(void)
+{
     test_delay_accuracy(1000,       "1us");
     test_delay_accuracy(10000,      "10us");
     test_delay_accuracy(100000,     "100us");
     test_delay_accuracy(1000000,    "1ms");
     test_delay_accuracy(10000000,   "10ms");
     test_delay_accuracy(50000000,   "50ms");
+}
+
+int main(void)
+{
+    printf("=== Speed Bump Delay Tests ===\n\n");
+
+    /* Test zero delay (edge case) */
+    test_zero_delay();
+
+    /* Uncalibrated: ktime clock */
+    printf("\n--- ktime clock ---\n");
+    test_delay_durations();
+
+    test_calibrate(false, SPEED_BUMP_CLOCK_KTIME, "calibrate_ktime");
+
+    printf("\n--- Delay modes ---\n");
+    test_mode_names();
+    test_delay_modes();
+    test_scaled_delays();
+
+#if defined(__x86_64__) || defined(__aarch64__)
+    printf("\n--- Cycle counter clock ---\n");
+    test_calibrate(true, SPEED_BUMP_CLOCK_CYCLES, "calibrate_cycles");
+    test_zero_delay();
+    test_delay_durations();
+#endif
 
     printf("\n=== Results: %d/%d tests passed ===\n", tests_passed, tests_run);
 
@@ -0,0 +1,202 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Speed Bump - Stochastic Delay Tests
+ *
+ * Tests the PRNG, the moments and bounds of each delay distribution,
+ * and decimal option parsing.
+ * Compile with -DMOCK_KERNEL
+ */
+
+#include "mock_kernel.h"
+#include "speed_bump.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TEST_SAMPLES 200000
+#define TEST_MEAN_NS 100000ULL
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+static void check(int ok, const char *description)
+{
+    tests_run++;
+    if (ok) {
+        tests_passed++;
+        printf("[PASS] %s\n", description);
+    } else {
+        printf("[FAIL] %s\n", description);
+    }
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    u64 x = *(const u64 *)a, y = *(const u64 *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Draw TEST_SAMPLES delays and check their mean and median against the
+ * distribution's, within @tol_pct percent, and that none exceeds @max_ns.
+ */
+static void test_moments(enum speed_bump_dist dist, u32 sigma_milli,
+                         u64 max_ns, double expect_mean, double expect_median,
+                         double tol_pct, const char *name)
+{
+    static u64 samples[TEST_SAMPLES];
+    u64 state = 0x9e3779b97f4a7c15ULL;
+    u64 bound = max_ns ? max_ns : SPEED_BUMP_MAX_DELAY_NS;
+    double sum = 0, mean, median;
+    int over = 0;
+    int i;
+
+    tests_run++;
+
+    for (i = 0; i < TEST_SAMPLES; i++) {
+        samples[i] = speed_bump_dist_sample(dist, TEST_MEAN_NS, max_ns,
+                                            sigma_milli, &state);
+        sum += (double)samples[i];
+        if (samples[i] > bound)
+            over++;
+    }
+    qsort(samples, TEST_SAMPLES, sizeof(samples[0]), cmp_u64);
+
+    mean = sum / TEST_SAMPLES;
+    median = (double)samples[TEST_SAMPLES / 2];
+
+    if (!over &&
+        mean >= expect_mean * (1 - tol_pct / 100) &&
+        mean <= expect_mean * (1 + tol_pct / 100) &&
+        median >= expect_median * (1 - tol_pct / 100) &&
+        median <= expect_median * (1 + tol_pct / 100)) {
+        tests_passed++;
+        printf("[PASS] %s: mean=%.0f (%.0f), median=%.0f (%.0f)\n", name,
+               mean, expect_mean, median, expect_median);
+    } else {
+        printf("[FAIL] %s: mean=%.0f (%.0f), median=%.0f (%.0f), %d over %llu\n",
+               name, mean, expect_mean, median, expect_median, over,
+               (unsigned long long)bound);
+    }
+}
+
+static void test_prng(void)
+{
+    u64 state = 1;
+    u64 r, ones = 0;
+    int zero = 0;
+    int i;
+
+    for (i = 0; i < TEST_SAMPLES; i++) {
+        r = speed_bump_prng_next(&state);
+        if (r == 0 || state == 0)
+            zero = 1;
+        ones += r >> 63;
+    }
+
+    check(!zero, "PRNG never returns or reaches zero");
+    check(ones > TEST_SAMPLES * 49 / 100 && ones < TEST_SAMPLES * 51 / 100,
+          "PRNG top bit is set about half the time");
+}
+
+static void test_fixed_parse(const char *str, unsigned int digits, int expected_ret,
+                             u64 expected, const char *description)
+{
+    u64 val = 0;
+    int ret = speed_bump_parse_fixed(str, digits, &val);
+
+    tests_run++;
+    if (ret == expected_ret && (ret || val == expected)) {
+        tests_passed++;
+        printf("[PASS] %s\n", description);
+    } else {
+        printf("[FAIL] %s: '%s' -> ret=%d val=%llu (expected ret=%d val=%llu)\n",
+               description, str, ret, (unsigned long long)val, expected_ret,
+               (unsigned long long)expected);
+    }
+}
+
+int main(void)
+{
+    static const enum speed_bump_dist dists[] = {
+        SPEED_BUMP_DIST_FIXED, SPEED_BUMP_DIST_EXP,
+        SPEED_BUMP_DIST_UNIFORM, SPEED_BUMP_DIST_LOGNORMAL,
+    };
+    enum speed_bump_dist dist;
+    u64 state = 42;
+    size_t i;
+    int saturated;
+    int ok;
+
+    printf("=== Speed Bump Stochastic Delay Tests ===\n\n");
+
+    printf("--- PRNG ---\n");
+    test_prng();
+
+    printf("\n--- Distributions ---\n");
+
+    check(speed_bump_dist_sample(SPEED_BUMP_DIST_FIXED, TEST_MEAN_NS, 0, 0,
+                                 &state) == TEST_MEAN_NS,
+          "fixed returns the mean");
+    check(speed_bump_dist_sample(SPEED_BUMP_DIST_FIXED, TEST_MEAN_NS, 5000, 0,
+                                 &state) == 5000,
+          "fixed is capped by max");
+
+    /* Exponential: median is mean * ln 2 */
+    test_moments(SPEED_BUMP_DIST_EXP, 0, 0, 100000, 69315, 2, "exp");
+    test_moments(SPEED_BUMP_DIST_UNIFORM, 0, 0, 100000, 100000, 2, "uniform");
+    /* Lognormal: median is mean * exp(-sigma^2 / 2) */
+    test_moments(SPEED_BUMP_DIST_LOGNORMAL, 500, 0, 100000, 88250, 3,
+                 "lognormal_sigma_0.5");
+    test_moments(SPEED_BUMP_DIST_LOGNORMAL, 1000, 0, 100000, 60653, 5,
+                 "lognormal_sigma_1.0");
+
+    /* Bounded: no sample above max, medians below it unchanged */
+    test_moments(SPEED_BUMP_DIST_EXP, 0, 150000, 77687, 69315, 2,
+                 "exp_bounded_at_1.5x_mean");
+
+    /* A very wide lognormal saturates at max rather than overflowing */
+    ok = 1;
+    saturated = 0;
+    for (i = 0; i < TEST_SAMPLES; i++) {
+        u64 d = speed_bump_dist_sample(SPEED_BUMP_DIST_LOGNORMAL, TEST_MEAN_NS,
+                                       1000000, SPEED_BUMP_MAX_SIGMA_MILLI,
+                                       &state);
+        if (d > 1000000)
+            ok = 0;
+        saturated += d == 1000000;
+    }
+    check(ok && saturated > 0, "lognormal_sigma_4 saturates at max");
+
+    printf("\n--- Names ---\n");
+
+    ok = 1;
+    for (i = 0; i < ARRAY_SIZE(dists); i++) {
+        if (speed_bump_parse_dist(speed_bump_dist_name(dists[i]), &dist) != 0 ||
+            dist != dists[i])
+            ok = 0;
+    }
+    if (speed_bump_parse_dist("normal", &dist) != -EINVAL)
+        ok = 0;
+    check(ok, "fixed/exp/uniform/lognormal round-trip");
+
+    printf("\n--- Decimal Parsing ---\n");
+
+    test_fixed_parse("0.25", 6, 0, 250000, "0.25 in ppm");
+    test_fixed_parse("1", 6, 0, 1000000, "integer in ppm");
+    test_fixed_parse(".5", 3, 0, 500, "leading point");
+    test_fixed_parse("2.", 3, 0, 2000, "trailing point");
+    test_fixed_parse("0.1234567", 6, 0, 123456, "excess digits dropped");
+    test_fixed_parse("", 6, -EINVAL, 0, "empty rejected");
+    test_fixed_parse(".", 6, -EINVAL, 0, "bare point rejected");
+    test_fixed_parse("1.2.3", 6, -EINVAL, 0, "two points rejected");
+    test_fixed_parse("-1", 6, -EINVAL, 0, "sign rejected");
+    test_fixed_parse("1e3", 6, -EINVAL, 0, "exponent rejected");
+    test_fixed_parse("99999999999999999999", 0, -ERANGE, 0, "overflow rejected");
+    test_fixed_parse("18446744073710", 6, -ERANGE, 0, "overflow in scaling rejected");
+
+    printf("\n=== Results: %d/%d tests passed ===\n", tests_passed, tests_run);
+
+    return (tests_passed == tests_run) ? 0 : 1;
+}
@@ -0,0 +1,400 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Speed Bump - ELF Symbol Resolution Tests
+ *
+ * Resolves symbols in fixture libraries built with GNU and SysV hash
+ * tables, with and without .symtab, and checks the file offsets against
+ * where the dynamic loader actually mapped each function. Build IDs are
+ * checked against the notes the loader mapped.
+ * Compile with -DMOCK_KERNEL
+ */
+
+#include "mock_kernel.h"
+#include "speed_bump.h"
+
+#include <dlfcn.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <link.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+static ssize_t pread_cb(void *ctx, void *buf, size_t len, loff_t pos)
+{
+    ssize_t ret = pread(*(int *)ctx, buf, len, pos);
+
+    return ret < 0 ? -errno : ret;
+}
+
+/*
+ * File offset of a loaded code address, from /proc/self/maps.
+ * This is independent of the ELF parser under test.
+ */
+static long long mapped_file_offset(const void *addr)
+{
+    unsigned long start, end, pgoff, a = (unsigned long)addr;
+    char line[512];
+    long long offset = -1;
+    FILE *f;
+
+    f = fopen("/proc/self/maps", "r");
+    if (!f)
+        return -1;
+
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%lx-%lx %*s %lx", &start, &end, &pgoff) != 3)
+            continue;
+        if (a >= start && a < end) {
+            offset = (long long)(a - start + pgoff);
+            break;
+        }
+    }
+
+    fclose(f);
+    return offset;
+}
+
+static int lookup(const char *path, const char *symbol, loff_t *offset)
+{
+    struct speed_bump_elf *elf;
+    int fd, ret;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -errno;
+
+    ret = speed_bump_elf_open(&elf, pread_cb, &fd);
+    if (ret == 0) {
+        ret = speed_bump_elf_lookup(elf, symbol, offset);
+        speed_bump_elf_close(elf);
+    }
+
+    close(fd);
+    return ret;
+}
+
+static int read_build_id(const char *path, u8 *id, size_t size)
+{
+    struct speed_bump_elf *elf;
+    int fd, ret;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -errno;
+
+    ret = speed_bump_elf_open(&elf, pread_cb, &fd);
+    if (ret == 0) {
+        ret = speed_bump_elf_build_id(elf, id, size);
+        speed_bump_elf_close(elf);
+    }
+
+    close(fd);
+    return ret;
+}
+
+struct loaded_build_id {
+    const char *path;
+    u8 id[64];
+    int len;
+};
+
+/*
+ * Find the build ID note of a loaded object in memory, where the
+ * loader mapped its PT_NOTE segments.
+ */
+static int loaded_build_id_fn(struct dl_phdr_info *info, size_t size,
+                              void *data)
+{
+    struct loaded_build_id *found = data;
+    const char *p, *end;
+    const ElfW(Nhdr) *note;
+    size_t align;
+    int i;
+
+    (void)size;
+    if (strcmp(info->dlpi_name, found->path) != 0)
+        return 0;
+
+    for (i = 0; i < info->dlpi_phnum; i++) {
+        if (info->dlpi_phdr[i].p_type != PT_NOTE)
+            continue;
+
+        align = info->dlpi_phdr[i].p_align == 8 ? 8 : 4;
+        p = (const char *)(info->dlpi_addr + info->dlpi_phdr[i].p_vaddr);
+        end = p + info->dlpi_phdr[i].p_memsz;
+        while (p + sizeof(*note) <= end) {
+            note = (const ElfW(Nhdr) *)p;
+            p += sizeof(*note);
+            if (note->n_type == NT_GNU_BUILD_ID && note->n_namesz == 4 &&
+                memcmp(p, "GNU", 4) == 0 &&
+                note->n_descsz <= sizeof(found->id)) {
+                memcpy(found->id, p + 4, note->n_descsz);
+                found->len = note->n_descsz;
+                return 1;
+            }
+            p += ALIGN((size_t)note->n_namesz, align) +
+                 ALIGN((size_t)note->n_descsz, align);
+        }
+    }
+    return 1;
+}
+
+/*
+ * Read the build ID of @path and compare it with @expected (@len bytes,
+ * or a negative errno), or with the loader's copy if @expected is NULL.
+ */
+static void test_build_id(const char *path, const u8 *expected, int len,
+                          const char *description)
+{
+    struct loaded_build_id found = { .path = path, .len = -ENODATA };
+    u8 id[SPEED_BUMP_MAX_BUILD_ID];
+    void *handle = NULL;
+    int ret;
+
+    tests_run++;
+    if (!expected) {
+        handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+        if (handle)
+            dl_iterate_phdr(loaded_build_id_fn, &found);
+        expected = found.id;
+        len = found.len;
+    }
+
+    ret = read_build_id(path, id, sizeof(id));
+    if (ret == len && (ret < 0 || memcmp(id, expected, len) == 0)) {
+        tests_passed++;
+        printf("[PASS] %s\n", description);
+    } else {
+        printf("[FAIL] %s: %s ret=%d expected=%d\n", description, path,
+               ret, len);
+    }
+
+    if (handle)
+        dlclose(handle);
+}
+
+static void test_build_ids(void)
+{
+    static const u8 fixed[] = {
+        0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+        0x88, 0x99, 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0xff,
+    };
+    u8 small[4];
+    int ret;
+
+    test_build_id("./elf_fixture_gnu.so", NULL, 0,
+                  "gnu: SHA-1 build ID matches the loaded note");
+    test_build_id("./elf_fixture_sysv.so", fixed, sizeof(fixed),
+                  "sysv: fixed build ID is read back");
+    test_build_id("./elf_fixture_stripped.so", fixed, -ENODATA,
+                  "stripped: no build ID returns -ENODATA");
+
+    tests_run++;
+    ret = read_build_id("./elf_fixture_sysv.so", small, sizeof(small));
+    if (ret == (int)sizeof(fixed) && memcmp(small, fixed, sizeof(small)) == 0) {
+        tests_passed++;
+        printf("[PASS] Short buffer gets a prefix and the full length\n");
+    } else {
+        printf("[FAIL] Short buffer gets a prefix and the full length: ret=%d\n",
+               ret);
+    }
+}
+
+static void test_expect_offset(const char *path, const char *symbol,
+                               const void *addr, const char *description)
+{
+    long long expected = mapped_file_offset(addr);
+    loff_t offset = 0;
+    int ret;
+
+    tests_run++;
+    ret = lookup(path, symbol, &offset);
+
+    if (ret == 0 && expected >= 0 && offset == expected) {
+        tests_passed++;
+        printf("[PASS] %s\n", description);
+    } else {
+        printf("[FAIL] %s: %s:%s ret=%d offset=0x%llx expected=0x%llx\n",
+               description, path, symbol, ret,
+               (unsigned long long)offset, (unsigned long long)expected);
+    }
+}
+
+static void test_expect_error(const char *path, const char *symbol,
+                              int expected, const char *description)
+{
+    loff_t offset = 0;
+    int ret;
+
+    tests_run++;
+    ret = lookup(path, symbol, &offset);
+
+    if (ret == expected) {
+        tests_passed++;
+        printf("[PASS] %s\n", description);
+    } else {
+        printf("[FAIL] %s: %s:%s expected=%d, got=%d\n",
+               description, path, symbol, expected, ret);
+    }
+}
+
+struct code_walk {
+    const char *path;
+    int fixture_fns;
+    int mismatches;
+    int saw_data;
+};
+
+static int code_walk_fn(void *data, const char *name, loff_t offset,
+                        bool is_func)
+{
+    struct code_walk *walk = data;
+    loff_t expected = 0;
+
+    if (strcmp(name, "fixture_data") == 0)
+        walk->saw_data = 1;
+    if (strncmp(name, "fixture_fn_", 11) != 0)
+        return 0;
+
+    walk->fixture_fns++;
+    if (!is_func)
+        walk->mismatches++;
+    if (lookup(walk->path, name, &expected) != 0 || expected != offset)
+        walk->mismatches++;
+    return 0;
+}
+
+/*
+ * Walk every code symbol and check it agrees with single-symbol lookup.
+ * Exported functions appear once per symbol table that holds them.
+ */
+static void test_code_walk(const char *path, int has_symtab, const char *name)
+{
+    struct code_walk walk = { .path = path };
+    struct speed_bump_elf *elf;
+    int fd, ret, expected = has_symtab ? 128 : 64;
+
+    tests_run++;
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("[FAIL] %s: open: %s\n", name, strerror(errno));
+        return;
+    }
+
+    ret = speed_bump_elf_open(&elf, pread_cb, &fd);
+    if (ret == 0) {
+        ret = speed_bump_elf_for_each_code_symbol(elf, code_walk_fn, &walk);
+        speed_bump_elf_close(elf);
+    }
+    close(fd);
+
+    if (ret == 0 && walk.fixture_fns == expected && !walk.mismatches &&
+        !walk.saw_data) {
+        tests_passed++;
+        printf("[PASS] %s: code symbol walk matches lookup\n", name);
+    } else {
+        printf("[FAIL] %s: code symbol walk ret=%d fns=%d (expected %d) "
+               "mismatches=%d data=%d\n", name, ret, walk.fixture_fns,
+               expected, walk.mismatches, walk.saw_data);
+    }
+}
+
+/*
+ * Resolve every exported fixture function plus the local one and
+ * compare against the loader's mapping.
+ */
+static void test_fixture(const char *path, int has_symtab, const char *name)
+{
+    char symbol[64], description[128];
+    void *handle, *addr;
+    void *(*local_addr)(void);
+    int i, j, failed = 0;
+    loff_t offset;
+
+    handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        tests_run++;
+        printf("[FAIL] %s: dlopen: %s\n", name, dlerror());
+        return;
+    }
+
+    /* All 64 exported functions: one result for the whole set */
+    tests_run++;
+    for (i = 1; i <= 8; i++) {
+        for (j = 0; j < 8; j++) {
+            snprintf(symbol, sizeof(symbol), "fixture_fn_%d%d", i, j);
+            addr = dlsym(handle, symbol);
+            offset = 0;
+            if (!addr || lookup(path, symbol, &offset) != 0 ||
+                offset != mapped_file_offset(addr)) {
+                printf("[FAIL] %s: %s resolved to 0x%llx, expected 0x%llx\n",
+                       name, symbol, (unsigned long long)offset,
+                       (unsigned long long)mapped_file_offset(addr));
+                failed = 1;
+            }
+        }
+    }
+    if (!failed) {
+        tests_passed++;
+        printf("[PASS] %s: 64 exported symbols via .dynsym\n", name);
+    }
+
+    local_addr = (void *(*)(void))dlsym(handle, "fixture_local_addr");
+    if (has_symtab && local_addr) {
+        snprintf(description, sizeof(description),
+                 "%s: local symbol via .symtab scan", name);
+        test_expect_offset(path, "fixture_local", local_addr(), description);
+    } else {
+        snprintf(description, sizeof(description),
+                 "%s: local symbol absent without .symtab", name);
+        test_expect_error(path, "fixture_local", -ENOENT, description);
+    }
+
+    snprintf(description, sizeof(description),
+             "%s: missing symbol returns -ENOENT", name);
+    test_expect_error(path, "fixture_no_such_symbol", -ENOENT, description);
+
+    snprintf(description, sizeof(description),
+             "%s: undefined import is not resolved", name);
+    test_expect_error(path, "__cxa_finalize", -ENOENT, description);
+
+    snprintf(description, sizeof(description),
+             "%s: data symbol is not resolved", name);
+    test_expect_error(path, "fixture_data", -ENOENT, description);
+
+    test_code_walk(path, has_symtab, name);
+
+    dlclose(handle);
+}
+
+int main(void)
+{
+    printf("=== Speed Bump ELF Tests ===\n\n");
+
+    printf("--- GNU hash ---\n");
+    test_fixture("./elf_fixture_gnu.so", 1, "gnu");
+
+    printf("\n--- SysV hash ---\n");
+    test_fixture("./elf_fixture_sysv.so", 1, "sysv");
+
+    printf("\n--- Stripped ---\n");
+    test_fixture("./elf_fixture_stripped.so", 0, "stripped");
+
+    printf("\n--- Build IDs ---\n");
+    test_build_ids();
+
+    printf("\n--- Edge Cases ---\n");
+    test_expect_error("./Makefile", "main", -ENOEXEC,
+                      "Non-ELF file returns -ENOEXEC");
+    test_expect_error("./no_such_file", "main", -ENOENT,
+                      "Missing file returns -ENOENT");
+
+    printf("\n=== Results: %d/%d tests passed ===\n", tests_passed, tests_run);
+
+    return (tests_passed == tests_run) ? 0 : 1;
+}
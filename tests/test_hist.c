@@ -0,0 +1,128 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Speed Bump - Latency Histogram Tests
+ *
+ * Tests log2 bucketing, merging and percentile estimates.
+ * Compile with -DMOCK_KERNEL
+ */
+
+#include "mock_kernel.h"
+#include "speed_bump.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+static void check(int ok, const char *description)
+{
+    tests_run++;
+    if (ok) {
+        tests_passed++;
+        printf("[PASS] %s\n", description);
+    } else {
+        printf("[FAIL] %s\n", description);
+    }
+}
+
+static void test_bucket(u64 ns, unsigned int expected, const char *description)
+{
+    unsigned int bucket = speed_bump_hist_bucket(ns);
+
+    tests_run++;
+    if (bucket == expected) {
+        tests_passed++;
+        printf("[PASS] %s\n", description);
+    } else {
+        printf("[FAIL] %s: ns=%llu, expected bucket %u, got %u\n",
+               description, (unsigned long long)ns, expected, bucket);
+    }
+}
+
+static void test_percentile(const struct speed_bump_hist *hist,
+                            unsigned int pct, u64 expected,
+                            const char *description)
+{
+    u64 result = speed_bump_hist_percentile(hist, pct);
+
+    tests_run++;
+    if (result == expected) {
+        tests_passed++;
+        printf("[PASS] %s\n", description);
+    } else {
+        printf("[FAIL] %s: p%u expected %llu, got %llu\n", description, pct,
+               (unsigned long long)expected, (unsigned long long)result);
+    }
+}
+
+int main(void)
+{
+    struct speed_bump_hist a, b, merged;
+    unsigned int i;
+    int ok;
+
+    printf("=== Speed Bump Histogram Tests ===\n\n");
+
+    printf("--- Bucketing ---\n");
+
+    test_bucket(0, 0, "0 ns in bucket 0");
+    test_bucket(1, 0, "1 ns in bucket 0");
+    test_bucket(2, 1, "2 ns starts bucket 1");
+    test_bucket(3, 1, "3 ns in bucket 1");
+    test_bucket(1023, 9, "1023 ns in bucket 9");
+    test_bucket(1024, 10, "1024 ns starts bucket 10");
+    test_bucket(1ULL << 39, SPEED_BUMP_HIST_BUCKETS - 1,
+                "2^39 ns in the last bucket");
+    test_bucket(U64_MAX, SPEED_BUMP_HIST_BUCKETS - 1,
+                "U64_MAX clamped to the last bucket");
+
+    ok = 1;
+    for (i = 0; i < SPEED_BUMP_HIST_BUCKETS; i++) {
+        if (speed_bump_hist_bucket(speed_bump_hist_bucket_lo(i)) != i)
+            ok = 0;
+        if (i > 0 && speed_bump_hist_bucket(speed_bump_hist_bucket_lo(i) - 1) != i - 1)
+            ok = 0;
+    }
+    check(ok, "Every bucket's lower bound starts that bucket");
+
+    printf("\n--- Record and Merge ---\n");
+
+    memset(&a, 0, sizeof(a));
+    memset(&b, 0, sizeof(b));
+    memset(&merged, 0, sizeof(merged));
+
+    /* a: 90 samples at ~1us; b: 10 samples at ~1ms */
+    for (i = 0; i < 90; i++)
+        speed_bump_hist_record(&a, 1000);
+    for (i = 0; i < 10; i++)
+        speed_bump_hist_record(&b, 1000000);
+
+    check(a.count == 90 && a.sum_ns == 90000 && a.buckets[9] == 90,
+          "Record updates count, sum and bucket");
+
+    speed_bump_hist_merge(&merged, &a);
+    speed_bump_hist_merge(&merged, &b);
+    check(merged.count == 100 && merged.sum_ns == 90000 + 10000000 &&
+          merged.buckets[9] == 90 && merged.buckets[19] == 10,
+          "Merge adds counts, sums and buckets");
+
+    printf("\n--- Percentiles ---\n");
+
+    test_percentile(&merged, 50, 1024, "p50 is the upper bound of the 1us bucket");
+    test_percentile(&merged, 90, 1024, "p90 is the last sample of the 1us bucket");
+    test_percentile(&merged, 91, 1ULL << 20, "p91 falls in the 1ms bucket");
+    test_percentile(&merged, 100, 1ULL << 20, "p100 is the slowest bucket");
+    test_percentile(&merged, 0, 1024, "p0 is the fastest bucket");
+
+    memset(&a, 0, sizeof(a));
+    test_percentile(&a, 50, 0, "Empty histogram reports 0");
+
+    speed_bump_hist_record(&a, U64_MAX);
+    test_percentile(&a, 99, 1ULL << SPEED_BUMP_HIST_BUCKETS,
+                    "Last bucket reports its lower bound doubled");
+
+    printf("\n=== Results: %d/%d tests passed ===\n", tests_passed, tests_run);
+
+    return (tests_passed == tests_run) ? 0 : 1;
+}
@@ -2,7 +2,7 @@
 /*
  * Speed Bump - Pattern Matching Tests
  *
- * Tests pattern matching for exact, prefix, and mismatch cases.
+ * Tests pattern matching for exact, prefix, glob, and mismatch cases.
  * Compile with -DMOCK_KERNEL
  */
 
@@ -89,6 +89,46 @@ int main(void)
     test_match("/usr/bin/*:func", "/usr/lib/app", "func", 0,
                "Prefix mismatch: different directory under prefix");
 
+    printf("\n--- Glob Match Tests ---\n");
+
+    /* Symbol globs */
+    test_match("/usr/lib64/libcuda.so:cuMem*", "/usr/lib64/libcuda.so",
+               "cuMemAlloc_v2", 1,
+               "Glob match: symbol prefix");
+
+    test_match("/usr/lib64/libcuda.so:cuMem*", "/usr/lib64/libcuda.so",
+               "cuMem", 1,
+               "Glob match: star matches empty run");
+
+    test_match("/opt/app/bin/*:Py*Dict*", "/opt/app/bin/python3",
+               "PyDict_GetItem", 1,
+               "Glob match: path and symbol globs");
+
+    test_match("/opt/app/bin/*:Py*Dict*", "/opt/app/bin/python3",
+               "_PyObject_GenericGetDict", 0,
+               "Glob mismatch: leading literal required");
+
+    test_match("/lib/libc.so.6:mem?py", "/lib/libc.so.6", "memcpy", 1,
+               "Glob match: question mark matches one char");
+
+    test_match("/lib/libc.so.6:mem?py", "/lib/libc.so.6", "memcppy", 0,
+               "Glob mismatch: question mark is exactly one char");
+
+    test_match("/lib/libc.so.6:*_chk", "/lib/libc.so.6", "__memcpy_chk", 1,
+               "Glob match: leading star");
+
+    test_match("/lib/libc.so.6:*_chk", "/lib/libc.so.6", "__memcpy_chk2", 0,
+               "Glob mismatch: literal suffix after star");
+
+    test_match("/lib/lib*.so.?:malloc", "/lib/libc.so.6", "malloc", 1,
+               "Glob match: wildcards inside path component");
+
+    test_match("/a*b*c:f", "/aXXbYYbZZc", "f", 1,
+               "Glob match: backtracking over repeated literal");
+
+    test_match("/a*b*c:f", "/aXXbYYbZZ", "f", 0,
+               "Glob mismatch: backtracking exhausts input");
+
     printf("\n--- Edge Cases ---\n");
 
     /* Edge cases */
@@ -0,0 +1,152 @@
+/* SPDX-License-Identifier: GPL-2.0 */
+/*
+ * Speed Bump - Delay Sweep Tests
+ *
+ * Tests parsing of sweep= schedules: ranges up and down, step lists,
+ * duration units and the limits on values and step counts.
+ * Compile with -DMOCK_KERNEL
+ */
+
+#include "mock_kernel.h"
+#include "speed_bump.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static int tests_run = 0;
+static int tests_passed = 0;
+
+static struct speed_bump_sweep_step steps[SPEED_BUMP_SWEEP_MAX_STEPS];
+
+static void check(int ok, const char *description)
+{
+    tests_run++;
+    if (ok) {
+        tests_passed++;
+        printf("[PASS] %s\n", description);
+    } else {
+        printf("[FAIL] %s\n", description);
+    }
+}
+
+static void test_result(const char *spec, int expected)
+{
+    int counted = speed_bump_parse_sweep(spec, NULL);
+    int parsed = speed_bump_parse_sweep(spec, steps);
+
+    tests_run++;
+    if (counted == expected && parsed == expected) {
+        tests_passed++;
+        printf("[PASS] \"%s\" -> %d\n", spec, expected);
+    } else {
+        printf("[FAIL] \"%s\": expected %d, got %d (counting %d)\n",
+               spec, expected, parsed, counted);
+    }
+}
+
+/* Whether steps[i] is @delay_ns for @duration_ns */
+static int step_is(int i, u64 delay_ns, u64 duration_ns)
+{
+    return steps[i].delay_ns == delay_ns &&
+           steps[i].duration_ns == duration_ns;
+}
+
+static void test_range(void)
+{
+    int i, ok = 1;
+
+    printf("\n--- Ranges ---\n");
+
+    check(speed_bump_parse_sweep("0:50000:5000@2s", steps) == 11,
+          "0:50000:5000@2s has 11 steps");
+    for (i = 0; i <= 10; i++)
+        ok &= step_is(i, i * 5000ULL, 2 * NSEC_PER_SEC);
+    check(ok, "Ascending steps of 5000 ns, 2 s each");
+
+    check(speed_bump_parse_sweep("50000:0:20000@10ms", steps) == 3 &&
+          step_is(0, 50000, 10 * NSEC_PER_MSEC) &&
+          step_is(1, 30000, 10 * NSEC_PER_MSEC) &&
+          step_is(2, 10000, 10 * NSEC_PER_MSEC),
+          "Descending range stops at the last whole step");
+
+    check(speed_bump_parse_sweep("7000:7000:1@1s", steps) == 1 &&
+          step_is(0, 7000, NSEC_PER_SEC),
+          "START == STOP is a single step");
+
+    test_result("0:255:1@1ms", 256);
+    test_result("0:256:1@1ms", -ERANGE);
+    test_result("0:10000000000:1000000000@1s", 11);
+    test_result("0:10000000001:1@1s", -ERANGE);
+    test_result("0:1000:0@1s", -EINVAL);
+    test_result("0:1000@1s", -EINVAL);
+    test_result("0:1000:100", -EINVAL);
+    test_result("0:1000:100@1s,", -EINVAL);
+}
+
+static void test_list(void)
+{
+    printf("\n--- Step lists ---\n");
+
+    check(speed_bump_parse_sweep("0@2s,20000@500ms,5000@1500000us", steps) == 3 &&
+          step_is(0, 0, 2 * NSEC_PER_SEC) &&
+          step_is(1, 20000, 500 * NSEC_PER_MSEC) &&
+          step_is(2, 5000, 1500 * NSEC_PER_MSEC),
+          "Mixed units in a list");
+
+    check(speed_bump_parse_sweep("100@1000000", steps) == 1 &&
+          step_is(0, 100, NSEC_PER_MSEC),
+          "A bare duration is in ns");
+
+    check(speed_bump_parse_sweep("100@3000000000ns", steps) == 1 &&
+          step_is(0, 100, 3 * NSEC_PER_SEC),
+          "ns suffix");
+
+    test_result("10000000000@1s", 1);
+    test_result("10000000001@1s", -ERANGE);
+    test_result("100", -EINVAL);
+    test_result("100@", -EINVAL);
+    test_result("100@1s,", -EINVAL);
+    test_result("100@1s,,200@1s", -EINVAL);
+    test_result("100@1s 200@1s", -EINVAL);
+    test_result("100@5000000h", -EINVAL);
+    test_result("-100@1s", -EINVAL);
+    test_result("", -EINVAL);
+}
+
+static void test_durations(void)
+{
+    char spec[8192];
+    size_t len = 0;
+    int i;
+
+    printf("\n--- Duration limits ---\n");
+
+    test_result("0@1ms", 1);
+    test_result("0@999us", -ERANGE);
+    test_result("0@0s", -ERANGE);
+    test_result("0@3600s", 1);
+    test_result("0@3601s", -ERANGE);
+    test_result("0@99999999999999999999s", -ERANGE);
+    test_result("0@18446744073709551615s", -ERANGE);
+
+    /* The step cap applies to lists too */
+    for (i = 0; i < SPEED_BUMP_SWEEP_MAX_STEPS; i++)
+        len += snprintf(spec + len, sizeof(spec) - len, "%s%d@1ms",
+                        i ? "," : "", i);
+    test_result(spec, SPEED_BUMP_SWEEP_MAX_STEPS);
+    snprintf(spec + len, sizeof(spec) - len, ",0@1ms");
+    test_result(spec, -ERANGE);
+}
+
+int main(void)
+{
+    printf("=== Speed Bump Delay Sweep Tests ===\n");
+
+    test_range();
+    test_list();
+    test_durations();
+
+    printf("\n=== Results: %d/%d tests passed ===\n", tests_passed, tests_run);
+
+    return (tests_passed == tests_run) ? 0 : 1;
+}
@@ -1,42 +1,79 @@
 /*
- * uprobe_test.c - Simple test program for uprobe-based delay injection
+ * uprobe_test.c - Test program and benchmark for uprobe-based delay injection
  *
- * Compile statically for VM testing:
- *   aarch64-linux-gnu-gcc -static -O2 -o uprobe_test uprobe_test.c
+ * Without options this calls target_function() a few times and prints
+ * how long each call took, for checking by hand that a target added on
+ * it delays:
+ *
+ *   ./uprobe_test [ITERATIONS]
+ *
+ * With --bench it measures what the module costs. It adds a target on
+ * its own target_function() through sysfs, calls it in tight loops
+ * from 1..N threads under each scenario below, and reports per-call
+ * percentiles. Needs root and the module loaded; the target is removed
+ * and the enabled state restored on exit.
+ *
+ *   native     no target: the cost of the timing itself
+ *   disabled   target with enabled=0: the trap, and a handler that
+ *              returns at its first check
+ *   handler    enabled, delay 0: the whole handler path
+ *   pid        as handler, with pid= filtering to this process
+ *   cgroup     as handler, with cgroup= set to this process's cgroup
+ *   delay      enabled, each --delays value in each --modes mode; the
+ *              error is the measured call time minus the requested delay
+ *
+ * Build with "make -C tests uprobe_test", or statically for VM testing:
+ *   aarch64-linux-gnu-gcc -static -O2 -pthread -o uprobe_test uprobe_test.c
  * or on native aarch64:
- *   gcc -static -O2 -o uprobe_test uprobe_test.c
+ *   gcc -static -O2 -pthread -o uprobe_test uprobe_test.c
  */
 
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/utsname.h>
 #include <time.h>
 #include <unistd.h>
 
+#define SYSFS_BASE    "/sys/kernel/speed_bump"
+#define SYSFS_TARGETS SYSFS_BASE "/targets"
+#define SYSFS_ENABLED SYSFS_BASE "/enabled"
+#define SYSFS_STATS   SYSFS_BASE "/stats"
+
+#define BENCH_MAX_LIST     16
+#define BENCH_DEFAULT_CALLS 100000
+#define BENCH_MIN_CALLS    100
+#define BENCH_SCENARIO_NS  2000000000ULL  /* cap on one thread's delay time */
+#define BENCH_LINE_LEN     512
+
 /* Target function for uprobe - intentionally not inlined */
 __attribute__((noinline))
-void target_function(void) {
+void target_function(void)
+{
     /* This function does nothing - it's just a hook point */
     asm volatile("" ::: "memory");
 }
 
 /* Get current time in nanoseconds */
-static long long get_time_ns(void) {
+static long long get_time_ns(void)
+{
     struct timespec ts;
     clock_gettime(CLOCK_MONOTONIC, &ts);
     return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
 }
 
-int main(int argc, char *argv[]) {
-    int iterations = 10;
+static int run_demo(const char *prog, int iterations)
+{
     long long total_ns = 0;
 
-    if (argc > 1) {
-        iterations = atoi(argv[1]);
-        if (iterations <= 0) iterations = 10;
-    }
-
     printf("uprobe_test: Running %d iterations\n", iterations);
-    printf("Binary path: %s\n", argv[0]);
+    printf("Binary path: %s\n", prog);
     printf("Symbol to probe: target_function\n\n");
 
     /* Warm up */
@@ -59,7 +96,539 @@ int main(int argc, char *argv[]) {
 
     /* Print info for speed_bump configuration */
     printf("\nTo add delay to this binary:\n");
-    printf("  echo \"+%s:target_function\" > /sys/kernel/speed_bump/targets\n", argv[0]);
+    printf("  echo \"+%s:target_function\" > /sys/kernel/speed_bump/targets\n", prog);
+
+    return 0;
+}
+
+/* ============================================================
+ * Benchmark
+ * ============================================================ */
+
+struct bench_opts {
+    unsigned long threads[BENCH_MAX_LIST];
+    int nr_threads;
+    unsigned long long delays[BENCH_MAX_LIST];
+    int nr_delays;
+    const char *modes[BENCH_MAX_LIST];
+    int nr_modes;
+    unsigned long calls;
+    int json;
+};
+
+/* One measured configuration of the target */
+struct bench_scenario {
+    const char *name;
+    int probe;                 /* add a target at all */
+    int enabled;
+    unsigned long long delay_ns;
+    const char *mode;
+    int pid_filter;            /* filter to this process */
+    const char *cgroup;        /* cgroup= path, or NULL */
+};
+
+struct bench_thread {
+    pthread_t thread;
+    pthread_barrier_t *start;
+    unsigned long calls;
+    uint64_t *samples;
+};
+
+static char bench_exe[PATH_MAX];
+static char bench_remove_cmd[PATH_MAX + 32];
+static char bench_enabled_saved[4] = "0";
+static int bench_target_added;
 
+/* open/write/close only, so it is safe from the signal handler too */
+static int write_file(const char *path, const char *data)
+{
+    size_t len = strlen(data);
+    ssize_t n;
+    int fd, err = 0;
+
+    fd = open(path, O_WRONLY);
+    if (fd < 0)
+        return -errno;
+
+    n = write(fd, data, len);
+    if (n < 0)
+        err = -errno;
+    else if ((size_t)n != len)
+        err = -EIO;
+
+    close(fd);
+    return err;
+}
+
+static int read_file(const char *path, char *buf, size_t size)
+{
+    ssize_t n;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return -errno;
+
+    n = read(fd, buf, size - 1);
+    close(fd);
+    if (n < 0)
+        return -errno;
+
+    buf[n] = '\0';
     return 0;
 }
+
+static void bench_remove_target(void)
+{
+    if (bench_target_added) {
+        write_file(SYSFS_TARGETS, bench_remove_cmd);
+        bench_target_added = 0;
+    }
+}
+
+static void bench_cleanup(void)
+{
+    bench_remove_target();
+    write_file(SYSFS_ENABLED, bench_enabled_saved);
+}
+
+static void bench_signal(int sig)
+{
+    (void)sig;
+    bench_cleanup();
+    _exit(1);
+}
+
+static int bench_add_target(const struct bench_scenario *s)
+{
+    char cmd[BENCH_LINE_LEN];
+    int len, ret;
+
+    len = snprintf(cmd, sizeof(cmd), "+%s:target_function %llu mode=%s",
+                   bench_exe, s->delay_ns, s->mode ? s->mode : "spin");
+    if (s->pid_filter)
+        len += snprintf(cmd + len, sizeof(cmd) - len, " pid=%d",
+                        (int)getpid());
+    if (s->cgroup)
+        len += snprintf(cmd + len, sizeof(cmd) - len, " cgroup=%s",
+                        s->cgroup);
+    if (len >= (int)sizeof(cmd))
+        return -ENAMETOOLONG;
+
+    ret = write_file(SYSFS_TARGETS, cmd);
+    if (ret == 0)
+        bench_target_added = 1;
+    return ret;
+}
+
+static void *bench_thread_fn(void *arg)
+{
+    struct bench_thread *t = arg;
+    unsigned long i;
+
+    /* Warm up the breakpoint, the PID verdict cache and the caches */
+    for (i = 0; i < 16; i++)
+        target_function();
+
+    pthread_barrier_wait(t->start);
+
+    for (i = 0; i < t->calls; i++) {
+        long long start = get_time_ns();
+        target_function();
+        t->samples[i] = get_time_ns() - start;
+    }
+
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* Nearest-rank percentile of sorted @v, @per_mille in 0..1000 */
+static uint64_t percentile(const uint64_t *v, size_t n, unsigned int per_mille)
+{
+    size_t rank = (n * per_mille + 999) / 1000;
+
+    return v[rank ? rank - 1 : 0];
+}
+
+struct bench_result {
+    unsigned long long calls;
+    uint64_t p50, p99, p999, max;
+    double mean;
+};
+
+/* Run @calls calls on each of @nr_threads threads and summarise them */
+static int bench_measure(unsigned long nr_threads, unsigned long calls,
+                         struct bench_result *r)
+{
+    struct bench_thread *threads;
+    pthread_barrier_t start;
+    uint64_t *samples;
+    unsigned long i;
+    size_t n = (size_t)nr_threads * calls;
+    double sum = 0;
+
+    samples = malloc(n * sizeof(*samples));
+    threads = calloc(nr_threads, sizeof(*threads));
+    if (!samples || !threads) {
+        free(samples);
+        free(threads);
+        return -ENOMEM;
+    }
+
+    pthread_barrier_init(&start, NULL, nr_threads);
+    for (i = 0; i < nr_threads; i++) {
+        threads[i].start = &start;
+        threads[i].calls = calls;
+        threads[i].samples = samples + i * calls;
+        if (pthread_create(&threads[i].thread, NULL, bench_thread_fn,
+                           &threads[i]) != 0) {
+            /* The barrier would never open: give up on the whole run */
+            fprintf(stderr, "Error: Cannot create thread %lu\n", i);
+            exit(1);
+        }
+    }
+    for (i = 0; i < nr_threads; i++)
+        pthread_join(threads[i].thread, NULL);
+    pthread_barrier_destroy(&start);
+
+    qsort(samples, n, sizeof(*samples), cmp_u64);
+    for (i = 0; i < n; i++)
+        sum += samples[i];
+
+    r->calls = n;
+    r->p50 = percentile(samples, n, 500);
+    r->p99 = percentile(samples, n, 990);
+    r->p999 = percentile(samples, n, 999);
+    r->max = samples[n - 1];
+    r->mean = sum / n;
+
+    free(samples);
+    free(threads);
+    return 0;
+}
+
+/* Fields of every JSON record that identify the machine */
+static char bench_kernel[128];
+static char bench_arch[72];
+static char bench_clock[16] = "unknown";
+
+static void bench_identify(void)
+{
+    struct utsname u;
+    char stats[4096];
+    char *p;
+
+    if (uname(&u) == 0) {
+        snprintf(bench_kernel, sizeof(bench_kernel), "%s", u.release);
+        snprintf(bench_arch, sizeof(bench_arch), "%s", u.machine);
+    }
+
+    if (read_file(SYSFS_STATS, stats, sizeof(stats)) == 0 &&
+        (p = strstr(stats, "delay_clock: ")) != NULL)
+        sscanf(p + 13, "%15s", bench_clock);
+}
+
+static long long signed_diff(uint64_t a, unsigned long long b)
+{
+    return (long long)a - (long long)b;
+}
+
+static void bench_report(const struct bench_scenario *s,
+                         unsigned long nr_threads,
+                         const struct bench_result *r, int json)
+{
+    if (json) {
+        printf("{\"scenario\":\"%s\",\"mode\":\"%s\",\"delay_ns\":%llu,"
+               "\"threads\":%lu,\"calls\":%llu,\"mean_ns\":%.1f,"
+               "\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,"
+               "\"max_ns\":%llu,\"err_p50_ns\":%lld,\"err_p99_ns\":%lld,"
+               "\"err_p999_ns\":%lld,\"kernel\":\"%s\",\"arch\":\"%s\","
+               "\"delay_clock\":\"%s\"}\n",
+               s->name, s->mode ? s->mode : "", s->delay_ns, nr_threads,
+               r->calls, r->mean,
+               (unsigned long long)r->p50, (unsigned long long)r->p99,
+               (unsigned long long)r->p999, (unsigned long long)r->max,
+               signed_diff(r->p50, s->delay_ns),
+               signed_diff(r->p99, s->delay_ns),
+               signed_diff(r->p999, s->delay_ns),
+               bench_kernel, bench_arch, bench_clock);
+    } else {
+        printf("%-9s %-7s %9llu %7lu %9llu %9llu %9llu %9llu %10lld %10lld\n",
+               s->name, s->mode ? s->mode : "-", s->delay_ns, nr_threads,
+               (unsigned long long)r->p50, (unsigned long long)r->p99,
+               (unsigned long long)r->p999, (unsigned long long)r->max,
+               signed_diff(r->p50, s->delay_ns),
+               signed_diff(r->p999, s->delay_ns));
+    }
+    fflush(stdout);
+}
+
+static int bench_run_scenario(const struct bench_scenario *s,
+                              const struct bench_opts *opts)
+{
+    struct bench_result r;
+    unsigned long long calls = opts->calls;
+    int i, ret;
+
+    /* Bound the time spent in long delays, not the sample count of short ones */
+    if (s->delay_ns && calls * s->delay_ns > BENCH_SCENARIO_NS) {
+        calls = BENCH_SCENARIO_NS / s->delay_ns;
+        if (calls < BENCH_MIN_CALLS)
+            calls = BENCH_MIN_CALLS;
+    }
+
+    if (s->probe) {
+        ret = write_file(SYSFS_ENABLED, s->enabled ? "1" : "0");
+        if (ret == 0)
+            ret = bench_add_target(s);
+        if (ret) {
+            fprintf(stderr, "Error: Cannot add target for %s: %s\n",
+                    s->name, strerror(-ret));
+            return ret;
+        }
+    }
+
+    for (i = 0; i < opts->nr_threads; i++) {
+        ret = bench_measure(opts->threads[i], calls, &r);
+        if (ret)
+            break;
+        bench_report(s, opts->threads[i], &r, opts->json);
+    }
+
+    bench_remove_target();
+    return ret;
+}
+
+/* This process's cgroup v2 path, or NULL if it has none but the root */
+static const char *bench_own_cgroup(void)
+{
+    static char path[BENCH_LINE_LEN];
+    char buf[4096];
+    char *p, *nl;
+
+    if (read_file("/proc/self/cgroup", buf, sizeof(buf)) < 0)
+        return NULL;
+
+    p = strstr(buf, "0::");
+    if (!p || (p != buf && p[-1] != '\n'))
+        return NULL;
+    p += 3;
+    nl = strchr(p, '\n');
+    if (nl)
+        *nl = '\0';
+    if (strcmp(p, "/") == 0 || strlen(p) >= sizeof(path))
+        return NULL;
+
+    snprintf(path, sizeof(path), "%s", p);
+    return path;
+}
+
+static int run_bench(const struct bench_opts *opts)
+{
+    struct bench_scenario s;
+    const char *cgroup;
+    ssize_t len;
+    int d, m, ret;
+
+    if (access(SYSFS_TARGETS, W_OK) != 0) {
+        fprintf(stderr, "Error: %s not writable (module loaded? running as root?)\n",
+                SYSFS_TARGETS);
+        return 1;
+    }
+
+    len = readlink("/proc/self/exe", bench_exe, sizeof(bench_exe) - 1);
+    if (len < 0) {
+        perror("readlink /proc/self/exe");
+        return 1;
+    }
+    bench_exe[len] = '\0';
+    snprintf(bench_remove_cmd, sizeof(bench_remove_cmd),
+             "-%s:target_function", bench_exe);
+
+    if (read_file(SYSFS_ENABLED, bench_enabled_saved,
+                  sizeof(bench_enabled_saved)) < 0)
+        snprintf(bench_enabled_saved, sizeof(bench_enabled_saved), "0");
+    atexit(bench_cleanup);
+    signal(SIGINT, bench_signal);
+    signal(SIGTERM, bench_signal);
+    signal(SIGHUP, bench_signal);
+    signal(SIGPIPE, bench_signal);  /* e.g. piped into head */
+
+    bench_identify();
+
+    if (!opts->json) {
+        printf("kernel %s, %s, delay_clock %s\n\n",
+               bench_kernel, bench_arch, bench_clock);
+        printf("%-9s %-7s %9s %7s %9s %9s %9s %9s %10s %10s\n",
+               "scenario", "mode", "delay_ns", "threads", "p50_ns",
+               "p99_ns", "p99.9_ns", "max_ns", "err_p50", "err_p99.9");
+    }
+
+    memset(&s, 0, sizeof(s));
+    s.name = "native";
+    ret = bench_run_scenario(&s, opts);
+
+    s.probe = 1;
+    s.mode = "spin";
+    if (!ret) {
+        s.name = "disabled";
+        ret = bench_run_scenario(&s, opts);
+    }
+
+    s.enabled = 1;
+    if (!ret) {
+        s.name = "handler";
+        ret = bench_run_scenario(&s, opts);
+    }
+
+    if (!ret) {
+        s.name = "pid";
+        s.pid_filter = 1;
+        ret = bench_run_scenario(&s, opts);
+        s.pid_filter = 0;
+    }
+
+    cgroup = bench_own_cgroup();
+    if (!ret && cgroup) {
+        s.name = "cgroup";
+        s.cgroup = cgroup;
+        /* A kernel without cgroup= support is not a benchmark failure */
+        bench_run_scenario(&s, opts);
+        s.cgroup = NULL;
+    }
+
+    s.name = "delay";
+    for (m = 0; !ret && m < opts->nr_modes; m++) {
+        s.mode = opts->modes[m];
+        for (d = 0; !ret && d < opts->nr_delays; d++) {
+            s.delay_ns = opts->delays[d];
+            ret = bench_run_scenario(&s, opts);
+        }
+    }
+
+    return ret ? 1 : 0;
+}
+
+/* Parse a comma-separated list of positive numbers */
+static int parse_list(const char *arg, unsigned long long *out, int max)
+{
+    char *end;
+    int n = 0;
+
+    while (*arg) {
+        if (n == max)
+            return -1;
+        errno = 0;
+        out[n] = strtoull(arg, &end, 10);
+        if (errno || end == arg || out[n] == 0 || (*end && *end != ','))
+            return -1;
+        n++;
+        arg = *end ? end + 1 : end;
+    }
+    return n;
+}
+
+static int parse_modes(char *arg, struct bench_opts *opts)
+{
+    char *tok;
+
+    opts->nr_modes = 0;
+    for (tok = strtok(arg, ","); tok; tok = strtok(NULL, ",")) {
+        if (strcmp(tok, "spin") && strcmp(tok, "sleep") &&
+            strcmp(tok, "hybrid"))
+            return -1;
+        if (opts->nr_modes == BENCH_MAX_LIST)
+            return -1;
+        opts->modes[opts->nr_modes++] = tok;
+    }
+    return opts->nr_modes ? 0 : -1;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [ITERATIONS]\n"
+            "       %s --bench [--threads=LIST] [--calls=N] [--delays=LIST]\n"
+            "                  [--modes=LIST] [--json]\n"
+            "\n"
+            "  --threads=LIST   Thread counts to run each scenario with (default 1,NPROC)\n"
+            "  --calls=N        Calls per thread (default %d; long delays run fewer)\n"
+            "  --delays=LIST    Requested delays in ns (default 100,1000,10000,1000000)\n"
+            "  --modes=LIST     Delay modes: spin, sleep, hybrid (default spin)\n"
+            "  --json           One JSON object per line instead of a table\n",
+            prog, prog, BENCH_DEFAULT_CALLS);
+}
+
+int main(int argc, char *argv[])
+{
+    static const unsigned long long default_delays[] = {
+        100, 1000, 10000, 1000000,
+    };
+    static char default_mode[] = "spin";
+    struct bench_opts opts;
+    unsigned long long list[BENCH_MAX_LIST];
+    long nproc;
+    int bench = 0;
+    int i, n;
+
+    memset(&opts, 0, sizeof(opts));
+    opts.calls = BENCH_DEFAULT_CALLS;
+    nproc = sysconf(_SC_NPROCESSORS_ONLN);
+    opts.threads[opts.nr_threads++] = 1;
+    if (nproc > 1)
+        opts.threads[opts.nr_threads++] = nproc;
+    memcpy(opts.delays, default_delays, sizeof(default_delays));
+    opts.nr_delays = sizeof(default_delays) / sizeof(default_delays[0]);
+    opts.modes[opts.nr_modes++] = default_mode;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--bench") == 0) {
+            bench = 1;
+        } else if (strcmp(argv[i], "--json") == 0) {
+            opts.json = 1;
+        } else if (strncmp(argv[i], "--threads=", 10) == 0) {
+            n = parse_list(argv[i] + 10, list, BENCH_MAX_LIST);
+            if (n <= 0)
+                goto bad;
+            for (opts.nr_threads = 0; opts.nr_threads < n; opts.nr_threads++)
+                opts.threads[opts.nr_threads] = list[opts.nr_threads];
+        } else if (strncmp(argv[i], "--calls=", 8) == 0) {
+            if (parse_list(argv[i] + 8, list, 1) != 1)
+                goto bad;
+            opts.calls = list[0];
+        } else if (strncmp(argv[i], "--delays=", 9) == 0) {
+            n = parse_list(argv[i] + 9, opts.delays, BENCH_MAX_LIST);
+            if (n <= 0)
+                goto bad;
+            opts.nr_delays = n;
+        } else if (strncmp(argv[i], "--modes=", 8) == 0) {
+            if (parse_modes(argv[i] + 8, &opts) < 0)
+                goto bad;
+        } else if (strcmp(argv[i], "-h") == 0 ||
+                   strcmp(argv[i], "--help") == 0) {
+            usage(argv[0]);
+            return 0;
+        } else if (!bench && i == argc - 1 && argv[i][0] != '-') {
+            /* Demo mode: ITERATIONS */
+            n = atoi(argv[i]);
+            return run_demo(argv[0], n > 0 ? n : 10);
+        } else {
+            goto bad;
+        }
+    }
+
+    if (bench)
+        return run_bench(&opts);
+    return run_demo(argv[0], 10);
+
+bad:
+    fprintf(stderr, "Error: Invalid argument '%s'\n", argv[i]);
+    usage(argv[0]);
+    return 1;
+}
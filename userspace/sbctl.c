@@ -1,7 +1,9 @@
 /*
  * sbctl - Speed Bump Control Tool
  *
- * Userspace utility for configuring the speed_bump kernel module via sysfs.
+ * Userspace utility for configuring the speed_bump kernel module. Targets
+ * are added, updated and removed through the /dev/speed_bump control
+ * device; everything else goes through sysfs.
  *
  * SPDX-License-Identifier: GPL-2.0
  */
@@ -12,20 +14,50 @@
 #include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "../src/speed_bump_uapi.h"
+
 #define SYSFS_BASE "/sys/kernel/speed_bump"
-#define SYSFS_TARGETS SYSFS_BASE "/targets"
 #define SYSFS_TARGETS_LIST SYSFS_BASE "/targets_list"
+#define SYSFS_GROUPS SYSFS_BASE "/groups"
+#define SYSFS_LATENCY SYSFS_BASE "/latency"
+#define SYSFS_OVERSHOOT SYSFS_BASE "/overshoot"
 #define SYSFS_ENABLED SYSFS_BASE "/enabled"
 #define SYSFS_STATS SYSFS_BASE "/stats"
 #define SYSFS_DEFAULT_DELAY SYSFS_BASE "/default_delay_ns"
+#define SYSFS_BUDGET SYSFS_BASE "/budget_ns_per_s"
+#define SYSFS_PROFILE SYSFS_BASE "/profile"
+#define SYSFS_PROFILES SYSFS_BASE "/profiles"
+
+/* Unbounded versions of targets_list and the histograms, when debugfs is mounted */
+#define DEBUGFS_BASE "/sys/kernel/debug/speed_bump"
+#define DEBUGFS_TARGETS DEBUGFS_BASE "/targets"
+#define DEBUGFS_LATENCY DEBUGFS_BASE "/latency"
+#define DEBUGFS_OVERSHOOT DEBUGFS_BASE "/overshoot"
+#define DEBUGFS_SWEEPS DEBUGFS_BASE "/sweeps"
+#define DEBUGFS_STATS_BIN DEBUGFS_BASE "/stats.bin"
+
+#define DEV_CTL "/dev/speed_bump"
 
 #define MAX_PATH_LEN 256
 #define MAX_SYMBOL_LEN 128
+#define MAX_PROFILE_LEN 32
+#define MAX_CGROUP_LEN 256
+#define MAX_SWEEP_LEN 256
+#define MAX_BUILD_ID 20
+#define MAX_CPUS_LEN 128
 #define MAX_DELAY_NS 10000000000UL
+#define MAX_SCALE_PCT 10000
+#define MAX_SIGMA 4.0
 #define READ_BUF_SIZE 4096
+#define WAIT_POLL_NS 10000000L
+#define WAIT_DEFAULT_S 60
+#define WATCH_DEFAULT_HITS 1000
 
 static const char *prog_name;
 
@@ -35,41 +67,138 @@ static void print_usage(void)
 		"Usage: %s <command> [options]\n"
 		"\n"
 		"Commands:\n"
-		"  add PATH:SYMBOL [DELAY_NS] [--pid=PID]\n"
-		"                              Add a target with optional delay and PID filter\n"
-		"  remove PATH:SYMBOL          Remove a specific target\n"
-		"  update PATH:SYMBOL DELAY_NS Update target's delay\n"
+		"  add PATH:SYMBOL [DELAY_NS] [--pid=PID [--autoremove]] [--async]\n"
+		"      [--sweep=SCHEDULE] [--buildid=HEX] [TARGET_OPTIONS]\n"
+		"                              Add a target with optional delay, PID filter\n"
+		"                              and target options; --async returns before\n"
+		"                              the target is registered. SYMBOL+0xOFF probes\n"
+		"                              OFF bytes into SYMBOL, PATH@0xOFF a file\n"
+		"                              offset with no symbol lookup\n"
+		"  wait [--timeout=SEC]        Wait until no async add is pending; fails if\n"
+		"                              any registration failed\n"
+		"  watch [--hits=N] [--count=N]\n"
+		"                              Print total hits and delay, then deltas each\n"
+		"                              N hits (default 1000, 0 = none) or change to\n"
+		"                              the targets; stop after --count=N events\n"
+		"  remove TARGET... [--rule=NAME] [--profile=NAME]\n"
+		"                              Remove targets, by PATH:SYMBOL, id or\n"
+		"                              @PROFILE for a whole profile\n"
+		"  update PATH:SYMBOL DELAY_NS [TARGET_OPTIONS]\n"
+		"                              Update target's delay (and options)\n"
 		"  list                        List all current targets\n"
+		"  groups                      List wildcard target groups\n"
+		"  latency                     Show entry->return latency histograms\n"
+		"  overshoot                   Show how far delays ran past their request\n"
+		"  sweeps                      Show the step boundaries of --sweep targets\n"
+		"  cpus                        Show each target's hits and delay per CPU\n"
+		"  task TID [--reset]          Show the delay pid/cgroup-filtered targets\n"
+		"                              injected into thread TID and its process\n"
 		"  clear                       Remove all targets\n"
 		"  enable                      Enable all probes\n"
 		"  disable                     Disable all probes\n"
 		"  status                      Show enabled state and statistics\n"
 		"  delay [DELAY_NS]            Get or set default delay\n"
-		"\n"
+		"  budget [NS]                 Get or set the cap on delay injected per\n"
+		"                              second across all targets (0 = none)\n"
+		"  profile [NAME|none]         Get or switch the active profile\n"
+		"  profiles                    List staged profiles\n"
+		"\n",
+		prog_name);
+
+	fprintf(stderr,
 		"Options:\n"
 		"  -h, --help                  Show this help message\n"
 		"  -v, --version               Show version\n"
 		"  --pid=PID                   Filter to only affect PID and its descendants\n"
+		"  --autoremove                With --pid, remove the target when PID exits\n"
+		"  --sweep=SCHEDULE            Step the delay on a timer instead of DELAY_NS:\n"
+		"                              START:STOP:STEP@DURATION or DELAY@DURATION,...\n"
+		"  --buildid=HEX               Refuse to probe PATH unless its GNU build ID\n"
+		"                              is HEX (as shown by readelf -n)\n"
 		"\n"
+		"Target options:\n"
+		"  --mode=MODE                 spin (default), sleep or hybrid\n"
+		"  --latency                   Also measure the function's own duration\n"
+		"                              (needs Linux 6.13+)\n"
+		"  --overshoot                 Keep a histogram of actual minus requested\n"
+		"                              delay\n"
+		"  --scale=PCT                 Delay each call by PCT%% of its own duration\n"
+		"                              (0 to 10000, needs Linux 6.13+)\n"
+		"  --every=N                   Delay only one hit in N\n"
+		"  --prob=P                    Delay each hit with probability P (0 to 1)\n"
+		"  --dist=DIST                 fixed (default), exp, uniform or lognormal;\n"
+		"                              DELAY_NS is then the mean delay\n"
+		"  --max=NS                    Upper bound on a sampled delay\n"
+		"  --sigma=S                   Shape of the lognormal (default 1, max 4)\n"
+		"  --budget=NS                 Cap on this target's delay per second\n"
+		"  --rule=NAME                 Add, update or remove rule NAME of the target;\n"
+		"                              a hit takes the first rule whose filter\n"
+		"                              matches\n"
+		"  --profile=NAME              Stage the target in profile NAME; it only\n"
+		"                              acts while NAME is the active profile\n"
+		"  --cgroup=PATH               Only delay tasks in cgroup v2 PATH and below,\n"
+		"                              PATH as in /proc/PID/cgroup; / for any\n"
+		"  --cpus=LIST                 Only delay hits on CPUs in LIST (e.g. 0-3,8);\n"
+		"                              all to lift the restriction\n"
+		"  --node=N                    Only delay hits on the CPUs of NUMA node N\n"
+		"\n");
+
+	/* Split so that no one string passes the 4095 bytes C99 guarantees */
+	fprintf(stderr,
 		"Examples:\n"
 		"  %s add /usr/lib/libcuda.so:cudaLaunchKernel 10000\n"
 		"  %s add /usr/bin/app:process_request --pid=12345\n"
 		"  %s add /usr/bin/app:process_request 50000 --pid=$$\n"
+		"  %s add /usr/bin/app:process_request 50000 --pid=$$ --autoremove\n"
+		"  %s add /usr/bin/app:process_request 50000 --cgroup=/system.slice/app.service\n"
 		"  %s update /usr/bin/app:process_request 50000\n"
+		"  %s add /usr/bin/app:read_block 5000000 --mode=hybrid\n"
+		"  %s add /usr/bin/app:process_request 0 --latency\n"
+		"  %s add /usr/bin/app:read_block 20000 --mode=sleep --overshoot\n"
+		"  %s add /usr/bin/app:process_request --sweep=0:50000:5000@2s\n"
+		"  %s add /usr/lib64/libc.so.6:malloc 2000 --pid=1234 --rule=jobA\n"
+		"  %s add /usr/bin/app@0x4f2a0 20000 --buildid=3f9a1c0e5b7d2468ace013579bdf2468ace01357\n"
+		"  %s add /usr/bin/app:parse_batch+0x84 5000\n"
+		"  %s add /usr/lib/libcuda.so:cudaLaunchKernel --scale=30\n"
+		"  %s add /usr/bin/app:send_packet 200000 --dist=exp --max=2000000 --prob=0.1\n"
+		"  %s add /usr/bin/app:process_request 50000 --cpus=4-7\n"
 		"  %s remove /usr/lib/libcuda.so:cudaLaunchKernel\n"
+		"  %s remove 3 4 7\n"
+		"  %s add '/usr/lib64/libcuda.so:cuMem*' 5000\n"
+		"  %s remove '/usr/lib64/libcuda.so:cuMem*'\n"
 		"  %s list\n"
 		"  %s clear\n"
 		"  %s enable\n"
 		"  %s status\n"
 		"  %s delay 1000000\n"
-		"\n"
+		"  %s budget 100000000\n"
+		"  %s add /usr/bin/app:process_request 50000 --profile=slow\n"
+		"  %s profile slow\n"
+		"  %s add /nfs/bin/app:process_request 50000 --async\n"
+		"  %s wait --timeout=30\n"
+		"  %s watch --hits=10000\n"
+		"\n",
+		prog_name, prog_name, prog_name, prog_name, prog_name, prog_name,
+		prog_name, prog_name, prog_name, prog_name, prog_name, prog_name,
+		prog_name, prog_name, prog_name, prog_name, prog_name, prog_name,
+		prog_name, prog_name, prog_name, prog_name, prog_name, prog_name,
+		prog_name, prog_name, prog_name, prog_name, prog_name, prog_name,
+		prog_name);
+
+	fprintf(stderr,
 		"Target format:\n"
 		"  PATH must be an absolute path to an ELF binary or shared library\n"
 		"  SYMBOL must be a valid symbol name in the ELF symbol table\n"
+		"  PATH@0xOFF probes file offset OFF (e.g. from debuginfo) and is\n"
+		"  listed as PATH:0xOFF; SYMBOL+0xOFF must land on an instruction\n"
+		"  TARGET id is the id= shown by list\n"
+		"  SYMBOL and the last component of PATH may use '*' and '?' to add\n"
+		"  every matching function as one group; the same pattern removes it\n"
 		"  DELAY_NS is the delay in nanoseconds (0 to 10000000000)\n"
-		"  PID filter restricts probes to the specified process and its children\n",
-		prog_name, prog_name, prog_name, prog_name, prog_name,
-		prog_name, prog_name, prog_name, prog_name, prog_name, prog_name);
+		"  PID filter restricts probes to the specified process and its children\n"
+		"  MODE spin busy-waits; sleep uses an hrtimer and consumes no CPU;\n"
+		"  hybrid sleeps and spins only the last 50us for precision\n"
+		"  A --scale target has no fixed delay unless DELAY_NS is given\n");
 }
 
 static void print_version(void)
@@ -88,6 +217,54 @@ static int check_module_loaded(void)
 	return 0;
 }
 
+/* Explain an errno returned for a target command */
+static void print_target_error(int err)
+{
+	switch (err) {
+	case EINVAL:
+		fprintf(stderr, "Error: Invalid format\n");
+		break;
+	case ENOENT:
+		fprintf(stderr, "Error: Path or symbol not found\n");
+		break;
+	case ENOEXEC:
+		fprintf(stderr, "Error: Not a valid ELF file\n");
+		break;
+	case ENAMETOOLONG:
+		fprintf(stderr, "Error: Path or symbol name too long\n");
+		break;
+	case ERANGE:
+		fprintf(stderr, "Error: Value out of range\n");
+		break;
+	case EEXIST:
+		fprintf(stderr, "Error: Target already exists (give another --rule=NAME to add a second rule)\n");
+		break;
+	case ENOSPC:
+		fprintf(stderr, "Error: Maximum target limit reached (see the max_targets module parameter, at most 16 rules per function)\n");
+		break;
+	case EBUSY:
+		fprintf(stderr, "Error: Module is busy\n");
+		break;
+	case EACCES:
+		fprintf(stderr, "Error: Permission denied\n");
+		break;
+	case EOPNOTSUPP:
+		fprintf(stderr, "Error: Not supported by this kernel (latency needs Linux 6.13+)\n");
+		break;
+	case ESRCH:
+		fprintf(stderr, "Error: No such process for --autoremove\n");
+		break;
+	case ESTALE:
+		fprintf(stderr, "Error: Binary changed (build ID does not match --buildid, or PATH was replaced)\n");
+		break;
+	case ENODATA:
+		fprintf(stderr, "Error: Binary has no build ID to check --buildid against\n");
+		break;
+	default:
+		fprintf(stderr, "Error: %s\n", strerror(err));
+	}
+}
+
 static int write_sysfs(const char *path, const char *data)
 {
 	int fd;
@@ -110,38 +287,7 @@ static int write_sysfs(const char *path, const char *data)
 	if (written < 0) {
 		int save_errno = errno;
 		close(fd);
-		switch (save_errno) {
-		case EINVAL:
-			fprintf(stderr, "Error: Invalid format\n");
-			break;
-		case ENOENT:
-			fprintf(stderr, "Error: Path or symbol not found\n");
-			break;
-		case ENOEXEC:
-			fprintf(stderr, "Error: Not a valid ELF file\n");
-			break;
-		case ENAMETOOLONG:
-			fprintf(stderr, "Error: Path or symbol name too long\n");
-			break;
-		case ERANGE:
-			fprintf(stderr, "Error: Delay value out of range\n");
-			break;
-		case EEXIST:
-			fprintf(stderr, "Error: Target already exists\n");
-			break;
-		case ENOSPC:
-			fprintf(stderr, "Error: Maximum target limit reached\n");
-			break;
-		case EBUSY:
-			fprintf(stderr, "Error: Module is busy\n");
-			break;
-		case EACCES:
-			fprintf(stderr, "Error: Permission denied\n");
-			break;
-		default:
-			fprintf(stderr, "Error: Write failed: %s\n",
-				strerror(save_errno));
-		}
+		print_target_error(save_errno);
 		return -1;
 	}
 
@@ -189,15 +335,23 @@ static int read_sysfs(const char *path)
 	return 0;
 }
 
+/* The first ':' of PATH:SYMBOL, else the last '@' of PATH@0xOFF */
+static const char *target_separator(const char *target)
+{
+	const char *sep = strchr(target, ':');
+
+	return sep ? sep : strrchr(target, '@');
+}
+
 static int validate_target(const char *target)
 {
 	const char *colon;
 	size_t path_len, symbol_len;
 
-	colon = strchr(target, ':');
+	colon = target_separator(target);
 	if (!colon) {
 		fprintf(stderr, "Error: Invalid target format (missing ':')\n"
-				"Expected: PATH:SYMBOL\n");
+				"Expected: PATH:SYMBOL, PATH:SYMBOL+0xOFF or PATH@0xOFF\n");
 		return -1;
 	}
 
@@ -214,9 +368,9 @@ static int validate_target(const char *target)
 		return -1;
 	}
 
-	if (path_len > MAX_PATH_LEN) {
+	if (path_len >= MAX_PATH_LEN) {
 		fprintf(stderr, "Error: PATH too long (max %d bytes)\n",
-			MAX_PATH_LEN);
+			MAX_PATH_LEN - 1);
 		return -1;
 	}
 
@@ -225,9 +379,14 @@ static int validate_target(const char *target)
 		return -1;
 	}
 
-	if (symbol_len > MAX_SYMBOL_LEN) {
+	if (*colon == '@' && strncmp(colon + 1, "0x", 2) != 0) {
+		fprintf(stderr, "Error: File offset must be hex, as PATH@0xOFF\n");
+		return -1;
+	}
+
+	if (symbol_len >= MAX_SYMBOL_LEN) {
 		fprintf(stderr, "Error: SYMBOL too long (max %d bytes)\n",
-			MAX_SYMBOL_LEN);
+			MAX_SYMBOL_LEN - 1);
 		return -1;
 	}
 
@@ -257,13 +416,448 @@ static int validate_delay(const char *delay_str, unsigned long *delay_out)
 	return 0;
 }
 
+/* Delay modes accepted by the module's mode= option, in mode order */
+static const char * const mode_names[] = { "spin", "sleep", "hybrid" };
+
+static const char * const dist_names[] = {
+	"fixed", "exp", "uniform", "lognormal"
+};
+
+/* Index of @name in @names, or -1 */
+static int lookup_name(const char *name, const char * const *names,
+		       size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		if (strcmp(name, names[i]) == 0)
+			return (int)i;
+	}
+	return -1;
+}
+
+static int validate_mode(const char *mode, __u32 *mode_out)
+{
+	int i = lookup_name(mode, mode_names, 3);
+
+	if (i < 0) {
+		fprintf(stderr, "Error: Invalid mode '%s' (expected spin, sleep or hybrid)\n",
+			mode);
+		return -1;
+	}
+	*mode_out = i;
+	return 0;
+}
+
+static int validate_scale(const char *str, __u32 *pct_out)
+{
+	char *endptr;
+	unsigned long pct;
+
+	errno = 0;
+	pct = strtoul(str, &endptr, 10);
+	if (errno != 0 || *endptr != '\0' || endptr == str || str[0] == '-' ||
+	    pct > MAX_SCALE_PCT) {
+		fprintf(stderr, "Error: Invalid scale '%s' (expected 0 to %d percent)\n",
+			str, MAX_SCALE_PCT);
+		return -1;
+	}
+	*pct_out = pct;
+	return 0;
+}
+
+static int validate_every(const char *str, __u32 *every_out)
+{
+	char *endptr;
+	unsigned long n;
+
+	errno = 0;
+	n = strtoul(str, &endptr, 10);
+	if (errno != 0 || *endptr != '\0' || endptr == str || str[0] == '-' ||
+	    n == 0 || n > 0xffffffffUL) {
+		fprintf(stderr, "Error: Invalid every '%s' (expected a positive count)\n",
+			str);
+		return -1;
+	}
+	*every_out = n;
+	return 0;
+}
+
+/*
+ * Parse a plain decimal (digits with at most one point, as the kernel
+ * parses it) no greater than @max, into fixed point with @frac_digits
+ * decimal places. Digits beyond those are dropped.
+ */
+static int validate_decimal(const char *str, double max, const char *what,
+			    unsigned int frac_digits, __u32 *out)
+{
+	const char *p;
+	int point = 0, digits = 0;
+	unsigned int frac = 0;
+	unsigned long long val = 0;
+
+	for (p = str; *p; p++) {
+		if (*p == '.' && !point) {
+			point = 1;
+			continue;
+		}
+		if (*p < '0' || *p > '9') {
+			digits = 0;
+			break;
+		}
+		digits = 1;
+		if (point && frac++ >= frac_digits)
+			continue;
+		if (val <= 0xffffffffULL)
+			val = val * 10 + (*p - '0');
+	}
+	for (; frac < frac_digits; frac++)
+		val *= 10;
+
+	if (!digits || strtod(str, NULL) > max || val > 0xffffffffULL) {
+		fprintf(stderr, "Error: Invalid %s '%s' (expected 0 to %g)\n",
+			what, str, max);
+		return -1;
+	}
+	*out = (__u32)val;
+	return 0;
+}
+
+static int validate_budget(const char *str, unsigned long long *budget_out)
+{
+	char *endptr;
+	unsigned long long budget;
+
+	errno = 0;
+	budget = strtoull(str, &endptr, 10);
+	if (errno != 0 || *endptr != '\0' || endptr == str || str[0] == '-') {
+		fprintf(stderr, "Error: Invalid budget '%s' (expected nanoseconds per second)\n",
+			str);
+		return -1;
+	}
+
+	if (budget_out)
+		*budget_out = budget;
+	return 0;
+}
+
+static int validate_dist(const char *dist, __u32 *dist_out)
+{
+	int i = lookup_name(dist, dist_names, 4);
+
+	if (i < 0) {
+		fprintf(stderr, "Error: Invalid dist '%s' (expected fixed, exp, uniform or lognormal)\n",
+			dist);
+		return -1;
+	}
+	*dist_out = i;
+	return 0;
+}
+
+/* Profile and rule names as the module accepts them; @what names which */
+static int validate_name(const char *what, const char *name)
+{
+	size_t len = strlen(name);
+	const char *p;
+
+	if (len == 0 || len >= MAX_PROFILE_LEN || strcmp(name, "none") == 0) {
+		fprintf(stderr, "Error: Invalid %s name '%s'\n", what, name);
+		return -1;
+	}
+
+	for (p = name; *p; p++) {
+		if (!(*p >= 'a' && *p <= 'z') && !(*p >= 'A' && *p <= 'Z') &&
+		    !(*p >= '0' && *p <= '9') && !strchr("_-.", *p)) {
+			fprintf(stderr, "Error: Invalid %s name '%s' (letters, digits, '_', '-' and '.')\n",
+				what, name);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static int validate_profile(const char *name)
+{
+	return validate_name("profile", name);
+}
+
+/* A cgroup v2 path from the hierarchy root, as the module takes it */
+static int validate_cgroup(const char *path)
+{
+	if (path[0] != '/') {
+		fprintf(stderr, "Error: Invalid cgroup '%s' (must start with '/', as in /proc/PID/cgroup)\n",
+			path);
+		return -1;
+	}
+	if (strlen(path) >= MAX_CGROUP_LEN) {
+		fprintf(stderr, "Error: cgroup path too long (max %d bytes)\n",
+			MAX_CGROUP_LEN - 1);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * A CPU list as in /sys/devices/system/cpu/online ("0-3,8", "0-15:2/4"),
+ * or "all". The module checks the CPUs themselves.
+ */
+static int validate_cpus(const char *list)
+{
+	size_t len = strlen(list);
+
+	if (strcmp(list, "all") == 0)
+		return 0;
+	if (len == 0 || strspn(list, "0123456789,-:/") != len) {
+		fprintf(stderr, "Error: Invalid CPU list '%s' (e.g. 0-3,8 or all)\n",
+			list);
+		return -1;
+	}
+	if (len >= MAX_CPUS_LEN) {
+		fprintf(stderr, "Error: CPU list too long (max %d bytes)\n",
+			MAX_CPUS_LEN - 1);
+		return -1;
+	}
+	return 0;
+}
+
+static int validate_node(const char *str, __s32 *node_out)
+{
+	char *endptr;
+	unsigned long n;
+
+	errno = 0;
+	n = strtoul(str, &endptr, 10);
+	if (errno != 0 || *endptr != '\0' || endptr == str || str[0] == '-' ||
+	    n > INT_MAX) {
+		fprintf(stderr, "Error: Invalid node '%s' (expected a NUMA node number)\n",
+			str);
+		return -1;
+	}
+	*node_out = n;
+	return 0;
+}
+
+/* A build ID is 1 to MAX_BUILD_ID bytes, written as hex digit pairs */
+static int validate_build_id(const char *hex)
+{
+	size_t len = strlen(hex);
+
+	if (len == 0 || len % 2 || len / 2 > MAX_BUILD_ID ||
+	    strspn(hex, "0123456789abcdefABCDEF") != len) {
+		fprintf(stderr, "Error: Invalid build ID '%s' (1 to %d bytes of hex)\n",
+			hex, MAX_BUILD_ID);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Split PATH:SYMBOL (or PATH@0xOFF, which the kernel takes as symbol
+ * 0xOFF) into @desc. The target must have passed validate_target().
+ */
+static void set_target_name(struct speed_bump_target_desc *desc,
+			    const char *target)
+{
+	const char *colon = target_separator(target);
+
+	memcpy(desc->path, target, colon - target);
+	desc->path[colon - target] = '\0';
+	snprintf(desc->symbol, sizeof(desc->symbol), "%s", colon + 1);
+}
+
+/*
+ * Fill in a target option shared by add and update (--mode=, --scale=,
+ * --latency, --overshoot, --every=, --prob=, --dist=, --max=, --sigma=, --budget=,
+ * --profile=, --cgroup=, --cpus=, --node=).
+ *
+ * Returns: 1 if @arg was such an option, 0 if it was not, -1 on error
+ */
+static int parse_target_option(struct speed_bump_target_desc *desc,
+			       const char *arg)
+{
+	unsigned long ul;
+	unsigned long long ull;
+
+	if (strncmp(arg, "--mode=", 7) == 0) {
+		if (validate_mode(arg + 7, &desc->mode) < 0)
+			return -1;
+		desc->given |= SPEED_BUMP_OPT_MODE;
+		return 1;
+	}
+
+	if (strncmp(arg, "--scale=", 8) == 0) {
+		if (validate_scale(arg + 8, &desc->scale_pct) < 0)
+			return -1;
+		desc->given |= SPEED_BUMP_OPT_SCALE;
+		return 1;
+	}
+
+	if (strcmp(arg, "--latency") == 0) {
+		desc->latency = 1;
+		desc->given |= SPEED_BUMP_OPT_LATENCY;
+		return 1;
+	}
+
+	if (strcmp(arg, "--overshoot") == 0) {
+		desc->given |= SPEED_BUMP_OPT_OVERSHOOT;
+		return 1;
+	}
+
+	if (strncmp(arg, "--every=", 8) == 0) {
+		if (validate_every(arg + 8, &desc->every) < 0)
+			return -1;
+		desc->given |= SPEED_BUMP_OPT_EVERY;
+		return 1;
+	}
+
+	if (strncmp(arg, "--prob=", 7) == 0) {
+		if (validate_decimal(arg + 7, 1.0, "probability", 6,
+				     &desc->prob_ppm) < 0)
+			return -1;
+		desc->given |= SPEED_BUMP_OPT_PROB;
+		return 1;
+	}
+
+	if (strncmp(arg, "--dist=", 7) == 0) {
+		if (validate_dist(arg + 7, &desc->dist) < 0)
+			return -1;
+		desc->given |= SPEED_BUMP_OPT_DIST;
+		return 1;
+	}
+
+	if (strncmp(arg, "--max=", 6) == 0) {
+		if (validate_delay(arg + 6, &ul) < 0)
+			return -1;
+		desc->max_ns = ul;
+		desc->given |= SPEED_BUMP_OPT_MAX;
+		return 1;
+	}
+
+	if (strncmp(arg, "--sigma=", 8) == 0) {
+		if (validate_decimal(arg + 8, MAX_SIGMA, "sigma", 3,
+				     &desc->sigma_milli) < 0)
+			return -1;
+		desc->given |= SPEED_BUMP_OPT_SIGMA;
+		return 1;
+	}
+
+	if (strncmp(arg, "--budget=", 9) == 0) {
+		if (validate_budget(arg + 9, &ull) < 0)
+			return -1;
+		desc->budget_ns_per_s = ull;
+		desc->given |= SPEED_BUMP_OPT_BUDGET;
+		return 1;
+	}
+
+	if (strncmp(arg, "--profile=", 10) == 0) {
+		if (validate_profile(arg + 10) < 0)
+			return -1;
+		snprintf(desc->profile, sizeof(desc->profile), "%s", arg + 10);
+		return 1;
+	}
+
+	if (strncmp(arg, "--rule=", 7) == 0) {
+		if (validate_name("rule", arg + 7) < 0)
+			return -1;
+		snprintf(desc->rule, sizeof(desc->rule), "%s", arg + 7);
+		return 1;
+	}
+
+	if (strncmp(arg, "--cgroup=", 9) == 0) {
+		if (validate_cgroup(arg + 9) < 0)
+			return -1;
+		snprintf(desc->cgroup, sizeof(desc->cgroup), "%s", arg + 9);
+		desc->given |= SPEED_BUMP_OPT_CGROUP;
+		return 1;
+	}
+
+	if (strncmp(arg, "--cpus=", 7) == 0) {
+		if (validate_cpus(arg + 7) < 0)
+			return -1;
+		snprintf(desc->cpus, sizeof(desc->cpus), "%s", arg + 7);
+		desc->given |= SPEED_BUMP_OPT_CPUS;
+		return 1;
+	}
+
+	if (strncmp(arg, "--node=", 7) == 0) {
+		if (validate_node(arg + 7, &desc->node) < 0)
+			return -1;
+		desc->given |= SPEED_BUMP_OPT_NODE;
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Open the control device; returns the fd, or -1 after printing why */
+static int open_ctl(void)
+{
+	int fd = open(DEV_CTL, O_RDWR);
+
+	if (fd < 0) {
+		if (errno == EACCES)
+			fprintf(stderr, "Error: Permission denied (try with sudo)\n");
+		else if (errno == ENOENT)
+			fprintf(stderr, "Error: %s not found\n", DEV_CTL);
+		else
+			fprintf(stderr, "Error: Cannot open %s: %s\n",
+				DEV_CTL, strerror(errno));
+	}
+	return fd;
+}
+
+/*
+ * Apply @count descriptors with one SPEED_BUMP_IOC_BATCH. Per-entry
+ * results are left in each descriptor's status.
+ *
+ * Returns: 0 if the batch ran, -1 (after printing why) if it did not
+ */
+static int run_batch(struct speed_bump_target_desc *descs, unsigned int count)
+{
+	struct speed_bump_batch batch;
+	int fd;
+
+	fd = open_ctl();
+	if (fd < 0)
+		return -1;
+
+	memset(&batch, 0, sizeof(batch));
+	batch.descs = (uintptr_t)descs;
+	batch.count = count;
+	batch.desc_size = sizeof(*descs);
+
+	if (ioctl(fd, SPEED_BUMP_IOC_BATCH, &batch) < 0) {
+		int save_errno = errno;
+
+		close(fd);
+		fprintf(stderr, "Error: %s: %s\n", DEV_CTL, strerror(save_errno));
+		return -1;
+	}
+
+	close(fd);
+	return 0;
+}
+
+/* Run a single descriptor; returns 0 or -1 after printing why it failed */
+static int run_one(struct speed_bump_target_desc *desc)
+{
+	if (run_batch(desc, 1) < 0)
+		return -1;
+
+	if (desc->status) {
+		print_target_error(-desc->status);
+		return -1;
+	}
+	return 0;
+}
+
 static int cmd_add(int argc, char **argv)
 {
-	char cmd[512];
-	int ret;
+	struct speed_bump_target_desc desc;
 	unsigned long delay = 0;
 	long pid = 0;
 	int have_delay = 0;
+	int ret;
 	int i;
 
 	if (argc < 1) {
@@ -274,19 +868,68 @@ static int cmd_add(int argc, char **argv)
 	if (validate_target(argv[0]) < 0)
 		return 1;
 
-	/* Parse remaining arguments for delay and --pid */
+	memset(&desc, 0, sizeof(desc));
+	desc.op = SPEED_BUMP_OP_ADD;
+	set_target_name(&desc, argv[0]);
+
+	/* Parse remaining arguments for delay, --pid and target options */
 	for (i = 1; i < argc; i++) {
 		if (strncmp(argv[i], "--pid=", 6) == 0) {
 			char *endptr;
 			errno = 0;
 			pid = strtol(argv[i] + 6, &endptr, 10);
-			if (errno != 0 || *endptr != '\0' || endptr == argv[i] + 6 || pid <= 0) {
+			if (errno != 0 || *endptr != '\0' || endptr == argv[i] + 6 ||
+			    pid <= 0 || pid > INT_MAX) {
 				fprintf(stderr, "Error: Invalid PID value '%s'\n", argv[i] + 6);
 				return 1;
 			}
-		} else if (!have_delay) {
+			desc.pid = pid;
+			desc.given |= SPEED_BUMP_OPT_PID;
+			continue;
+		}
+
+		if (strcmp(argv[i], "--async") == 0) {
+			desc.given |= SPEED_BUMP_OPT_ASYNC;
+			continue;
+		}
+
+		if (strcmp(argv[i], "--autoremove") == 0) {
+			desc.given |= SPEED_BUMP_OPT_AUTOREMOVE;
+			continue;
+		}
+
+		/* The kernel parses the schedule and reports ERANGE/EINVAL */
+		if (strncmp(argv[i], "--sweep=", 8) == 0) {
+			if (strlen(argv[i] + 8) >= MAX_SWEEP_LEN) {
+				fprintf(stderr, "Error: sweep schedule too long (max %d bytes)\n",
+					MAX_SWEEP_LEN - 1);
+				return 1;
+			}
+			snprintf(desc.sweep, sizeof(desc.sweep), "%s", argv[i] + 8);
+			desc.given |= SPEED_BUMP_OPT_SWEEP;
+			continue;
+		}
+
+		if (strncmp(argv[i], "--buildid=", 10) == 0) {
+			if (validate_build_id(argv[i] + 10) < 0)
+				return 1;
+			snprintf(desc.buildid, sizeof(desc.buildid), "%s",
+				 argv[i] + 10);
+			desc.given |= SPEED_BUMP_OPT_BUILDID;
+			continue;
+		}
+
+		ret = parse_target_option(&desc, argv[i]);
+		if (ret < 0)
+			return 1;
+		if (ret > 0)
+			continue;
+
+		if (!have_delay) {
 			if (validate_delay(argv[i], &delay) < 0)
 				return 1;
+			desc.delay_ns = delay;
+			desc.given |= SPEED_BUMP_OPT_DELAY;
 			have_delay = 1;
 		} else {
 			fprintf(stderr, "Error: Unexpected argument '%s'\n", argv[i]);
@@ -294,69 +937,161 @@ static int cmd_add(int argc, char **argv)
 		}
 	}
 
-	/* Build command string */
-	if (have_delay && pid > 0) {
-		ret = snprintf(cmd, sizeof(cmd), "+%s %lu pid=%ld", argv[0], delay, pid);
-	} else if (have_delay) {
-		ret = snprintf(cmd, sizeof(cmd), "+%s %lu", argv[0], delay);
-	} else if (pid > 0) {
-		ret = snprintf(cmd, sizeof(cmd), "+%s pid=%ld", argv[0], pid);
-	} else {
-		ret = snprintf(cmd, sizeof(cmd), "+%s", argv[0]);
+	if ((desc.given & SPEED_BUMP_OPT_AUTOREMOVE) && !pid) {
+		fprintf(stderr, "Error: --autoremove requires --pid\n");
+		return 1;
 	}
 
-	if (ret < 0 || (size_t)ret >= sizeof(cmd)) {
-		fprintf(stderr, "Error: Command too long\n");
+	if ((desc.given & SPEED_BUMP_OPT_SWEEP) && have_delay) {
+		fprintf(stderr, "Error: --sweep sets the delay; drop DELAY_NS\n");
 		return 1;
 	}
 
 	if (check_module_loaded() < 0)
 		return 1;
 
-	if (write_sysfs(SYSFS_TARGETS, cmd) < 0)
+	if (run_one(&desc) < 0)
 		return 1;
 
-	if (pid > 0)
-		printf("Added target: %s (pid=%ld)\n", argv[0], pid);
+	if (desc.group)
+		printf("Added group %u: %s", desc.group, argv[0]);
+	else if (desc.given & SPEED_BUMP_OPT_ASYNC)
+		printf("Queued target %u: %s", desc.id, argv[0]);
 	else
-		printf("Added target: %s\n", argv[0]);
+		printf("Added target %u: %s", desc.id, argv[0]);
+	if (pid > 0)
+		printf(" (pid=%ld)", pid);
+	if (desc.rule[0])
+		printf(" as rule %s", desc.rule);
+	if (desc.profile[0])
+		printf(" in profile %s", desc.profile);
+	printf("\n");
 	return 0;
 }
 
+/* A TARGET argument that is all digits is a target id */
+static int parse_target_id(const char *arg, __u32 *id)
+{
+	char *endptr;
+	unsigned long val;
+
+	if (arg[0] < '0' || arg[0] > '9')
+		return 0;
+
+	errno = 0;
+	val = strtoul(arg, &endptr, 10);
+	if (errno != 0 || *endptr != '\0' || val == 0 || val > 0xffffffffUL)
+		return 0;
+
+	*id = val;
+	return 1;
+}
+
 static int cmd_remove(int argc, char **argv)
 {
-	char cmd[512];
-	int ret;
+	struct speed_bump_target_desc *descs;
+	const char *profile = "", *rule = "";
+	int failed = 0;
+	int i, n = 0;
 
 	if (argc < 1) {
 		fprintf(stderr, "Error: 'remove' requires PATH:SYMBOL argument\n");
 		return 1;
 	}
 
-	if (validate_target(argv[0]) < 0)
+	if (argc > SPEED_BUMP_BATCH_MAX) {
+		fprintf(stderr, "Error: At most %d targets per remove\n",
+			SPEED_BUMP_BATCH_MAX);
 		return 1;
+	}
 
-	ret = snprintf(cmd, sizeof(cmd), "-%s", argv[0]);
-	if (ret < 0 || (size_t)ret >= sizeof(cmd)) {
-		fprintf(stderr, "Error: Command too long\n");
+	descs = calloc(argc, sizeof(*descs));
+	if (!descs) {
+		fprintf(stderr, "Error: Out of memory\n");
 		return 1;
 	}
 
-	if (check_module_loaded() < 0)
+	for (i = 0; i < argc; i++) {
+		if (strncmp(argv[i], "--profile=", 10) == 0) {
+			profile = argv[i] + 10;
+			if (validate_profile(profile) < 0) {
+				free(descs);
+				return 1;
+			}
+		}
+		if (strncmp(argv[i], "--rule=", 7) == 0) {
+			rule = argv[i] + 7;
+			if (validate_name("rule", rule) < 0) {
+				free(descs);
+				return 1;
+			}
+		}
+	}
+
+	/* Every target goes in one batch: one lock, one probe sync */
+	for (i = 0; i < argc; i++) {
+		struct speed_bump_target_desc *desc = &descs[n];
+
+		if (strncmp(argv[i], "--profile=", 10) == 0 ||
+		    strncmp(argv[i], "--rule=", 7) == 0)
+			continue;
+		argv[n++] = argv[i];
+
+		desc->op = SPEED_BUMP_OP_REMOVE;
+		if (argv[i][0] == '@') {
+			desc->op = SPEED_BUMP_OP_REMOVE_PROFILE;
+			if (validate_profile(argv[i] + 1) < 0) {
+				free(descs);
+				return 1;
+			}
+			snprintf(desc->profile, sizeof(desc->profile), "%s",
+				 argv[i] + 1);
+			continue;
+		}
+		if (parse_target_id(argv[i], &desc->id))
+			continue;
+		if (validate_target(argv[i]) < 0) {
+			free(descs);
+			return 1;
+		}
+		set_target_name(desc, argv[i]);
+		snprintf(desc->profile, sizeof(desc->profile), "%s", profile);
+		snprintf(desc->rule, sizeof(desc->rule), "%s", rule);
+	}
+
+	if (n == 0) {
+		fprintf(stderr, "Error: 'remove' requires PATH:SYMBOL argument\n");
+		free(descs);
 		return 1;
+	}
 
-	if (write_sysfs(SYSFS_TARGETS, cmd) < 0)
+	if (check_module_loaded() < 0 || run_batch(descs, n) < 0) {
+		free(descs);
 		return 1;
+	}
 
-	printf("Removed target: %s\n", argv[0]);
-	return 0;
+	for (i = 0; i < n; i++) {
+		if (descs[i].status) {
+			fprintf(stderr, "%s: ", argv[i]);
+			print_target_error(-descs[i].status);
+			failed = 1;
+		} else if (descs[i].op == SPEED_BUMP_OP_REMOVE_PROFILE) {
+			printf("Removed profile: %s\n", argv[i] + 1);
+		} else {
+			printf("Removed target: %s\n", argv[i]);
+		}
+	}
+
+	free(descs);
+	return failed;
 }
 
 static int cmd_update(int argc, char **argv)
 {
-	char cmd[512];
+	struct speed_bump_target_desc desc;
 	unsigned long delay;
 	int ret;
+	int i;
 
 	if (argc < 2) {
 		fprintf(stderr, "Error: 'update' requires PATH:SYMBOL and DELAY_NS\n");
@@ -369,16 +1104,26 @@ static int cmd_update(int argc, char **argv)
 	if (validate_delay(argv[1], &delay) < 0)
 		return 1;
 
-	ret = snprintf(cmd, sizeof(cmd), "=%s %lu", argv[0], delay);
-	if (ret < 0 || (size_t)ret >= sizeof(cmd)) {
-		fprintf(stderr, "Error: Command too long\n");
-		return 1;
+	memset(&desc, 0, sizeof(desc));
+	desc.op = SPEED_BUMP_OP_UPDATE;
+	set_target_name(&desc, argv[0]);
+	desc.delay_ns = delay;
+	desc.given = SPEED_BUMP_OPT_DELAY;
+
+	for (i = 2; i < argc; i++) {
+		ret = parse_target_option(&desc, argv[i]);
+		if (ret < 0)
+			return 1;
+		if (ret == 0) {
+			fprintf(stderr, "Error: Unexpected argument '%s'\n", argv[i]);
+			return 1;
+		}
 	}
 
 	if (check_module_loaded() < 0)
 		return 1;
 
-	if (write_sysfs(SYSFS_TARGETS, cmd) < 0)
+	if (run_one(&desc) < 0)
 		return 1;
 
 	printf("Updated target: %s delay=%lu ns\n", argv[0], delay);
@@ -390,15 +1135,426 @@ static int cmd_list(void)
 	if (check_module_loaded() < 0)
 		return 1;
 
+	/* sysfs stops at a page; debugfs has every target */
+	if (access(DEBUGFS_TARGETS, R_OK) == 0)
+		return read_sysfs(DEBUGFS_TARGETS) < 0 ? 1 : 0;
+
 	return read_sysfs(SYSFS_TARGETS_LIST) < 0 ? 1 : 0;
 }
 
+/*
+ * Scan a targets listing for async adds.
+ *
+ * Returns: the number of pending targets, or -1 if it cannot be read.
+ * @failed is set to the number of failed ones, which are printed if
+ * @report.
+ */
+static int scan_pending(const char *path, int *failed, int report)
+{
+	char line[READ_BUF_SIZE];
+	const char *state;
+	int pending = 0;
+	FILE *f;
+
+	f = fopen(path, "r");
+	if (!f) {
+		fprintf(stderr, "Error: Cannot open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	*failed = 0;
+	while (fgets(line, sizeof(line), f)) {
+		state = strstr(line, " state=");
+		if (!state)
+			continue;
+		state += 7;
+
+		if (strncmp(state, "pending", 7) == 0) {
+			pending++;
+		} else if (strncmp(state, "failed(", 7) == 0) {
+			(*failed)++;
+			if (report)
+				fprintf(stderr, "Error: %.*s: %s\n",
+					(int)strcspn(line, " "), line,
+					strerror(atoi(state + 7)));
+		}
+	}
+
+	fclose(f);
+	return pending;
+}
+
+static int cmd_wait(int argc, char **argv)
+{
+	struct timespec poll = { 0, WAIT_POLL_NS };
+	struct timespec start, now;
+	unsigned long timeout = WAIT_DEFAULT_S;
+	const char *path;
+	char *endptr;
+	int pending, failed;
+
+	if (argc > 1 || (argc == 1 && strncmp(argv[0], "--timeout=", 10) != 0)) {
+		fprintf(stderr, "Error: Usage: wait [--timeout=SEC]\n");
+		return 1;
+	}
+	if (argc == 1) {
+		errno = 0;
+		timeout = strtoul(argv[0] + 10, &endptr, 10);
+		if (errno != 0 || *endptr != '\0' || endptr == argv[0] + 10) {
+			fprintf(stderr, "Error: Invalid timeout '%s'\n", argv[0] + 10);
+			return 1;
+		}
+	}
+
+	if (check_module_loaded() < 0)
+		return 1;
+
+	path = access(DEBUGFS_TARGETS, R_OK) == 0 ? DEBUGFS_TARGETS :
+						     SYSFS_TARGETS_LIST;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	while ((pending = scan_pending(path, &failed, 0)) > 0) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if ((unsigned long)(now.tv_sec - start.tv_sec) >= timeout) {
+			fprintf(stderr, "Error: %d targets still pending after %lu s\n",
+				pending, timeout);
+			return 1;
+		}
+		nanosleep(&poll, NULL);
+	}
+	if (pending < 0)
+		return 1;
+
+	if (failed) {
+		scan_pending(path, &failed, 1);
+		return 1;
+	}
+	return 0;
+}
+
+/* Parse a --NAME=COUNT option of watch; returns 0 or -1 after printing why */
+static int parse_watch_count(const char *arg, const char *name,
+			     unsigned long long *out)
+{
+	size_t len = strlen(name);
+	char *endptr;
+
+	errno = 0;
+	*out = strtoull(arg + len, &endptr, 10);
+	if (errno != 0 || *endptr != '\0' || endptr == arg + len ||
+	    arg[len] == '-') {
+		fprintf(stderr, "Error: Invalid count '%s'\n", arg + len);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Print the global totals, then one line of deltas for each event of
+ * the control device: a batch of --hits=N hits, or a change to the
+ * targets. Nothing is read or formatted in between.
+ */
+static int cmd_watch(int argc, char **argv)
+{
+	struct speed_bump_watch watch;
+	struct speed_bump_event ev, last;
+	unsigned long long hits = WATCH_DEFAULT_HITS, count = 0, n;
+	struct timespec now;
+	ssize_t len;
+	int fd, i;
+
+	for (i = 0; i < argc; i++) {
+		if (strncmp(argv[i], "--hits=", 7) == 0) {
+			if (parse_watch_count(argv[i], "--hits=", &hits) < 0)
+				return 1;
+		} else if (strncmp(argv[i], "--count=", 8) == 0) {
+			if (parse_watch_count(argv[i], "--count=", &count) < 0)
+				return 1;
+		} else {
+			fprintf(stderr, "Error: Usage: watch [--hits=N] [--count=N]\n");
+			return 1;
+		}
+	}
+
+	if (check_module_loaded() < 0)
+		return 1;
+
+	fd = open_ctl();
+	if (fd < 0)
+		return 1;
+
+	memset(&watch, 0, sizeof(watch));
+	watch.hits = hits;
+	if (ioctl(fd, SPEED_BUMP_IOC_WATCH, &watch) < 0) {
+		fprintf(stderr, "Error: %s: %s\n", DEV_CTL, strerror(errno));
+		close(fd);
+		return 1;
+	}
+
+	/* The first read returns at once, with the totals to start from */
+	memset(&last, 0, sizeof(last));
+	for (n = 0; count == 0 || n <= count; n++) {
+		len = read(fd, &ev, sizeof(ev));
+		if (len < 0 && errno == EINTR) {
+			n--;
+			continue;
+		}
+		if (len != (ssize_t)sizeof(ev)) {
+			fprintf(stderr, "Error: %s: %s\n", DEV_CTL,
+				len < 0 ? strerror(errno) : "short read");
+			close(fd);
+			return 1;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (n == 0)
+			printf("%ld.%03ld targets=%u enabled=%u hits=%llu delay_ns=%llu actual_ns=%llu throttled=%llu\n",
+			       (long)now.tv_sec, now.tv_nsec / 1000000,
+			       ev.nr_targets, ev.enabled,
+			       (unsigned long long)ev.total_hits,
+			       (unsigned long long)ev.total_delay_ns,
+			       (unsigned long long)ev.total_actual_ns,
+			       (unsigned long long)ev.total_throttled);
+		else
+			printf("%ld.%03ld targets=%u enabled=%u changes=%u hits=+%llu delay_ns=+%llu actual_ns=+%llu throttled=+%llu\n",
+			       (long)now.tv_sec, now.tv_nsec / 1000000,
+			       ev.nr_targets, ev.enabled, ev.changes,
+			       (unsigned long long)(ev.total_hits - last.total_hits),
+			       (unsigned long long)(ev.total_delay_ns - last.total_delay_ns),
+			       (unsigned long long)(ev.total_actual_ns - last.total_actual_ns),
+			       (unsigned long long)(ev.total_throttled - last.total_throttled));
+		fflush(stdout);
+		last = ev;
+	}
+
+	close(fd);
+	return 0;
+}
+
+static int cmd_groups(void)
+{
+	if (check_module_loaded() < 0)
+		return 1;
+
+	return read_sysfs(SYSFS_GROUPS) < 0 ? 1 : 0;
+}
+
+static int cmd_latency(void)
+{
+	if (check_module_loaded() < 0)
+		return 1;
+
+	if (access(DEBUGFS_LATENCY, R_OK) == 0)
+		return read_sysfs(DEBUGFS_LATENCY) < 0 ? 1 : 0;
+
+	return read_sysfs(SYSFS_LATENCY) < 0 ? 1 : 0;
+}
+
+static int cmd_overshoot(void)
+{
+	if (check_module_loaded() < 0)
+		return 1;
+
+	if (access(DEBUGFS_OVERSHOOT, R_OK) == 0)
+		return read_sysfs(DEBUGFS_OVERSHOOT) < 0 ? 1 : 0;
+
+	return read_sysfs(SYSFS_OVERSHOOT) < 0 ? 1 : 0;
+}
+
+/* Too long for a sysfs page, so only debugfs has the sweep log */
+static int cmd_sweeps(void)
+{
+	if (check_module_loaded() < 0)
+		return 1;
+
+	if (access(DEBUGFS_SWEEPS, R_OK) != 0) {
+		fprintf(stderr,
+			"Error: %s not readable (is debugfs mounted?)\n",
+			DEBUGFS_SWEEPS);
+		return 1;
+	}
+
+	return read_sysfs(DEBUGFS_SWEEPS) < 0 ? 1 : 0;
+}
+
+/*
+ * Read all of stats.bin. debugfs sizes it as the module writes it, so
+ * read to EOF rather than trusting st_size.
+ *
+ * Returns: the buffer (to free) with *@len set, or NULL after printing why
+ */
+static char *read_stats_bin(size_t *len)
+{
+	size_t size = READ_BUF_SIZE, used = 0;
+	char *buf = malloc(size), *grown;
+	ssize_t n;
+	int fd;
+
+	fd = open(DEBUGFS_STATS_BIN, O_RDONLY);
+	if (fd < 0 || !buf) {
+		fprintf(stderr,
+			"Error: Cannot read %s: %s (is debugfs mounted?)\n",
+			DEBUGFS_STATS_BIN, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		free(buf);
+		return NULL;
+	}
+
+	while ((n = read(fd, buf + used, size - used)) > 0) {
+		used += n;
+		if (used < size)
+			continue;
+		grown = realloc(buf, size * 2);
+		if (!grown) {
+			n = -1;
+			break;
+		}
+		buf = grown;
+		size *= 2;
+	}
+	close(fd);
+
+	if (n < 0) {
+		fprintf(stderr, "Error: Read failed: %s\n", strerror(errno));
+		free(buf);
+		return NULL;
+	}
+
+	*len = used;
+	return buf;
+}
+
+/* Each target's hits and delay split by the CPU that took them */
+static int cmd_cpus(void)
+{
+	const struct speed_bump_stats_header *hdr;
+	const struct speed_bump_stats_record *rec;
+	const struct speed_bump_stats_cpu *cpu;
+	size_t len, need;
+	unsigned int i, c;
+	char *buf;
+
+	if (check_module_loaded() < 0)
+		return 1;
+
+	buf = read_stats_bin(&len);
+	if (!buf)
+		return 1;
+
+	hdr = (const void *)buf;
+	if (len < sizeof(*hdr) || hdr->magic != SPEED_BUMP_STATS_MAGIC ||
+	    hdr->version < SPEED_BUMP_STATS_VERSION ||
+	    hdr->record_size < sizeof(*rec) + hdr->nr_cpus * sizeof(*cpu)) {
+		fprintf(stderr, "Error: %s has an unknown format\n",
+			DEBUGFS_STATS_BIN);
+		free(buf);
+		return 1;
+	}
+	need = hdr->header_size + (size_t)hdr->nr_targets * hdr->record_size;
+	if (len < need) {
+		fprintf(stderr, "Error: %s is truncated\n", DEBUGFS_STATS_BIN);
+		free(buf);
+		return 1;
+	}
+
+	for (i = 0; i < hdr->nr_targets; i++) {
+		rec = (const void *)(buf + hdr->header_size +
+				     (size_t)i * hdr->record_size);
+		printf("id=%llu hits=%llu skipped=%llu delay_ns=%llu\n",
+		       (unsigned long long)rec->id,
+		       (unsigned long long)rec->hits,
+		       (unsigned long long)rec->skipped,
+		       (unsigned long long)rec->total_delay_ns);
+		for (c = 0; c < hdr->nr_cpus; c++) {
+			cpu = &rec->cpus[c];
+			if (!cpu->hits)
+				continue;
+			printf("  cpu%u hits=%llu delay_ns=%llu\n", c,
+			       (unsigned long long)cpu->hits,
+			       (unsigned long long)cpu->delay_ns);
+		}
+	}
+
+	free(buf);
+	return 0;
+}
+
+/*
+ * The delay filtered targets injected into thread TID and its process.
+ * A program reads its own with SPEED_BUMP_IOC_TASK_STATS and tid 0.
+ */
+static int cmd_task(int argc, char **argv)
+{
+	struct speed_bump_task_stats stats;
+	const struct speed_bump_task_delay *d;
+	char *endptr;
+	unsigned long tid;
+	int fd, i;
+
+	memset(&stats, 0, sizeof(stats));
+
+	if (argc < 1 || argc > 2) {
+		fprintf(stderr, "Error: task requires TID [--reset]\n");
+		return 1;
+	}
+	errno = 0;
+	tid = strtoul(argv[0], &endptr, 10);
+	if (errno != 0 || *endptr != '\0' || argv[0][0] < '1' ||
+	    argv[0][0] > '9' || tid > INT_MAX) {
+		fprintf(stderr, "Error: Invalid TID '%s'\n", argv[0]);
+		return 1;
+	}
+	stats.tid = tid;
+	if (argc == 2) {
+		if (strcmp(argv[1], "--reset") != 0) {
+			fprintf(stderr, "Error: Unknown option '%s'\n", argv[1]);
+			return 1;
+		}
+		stats.flags |= SPEED_BUMP_TASK_STATS_RESET;
+	}
+
+	if (check_module_loaded() < 0)
+		return 1;
+
+	fd = open_ctl();
+	if (fd < 0)
+		return 1;
+	if (ioctl(fd, SPEED_BUMP_IOC_TASK_STATS, &stats) < 0) {
+		if (errno == ESRCH)
+			fprintf(stderr, "Error: No thread %lu\n", tid);
+		else
+			fprintf(stderr, "Error: %s: %s\n", DEV_CTL,
+				strerror(errno));
+		close(fd);
+		return 1;
+	}
+	close(fd);
+
+	for (i = 0; i < 2; i++) {
+		d = i ? &stats.process : &stats.thread;
+		printf("%s hits=%llu delay_ns=%llu actual_ns=%llu\n",
+		       i ? "process" : "thread",
+		       (unsigned long long)d->hits,
+		       (unsigned long long)d->delay_ns,
+		       (unsigned long long)d->actual_ns);
+	}
+	if (stats.dropped)
+		printf("dropped=%llu\n", (unsigned long long)stats.dropped);
+
+	return 0;
+}
+
 static int cmd_clear(void)
 {
+	struct speed_bump_target_desc desc;
+
 	if (check_module_loaded() < 0)
 		return 1;
 
-	if (write_sysfs(SYSFS_TARGETS, "-*") < 0)
+	memset(&desc, 0, sizeof(desc));
+	desc.op = SPEED_BUMP_OP_CLEAR;
+	if (run_one(&desc) < 0)
 		return 1;
 
 	printf("All targets cleared\n");
@@ -462,6 +1618,63 @@ static int cmd_delay(int argc, char **argv)
 	return 0;
 }
 
+static int cmd_budget(int argc, char **argv)
+{
+	unsigned long long budget;
+	char buf[32];
+
+	if (check_module_loaded() < 0)
+		return 1;
+
+	if (argc == 0)
+		return read_sysfs(SYSFS_BUDGET) < 0 ? 1 : 0;
+
+	if (validate_budget(argv[0], &budget) < 0)
+		return 1;
+
+	snprintf(buf, sizeof(buf), "%llu", budget);
+	if (write_sysfs(SYSFS_BUDGET, buf) < 0)
+		return 1;
+
+	if (budget)
+		printf("Delay budget set to %llu ns per second\n", budget);
+	else
+		printf("Delay budget removed\n");
+	return 0;
+}
+
+static int cmd_profile(int argc, char **argv)
+{
+	struct speed_bump_target_desc desc;
+
+	if (check_module_loaded() < 0)
+		return 1;
+
+	if (argc == 0)
+		return read_sysfs(SYSFS_PROFILE) < 0 ? 1 : 0;
+
+	if (strcmp(argv[0], "none") != 0 && validate_profile(argv[0]) < 0)
+		return 1;
+
+	memset(&desc, 0, sizeof(desc));
+	desc.op = SPEED_BUMP_OP_ACTIVATE;
+	if (strcmp(argv[0], "none") != 0)
+		snprintf(desc.profile, sizeof(desc.profile), "%s", argv[0]);
+	if (run_one(&desc) < 0)
+		return 1;
+
+	printf("Active profile: %s\n", argv[0]);
+	return 0;
+}
+
+static int cmd_profiles(void)
+{
+	if (check_module_loaded() < 0)
+		return 1;
+
+	return read_sysfs(SYSFS_PROFILES) < 0 ? 1 : 0;
+}
+
 int main(int argc, char **argv)
 {
 	int opt;
@@ -473,7 +1686,8 @@ int main(int argc, char **argv)
 
 	prog_name = argv[0];
 
-	while ((opt = getopt_long(argc, argv, "hv", long_opts, NULL)) != -1) {
+	/* "+": stop at the command, whose own options start with "--" too */
+	while ((opt = getopt_long(argc, argv, "+hv", long_opts, NULL)) != -1) {
 		switch (opt) {
 		case 'h':
 			print_usage();
@@ -504,6 +1718,22 @@ int main(int argc, char **argv)
 		return cmd_update(argc - 1, argv + 1);
 	else if (strcmp(argv[0], "list") == 0)
 		return cmd_list();
+	else if (strcmp(argv[0], "wait") == 0)
+		return cmd_wait(argc - 1, argv + 1);
+	else if (strcmp(argv[0], "groups") == 0)
+		return cmd_groups();
+	else if (strcmp(argv[0], "latency") == 0)
+		return cmd_latency();
+	else if (strcmp(argv[0], "overshoot") == 0)
+		return cmd_overshoot();
+	else if (strcmp(argv[0], "sweeps") == 0)
+		return cmd_sweeps();
+	else if (strcmp(argv[0], "cpus") == 0)
+		return cmd_cpus();
+	else if (strcmp(argv[0], "task") == 0)
+		return cmd_task(argc - 1, argv + 1);
+	else if (strcmp(argv[0], "watch") == 0)
+		return cmd_watch(argc - 1, argv + 1);
 	else if (strcmp(argv[0], "clear") == 0)
 		return cmd_clear();
 	else if (strcmp(argv[0], "enable") == 0)
@@ -514,6 +1744,12 @@ int main(int argc, char **argv)
 		return cmd_status();
 	else if (strcmp(argv[0], "delay") == 0)
 		return cmd_delay(argc - 1, argv + 1);
+	else if (strcmp(argv[0], "budget") == 0)
+		return cmd_budget(argc - 1, argv + 1);
+	else if (strcmp(argv[0], "profile") == 0)
+		return cmd_profile(argc - 1, argv + 1);
+	else if (strcmp(argv[0], "profiles") == 0)
+		return cmd_profiles();
 	else {
 		fprintf(stderr, "Error: Unknown command '%s'\n\n", argv[0]);
 		print_usage();